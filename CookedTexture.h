@@ -0,0 +1,770 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "GLResources.h"
+#include "Hashing.h"
+#include "MipGenerator.h"
+#include "ShaderSource.h"
+#include "TextureCompression.h"
+#include "stb_image.h"
+
+// Cooked textures are stored ready for the GPU: every mip level is generated and block compressed ahead of time,
+// so loading one is a memory map and a copy into a pixel buffer object, with no decoding.
+//
+// File layout, all little endian:
+//	CookedTextureHeader
+//	CookedTextureLevel[levelCount], base level first
+//	Level payloads, each at its offset from the start of the file, aligned to COOKED_TEXTURE_ALIGNMENT.
+//	The payload of a level in a texture array holds every layer, one after the other.
+
+const uint32_t COOKED_TEXTURE_VERSION = 3;
+const uint32_t COOKED_TEXTURE_ALIGNMENT = 16;
+
+// Texel format of a cooked texture's payloads
+enum class CookedTextureFormat : uint32_t
+{
+	// Uncompressed. Textures cooked as RGBA8 only keep the channels they need, so they may come out as R8, RG8 or RGB8.
+	RGBA8,
+	BC1,
+	BC3,
+	BC4,
+	BC5,
+	BC7,
+	R8,
+	RG8,
+	RGB8
+};
+
+struct CookedTextureHeader
+{
+	// "CTEX"
+	char magic[4];
+	uint32_t version;
+	CookedTextureFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+
+	// 1 for plain 2D textures, more for texture arrays
+	uint32_t layerCount;
+
+	// GL_TEXTURE_SWIZZLE_RGBA to apply when sampling
+	int32_t swizzle[4];
+
+	// Modification time of the source image, to notice when the cooked texture is stale
+	int64_t sourceTime;
+
+	// Settings the texture was cooked with, to notice when they changed
+	uint32_t mipFilter;
+	uint32_t mipContent;
+
+	// For texture arrays, hash of the cooked textures the layers were packed from, to notice when one changed
+	uint64_t layerHash;
+
+	// Hash of the channels packed in from other images, to notice when they changed
+	uint64_t packedChannelHash;
+};
+
+struct CookedTextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+// How a source image is turned into a cooked texture
+struct CookedTextureSettings
+{
+	CookedTextureFormat format;
+	MipFilter mipFilter;
+	MipContent mipContent;
+};
+
+// A channel copied into a cooked texture from another image, e.g. a specular mask into the alpha of a diffuse map
+struct PackedChannel
+{
+	// Image to copy the channel from. It must be the size of the texture's source image.
+	std::string sourcePath;
+
+	// Channel of that image (0 to 3 for red to alpha). Grey images have their grey in red, green and blue.
+	int sourceChannel;
+
+	// Channel of the texture to copy it into
+	int channel;
+};
+
+// A source image and where its cooked texture goes
+struct CookedTextureSource
+{
+	std::string sourcePath;
+	std::string cookedPath;
+	CookedTextureSettings settings;
+
+	// Channels that replace those of the source image
+	std::vector<PackedChannel> packedChannels = {};
+};
+
+// A read-only memory mapping of a whole file
+struct MappedFile
+{
+	const unsigned char* data;
+	size_t size;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+// A cooked texture file mapped into memory. The header and levels point into the mapping.
+struct CookedTexture
+{
+	MappedFile file;
+	const CookedTextureHeader* header;
+	const CookedTextureLevel* levels;
+};
+
+// Maps a file into memory for reading
+// @param	path	Path of the file
+// @param	file	Receives the mapping
+// @return	Returns false if the file could not be opened or is empty
+bool OpenMappedFile(const std::string& path, MappedFile& file)
+{
+	file = {};
+
+#ifdef _WIN32
+	file.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file.file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file.file, &size);
+	file.size = (size_t)size.QuadPart;
+	file.mapping = file.size > 0 ? CreateFileMappingA(file.file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	file.data = file.mapping ? (const unsigned char*)MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!file.data)
+	{
+		if (file.mapping)
+		{
+			CloseHandle(file.mapping);
+		}
+		CloseHandle(file.file);
+		file = {};
+		return false;
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	// The mapping keeps the file alive by itself
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+
+	// The whole file is about to be copied front to back
+	madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	file.data = (const unsigned char*)data;
+	file.size = (size_t)info.st_size;
+#endif
+
+	return true;
+}
+
+// Unmaps a file mapped with OpenMappedFile
+void CloseMappedFile(MappedFile& file)
+{
+	if (!file.data)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle(file.mapping);
+	CloseHandle(file.file);
+#else
+	munmap((void*)file.data, file.size);
+#endif
+	file = {};
+}
+
+// Checks whether a cooked texture format is block compressed
+bool IsCookedTextureCompressed(CookedTextureFormat format)
+{
+	return format >= CookedTextureFormat::BC1 && format <= CookedTextureFormat::BC7;
+}
+
+// Gets the number of bytes in a texel of an uncompressed cooked texture format
+int GetCookedTexelSize(CookedTextureFormat format)
+{
+	switch (format)
+	{
+	case CookedTextureFormat::R8:	return 1;
+	case CookedTextureFormat::RG8:	return 2;
+	case CookedTextureFormat::RGB8:	return 3;
+	default:						return 4;
+	}
+}
+
+// Gets the GL formats to upload an uncompressed cooked texture format with
+// @param	format			Uncompressed cooked texture format
+// @param	internalFormat	Receives the internal format of the texture, e.g. GL_R8
+// @param	pixelFormat		Receives the format of the payload's pixels, e.g. GL_RED
+void GetCookedTextureGLFormat(CookedTextureFormat format, GLenum& internalFormat, GLenum& pixelFormat)
+{
+	switch (format)
+	{
+	case CookedTextureFormat::R8:	internalFormat = GL_R8;		pixelFormat = GL_RED;	break;
+	case CookedTextureFormat::RG8:	internalFormat = GL_RG8;	pixelFormat = GL_RG;	break;
+	case CookedTextureFormat::RGB8:	internalFormat = GL_RGB8;	pixelFormat = GL_RGB;	break;
+	default:						internalFormat = GL_RGBA8;	pixelFormat = GL_RGBA;	break;
+	}
+}
+
+// Gets the block format of a cooked texture format. Must not be called with uncompressed formats.
+BlockFormat GetCookedBlockFormat(CookedTextureFormat format)
+{
+	switch (format)
+	{
+	case CookedTextureFormat::BC1:	return BlockFormat::BC1;
+	case CookedTextureFormat::BC3:	return BlockFormat::BC3;
+	case CookedTextureFormat::BC4:	return BlockFormat::BC4;
+	case CookedTextureFormat::BC5:	return BlockFormat::BC5;
+	default:						return BlockFormat::BC7;
+	}
+}
+
+// Maps a cooked texture file and checks that it is intact
+// @param	path	Path of the cooked texture
+// @param	texture	Receives the mapped texture
+// @return	Returns false if the file is missing, corrupt or from another version
+bool OpenCookedTexture(const std::string& path, CookedTexture& texture)
+{
+	texture = {};
+	if (!OpenMappedFile(path, texture.file))
+	{
+		return false;
+	}
+
+	const MappedFile& file = texture.file;
+	const CookedTextureHeader* header = (const CookedTextureHeader*)file.data;
+	bool valid = file.size >= sizeof(CookedTextureHeader)
+		&& std::memcmp(header->magic, "CTEX", 4) == 0
+		&& header->version == COOKED_TEXTURE_VERSION
+		&& header->format <= CookedTextureFormat::RGB8
+		&& header->levelCount > 0 && header->levelCount <= 32
+		&& header->layerCount > 0
+		&& file.size >= sizeof(CookedTextureHeader) + header->levelCount * sizeof(CookedTextureLevel);
+
+	// Every payload has to be inside the file, have the size its dimensions call for and start after
+	// the one before it; uploads copy the range from the first payload to the end of the last
+	const CookedTextureLevel* levels = (const CookedTextureLevel*)(file.data + sizeof(CookedTextureHeader));
+	for (uint32_t i = 0; valid && i < header->levelCount; ++i)
+	{
+		const CookedTextureLevel& level = levels[i];
+		size_t expectedSize = header->layerCount * (IsCookedTextureCompressed(header->format)
+			? GetCompressedImageSize(GetCookedBlockFormat(header->format), level.width, level.height)
+			: (size_t)level.width * level.height * GetCookedTexelSize(header->format));
+		valid = level.width > 0 && level.height > 0 && level.size == expectedSize
+			&& level.offset <= file.size && level.size <= file.size - level.offset
+			&& (i == 0 || level.offset >= levels[i - 1].offset + levels[i - 1].size);
+	}
+
+	if (!valid)
+	{
+		std::cout << "Ignoring corrupt cooked texture " << path << std::endl;
+		CloseMappedFile(texture.file);
+		return false;
+	}
+
+	texture.header = header;
+	texture.levels = levels;
+	return true;
+}
+
+// Unmaps a cooked texture opened with OpenCookedTexture
+void CloseCookedTexture(CookedTexture& texture)
+{
+	CloseMappedFile(texture.file);
+	texture = {};
+}
+
+// Gets the swizzle that hands a format's channels to the shader.
+// Single-channel textures are grey masks, so red is repeated into green and blue.
+void GetCookedTextureSwizzle(CookedTextureFormat format, int32_t swizzle[4])
+{
+	if (format == CookedTextureFormat::BC4 || format == CookedTextureFormat::R8)
+	{
+		swizzle[0] = swizzle[1] = swizzle[2] = GL_RED;
+		swizzle[3] = GL_ONE;
+	}
+	else
+	{
+		swizzle[0] = GL_RED;
+		swizzle[1] = GL_GREEN;
+		swizzle[2] = GL_BLUE;
+		swizzle[3] = GL_ALPHA;
+	}
+}
+
+// Counts the channels of the source image's RGBA expansion a cooked texture has to keep. Normal maps only keep
+// X and Y, grey images only keep red, and images with alpha (including grey ones) keep all four.
+// @param	imageChannelCount	Number of channels in the source image, as stb_image reports it
+// @param	source				Texture being cooked
+// @return	Returns the number of leading channels (red, green, blue, alpha) to keep
+int GetCookedChannelCount(int imageChannelCount, const CookedTextureSource& source)
+{
+	int channelCount = imageChannelCount == 2 ? 4 : imageChannelCount;
+	if (source.settings.mipContent == MipContent::NormalMap)
+	{
+		channelCount = 2;
+	}
+	for (const PackedChannel& packed : source.packedChannels)
+	{
+		channelCount = std::max(channelCount, packed.channel + 1);
+	}
+	return channelCount;
+}
+
+// Picks the format a texture is cooked to from the one it asks for and the channels it keeps.
+// Uncompressed textures drop the channels they don't keep, and BC1, which has no alpha, becomes BC3 when alpha is kept.
+CookedTextureFormat InferCookedTextureFormat(CookedTextureFormat format, int channelCount)
+{
+	if (format == CookedTextureFormat::RGBA8)
+	{
+		const CookedTextureFormat uncompressedFormats[] = { CookedTextureFormat::R8, CookedTextureFormat::RG8, CookedTextureFormat::RGB8, CookedTextureFormat::RGBA8 };
+		return uncompressedFormats[channelCount - 1];
+	}
+	if (format == CookedTextureFormat::BC1 && channelCount == 4)
+	{
+		return CookedTextureFormat::BC3;
+	}
+	return format;
+}
+
+// Checks whether InferCookedTextureFormat can turn one format into another
+bool IsInferredCookedTextureFormat(CookedTextureFormat inferred, CookedTextureFormat format)
+{
+	if (format == CookedTextureFormat::RGBA8)
+	{
+		return !IsCookedTextureCompressed(inferred);
+	}
+	if (format == CookedTextureFormat::BC1)
+	{
+		return inferred == CookedTextureFormat::BC1 || inferred == CookedTextureFormat::BC3;
+	}
+	return inferred == format;
+}
+
+// Hashes the channels a texture packs in from other images
+uint64_t HashPackedChannels(const CookedTextureSource& source)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const PackedChannel& packed : source.packedChannels)
+	{
+		hash = HashStringFNV1a(hash, packed.sourcePath);
+		hash = HashStringFNV1a(hash, std::to_string(packed.sourceChannel) + ">" + std::to_string(packed.channel));
+	}
+	return hash;
+}
+
+// Gets the modification time of the newest image a texture is cooked from
+// @return	Returns -1 if any of the images is missing
+long long GetCookedTextureSourceTime(const CookedTextureSource& source)
+{
+	long long sourceTime = GetFileModificationTime(source.sourcePath);
+	for (const PackedChannel& packed : source.packedChannels)
+	{
+		long long packedTime = GetFileModificationTime(packed.sourcePath);
+		sourceTime = sourceTime < 0 || packedTime < 0 ? -1 : std::max(sourceTime, packedTime);
+	}
+	return sourceTime;
+}
+
+// Writes a cooked texture file
+// @param	cookedPath	Path of the cooked texture to write
+// @param	header		Header of the texture. The magic, version and level count are filled in.
+// @param	payloads	Data of every level, base level first
+// @return	Returns true if the cooked texture was written
+bool WriteCookedTexture(const std::string& cookedPath, CookedTextureHeader header, const std::vector<CompressedLevel>& payloads)
+{
+	std::memcpy(header.magic, "CTEX", 4);
+	header.version = COOKED_TEXTURE_VERSION;
+	header.levelCount = (uint32_t)payloads.size();
+
+	std::vector<CookedTextureLevel> levels(payloads.size());
+	uint64_t offset = sizeof(CookedTextureHeader) + levels.size() * sizeof(CookedTextureLevel);
+	for (size_t i = 0; i < payloads.size(); ++i)
+	{
+		offset = (offset + COOKED_TEXTURE_ALIGNMENT - 1) / COOKED_TEXTURE_ALIGNMENT * COOKED_TEXTURE_ALIGNMENT;
+		levels[i] = { (uint32_t)payloads[i].width, (uint32_t)payloads[i].height, offset, payloads[i].data.size() };
+		offset += payloads[i].data.size();
+	}
+
+	// Make sure the directory exists, or writing will fail
+	std::string directory = GetDirectory(cookedPath);
+	if (!directory.empty())
+	{
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+
+	// Write next to the destination and rename, so a cook that fails halfway never leaves a truncated texture behind
+	std::string temporaryPath = cookedPath + ".tmp";
+	std::ofstream file(temporaryPath, std::ios::binary);
+	if (file.fail())
+	{
+		std::cout << "Failed to write cooked texture " << cookedPath << std::endl;
+		return false;
+	}
+
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)levels.data(), levels.size() * sizeof(CookedTextureLevel));
+	for (size_t i = 0; i < payloads.size(); ++i)
+	{
+		static const char padding[COOKED_TEXTURE_ALIGNMENT] = {};
+		file.write(padding, levels[i].offset - (uint64_t)file.tellp());
+		file.write((const char*)payloads[i].data.data(), payloads[i].data.size());
+	}
+	file.close();
+	if (file.fail())
+	{
+		std::cout << "Failed to write cooked texture " << cookedPath << std::endl;
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	std::remove(cookedPath.c_str());
+	return std::rename(temporaryPath.c_str(), cookedPath.c_str()) == 0;
+}
+
+// Decodes an image, packs in the channels of other images, generates the mip chain,
+// compresses it and writes it as a cooked texture
+// @param	source	Texture to cook
+// @return	Returns true if the cooked texture was written
+bool CookTexture(const CookedTextureSource& source)
+{
+	// The size is probed first, so images decode straight into buffers sized for them
+	int width, height, imageChannelCount;
+	std::vector<unsigned char> pixels;
+	if (stbi_info(source.sourcePath.c_str(), &width, &height, &imageChannelCount))
+	{
+		pixels.resize((size_t)width * height * 4);
+	}
+	if (pixels.empty() || !stbi_load_into(source.sourcePath.c_str(), pixels.data(), width, height, width * 4, 4))
+	{
+		std::cout << "Failed to load texture " << source.sourcePath << std::endl;
+		return false;
+	}
+
+	std::vector<unsigned char> packedPixels(source.packedChannels.empty() ? 0 : pixels.size());
+	for (const PackedChannel& packed : source.packedChannels)
+	{
+		int packedWidth, packedHeight, packedChannelCount;
+		if (!stbi_info(packed.sourcePath.c_str(), &packedWidth, &packedHeight, &packedChannelCount) || packedWidth != width || packedHeight != height
+			|| !stbi_load_into(packed.sourcePath.c_str(), packedPixels.data(), width, height, width * 4, 4))
+		{
+			std::cout << "Failed to pack " << packed.sourcePath << " into " << source.sourcePath << ", it is missing or a different size" << std::endl;
+			return false;
+		}
+		for (size_t i = 0; i < (size_t)width * height; ++i)
+		{
+			pixels[i * 4 + packed.channel] = packedPixels[i * 4 + packed.sourceChannel];
+		}
+	}
+
+	std::vector<MipLevel> mips = GenerateMipChain(pixels.data(), width, height, source.settings.mipFilter, source.settings.mipContent);
+	pixels = std::vector<unsigned char>();
+
+	CookedTextureFormat format = InferCookedTextureFormat(source.settings.format, GetCookedChannelCount(imageChannelCount, source));
+	std::vector<CompressedLevel> payloads;
+	if (IsCookedTextureCompressed(format))
+	{
+		payloads = CompressMipChain(mips, GetCookedBlockFormat(format));
+	}
+	else
+	{
+		// Keep the leading channels of every texel
+		int texelSize = GetCookedTexelSize(format);
+		for (MipLevel& mip : mips)
+		{
+			CompressedLevel payload = { mip.width, mip.height, std::vector<unsigned char>((size_t)mip.width * mip.height * texelSize) };
+			for (size_t i = 0; i < (size_t)mip.width * mip.height; ++i)
+			{
+				std::memcpy(&payload.data[i * texelSize], &mip.pixels[i * 4], texelSize);
+			}
+			payloads.push_back(std::move(payload));
+		}
+	}
+
+	CookedTextureHeader header = {};
+	header.format = format;
+	header.width = (uint32_t)width;
+	header.height = (uint32_t)height;
+	header.layerCount = 1;
+	GetCookedTextureSwizzle(format, header.swizzle);
+	header.sourceTime = GetCookedTextureSourceTime(source);
+	header.mipFilter = (uint32_t)source.settings.mipFilter;
+	header.mipContent = (uint32_t)source.settings.mipContent;
+	header.packedChannelHash = HashPackedChannels(source);
+	return WriteCookedTexture(source.cookedPath, header, payloads);
+}
+
+// Checks whether a cooked texture is up to date with its source image and settings.
+// Without a source it can't be recooked anyway, so cooked textures can ship without their sources.
+bool IsCookedTextureCurrent(const CookedTexture& texture, const CookedTextureSource& source)
+{
+	long long sourceTime = GetCookedTextureSourceTime(source);
+	if (sourceTime < 0)
+	{
+		return true;
+	}
+	return sourceTime == texture.header->sourceTime
+		&& IsInferredCookedTextureFormat(texture.header->format, source.settings.format)
+		&& texture.header->mipFilter == (uint32_t)source.settings.mipFilter
+		&& texture.header->mipContent == (uint32_t)source.settings.mipContent
+		&& texture.header->packedChannelHash == HashPackedChannels(source);
+}
+
+// Maps a cooked texture, cooking it from its source images first if it is missing or stale
+// @param	source	Texture to load
+// @param	texture	Receives the mapped texture
+// @return	Returns false if there is neither a usable cooked texture nor the sources to cook it from
+bool LoadCookedTexture(const CookedTextureSource& source, CookedTexture& texture)
+{
+	if (OpenCookedTexture(source.cookedPath, texture))
+	{
+		if (IsCookedTextureCurrent(texture, source))
+		{
+			return true;
+		}
+		CloseCookedTexture(texture);
+	}
+
+	std::cout << "Cooking " << source.sourcePath << " into " << source.cookedPath << std::endl;
+	return CookTexture(source) && OpenCookedTexture(source.cookedPath, texture);
+}
+
+// Hashes what a texture array is packed from: the cooked texture of every layer, and what each was cooked from
+uint64_t HashCookedTextureLayers(const std::vector<CookedTextureSource>& layers, const std::vector<CookedTexture>& cooked)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < layers.size(); ++i)
+	{
+		const CookedTextureHeader& header = *cooked[i].header;
+		hash = HashStringFNV1a(hash, layers[i].cookedPath);
+		hash = HashStringFNV1a(hash, std::string((const char*)&header.sourceTime, sizeof(header.sourceTime)));
+		hash = HashStringFNV1a(hash, std::string((const char*)&header.format, sizeof(header.format)));
+		hash = HashStringFNV1a(hash, std::string((const char*)&header.mipFilter, sizeof(header.mipFilter)));
+		hash = HashStringFNV1a(hash, std::string((const char*)&header.mipContent, sizeof(header.mipContent)));
+		hash = HashStringFNV1a(hash, std::string((const char*)&header.packedChannelHash, sizeof(header.packedChannelHash)));
+	}
+	return hash;
+}
+
+// Packs cooked textures into a cooked texture array, one layer per texture in order
+// @param	layers		Cooked 2D textures, all of the same format and size
+// @param	layerHash	Hash of the layers from HashCookedTextureLayers, or 0 when packing offline
+// @param	arrayPath	Path of the cooked texture array to write
+// @return	Returns false if the textures don't all match the first one, or the array could not be written
+bool PackCookedTextureArray(const std::vector<CookedTexture>& layers, uint64_t layerHash, const std::string& arrayPath)
+{
+	if (layers.empty())
+	{
+		return false;
+	}
+
+	const CookedTextureHeader& first = *layers[0].header;
+	for (size_t i = 0; i < layers.size(); ++i)
+	{
+		const CookedTextureHeader& header = *layers[i].header;
+		if (header.layerCount != 1 || header.format != first.format || header.width != first.width || header.height != first.height
+			|| header.levelCount != first.levelCount || std::memcmp(header.swizzle, first.swizzle, sizeof(first.swizzle)) != 0)
+		{
+			std::cout << "Layer " << i << " of " << arrayPath << " doesn't match the format and size of layer 0" << std::endl;
+			return false;
+		}
+	}
+
+	std::vector<CompressedLevel> payloads;
+	for (uint32_t level = 0; level < first.levelCount; ++level)
+	{
+		const CookedTextureLevel& firstLevel = layers[0].levels[level];
+		CompressedLevel payload = { (int)firstLevel.width, (int)firstLevel.height, {} };
+		for (const CookedTexture& layer : layers)
+		{
+			const unsigned char* data = layer.file.data + layer.levels[level].offset;
+			payload.data.insert(payload.data.end(), data, data + layer.levels[level].size);
+		}
+		payloads.push_back(std::move(payload));
+	}
+
+	CookedTextureHeader header = first;
+	header.layerCount = (uint32_t)layers.size();
+	header.layerHash = layerHash;
+	return WriteCookedTexture(arrayPath, header, payloads);
+}
+
+// Maps a cooked texture array, cooking its layers and packing them first if the array is missing or stale.
+// If the layers can't be loaded (e.g. they weren't shipped) the array is used as it is.
+// @param	layers		Textures to pack, one per layer
+// @param	arrayPath	Path of the cooked texture array
+// @param	texture		Receives the mapped texture array
+// @return	Returns false if there is neither a usable array nor the layers to pack it from
+bool LoadCookedTextureArray(const std::vector<CookedTextureSource>& layers, const std::string& arrayPath, CookedTexture& texture)
+{
+	std::vector<CookedTexture> cooked(layers.size());
+	bool layersLoaded = true;
+	for (size_t i = 0; i < layers.size() && layersLoaded; ++i)
+	{
+		layersLoaded = LoadCookedTexture(layers[i], cooked[i]);
+	}
+
+	bool loaded = OpenCookedTexture(arrayPath, texture);
+	if (layersLoaded)
+	{
+		uint64_t layerHash = HashCookedTextureLayers(layers, cooked);
+		if (loaded && (texture.header->layerHash != layerHash || texture.header->layerCount != layers.size()))
+		{
+			CloseCookedTexture(texture);
+			loaded = false;
+		}
+		if (!loaded)
+		{
+			std::cout << "Packing " << layers.size() << " textures into " << arrayPath << std::endl;
+			loaded = PackCookedTextureArray(cooked, layerHash, arrayPath) && OpenCookedTexture(arrayPath, texture);
+		}
+	}
+
+	for (CookedTexture& layer : cooked)
+	{
+		CloseCookedTexture(layer);
+	}
+	return loaded;
+}
+
+// Uploads a cooked 2D texture (not an array) to the currently bound GL_TEXTURE_2D, and turns on trilinear filtering.
+// The payloads are copied straight from the file mapping into a pixel buffer object, and every level
+// is then filled from the buffer. Block formats the driver can't sample are decoded in software instead.
+// @param	resources	Manager to create the pixel buffer with
+// @param	texture		Mapped cooked texture
+// @return	Returns the size of the texture in GPU memory, in bytes
+size_t UploadCookedTexture(GLResourceManager& resources, const CookedTexture& texture)
+{
+	const CookedTextureHeader& header = *texture.header;
+	bool compressed = IsCookedTextureCompressed(header.format);
+	BlockFormat blockFormat = GetCookedBlockFormat(header.format);
+	GLenum internalFormat, pixelFormat;
+	GetCookedTextureGLFormat(header.format, internalFormat, pixelFormat);
+
+	std::vector<CompressedLevel> fallbackLevels;
+	if (compressed && !IsBlockFormatSupported(blockFormat))
+	{
+		for (uint32_t i = 0; i < header.levelCount; ++i)
+		{
+			const CookedTextureLevel& level = texture.levels[i];
+			const unsigned char* payload = texture.file.data + level.offset;
+			fallbackLevels.push_back({ (int)level.width, (int)level.height, std::vector<unsigned char>(payload, payload + level.size) });
+		}
+	}
+
+	size_t size = 0;
+	if (!fallbackLevels.empty())
+	{
+		size = UploadCompressedMipChain(fallbackLevels, blockFormat);
+	}
+	else
+	{
+		// The payloads keep their offsets from the file, so the buffer is a copy of the file's payload range
+		uint64_t payloadStart = texture.levels[0].offset;
+		uint64_t payloadEnd = texture.levels[header.levelCount - 1].offset + texture.levels[header.levelCount - 1].size;
+
+		GLResourceHandle bufferHandle = CreateGLResource(resources, GLResourceType::Buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, GetGLResourceName(resources, bufferHandle));
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)(payloadEnd - payloadStart), nullptr, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)(payloadEnd - payloadStart),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped)
+		{
+			std::memcpy(mapped, texture.file.data + payloadStart, (size_t)(payloadEnd - payloadStart));
+		}
+
+		// With the pixel buffer bound, the data pointers passed to GL are offsets into it
+		const unsigned char* source = nullptr;
+		if (!mapped || glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+		{
+			// The buffer's contents are lost, so upload straight from the mapping instead
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			source = texture.file.data + payloadStart;
+		}
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (uint32_t i = 0; i < header.levelCount; ++i)
+		{
+			const CookedTextureLevel& level = texture.levels[i];
+			const void* data = source + (level.offset - payloadStart);
+			if (compressed)
+			{
+				glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, GetBlockFormatGLFormat(blockFormat), level.width, level.height, 0,
+					(GLsizei)level.size, data);
+			}
+			else
+			{
+				glTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, level.width, level.height, 0, pixelFormat, GL_UNSIGNED_BYTE, data);
+			}
+			size += (size_t)level.size;
+		}
+
+		// The buffer is only freed once the GPU is done reading from it
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		DestroyGLResource(resources, bufferHandle);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)header.levelCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, (const GLint*)header.swizzle);
+	return size;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Number of timer queries in flight. Results are read a few frames late so that
+// reading them never waits for the GPU.
+#define GPU_TIMER_QUERY_COUNT 4
+
+// Measures GPU time spent between BeginGpuTimer and EndGpuTimer, without stalling
+struct GpuTimer
+{
+	GLuint queries[GPU_TIMER_QUERY_COUNT];
+	bool issued[GPU_TIMER_QUERY_COUNT];
+	int next;
+
+	// Most recent result, in milliseconds
+	float lastMs;
+};
+
+void CreateGpuTimer(GpuTimer& timer)
+{
+	glGenQueries(GPU_TIMER_QUERY_COUNT, timer.queries);
+	for (int i = 0; i < GPU_TIMER_QUERY_COUNT; ++i)
+	{
+		timer.issued[i] = false;
+	}
+	timer.next = 0;
+	timer.lastMs = 0.0f;
+}
+
+void BeginGpuTimer(GpuTimer& timer)
+{
+	glBeginQuery(GL_TIME_ELAPSED, timer.queries[timer.next]);
+}
+
+void EndGpuTimer(GpuTimer& timer)
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	timer.issued[timer.next] = true;
+	timer.next = (timer.next + 1) % GPU_TIMER_QUERY_COUNT;
+}
+
+// Reads back every finished query, oldest first
+// @return	Returns true if at least one new result was read
+bool PollGpuTimer(GpuTimer& timer)
+{
+	bool gotResult = false;
+	for (int i = 0; i < GPU_TIMER_QUERY_COUNT; ++i)
+	{
+		// Start at the oldest query, which is the one that will be reused next
+		int index = (timer.next + i) % GPU_TIMER_QUERY_COUNT;
+		if (!timer.issued[index])
+		{
+			continue;
+		}
+
+		GLint available = 0;
+		glGetQueryObjectiv(timer.queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			break;
+		}
+
+		GLuint64 elapsedNs = 0;
+		glGetQueryObjectui64v(timer.queries[index], GL_QUERY_RESULT, &elapsedNs);
+		timer.lastMs = (float)(elapsedNs / 1.0e6);
+		timer.issued[index] = false;
+		gotResult = true;
+	}
+	return gotResult;
+}
+
+void DeleteGpuTimer(GpuTimer& timer)
+{
+	glDeleteQueries(GPU_TIMER_QUERY_COUNT, timer.queries);
+}
+
+// Renders the scene to an offscreen target whose resolution follows the measured GPU frame time,
+// then upscales it to the window.
+// The target is allocated once at the maximum scale, and lower scales only render into part of it,
+// so changing the scale never reallocates anything.
+struct DynamicResolution
+{
+	// Size of the window's framebuffer
+	int outputWidth;
+	int outputHeight;
+
+	// GPU frame time to aim for, in milliseconds
+	float targetMs;
+
+	// Limits of the render scale, per axis
+	float minScale;
+	float maxScale;
+
+	// Current render scale, per axis
+	float scale;
+
+	// GPU frame time smoothed over the last few frames
+	float smoothedMs;
+
+	GLuint framebuffer;
+	GLuint colorTex;
+	GLuint depthRenderbuffer;
+
+	GpuTimer timer;
+};
+
+// Creates the offscreen target and the GPU timer
+// @param	dr				Dynamic resolution state to set up
+// @param	outputWidth		Width of the window's framebuffer
+// @param	outputHeight	Height of the window's framebuffer
+// @param	targetMs		GPU frame time to aim for, in milliseconds
+// @param	minScale		Lowest render scale allowed
+// @param	maxScale		Highest render scale allowed
+void CreateDynamicResolution(DynamicResolution& dr, int outputWidth, int outputHeight, float targetMs, float minScale, float maxScale)
+{
+	dr.outputWidth = outputWidth;
+	dr.outputHeight = outputHeight;
+	dr.targetMs = targetMs;
+	dr.minScale = minScale;
+	dr.maxScale = maxScale;
+	dr.scale = std::min(1.0f, maxScale);
+	dr.smoothedMs = 0.0f;
+
+	int maxWidth = (int)std::ceil(outputWidth * maxScale);
+	int maxHeight = (int)std::ceil(outputHeight * maxScale);
+
+	glGenTextures(1, &dr.colorTex);
+	glBindTexture(GL_TEXTURE_2D, dr.colorTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, maxWidth, maxHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	glGenRenderbuffers(1, &dr.depthRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, dr.depthRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, maxWidth, maxHeight);
+
+	glGenFramebuffers(1, &dr.framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, dr.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dr.colorTex, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, dr.depthRenderbuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		throw std::runtime_error("dynamic resolution framebuffer is incomplete");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	CreateGpuTimer(dr.timer);
+}
+
+// Returns the current render size in pixels
+int GetRenderWidth(const DynamicResolution& dr)
+{
+	return std::max(1, (int)(dr.outputWidth * dr.scale));
+}
+
+int GetRenderHeight(const DynamicResolution& dr)
+{
+	return std::max(1, (int)(dr.outputHeight * dr.scale));
+}
+
+// Picks this frame's render scale from the latest GPU timings, binds the offscreen target,
+// and starts timing the frame. Call before rendering the scene.
+void BeginDynamicResolutionFrame(DynamicResolution& dr)
+{
+	if (PollGpuTimer(dr.timer))
+	{
+		float ms = dr.timer.lastMs;
+		dr.smoothedMs = dr.smoothedMs > 0.0f ? dr.smoothedMs * 0.9f + ms * 0.1f : ms;
+
+		// GPU time scales roughly with the pixel count, which is the square of the per-axis scale.
+		// Only react outside of a small band around the target, so the scale doesn't jitter.
+		float ratio = dr.targetMs / dr.smoothedMs;
+		if (ratio < 0.95f || ratio > 1.05f)
+		{
+			float desired = dr.scale * std::sqrt(ratio);
+
+			// Move part of the way there each frame, and snap to 1/64 steps so that
+			// the render size only changes when the scale changes noticeably
+			float newScale = dr.scale + (desired - dr.scale) * 0.25f;
+			dr.scale = std::round(newScale * 64.0f) / 64.0f;
+		}
+	}
+
+	// Clamped on every frame, so changing the limits takes effect even while the GPU time is on target
+	dr.scale = std::max(dr.minScale, std::min(dr.maxScale, dr.scale));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, dr.framebuffer);
+	glViewport(0, 0, GetRenderWidth(dr), GetRenderHeight(dr));
+
+	BeginGpuTimer(dr.timer);
+}
+
+// Upscales the rendered image to the window and stops timing the frame. Call before swapping buffers.
+void EndDynamicResolutionFrame(DynamicResolution& dr)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, dr.framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, GetRenderWidth(dr), GetRenderHeight(dr), 0, 0, dr.outputWidth, dr.outputHeight,
+		GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, dr.outputWidth, dr.outputHeight);
+
+	EndGpuTimer(dr.timer);
+}
+
+void DeleteDynamicResolution(DynamicResolution& dr)
+{
+	DeleteGpuTimer(dr.timer);
+	glDeleteFramebuffers(1, &dr.framebuffer);
+	glDeleteRenderbuffers(1, &dr.depthRenderbuffer);
+	glDeleteTextures(1, &dr.colorTex);
+}
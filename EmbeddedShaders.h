@@ -0,0 +1,393 @@
+// Generated by Tools/EmbedShaders.cpp from the shader files, do not edit.
+// Rerun the tool after editing a shader.
+#pragma once
+
+struct EmbeddedShaderFile
+{
+	const char* path;
+	const char* source;
+};
+
+constexpr EmbeddedShaderFile embeddedShaderFiles[] =
+{
+	{ "Basic.vsh",
+		R"shader(#version 330
+
+layout(location = 0) in vec3 vertexPosition;
+
+uniform mat4 modelMatrix;
+uniform mat4 viewMatrix;
+uniform mat4 projMatrix;
+
+void main() {
+    gl_Position = projMatrix * viewMatrix * modelMatrix * vec4(vertexPosition, 1.0);
+})shader"
+	},
+	{ "Basic.fsh",
+		R"shader(#version 330
+
+uniform vec3 color;
+
+out vec4 fragColor;
+
+void main() {
+	fragColor = vec4(color, 1.0);
+})shader"
+	},
+	{ "BasicLighting.vsh",
+		R"shader(#version 330
+
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec2 vertexUV;
+layout(location = 3) in vec3 vertexTangent;
+layout(location = 4) in vec3 vertexBitangent;
+layout(location = 5) in vec2 vertexLightmapUV;
+
+// Per-instance attributes, so that every cube is drawn by one instanced draw
+layout(location = 6) in mat4 instanceModelMatrix;
+layout(location = 10) in vec4 instanceLightmapScaleOffset;
+layout(location = 11) in int instanceMaterialLayer;
+layout(location = 12) in ivec2 instanceLightCounts;
+layout(location = 13) in ivec4 instancePointLights;
+layout(location = 14) in ivec4 instanceSpotLights;
+
+out vec3 fragPos;
+out vec3 outNormal;
+out vec2 outUV;
+flat out int materialLayer;
+flat out int numObjectPointLights;
+flat out ivec4 objectPointLights;
+flat out int numObjectSpotLights;
+flat out ivec4 objectSpotLights;
+#ifdef NORMAL_MAPPING
+out mat3 TBN;
+#endif
+#ifdef LIGHTMAP
+out vec2 lightmapUV;
+#endif
+
+uniform mat4 viewMatrix;
+uniform mat4 projMatrix;
+
+void main() {
+    mat4 modelMatrix = instanceModelMatrix;
+
+    gl_Position = projMatrix * viewMatrix * modelMatrix * vec4(vertexPosition, 1.0);
+
+    fragPos = vec3(modelMatrix * vec4(vertexPosition, 1.0));
+
+    outNormal = mat3(transpose(inverse(modelMatrix))) * vertexNormal;
+
+    outUV = vertexUV;
+
+    // Layer of this object's material in the material texture arrays
+    materialLayer = instanceMaterialLayer;
+
+    // Lights that can reach this object
+    numObjectPointLights = instanceLightCounts.x;
+    objectPointLights = instancePointLights;
+    numObjectSpotLights = instanceLightCounts.y;
+    objectSpotLights = instanceSpotLights;
+
+#ifdef LIGHTMAP
+    // Scale (xy) and offset (zw) from the mesh's lightmap UVs to this object's tile in the lightmap atlas
+    lightmapUV = vertexLightmapUV * instanceLightmapScaleOffset.xy + instanceLightmapScaleOffset.zw;
+#endif
+
+#ifdef NORMAL_MAPPING
+    vec3 T = normalize(vec3(modelMatrix * vec4(vertexTangent, 0.0)));
+    vec3 B = normalize(vec3(modelMatrix * vec4(vertexBitangent, 0.0)));
+    vec3 N = normalize(vec3(modelMatrix * vec4(vertexNormal, 0.0)));
+    TBN = mat3(T, B, N);
+#endif
+})shader"
+	},
+	{ "BasicLighting.fsh",
+		R"shader(#version 330
+
+in vec3 fragPos;
+in vec3 outNormal;
+in vec2 outUV;
+flat in int materialLayer;
+#ifdef NORMAL_MAPPING
+in mat3 TBN;
+#endif
+#ifdef LIGHTMAP
+in vec2 lightmapUV;
+#endif
+
+out vec4 fragColor;
+
+uniform vec3 eyePos;
+
+#include "Lights.glsl"
+
+uniform DirectionalLight dirLight;
+
+uniform PointLight pointLights[MAX_POINT_LIGHTS];
+
+uniform SpotLight spotLights[MAX_SPOT_LIGHTS];
+uniform int numSpotLights;
+
+// Lights that can reach the object being drawn, as indices into the light arrays above.
+// These are filled in per instance by the CPU light culling pass, four of each kind at most.
+#if MAX_LIGHTS_PER_OBJECT != 4
+#error The instance attributes carry four light indices of each kind
+#endif
+flat in int numObjectPointLights;
+flat in ivec4 objectPointLights;
+flat in int numObjectSpotLights;
+flat in ivec4 objectSpotLights;
+
+// Material texture arrays, indexed by materialLayer
+
+// Diffuse maps, with the specular mask in alpha
+uniform sampler2DArray diffuseTex;
+
+#ifdef NORMAL_MAPPING
+// Normal maps
+uniform sampler2DArray normalTex;
+#endif
+
+#ifdef LIGHTMAP
+// Baked lighting from the static lights (ambient, point lights and their first bounce)
+uniform sampler2D lightmapTex;
+#else
+// Ambient lighting from the light probe grid
+#include "LightProbes.glsl"
+#endif
+
+
+
+// Computes the contribution of a point light to the current fragment
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+	vec3 lightToFragDir = normalize(fragPos - light.position);
+	vec3 fragToLightDir = -lightToFragDir;
+
+	float pointLightDiffuseCoefficient = max(dot(normal, fragToLightDir), 0.0);
+	vec3 pointLightDiffuse = light.diffuse * (pointLightDiffuseCoefficient * diffuseColor);
+
+	vec3 pointLightSpecular = vec3(0.0, 0.0, 0.0);
+	if (pointLightDiffuseCoefficient > 0.0)
+	{
+		vec3 reflectDir = reflect(lightToFragDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 16.0);
+		pointLightSpecular = light.specular * (spec * specularColor);
+	}
+
+	float lightToFragDist = length(fragPos - light.position);
+	float attenuation = 1.0 / (light.kConstant + light.kLinear * lightToFragDist + light.kQuadratic * lightToFragDist * lightToFragDist);
+
+	return (pointLightDiffuse + pointLightSpecular) * attenuation;
+}
+
+// Computes the contribution of a spot light to the current fragment
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+	vec3 lightToFragDir = normalize(fragPos - light.position);
+	vec3 fragToLightDir = -lightToFragDir;
+
+	vec3 spotLightDiffuse = vec3(0.0, 0.0, 0.0);
+	vec3 spotLightSpecular = vec3(0.0, 0.0, 0.0);
+
+	float cosTheta = dot(lightToFragDir, light.direction);
+	float cosPhi = cos(light.cutOffAngle);
+	if (cosTheta > cosPhi)
+	{
+		float spotLightDiffuseCoefficient = max(dot(normal, fragToLightDir), 0.0);
+		spotLightDiffuse = light.diffuse * (spotLightDiffuseCoefficient * diffuseColor);
+
+		if (spotLightDiffuseCoefficient > 0.0)
+		{
+			vec3 reflectDir = reflect(lightToFragDir, normal);
+			float spec = pow(max(dot(viewDir, reflectDir), 0.0), 16.0);
+			spotLightSpecular = light.specular * (spec * specularColor);
+		}
+	}
+
+	float lightToFragDist = length(fragPos - light.position);
+	float attenuation = 1.0 / (light.kConstant + light.kLinear * lightToFragDist + light.kQuadratic * lightToFragDist * lightToFragDist);
+
+	return (spotLightDiffuse + spotLightSpecular) * attenuation;
+}
+
+#ifdef LIGHTMAP
+// Computes the ambient term of a spot light, which reaches outside of its cone
+vec3 CalcSpotLightAmbient(SpotLight light, vec3 diffuseColor)
+{
+	float lightToFragDist = length(fragPos - light.position);
+	float attenuation = 1.0 / (light.kConstant + light.kLinear * lightToFragDist + light.kQuadratic * lightToFragDist * lightToFragDist);
+
+	return light.ambient * diffuseColor * attenuation;
+}
+#endif
+
+void main() {
+	// Get the diffuse color and the specular mask from the diffuse map at the given UV coordinates
+	vec4 diffuseSample = texture(diffuseTex, vec3(outUV, materialLayer));
+	vec3 diffuseColor = diffuseSample.rgb;
+	vec3 specularColor = vec3(diffuseSample.a);
+
+#ifdef NORMAL_MAPPING
+	// The normal map only stores X and Y (BC5), so rebuild Z from the unit length
+	vec3 normal;
+	normal.xy = texture(normalTex, vec3(outUV, materialLayer)).rg * 2.0 - 1.0;
+	normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+	normal = normalize(TBN * normal);
+#else
+	vec3 normal = normalize(outNormal);
+#endif
+
+	vec3 viewDir = normalize(eyePos - fragPos);
+
+	// --- Compute for directional light ---
+
+	vec3 lightDir = normalize(dirLight.direction);
+	vec3 fragToLightDir = -lightDir;
+
+	float dirLightDiffuseCoefficient = max(dot(normal, fragToLightDir), 0.0);
+	vec3 dirLightDiffuse = dirLight.diffuse * (dirLightDiffuseCoefficient * diffuseColor);
+
+	vec3 dirLightSpecular = vec3(0.0, 0.0, 0.0);
+	if (dirLightDiffuseCoefficient > 0.0)
+	{
+		vec3 reflectDir = reflect(lightDir, normal);
+		float spec = pow(max(dot(viewDir, reflectDir), 0.0), 16.0);
+		dirLightSpecular = dirLight.specular * (spec * specularColor);
+	}
+
+#ifdef LIGHTMAP
+	// The ambient term and the point lights are baked into the lightmap,
+	// only the lights that move with the camera are computed per fragment.
+	vec3 result = diffuseColor * texture(lightmapTex, lightmapUV).rgb + dirLightDiffuse + dirLightSpecular;
+
+	// The lightmap doesn't have the spot lights either, so their ambient terms are added here.
+	// Culling only keeps the spot lights whose cone reaches the object, so every spot light is visited.
+	for (int i = 0; i < numSpotLights; ++i)
+	{
+		result += CalcSpotLightAmbient(spotLights[i], diffuseColor);
+	}
+#else
+	// The ambient terms of all lights come from the light probes
+	vec3 result = diffuseColor * SampleLightProbes(fragPos, normal) + dirLightDiffuse + dirLightSpecular;
+
+	// --- Compute for the point lights that can reach this object ---
+
+	for (int i = 0; i < numObjectPointLights; ++i)
+	{
+		result += CalcPointLight(pointLights[objectPointLights[i]], normal, viewDir, diffuseColor, specularColor);
+	}
+#endif
+
+	// --- Compute for the spot lights that can reach this object ---
+
+	for (int i = 0; i < numObjectSpotLights; ++i)
+	{
+		result += CalcSpotLight(spotLights[objectSpotLights[i]], normal, viewDir, diffuseColor, specularColor);
+	}
+	
+	// Get the sum of the effects of all light sources to get the final color of the fragment
+    fragColor = vec4(result, 1.0);
+})shader"
+	},
+	{ "Lights.glsl",
+		R"shader(// Light types shared by the lit shaders
+
+struct DirectionalLight
+{
+	vec3 direction;
+
+	vec3 diffuse;
+	vec3 specular;	
+};
+
+struct PointLight
+{
+	vec3 position;
+
+	vec3 diffuse;
+	vec3 specular;
+
+	float kConstant;
+	float kLinear;
+	float kQuadratic;
+};
+
+struct SpotLight
+{
+	vec3 position;
+	vec3 direction;
+
+	// Only read for lightmapped objects, the others get it from the light probes
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	float kConstant;
+	float kLinear;
+	float kQuadratic;
+
+	float cutOffAngle;
+};
+
+// The light counts are normally injected by the application from LightCulling.h,
+// these defaults only apply when the shader is compiled on its own.
+#ifndef MAX_POINT_LIGHTS
+#define MAX_POINT_LIGHTS 4
+#endif
+#ifndef MAX_SPOT_LIGHTS
+#define MAX_SPOT_LIGHTS 4
+#endif
+#ifndef MAX_LIGHTS_PER_OBJECT
+#define MAX_LIGHTS_PER_OBJECT 4
+#endif
+)shader"
+	},
+	{ "LightProbes.glsl",
+		R"shader(// Sampling of the light probe grid (see LightProbes.h).
+// Ambient lighting comes from a grid of L2 spherical harmonic probes. The 9 RGB coefficients
+// of each probe are spread in order over the RGBA texels of the 7 textures.
+uniform sampler3D probeTex[7];
+uniform vec3 probeVolumeMin;
+uniform vec3 probeVolumeMax;
+uniform vec3 probeVolumeResolution;
+
+// Returns the ambient lighting arriving at the given position on a surface facing the given normal
+vec3 SampleLightProbes(vec3 position, vec3 normal)
+{
+	// Map the position to the texel centers of the first and last probe
+	vec3 t = clamp((position - probeVolumeMin) / (probeVolumeMax - probeVolumeMin), 0.0, 1.0);
+	vec3 uvw = (t * (probeVolumeResolution - 1.0) + 0.5) / probeVolumeResolution;
+
+	vec4 t0 = texture(probeTex[0], uvw);
+	vec4 t1 = texture(probeTex[1], uvw);
+	vec4 t2 = texture(probeTex[2], uvw);
+	vec4 t3 = texture(probeTex[3], uvw);
+	vec4 t4 = texture(probeTex[4], uvw);
+	vec4 t5 = texture(probeTex[5], uvw);
+	vec4 t6 = texture(probeTex[6], uvw);
+
+	vec3 c0 = t0.rgb;
+	vec3 c1 = vec3(t0.a, t1.rg);
+	vec3 c2 = vec3(t1.ba, t2.r);
+	vec3 c3 = t2.gba;
+	vec3 c4 = t3.rgb;
+	vec3 c5 = vec3(t3.a, t4.rg);
+	vec3 c6 = vec3(t4.ba, t5.r);
+	vec3 c7 = t5.gba;
+	vec3 c8 = t6.rgb;
+
+	// The coefficients are already convolved with the cosine lobe, so this gives irradiance directly
+	vec3 n = normal;
+	vec3 result = c0 * 0.282095
+		+ c1 * (0.488603 * n.y) + c2 * (0.488603 * n.z) + c3 * (0.488603 * n.x)
+		+ c4 * (1.092548 * n.x * n.y) + c5 * (1.092548 * n.y * n.z)
+		+ c6 * (0.315392 * (3.0 * n.z * n.z - 1.0))
+		+ c7 * (1.092548 * n.x * n.z) + c8 * (0.546274 * (n.x * n.x - n.y * n.y));
+	return max(result, 0.0);
+}
+)shader"
+	},
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// glad is generated for the OpenGL 3.3 core profile without extensions,
+// so newer entry points that are used when available are loaded here by hand.
+// The declarations mirror glad's, and are skipped if glad is ever regenerated for a version that has them.
+
+#ifndef GL_VERSION_4_1
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROC glad_glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri = nullptr;
+#define glGetProgramBinary glad_glGetProgramBinary
+#define glProgramBinary glad_glProgramBinary
+#define glProgramParameteri glad_glProgramParameteri
+#endif
+
+// GL_KHR_parallel_shader_compile, and the identical GL_ARB_parallel_shader_compile
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = nullptr;
+#define glMaxShaderCompilerThreadsKHR glad_glMaxShaderCompilerThreadsKHR
+#endif
+
+// GL_EXT_texture_compression_s3tc (BC1-BC3)
+#ifndef GL_EXT_texture_compression_s3tc
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// GL_EXT_texture_sRGB, sRGB versions of the S3TC formats
+#ifndef GL_EXT_texture_sRGB
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// BPTC (BC6H, BC7), core in GL 4.2 and GL_ARB_texture_compression_bptc before that
+#ifndef GL_VERSION_4_2
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+// Optional features detected at runtime by LoadGLExtensions
+struct GLExtensionSupport
+{
+	// glGetProgramBinary / glProgramBinary (GL 4.1 or GL_ARB_get_program_binary),
+	// with at least one binary format offered by the driver
+	bool programBinary;
+
+	// GL_COMPLETION_STATUS_KHR can be queried without waiting for a compile or link to finish
+	bool parallelShaderCompile;
+
+	// BC1-BC3 texture formats can be sampled directly
+	bool textureCompressionS3TC;
+
+	// The S3TC formats have sRGB versions
+	bool textureCompressionS3TCSRGB;
+
+	// BC7 texture formats can be sampled directly
+	bool textureCompressionBPTC;
+};
+
+GLExtensionSupport glExtensions = {};
+
+// Checks whether the current context exposes the given extension
+// @param	name	Extension name, e.g. "GL_ARB_get_program_binary"
+// @return	Returns true if the extension is supported
+bool HasGLExtension(const char* name)
+{
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount; ++i)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && std::strcmp(extension, name) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Checks whether the current context is at least the given OpenGL version
+bool IsGLVersionAtLeast(int major, int minor)
+{
+	return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+// Loads the optional entry points and fills in glExtensions. Call once after gladLoadGLLoader.
+// @param	load	Function that returns the address of a GL function (e.g. glfwGetProcAddress)
+void LoadGLExtensions(GLADloadproc load)
+{
+	glExtensions = {};
+
+	if (IsGLVersionAtLeast(4, 1) || HasGLExtension("GL_ARB_get_program_binary"))
+	{
+#ifndef GL_VERSION_4_1
+		glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+		glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+		glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+#endif
+
+		// Some drivers expose the extension but offer no formats, which makes it useless
+		GLint binaryFormatCount = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatCount);
+		glExtensions.programBinary = glGetProgramBinary && glProgramBinary && glProgramParameteri && binaryFormatCount > 0;
+	}
+
+	if (HasGLExtension("GL_KHR_parallel_shader_compile"))
+	{
+		glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+	}
+	else if (HasGLExtension("GL_ARB_parallel_shader_compile"))
+	{
+		glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+	}
+	glExtensions.parallelShaderCompile = glMaxShaderCompilerThreadsKHR != nullptr;
+
+	// Compressed formats only need their enums, which are declared above. RGTC (BC4, BC5) is core since GL 3.0.
+	glExtensions.textureCompressionS3TC = HasGLExtension("GL_EXT_texture_compression_s3tc");
+	glExtensions.textureCompressionS3TCSRGB = glExtensions.textureCompressionS3TC && HasGLExtension("GL_EXT_texture_sRGB");
+	glExtensions.textureCompressionBPTC = IsGLVersionAtLeast(4, 2) || HasGLExtension("GL_ARB_texture_compression_bptc");
+}
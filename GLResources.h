@@ -0,0 +1,402 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Kinds of GL objects managed by GLResourceManager
+enum class GLResourceType
+{
+	Buffer,
+	Texture,
+	VertexArray,
+	Framebuffer,
+	Renderbuffer,
+	Count
+};
+
+const char* GetGLResourceTypeName(GLResourceType type)
+{
+	switch (type)
+	{
+	case GLResourceType::Buffer:		return "buffers";
+	case GLResourceType::Texture:		return "textures";
+	case GLResourceType::VertexArray:	return "vertex arrays";
+	case GLResourceType::Framebuffer:	return "framebuffers";
+	case GLResourceType::Renderbuffer:	return "renderbuffers";
+	default:							return "unknown";
+	}
+}
+
+// Reference to a GL object owned by a GLResourceManager.
+// The generation changes every time the slot is reused, so a handle to a destroyed object
+// never resolves to whatever object takes its place. Handles are plain values and can be passed between threads.
+struct GLResourceHandle
+{
+	uint32_t index;
+
+	// 0 is never a live generation, so a zeroed handle is always invalid
+	uint32_t generation;
+};
+
+struct GLResourceSlot
+{
+	GLuint name;
+	GLResourceType type;
+	uint32_t generation;
+	bool live;
+
+	// Estimated GPU memory, as reported by the owner
+	size_t bytes;
+};
+
+// Objects destroyed during one frame, deleted once the GPU is past the fence issued at the end of that frame
+struct GLPendingDeletion
+{
+	GLsync fence;
+	std::vector<GLuint> names[(int)GLResourceType::Count];
+};
+
+// Owns GL objects on behalf of the rest of the program.
+// Object names are generated in batches on the GL thread, so any thread can create a resource,
+// which only takes a pre-generated name. Destroyed objects are deleted after the GPU is done with them.
+struct GLResourceManager
+{
+	// Guards everything below, since handles can be created and destroyed from any thread
+	std::mutex mutex;
+
+	std::vector<GLResourceSlot> slots;
+	std::vector<uint32_t> freeSlots;
+
+	// Names generated ahead of time, per type
+	std::vector<GLuint> namePools[(int)GLResourceType::Count];
+
+	// Number of names to generate at a time
+	int batchSize;
+
+	// Live slots that were created while the pool of their type was empty, waiting for a name
+	std::vector<uint32_t> unnamedSlots;
+
+	// Names destroyed since the last EndGLResourceFrame
+	std::vector<GLuint> destroyedNames[(int)GLResourceType::Count];
+
+	std::deque<GLPendingDeletion> pendingDeletions;
+
+	// Statistics per type
+	int liveCounts[(int)GLResourceType::Count];
+	size_t liveBytes[(int)GLResourceType::Count];
+};
+
+// Generates a batch of GL object names of one type
+void GenerateGLNames(GLResourceType type, GLsizei count, GLuint* names)
+{
+	switch (type)
+	{
+	case GLResourceType::Buffer:		glGenBuffers(count, names); break;
+	case GLResourceType::Texture:		glGenTextures(count, names); break;
+	case GLResourceType::VertexArray:	glGenVertexArrays(count, names); break;
+	case GLResourceType::Framebuffer:	glGenFramebuffers(count, names); break;
+	case GLResourceType::Renderbuffer:	glGenRenderbuffers(count, names); break;
+	default: break;
+	}
+}
+
+// Deletes a batch of GL object names of one type
+void DeleteGLNames(GLResourceType type, GLsizei count, const GLuint* names)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	switch (type)
+	{
+	case GLResourceType::Buffer:		glDeleteBuffers(count, names); break;
+	case GLResourceType::Texture:		glDeleteTextures(count, names); break;
+	case GLResourceType::VertexArray:	glDeleteVertexArrays(count, names); break;
+	case GLResourceType::Framebuffer:	glDeleteFramebuffers(count, names); break;
+	case GLResourceType::Renderbuffer:	glDeleteRenderbuffers(count, names); break;
+	default: break;
+	}
+}
+
+// Tops up the name pools and names the slots that were created while a pool was empty.
+// Must be called on the GL thread.
+void RefillGLResourcePools(GLResourceManager& manager)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+
+	for (int type = 0; type < (int)GLResourceType::Count; ++type)
+	{
+		std::vector<GLuint>& pool = manager.namePools[type];
+		if ((int)pool.size() < manager.batchSize / 2)
+		{
+			size_t oldSize = pool.size();
+			pool.resize(oldSize + manager.batchSize);
+			GenerateGLNames((GLResourceType)type, manager.batchSize, pool.data() + oldSize);
+		}
+	}
+
+	for (uint32_t index : manager.unnamedSlots)
+	{
+		GLResourceSlot& slot = manager.slots[index];
+		std::vector<GLuint>& pool = manager.namePools[(int)slot.type];
+		if (pool.empty())
+		{
+			GenerateGLNames(slot.type, 1, &slot.name);
+		}
+		else
+		{
+			slot.name = pool.back();
+			pool.pop_back();
+		}
+	}
+	manager.unnamedSlots.clear();
+}
+
+// Sets up a resource manager, and generates the first batch of names. Must be called on the GL thread.
+// @param	manager		Resource manager to set up
+// @param	batchSize	Number of names to generate at a time
+void CreateGLResourceManager(GLResourceManager& manager, int batchSize = 32)
+{
+	manager.batchSize = batchSize;
+	for (int type = 0; type < (int)GLResourceType::Count; ++type)
+	{
+		manager.liveCounts[type] = 0;
+		manager.liveBytes[type] = 0;
+	}
+	RefillGLResourcePools(manager);
+}
+
+// Creates a GL object. Can be called from any thread.
+// If the pool of names ran dry, the object gets its name at the next RefillGLResourcePools, and resolves to 0 until then.
+// @param	manager		Resource manager to create the object in
+// @param	type		Type of the object
+// @return	Returns the handle to the object
+GLResourceHandle CreateGLResource(GLResourceManager& manager, GLResourceType type)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+
+	uint32_t index;
+	if (manager.freeSlots.empty())
+	{
+		index = (uint32_t)manager.slots.size();
+		manager.slots.push_back(GLResourceSlot());
+	}
+	else
+	{
+		index = manager.freeSlots.back();
+		manager.freeSlots.pop_back();
+	}
+
+	GLResourceSlot& slot = manager.slots[index];
+	slot.type = type;
+	slot.live = true;
+	slot.bytes = 0;
+	if (++slot.generation == 0)
+	{
+		slot.generation = 1;
+	}
+
+	std::vector<GLuint>& pool = manager.namePools[(int)type];
+	if (pool.empty())
+	{
+		slot.name = 0;
+		manager.unnamedSlots.push_back(index);
+	}
+	else
+	{
+		slot.name = pool.back();
+		pool.pop_back();
+	}
+
+	++manager.liveCounts[(int)type];
+	return { index, slot.generation };
+}
+
+// Finds the live slot of a handle. The mutex must be held.
+GLResourceSlot* FindGLResourceSlot(GLResourceManager& manager, GLResourceHandle handle)
+{
+	if (handle.index >= manager.slots.size())
+	{
+		return nullptr;
+	}
+	GLResourceSlot& slot = manager.slots[handle.index];
+	return (slot.live && slot.generation == handle.generation) ? &slot : nullptr;
+}
+
+// Gets the GL name of an object
+// @return	Returns the name, or 0 if the handle refers to a destroyed object
+GLuint GetGLResourceName(GLResourceManager& manager, GLResourceHandle handle)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+	GLResourceSlot* slot = FindGLResourceSlot(manager, handle);
+	return slot ? slot->name : 0;
+}
+
+bool IsGLResourceValid(GLResourceManager& manager, GLResourceHandle handle)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+	return FindGLResourceSlot(manager, handle) != nullptr;
+}
+
+// Records how much GPU memory an object uses, for the statistics
+void SetGLResourceMemory(GLResourceManager& manager, GLResourceHandle handle, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+	GLResourceSlot* slot = FindGLResourceSlot(manager, handle);
+	if (slot)
+	{
+		manager.liveBytes[(int)slot->type] += bytes - slot->bytes;
+		slot->bytes = bytes;
+	}
+}
+
+// Estimates the memory used by a 2D texture
+// @param	width			Width of the base level
+// @param	height			Height of the base level
+// @param	bytesPerTexel	Size of one texel of the internal format
+// @param	mipmapped		Whether the texture has a full mip chain
+size_t EstimateTextureMemory(int width, int height, size_t bytesPerTexel, bool mipmapped)
+{
+	size_t bytes = (size_t)width * height * bytesPerTexel;
+
+	// A full mip chain adds a third
+	return mipmapped ? bytes + bytes / 3 : bytes;
+}
+
+// Destroys an object. Can be called from any thread.
+// The handle becomes invalid right away, but the GL object is only deleted once the GPU has finished the frame it was last used in.
+void DestroyGLResource(GLResourceManager& manager, GLResourceHandle handle)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+	GLResourceSlot* slot = FindGLResourceSlot(manager, handle);
+	if (!slot)
+	{
+		return;
+	}
+
+	if (slot->name != 0)
+	{
+		manager.destroyedNames[(int)slot->type].push_back(slot->name);
+	}
+	else
+	{
+		// It was never named, so there is nothing to delete
+		for (size_t i = 0; i < manager.unnamedSlots.size(); ++i)
+		{
+			if (manager.unnamedSlots[i] == handle.index)
+			{
+				manager.unnamedSlots.erase(manager.unnamedSlots.begin() + i);
+				break;
+			}
+		}
+	}
+
+	--manager.liveCounts[(int)slot->type];
+	manager.liveBytes[(int)slot->type] -= slot->bytes;
+	slot->live = false;
+	slot->name = 0;
+	slot->bytes = 0;
+	manager.freeSlots.push_back(handle.index);
+}
+
+// Deletes the objects whose frames the GPU has finished, fences the objects destroyed this frame,
+// and tops up the name pools. Call on the GL thread once per frame, after the frame's commands are issued.
+void EndGLResourceFrame(GLResourceManager& manager)
+{
+	// Delete the names whose fences have been passed, oldest first
+	while (!manager.pendingDeletions.empty())
+	{
+		GLPendingDeletion& pending = manager.pendingDeletions.front();
+		GLenum result = glClientWaitSync(pending.fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+		{
+			break;
+		}
+
+		for (int type = 0; type < (int)GLResourceType::Count; ++type)
+		{
+			DeleteGLNames((GLResourceType)type, (GLsizei)pending.names[type].size(), pending.names[type].data());
+		}
+		glDeleteSync(pending.fence);
+		manager.pendingDeletions.pop_front();
+	}
+
+	// Fence this frame's deletions
+	GLPendingDeletion deletion;
+	bool anyDestroyed = false;
+	{
+		std::lock_guard<std::mutex> lock(manager.mutex);
+		for (int type = 0; type < (int)GLResourceType::Count; ++type)
+		{
+			anyDestroyed |= !manager.destroyedNames[type].empty();
+			deletion.names[type].swap(manager.destroyedNames[type]);
+		}
+	}
+	if (anyDestroyed)
+	{
+		deletion.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		manager.pendingDeletions.push_back(std::move(deletion));
+	}
+
+	RefillGLResourcePools(manager);
+}
+
+// Prints the number of live objects and their estimated memory, per type
+void PrintGLResourceStats(GLResourceManager& manager)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+
+	size_t totalBytes = 0;
+	std::cout << "GL resources:" << std::endl;
+	for (int type = 0; type < (int)GLResourceType::Count; ++type)
+	{
+		std::cout << "\t" << GetGLResourceTypeName((GLResourceType)type) << ": " << manager.liveCounts[type]
+			<< " live, " << manager.liveBytes[type] / 1024 << " KiB" << std::endl;
+		totalBytes += manager.liveBytes[type];
+	}
+	std::cout << "\ttotal: " << totalBytes / 1024 << " KiB" << std::endl;
+}
+
+// Deletes every object, including the ones still waiting for their fence and the unused pooled names.
+// Must be called on the GL thread, and no handles may be used afterwards.
+void DeleteGLResourceManager(GLResourceManager& manager)
+{
+	std::lock_guard<std::mutex> lock(manager.mutex);
+
+	for (GLPendingDeletion& pending : manager.pendingDeletions)
+	{
+		for (int type = 0; type < (int)GLResourceType::Count; ++type)
+		{
+			DeleteGLNames((GLResourceType)type, (GLsizei)pending.names[type].size(), pending.names[type].data());
+		}
+		glDeleteSync(pending.fence);
+	}
+	manager.pendingDeletions.clear();
+
+	for (const GLResourceSlot& slot : manager.slots)
+	{
+		if (slot.live && slot.name != 0)
+		{
+			DeleteGLNames(slot.type, 1, &slot.name);
+		}
+	}
+	manager.slots.clear();
+	manager.freeSlots.clear();
+	manager.unnamedSlots.clear();
+
+	for (int type = 0; type < (int)GLResourceType::Count; ++type)
+	{
+		DeleteGLNames((GLResourceType)type, (GLsizei)manager.namePools[type].size(), manager.namePools[type].data());
+		DeleteGLNames((GLResourceType)type, (GLsizei)manager.destroyedNames[type].size(), manager.destroyedNames[type].data());
+		manager.namePools[type].clear();
+		manager.destroyedNames[type].clear();
+		manager.liveCounts[type] = 0;
+		manager.liveBytes[type] = 0;
+	}
+}
@@ -4,31 +4,17 @@
 
 #include <string>
 #include <fstream>
+#include <unordered_map>
+#include <vector>
 
-// Reads the contents of the file specified by the file path,
-// and places the file contents into a string.
-// @param	filePath		Path of the file to read
-// @param	outputString	String where the file contents will be copied to
-// @return	Returns true if the file was successfully read or not.
-bool ReadFile(const std::string& filePath, std::string& outputString) {
-	std::ifstream file(filePath);
-	if (file.fail()) {
-		return false;
-	}
-
-	std::string line;
-	while (std::getline(file, line)) {
-		outputString += line + "\n";
-	}
+#include "ProgramBinaryCache.h"
+#include "ShaderSource.h"
 
-	return true;
-}
-
-// Creates a shader object given the shader type and the corresponding shader source
+// Creates a shader object and starts compiling it, without waiting for the compile to finish
 // @param	type	Shader type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...)
 // @param	source	Shader source (as string)
 // @return	Returns the handle to the shader object
-GLuint CreateShader(const GLuint& type, const std::string& source)
+GLuint StartShaderCompile(const GLuint& type, const std::string& source)
 {
 	// Create the shader object of the given type
 	GLuint shader = glCreateShader(type);
@@ -39,7 +25,16 @@ GLuint CreateShader(const GLuint& type, const std::string& source)
 	glShaderSource(shader, 1, &sourceCStr, &sourceLen);
 	glCompileShader(shader);
 
-	// Check compilation status
+	return shader;
+}
+
+// Checks whether a shader compiled successfully, and prints the compile log if it didn't.
+// This waits for the compile to finish.
+// @param	shader	Shader object to check
+// @param	type	Shader type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...)
+// @return	Returns true if the shader compiled
+bool CheckShaderCompileStatus(GLuint shader, const GLuint& type)
+{
 	GLint compileStatus;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
 	if (compileStatus == GL_FALSE)
@@ -67,11 +62,52 @@ GLuint CreateShader(const GLuint& type, const std::string& source)
 		std::cout << errorMsg << std::endl;
 	}
 
+	return compileStatus == GL_TRUE;
+}
+
+// Creates a shader object given the shader type and the corresponding shader source
+// @param	type	Shader type (GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, ...)
+// @param	source	Shader source (as string)
+// @return	Returns the handle to the shader object
+GLuint CreateShader(const GLuint& type, const std::string& source)
+{
+	GLuint shader = StartShaderCompile(type, source);
+
+	// Check compilation status
+	CheckShaderCompileStatus(shader, type);
+
 	return shader;
 }
 
-GLuint CreateShaderProgramFromSource(const std::string& vertexShaderSource, const std::string& fragmentShaderSource)
+// Gets the link log of a program
+std::string GetProgramInfoLog(GLuint program)
 {
+	char infoLog[512];
+	GLsizei infoLogLen = sizeof(infoLog);
+	glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
+	return std::string(infoLog, infoLogLen);
+}
+
+// Creates a shader program from vertex and fragment shader sources
+// @param	vertexShaderSource		Vertex shader source (as string)
+// @param	fragmentShaderSource	Fragment shader source (as string)
+// @param	binaryCache				Optional cache to load the linked program from, and to store it into after linking
+// @return	Returns the handle to the shader program
+GLuint CreateShaderProgramFromSource(const std::string& vertexShaderSource, const std::string& fragmentShaderSource,
+	ProgramBinaryCache* binaryCache = nullptr)
+{
+	// Skip compiling and linking if the driver accepts a previously saved binary
+	uint64_t binaryKey = 0;
+	if (binaryCache)
+	{
+		binaryKey = HashProgramSources(*binaryCache, vertexShaderSource, fragmentShaderSource);
+		GLuint cachedProgram = LoadProgramBinary(*binaryCache, binaryKey);
+		if (cachedProgram)
+		{
+			return cachedProgram;
+		}
+	}
+
 	// Create the vertex and fragment shader objects
 	GLuint vsh = CreateShader(GL_VERTEX_SHADER, vertexShaderSource);
 	GLuint fsh = CreateShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
@@ -83,6 +119,12 @@ GLuint CreateShaderProgramFromSource(const std::string& vertexShaderSource, cons
 	glAttachShader(program, vsh);
 	glAttachShader(program, fsh);
 
+	// Ask the driver to keep the binary around so that it can be cached
+	if (binaryCache && binaryCache->enabled)
+	{
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
 	// Link all attached shaders
 	glLinkProgram(program);
 
@@ -90,10 +132,7 @@ GLuint CreateShaderProgramFromSource(const std::string& vertexShaderSource, cons
 	GLint linkStatus;
 	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
 	if (linkStatus != GL_TRUE) {
-		char infoLog[512];
-		GLsizei infoLogLen = sizeof(infoLog);
-		glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
-		throw std::runtime_error(std::string("program link error: ") + infoLog);
+		throw std::runtime_error(std::string("program link error: ") + GetProgramInfoLog(program));
 		return 0;
 	}
 
@@ -106,18 +145,25 @@ GLuint CreateShaderProgramFromSource(const std::string& vertexShaderSource, cons
 	glDeleteShader(vsh);
 	glDeleteShader(fsh);
 
+	if (binaryCache && binaryCache->enabled)
+	{
+		SaveProgramBinary(*binaryCache, binaryKey, program);
+	}
+
 	return program;
 }
 
 // Creates a shader program based on the given vertex and fragment shader source file paths
 // @param	vertexShaderPath	Path to the vertex shader file
 // @param	fragmentShaderPath	Path to the fragment shader file
+// @param	binaryCache			Optional cache of linked program binaries
 // @return	Returns the handle to the shader program
-GLuint CreateShaderProgram(const std::string& vertexShaderPath, const std::string& fragmentShaderPath)
+GLuint CreateShaderProgram(const std::string& vertexShaderPath, const std::string& fragmentShaderPath,
+	ProgramBinaryCache* binaryCache = nullptr)
 {
 	// Read the source code from the vertex shader file
-	std::string vshCode;
-	if (!ReadFile(vertexShaderPath, vshCode))
+	ShaderSource vshSource;
+	if (!LoadShaderSource(vertexShaderPath, vshSource))
 	{
 		std::cout << "Failed to read shader file " << vertexShaderPath << std::endl;
 		throw std::runtime_error(std::string("failed to read shader file: ") + vertexShaderPath);
@@ -125,13 +171,438 @@ GLuint CreateShaderProgram(const std::string& vertexShaderPath, const std::strin
 	}
 
 	// Read the source code from the fragment shader file
-	std::string fshCode;
-	if (!ReadFile(fragmentShaderPath, fshCode))
+	ShaderSource fshSource;
+	if (!LoadShaderSource(fragmentShaderPath, fshSource))
 	{
 		std::cout << "Failed to read shader file: " << fragmentShaderPath << std::endl;
 		throw std::runtime_error(std::string("failed to read shader file: ") + fragmentShaderPath);
 		return 0;
 	}
 
-	return CreateShaderProgramFromSource(vshCode, fshCode);
+	return CreateShaderProgramFromSource(vshSource.text, fshSource.text, binaryCache);
+}
+
+// Progress of a program in a ShaderCompileBatch
+enum class ShaderProgramState
+{
+	Compiling,
+	Linking,
+	Ready,
+	Failed
+};
+
+// A program whose shaders are being compiled and linked in the background
+struct PendingShaderProgram
+{
+	GLuint vertexShader;
+	GLuint fragmentShader;
+	GLuint program;
+	ShaderProgramState state;
+
+	// Where to save the linked binary, if anywhere
+	ProgramBinaryCache* binaryCache;
+	uint64_t binaryKey;
+};
+
+// Index of a program in its ShaderCompileBatch
+typedef int ShaderProgramHandle;
+
+// Compiles and links many programs without stalling on each one in turn.
+// All compiles are issued up front, and PollShaderCompileBatch advances them once per frame.
+// With GL_KHR_parallel_shader_compile the driver compiles on its own threads and the polling never blocks.
+// Without it, checking a status waits for that compile, so only a few programs are finished per poll.
+struct ShaderCompileBatch
+{
+	std::vector<PendingShaderProgram> programs;
+
+	// Number of programs that are still compiling or linking
+	int pendingCount;
+};
+
+// Sets up an empty batch, and lets the driver use as many compiler threads as it wants
+void CreateShaderCompileBatch(ShaderCompileBatch& batch)
+{
+	batch.programs.clear();
+	batch.pendingCount = 0;
+
+	if (glExtensions.parallelShaderCompile)
+	{
+		// 0xFFFFFFFF lets the implementation pick the number of threads
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+}
+
+// Starts building a program from vertex and fragment shader sources
+// @param	batch					Batch to add the program to
+// @param	vertexShaderSource		Vertex shader source (as string)
+// @param	fragmentShaderSource	Fragment shader source (as string)
+// @param	binaryCache				Optional cache of linked program binaries. A cached program is ready right away.
+// @return	Returns the handle to the program in the batch
+ShaderProgramHandle QueueShaderProgram(ShaderCompileBatch& batch, const std::string& vertexShaderSource, const std::string& fragmentShaderSource,
+	ProgramBinaryCache* binaryCache = nullptr)
+{
+	PendingShaderProgram pending = {};
+	pending.binaryCache = binaryCache;
+
+	if (binaryCache)
+	{
+		pending.binaryKey = HashProgramSources(*binaryCache, vertexShaderSource, fragmentShaderSource);
+		pending.program = LoadProgramBinary(*binaryCache, pending.binaryKey);
+	}
+
+	if (pending.program)
+	{
+		pending.state = ShaderProgramState::Ready;
+	}
+	else
+	{
+		pending.vertexShader = StartShaderCompile(GL_VERTEX_SHADER, vertexShaderSource);
+		pending.fragmentShader = StartShaderCompile(GL_FRAGMENT_SHADER, fragmentShaderSource);
+		pending.state = ShaderProgramState::Compiling;
+		++batch.pendingCount;
+	}
+
+	batch.programs.push_back(pending);
+	return (ShaderProgramHandle)batch.programs.size() - 1;
+}
+
+// Checks whether the driver is done with a shader or program, without waiting
+bool IsShaderWorkComplete(GLuint object, bool isProgram)
+{
+	if (!glExtensions.parallelShaderCompile)
+	{
+		// Status queries will wait for the work, which the caller accounts for
+		return true;
+	}
+
+	GLint complete = GL_FALSE;
+	if (isProgram)
+	{
+		glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &complete);
+	}
+	else
+	{
+		glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &complete);
+	}
+	return complete == GL_TRUE;
+}
+
+// Advances the programs of a batch: links the ones whose shaders have compiled,
+// and finalizes the ones that have linked. Call once per frame.
+// @param	batch					Batch to advance
+// @param	maxBlockingPrograms		Without GL_KHR_parallel_shader_compile, the most programs to wait on in this call
+void PollShaderCompileBatch(ShaderCompileBatch& batch, int maxBlockingPrograms = 1)
+{
+	int blockingBudget = glExtensions.parallelShaderCompile ? (int)batch.programs.size() : maxBlockingPrograms;
+
+	for (PendingShaderProgram& pending : batch.programs)
+	{
+		if (blockingBudget <= 0)
+		{
+			break;
+		}
+
+		if (pending.state == ShaderProgramState::Compiling)
+		{
+			if (!IsShaderWorkComplete(pending.vertexShader, false) || !IsShaderWorkComplete(pending.fragmentShader, false))
+			{
+				continue;
+			}
+			--blockingBudget;
+
+			bool vertexOk = CheckShaderCompileStatus(pending.vertexShader, GL_VERTEX_SHADER);
+			bool fragmentOk = CheckShaderCompileStatus(pending.fragmentShader, GL_FRAGMENT_SHADER);
+			if (!vertexOk || !fragmentOk)
+			{
+				glDeleteShader(pending.vertexShader);
+				glDeleteShader(pending.fragmentShader);
+				pending.state = ShaderProgramState::Failed;
+				--batch.pendingCount;
+				continue;
+			}
+
+			pending.program = glCreateProgram();
+			glAttachShader(pending.program, pending.vertexShader);
+			glAttachShader(pending.program, pending.fragmentShader);
+			if (pending.binaryCache && pending.binaryCache->enabled)
+			{
+				glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			}
+			glLinkProgram(pending.program);
+			pending.state = ShaderProgramState::Linking;
+
+			// Linking is checked on a later poll, giving the driver time to finish it
+			continue;
+		}
+
+		if (pending.state == ShaderProgramState::Linking)
+		{
+			if (!IsShaderWorkComplete(pending.program, true))
+			{
+				continue;
+			}
+			--blockingBudget;
+
+			glDetachShader(pending.program, pending.vertexShader);
+			glDetachShader(pending.program, pending.fragmentShader);
+			glDeleteShader(pending.vertexShader);
+			glDeleteShader(pending.fragmentShader);
+			--batch.pendingCount;
+
+			GLint linkStatus;
+			glGetProgramiv(pending.program, GL_LINK_STATUS, &linkStatus);
+			if (linkStatus != GL_TRUE)
+			{
+				std::cout << "program link error: " << GetProgramInfoLog(pending.program) << std::endl;
+				glDeleteProgram(pending.program);
+				pending.program = 0;
+				pending.state = ShaderProgramState::Failed;
+				continue;
+			}
+
+			if (pending.binaryCache)
+			{
+				SaveProgramBinary(*pending.binaryCache, pending.binaryKey, pending.program);
+			}
+			pending.state = ShaderProgramState::Ready;
+		}
+	}
+}
+
+// Gets the state of a program in a batch
+ShaderProgramState GetShaderProgramState(const ShaderCompileBatch& batch, ShaderProgramHandle handle)
+{
+	return batch.programs[handle].state;
+}
+
+// Gets a program from a batch if it is ready to use
+// @param	batch		Batch the program is in
+// @param	handle		Handle returned by QueueShaderProgram
+// @param	fallback	Program to use while the requested one is not ready (or failed to build)
+// @return	Returns the handle to the shader program, or the fallback
+GLuint GetShaderProgram(const ShaderCompileBatch& batch, ShaderProgramHandle handle, GLuint fallback)
+{
+	const PendingShaderProgram& pending = batch.programs[handle];
+	return pending.state == ShaderProgramState::Ready ? pending.program : fallback;
+}
+
+// Inserts preprocessor definitions into a shader source, right after its #version directive
+// (GLSL requires #version to be the first statement).
+// @param	source		Shader source (as string)
+// @param	defines		Definitions to insert, one "#define ..." per line
+// @return	Returns the shader source with the definitions inserted
+std::string InjectShaderDefines(const std::string& source, const std::string& defines)
+{
+	if (defines.empty())
+	{
+		return source;
+	}
+
+	size_t insertPos = 0;
+	size_t versionPos = source.find("#version");
+	if (versionPos != std::string::npos)
+	{
+		size_t lineEnd = source.find('\n', versionPos);
+		insertPos = (lineEnd == std::string::npos) ? source.size() : lineEnd + 1;
+	}
+
+	// Count the lines before the insertion point so that
+	// compile errors still report line numbers of the original file
+	int nextLine = 1;
+	for (size_t i = 0; i < insertPos; ++i)
+	{
+		if (source[i] == '\n')
+		{
+			++nextLine;
+		}
+	}
+
+	std::string result = source.substr(0, insertPos);
+	if (!result.empty() && result.back() != '\n')
+	{
+		result += "\n";
+	}
+	result += defines;
+	result += "#line " + std::to_string(nextLine) + "\n";
+	result += source.substr(insertPos);
+	return result;
+}
+
+// A family of shader programs built from the same vertex and fragment shader sources,
+// where each program is compiled with a different set of feature #defines.
+// Programs are identified by a bitmask, where bit i enables featureDefines[i].
+struct ShaderPermutationSet
+{
+	std::string vertexShaderPath;
+	std::string fragmentShaderPath;
+
+	// Sources with their #includes resolved
+	std::string vertexShaderSource;
+	std::string fragmentShaderSource;
+
+	// Files the sources were built from
+	std::vector<std::string> dependencies;
+
+	// Names of the macros defined by each feature bit
+	std::vector<std::string> featureDefines;
+
+	// Definitions shared by every permutation (e.g. light counts)
+	std::string commonDefines;
+
+	// Compiled programs, keyed by feature bitmask
+	std::unordered_map<unsigned int, GLuint> programs;
+
+	// Programs being built in the background, keyed by feature bitmask
+	std::unordered_map<unsigned int, ShaderProgramHandle> pendingPrograms;
+
+	// Cache of linked program binaries, or null to always compile
+	ProgramBinaryCache* binaryCache;
+};
+
+// Creates a permutation set for the given vertex and fragment shader files.
+// The shader sources are read once, and no programs are compiled until they are requested.
+// @param	vertexShaderPath	Path to the vertex shader file
+// @param	fragmentShaderPath	Path to the fragment shader file
+// @param	featureDefines		Macro name for each feature bit
+// @param	commonDefines		Definitions shared by every permutation, one "#define ..." per line
+// @param	binaryCache			Optional cache of linked program binaries
+// @return	Returns the permutation set
+ShaderPermutationSet CreateShaderPermutationSet(const std::string& vertexShaderPath, const std::string& fragmentShaderPath,
+	const std::vector<std::string>& featureDefines, const std::string& commonDefines, ProgramBinaryCache* binaryCache = nullptr)
+{
+	ShaderPermutationSet permutations;
+	permutations.vertexShaderPath = vertexShaderPath;
+	permutations.fragmentShaderPath = fragmentShaderPath;
+	permutations.featureDefines = featureDefines;
+	permutations.commonDefines = commonDefines;
+	permutations.binaryCache = binaryCache;
+
+	ShaderSource vshSource;
+	if (!LoadShaderSource(vertexShaderPath, vshSource))
+	{
+		std::cout << "Failed to read shader file " << vertexShaderPath << std::endl;
+		throw std::runtime_error(std::string("failed to read shader file: ") + vertexShaderPath);
+	}
+
+	ShaderSource fshSource;
+	if (!LoadShaderSource(fragmentShaderPath, fshSource))
+	{
+		std::cout << "Failed to read shader file: " << fragmentShaderPath << std::endl;
+		throw std::runtime_error(std::string("failed to read shader file: ") + fragmentShaderPath);
+	}
+
+	permutations.vertexShaderSource = vshSource.text;
+	permutations.fragmentShaderSource = fshSource.text;
+	permutations.dependencies = vshSource.dependencies;
+	permutations.dependencies.insert(permutations.dependencies.end(), fshSource.dependencies.begin(), fshSource.dependencies.end());
+
+	return permutations;
+}
+
+// Builds the #define block for a permutation
+// @param	permutations	Permutation set the feature bits refer to
+// @param	features		Feature bitmask of the permutation
+// @return	Returns the definitions, one "#define ..." per line
+std::string GetShaderPermutationDefines(const ShaderPermutationSet& permutations, unsigned int features)
+{
+	std::string defines = permutations.commonDefines;
+	for (size_t i = 0; i < permutations.featureDefines.size(); ++i)
+	{
+		if (features & (1u << i))
+		{
+			defines += "#define " + permutations.featureDefines[i] + "\n";
+		}
+	}
+	return defines;
+}
+
+// Gets the program for the given feature bitmask, compiling it the first time it is requested
+// @param	permutations	Permutation set to get the program from
+// @param	features		Feature bitmask of the permutation
+// @return	Returns the handle to the shader program
+GLuint GetShaderPermutation(ShaderPermutationSet& permutations, unsigned int features)
+{
+	auto it = permutations.programs.find(features);
+	if (it != permutations.programs.end())
+	{
+		return it->second;
+	}
+
+	std::string defines = GetShaderPermutationDefines(permutations, features);
+	GLuint program = CreateShaderProgramFromSource(
+		InjectShaderDefines(permutations.vertexShaderSource, defines),
+		InjectShaderDefines(permutations.fragmentShaderSource, defines),
+		permutations.binaryCache);
+
+	permutations.programs[features] = program;
+	return program;
+}
+
+// Compiles the given permutations ahead of time, so that switching to them later does not stall a frame
+// @param	permutations	Permutation set to compile the programs of
+// @param	featureSets		Feature bitmasks of the permutations to compile
+void PrewarmShaderPermutations(ShaderPermutationSet& permutations, const std::vector<unsigned int>& featureSets)
+{
+	for (unsigned int features : featureSets)
+	{
+		GetShaderPermutation(permutations, features);
+	}
+}
+
+// Starts building the given permutations in the background
+// @param	permutations	Permutation set to build the programs of
+// @param	batch			Batch to build the programs in
+// @param	featureSets		Feature bitmasks of the permutations to build
+void QueueShaderPermutations(ShaderPermutationSet& permutations, ShaderCompileBatch& batch, const std::vector<unsigned int>& featureSets)
+{
+	for (unsigned int features : featureSets)
+	{
+		if (permutations.programs.count(features) || permutations.pendingPrograms.count(features))
+		{
+			continue;
+		}
+
+		std::string defines = GetShaderPermutationDefines(permutations, features);
+		permutations.pendingPrograms[features] = QueueShaderProgram(batch,
+			InjectShaderDefines(permutations.vertexShaderSource, defines),
+			InjectShaderDefines(permutations.fragmentShaderSource, defines),
+			permutations.binaryCache);
+	}
+}
+
+// Gets the program for the given feature bitmask without waiting for it to be built.
+// A permutation that isn't built yet is queued, and the fallback permutation is used in the meantime.
+// @param	permutations		Permutation set to get the program from
+// @param	batch				Batch that builds the permutations in the background
+// @param	features			Feature bitmask of the wanted permutation
+// @param	fallbackFeatures	Feature bitmask of the permutation to use until then. It is compiled immediately if needed.
+// @param	usedFeatures		Receives the feature bitmask of the program that was returned
+// @return	Returns the handle to the shader program
+GLuint GetReadyShaderPermutation(ShaderPermutationSet& permutations, ShaderCompileBatch& batch, unsigned int features,
+	unsigned int fallbackFeatures, unsigned int& usedFeatures)
+{
+	auto it = permutations.programs.find(features);
+	if (it != permutations.programs.end())
+	{
+		usedFeatures = features;
+		return it->second;
+	}
+
+	auto pendingIt = permutations.pendingPrograms.find(features);
+	if (pendingIt == permutations.pendingPrograms.end())
+	{
+		QueueShaderPermutations(permutations, batch, { features });
+	}
+	else if (GetShaderProgramState(batch, pendingIt->second) == ShaderProgramState::Ready)
+	{
+		GLuint program = GetShaderProgram(batch, pendingIt->second, 0);
+		permutations.programs[features] = program;
+		permutations.pendingPrograms.erase(pendingIt);
+		usedFeatures = features;
+		return program;
+	}
+
+	// Failed permutations stay pending, so they keep using the fallback instead of being rebuilt every frame
+	usedFeatures = fallbackFeatures;
+	return GetShaderPermutation(permutations, fallbackFeatures);
 }
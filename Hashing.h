@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Adds the bytes of a string to a 64-bit FNV-1a hash
+uint64_t HashStringFNV1a(uint64_t hash, const std::string& str)
+{
+	for (unsigned char c : str)
+	{
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+
+	// Hash the terminator too, so that "ab" + "c" and "a" + "bc" differ
+	return (hash ^ 0xff) * 1099511628211ull;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIGHT_CULLING_SSE2
+#endif
+
+// Array sizes of the light uniforms in BasicLighting.fsh.
+// These are injected into the shader by GetLightCountDefines.
+#define MAX_POINT_LIGHTS 4
+#define MAX_SPOT_LIGHTS 4
+#define MAX_LIGHTS_PER_OBJECT 4
+
+// Default contribution below which a light is treated as having no effect.
+// One 8-bit color step is the smallest change that can show up on screen.
+const float kLightCutoffThreshold = 1.0f / 256.0f;
+
+// Builds the #define block that sizes the light arrays in BasicLighting.fsh
+// @return	Returns the definitions, one "#define ..." per line
+std::string GetLightCountDefines()
+{
+	return "#define MAX_POINT_LIGHTS " + std::to_string(MAX_POINT_LIGHTS) + "\n"
+		+ "#define MAX_SPOT_LIGHTS " + std::to_string(MAX_SPOT_LIGHTS) + "\n"
+		+ "#define MAX_LIGHTS_PER_OBJECT " + std::to_string(MAX_LIGHTS_PER_OBJECT) + "\n";
+}
+
+// CPU-side mirror of the PointLight struct in BasicLighting.fsh.
+// The ambient term isn't passed to the shader, it reaches it through the lightmap and light probes instead.
+struct PointLight
+{
+	glm::vec3 position;
+
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+
+	float kConstant;
+	float kLinear;
+	float kQuadratic;
+};
+
+// CPU-side mirror of the SpotLight struct in BasicLighting.fsh.
+// The light probes carry the ambient term, but it's also passed to the shader for lightmapped objects.
+struct SpotLight
+{
+	glm::vec3 position;
+	glm::vec3 direction;
+
+	glm::vec3 ambient;
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+
+	float kConstant;
+	float kLinear;
+	float kQuadratic;
+
+	float cutOffAngle;
+};
+
+// Indices of the lights that can affect a single object
+struct LightList
+{
+	int numPointLights;
+	int pointLightIndices[MAX_LIGHTS_PER_OBJECT];
+
+	int numSpotLights;
+	int spotLightIndices[MAX_LIGHTS_PER_OBJECT];
+};
+
+// Bounding spheres of the objects to cull against, stored as separate arrays
+// so that four objects can be tested at once. Every array is padded to a
+// multiple of four with zero-radius spheres placed infinitely far away.
+struct ObjectBounds
+{
+	int count = 0;
+	std::vector<float> x, y, z, radius;
+};
+
+// Adds an object's bounding sphere to the list of bounds
+// @param	bounds	Bounds to add the sphere to
+// @param	center	World-space center of the sphere
+// @param	radius	Radius of the sphere
+void AddObjectBounds(ObjectBounds& bounds, const glm::vec3& center, float radius)
+{
+	// Fill the first padding slot, if any, otherwise grow by a batch of four
+	if (bounds.count == (int)bounds.x.size())
+	{
+		const float farAway = std::numeric_limits<float>::max();
+		bounds.x.resize(bounds.count + 4, farAway);
+		bounds.y.resize(bounds.count + 4, farAway);
+		bounds.z.resize(bounds.count + 4, farAway);
+		bounds.radius.resize(bounds.count + 4, 0.0f);
+	}
+
+	bounds.x[bounds.count] = center.x;
+	bounds.y[bounds.count] = center.y;
+	bounds.z[bounds.count] = center.z;
+	bounds.radius[bounds.count] = radius;
+	++bounds.count;
+}
+
+// Computes the distance past which a light's attenuated contribution drops below the threshold.
+// Solves intensity / (kConstant + kLinear * d + kQuadratic * d^2) = threshold for d.
+// @param	kConstant	Constant attenuation term
+// @param	kLinear		Linear attenuation term
+// @param	kQuadratic	Quadratic attenuation term
+// @param	intensity	Brightest color channel the light can output before attenuation
+// @param	threshold	Contribution below which the light is ignored
+// @return	Returns the influence radius, or infinity if the light never falls below the threshold
+float ComputeLightInfluenceRadius(float kConstant, float kLinear, float kQuadratic, float intensity, float threshold)
+{
+	float c = kConstant - intensity / threshold;
+	if (c >= 0.0f)
+	{
+		// Even at distance 0 the light is too dim to matter
+		return 0.0f;
+	}
+
+	if (kQuadratic > 0.0f)
+	{
+		return (-kLinear + std::sqrt(kLinear * kLinear - 4.0f * kQuadratic * c)) / (2.0f * kQuadratic);
+	}
+	if (kLinear > 0.0f)
+	{
+		return -c / kLinear;
+	}
+	return std::numeric_limits<float>::infinity();
+}
+
+// Returns the largest color channel a light can add to a fragment, ignoring attenuation.
+// The ambient term is left out since the shader doesn't evaluate it per light.
+template <typename Light>
+float GetLightIntensity(const Light& light)
+{
+	glm::vec3 sum = light.diffuse + light.specular;
+	return std::max(sum.x, std::max(sum.y, sum.z));
+}
+
+// Appends a light index to a fixed-size index list, dropping it if the list is full
+void PushLightIndex(int* indices, int& count, int lightIndex)
+{
+	if (count < MAX_LIGHTS_PER_OBJECT)
+	{
+		indices[count++] = lightIndex;
+	}
+}
+
+// Tests every object against a point light's influence sphere.
+// @param	bounds		Object bounding spheres
+// @param	position	Light position
+// @param	range		Light influence radius
+// @param	visible		Receives a non-zero value per object that the light can reach
+void CullPointLight(const ObjectBounds& bounds, const glm::vec3& position, float range, std::vector<int>& visible)
+{
+	int paddedCount = (int)bounds.x.size();
+	visible.assign(paddedCount, 0);
+
+#ifdef LIGHT_CULLING_SSE2
+	__m128 lx = _mm_set1_ps(position.x);
+	__m128 ly = _mm_set1_ps(position.y);
+	__m128 lz = _mm_set1_ps(position.z);
+	__m128 lr = _mm_set1_ps(range);
+
+	for (int i = 0; i < paddedCount; i += 4)
+	{
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(&bounds.x[i]), lx);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(&bounds.y[i]), ly);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(&bounds.z[i]), lz);
+		__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+		__m128 reach = _mm_add_ps(_mm_loadu_ps(&bounds.radius[i]), lr);
+		int mask = _mm_movemask_ps(_mm_cmple_ps(distSq, _mm_mul_ps(reach, reach)));
+		for (int j = 0; j < 4; ++j)
+		{
+			visible[i + j] = (mask >> j) & 1;
+		}
+	}
+#else
+	for (int i = 0; i < paddedCount; ++i)
+	{
+		glm::vec3 d = glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]) - position;
+		float reach = bounds.radius[i] + range;
+		visible[i] = glm::dot(d, d) <= reach * reach;
+	}
+#endif
+}
+
+// Tests every object against a spot light's cone, capped at the light's influence radius.
+// https://bartwronski.com/2017/04/13/cull-that-cone/
+// @param	bounds		Object bounding spheres
+// @param	light		Spot light to test (direction must be normalized)
+// @param	range		Light influence radius
+// @param	visible		Receives a non-zero value per object that the cone can reach
+void CullSpotLight(const ObjectBounds& bounds, const SpotLight& light, float range, std::vector<int>& visible)
+{
+	int paddedCount = (int)bounds.x.size();
+	visible.assign(paddedCount, 0);
+
+	float cosAngle = std::cos(light.cutOffAngle);
+	float sinAngle = std::sin(light.cutOffAngle);
+
+#ifdef LIGHT_CULLING_SSE2
+	__m128 ox = _mm_set1_ps(light.position.x);
+	__m128 oy = _mm_set1_ps(light.position.y);
+	__m128 oz = _mm_set1_ps(light.position.z);
+	__m128 dirX = _mm_set1_ps(light.direction.x);
+	__m128 dirY = _mm_set1_ps(light.direction.y);
+	__m128 dirZ = _mm_set1_ps(light.direction.z);
+	__m128 cosA = _mm_set1_ps(cosAngle);
+	__m128 sinA = _mm_set1_ps(sinAngle);
+	__m128 lr = _mm_set1_ps(range);
+	__m128 zero = _mm_setzero_ps();
+
+	for (int i = 0; i < paddedCount; i += 4)
+	{
+		__m128 vx = _mm_sub_ps(_mm_loadu_ps(&bounds.x[i]), ox);
+		__m128 vy = _mm_sub_ps(_mm_loadu_ps(&bounds.y[i]), oy);
+		__m128 vz = _mm_sub_ps(_mm_loadu_ps(&bounds.z[i]), oz);
+		__m128 radius = _mm_loadu_ps(&bounds.radius[i]);
+
+		__m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		__m128 alongAxis = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dirX), _mm_mul_ps(vy, dirY)), _mm_mul_ps(vz, dirZ));
+		__m128 perpSq = _mm_max_ps(_mm_sub_ps(lenSq, _mm_mul_ps(alongAxis, alongAxis)), zero);
+		__m128 closest = _mm_sub_ps(_mm_mul_ps(cosA, _mm_sqrt_ps(perpSq)), _mm_mul_ps(alongAxis, sinA));
+
+		__m128 angleCull = _mm_cmpgt_ps(closest, radius);
+		__m128 frontCull = _mm_cmpgt_ps(alongAxis, _mm_add_ps(radius, lr));
+		__m128 backCull = _mm_cmplt_ps(alongAxis, _mm_sub_ps(zero, radius));
+		int mask = _mm_movemask_ps(_mm_or_ps(angleCull, _mm_or_ps(frontCull, backCull)));
+		for (int j = 0; j < 4; ++j)
+		{
+			visible[i + j] = !((mask >> j) & 1);
+		}
+	}
+#else
+	for (int i = 0; i < paddedCount; ++i)
+	{
+		glm::vec3 v = glm::vec3(bounds.x[i], bounds.y[i], bounds.z[i]) - light.position;
+		float radius = bounds.radius[i];
+		float alongAxis = glm::dot(v, light.direction);
+		float perp = std::sqrt(std::max(glm::dot(v, v) - alongAxis * alongAxis, 0.0f));
+		float closest = cosAngle * perp - alongAxis * sinAngle;
+
+		bool angleCull = closest > radius;
+		bool frontCull = alongAxis > radius + range;
+		bool backCull = alongAxis < -radius;
+		visible[i] = !(angleCull || frontCull || backCull);
+	}
+#endif
+}
+
+// Builds the per-object light lists for the given lights and objects.
+// Lights whose contribution is below the threshold for an object are left out of its list.
+// @param	pointLights	Point lights in the scene
+// @param	spotLights	Spot lights in the scene
+// @param	bounds		Object bounding spheres
+// @param	threshold	Contribution below which a light is ignored
+// @param	lightLists	Receives one light list per object
+void CullLights(const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights,
+	const ObjectBounds& bounds, float threshold, std::vector<LightList>& lightLists)
+{
+	lightLists.assign(bounds.count, LightList{});
+
+	std::vector<int> visible;
+	for (int i = 0; i < (int)pointLights.size(); ++i)
+	{
+		const PointLight& light = pointLights[i];
+		float range = ComputeLightInfluenceRadius(light.kConstant, light.kLinear, light.kQuadratic, GetLightIntensity(light), threshold);
+
+		CullPointLight(bounds, light.position, range, visible);
+		for (int j = 0; j < bounds.count; ++j)
+		{
+			if (visible[j])
+			{
+				PushLightIndex(lightLists[j].pointLightIndices, lightLists[j].numPointLights, i);
+			}
+		}
+	}
+
+	for (int i = 0; i < (int)spotLights.size(); ++i)
+	{
+		const SpotLight& light = spotLights[i];
+		float range = ComputeLightInfluenceRadius(light.kConstant, light.kLinear, light.kQuadratic, GetLightIntensity(light), threshold);
+
+		CullSpotLight(bounds, light, range, visible);
+		for (int j = 0; j < bounds.count; ++j)
+		{
+			if (visible[j])
+			{
+				PushLightIndex(lightLists[j].spotLightIndices, lightLists[j].numSpotLights, i);
+			}
+		}
+	}
+}
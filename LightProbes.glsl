@@ -0,0 +1,42 @@
+// Sampling of the light probe grid (see LightProbes.h).
+// Ambient lighting comes from a grid of L2 spherical harmonic probes. The 9 RGB coefficients
+// of each probe are spread in order over the RGBA texels of the 7 textures.
+uniform sampler3D probeTex[7];
+uniform vec3 probeVolumeMin;
+uniform vec3 probeVolumeMax;
+uniform vec3 probeVolumeResolution;
+
+// Returns the ambient lighting arriving at the given position on a surface facing the given normal
+vec3 SampleLightProbes(vec3 position, vec3 normal)
+{
+	// Map the position to the texel centers of the first and last probe
+	vec3 t = clamp((position - probeVolumeMin) / (probeVolumeMax - probeVolumeMin), 0.0, 1.0);
+	vec3 uvw = (t * (probeVolumeResolution - 1.0) + 0.5) / probeVolumeResolution;
+
+	vec4 t0 = texture(probeTex[0], uvw);
+	vec4 t1 = texture(probeTex[1], uvw);
+	vec4 t2 = texture(probeTex[2], uvw);
+	vec4 t3 = texture(probeTex[3], uvw);
+	vec4 t4 = texture(probeTex[4], uvw);
+	vec4 t5 = texture(probeTex[5], uvw);
+	vec4 t6 = texture(probeTex[6], uvw);
+
+	vec3 c0 = t0.rgb;
+	vec3 c1 = vec3(t0.a, t1.rg);
+	vec3 c2 = vec3(t1.ba, t2.r);
+	vec3 c3 = t2.gba;
+	vec3 c4 = t3.rgb;
+	vec3 c5 = vec3(t3.a, t4.rg);
+	vec3 c6 = vec3(t4.ba, t5.r);
+	vec3 c7 = t5.gba;
+	vec3 c8 = t6.rgb;
+
+	// The coefficients are already convolved with the cosine lobe, so this gives irradiance directly
+	vec3 n = normal;
+	vec3 result = c0 * 0.282095
+		+ c1 * (0.488603 * n.y) + c2 * (0.488603 * n.z) + c3 * (0.488603 * n.x)
+		+ c4 * (1.092548 * n.x * n.y) + c5 * (1.092548 * n.y * n.z)
+		+ c6 * (0.315392 * (3.0 * n.z * n.z - 1.0))
+		+ c7 * (1.092548 * n.x * n.z) + c8 * (0.546274 * (n.x * n.x - n.y * n.y));
+	return max(result, 0.0);
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "LightCulling.h"
+#include "LightmapBaker.h"
+
+// Number of coefficients in an L2 spherical harmonic
+#define SH_COEFFICIENT_COUNT 9
+
+// Number of RGBA textures needed to store 9 RGB coefficients (27 floats, padded to 28)
+#define SH_TEXTURE_COUNT 7
+
+// Ambient lighting around a point, as L2 spherical harmonic coefficients per color channel.
+// The coefficients are already convolved with the cosine lobe and divided by pi, so evaluating
+// them for a normal gives the same units as the ambient terms of the lights.
+struct SHProbe
+{
+	glm::vec3 coefficients[SH_COEFFICIENT_COUNT];
+};
+
+// A regular grid of light probes spanning an axis-aligned box
+struct ProbeVolume
+{
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+	glm::ivec3 resolution;
+
+	std::vector<SHProbe> probes;
+
+	// Textures holding the probe coefficients, see UploadProbeVolume for the layout
+	GLuint textures[SH_TEXTURE_COUNT];
+
+	// Incremental update state
+	int nextProbe = 0;
+	int pendingFirst = 0;
+	std::vector<SHProbe> pendingProbes;
+	std::future<void> pendingUpdate;
+};
+
+// Lighting the probes are computed from
+struct ProbeLightingInputs
+{
+	const BVH* bvh;
+
+	// Static point lights, with shadows and one bounce
+	std::vector<PointLight> pointLights;
+
+	// Spot lights only contribute their ambient term
+	std::vector<SpotLight> spotLights;
+
+	// Constant light arriving from every unoccluded direction
+	glm::vec3 skyAmbient;
+
+	// Average albedo of the scene, used for the bounced light
+	glm::vec3 bounceAlbedo;
+
+	// Rays further than this are treated as escaping to the sky
+	float maxRayDistance;
+
+	// Directions sampled per probe (rounded up to a multiple of the packet size)
+	int sampleCount;
+};
+
+// Evaluates the 9 real L2 spherical harmonic basis functions for a unit direction
+void EvaluateSHBasis(const glm::vec3& d, float basis[SH_COEFFICIENT_COUNT])
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * d.y;
+	basis[2] = 0.488603f * d.z;
+	basis[3] = 0.488603f * d.x;
+	basis[4] = 1.092548f * d.x * d.y;
+	basis[5] = 1.092548f * d.y * d.z;
+	basis[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+	basis[7] = 1.092548f * d.x * d.z;
+	basis[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+// Returns the i-th of count directions spread evenly over the sphere (Fibonacci sphere)
+glm::vec3 GetSphereSampleDirection(int i, int count)
+{
+	const float goldenAngle = glm::pi<float>() * (3.0f - std::sqrt(5.0f));
+	float z = 1.0f - (2.0f * i + 1.0f) / count;
+	float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+	float phi = goldenAngle * i;
+	return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Returns the world-space position of a probe in the grid
+glm::vec3 GetProbePosition(const ProbeVolume& volume, int index)
+{
+	int x = index % volume.resolution.x;
+	int y = (index / volume.resolution.x) % volume.resolution.y;
+	int z = index / (volume.resolution.x * volume.resolution.y);
+	glm::vec3 t = glm::vec3((float)x, (float)y, (float)z) / glm::max(glm::vec3(volume.resolution - 1), glm::vec3(1.0f));
+	return volume.boundsMin + t * (volume.boundsMax - volume.boundsMin);
+}
+
+// Computes the ambient lighting at a point: occluded sky, one bounce of the point lights,
+// and the (unoccluded, direction-less) ambient terms of every light.
+SHProbe ComputeProbe(const ProbeLightingInputs& inputs, const glm::vec3& position)
+{
+	SHProbe probe;
+	for (int c = 0; c < SH_COEFFICIENT_COUNT; ++c)
+	{
+		probe.coefficients[c] = glm::vec3(0.0f);
+	}
+
+	int packetCount = (inputs.sampleCount + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+	int sampleCount = packetCount * RAY_PACKET_SIZE;
+
+	glm::vec3 positions[RAY_PACKET_SIZE];
+	glm::vec3 normals[RAY_PACKET_SIZE];
+	int active[RAY_PACKET_SIZE];
+	glm::vec3 irradiance[RAY_PACKET_SIZE];
+
+	for (int p = 0; p < packetCount; ++p)
+	{
+		RayPacket packet;
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			packet.origins[i] = position;
+			packet.directions[i] = GetSphereSampleDirection(p * RAY_PACKET_SIZE + i, sampleCount);
+			packet.tMax[i] = inputs.maxRayDistance;
+			packet.active[i] = 1;
+		}
+		TracePacket(*inputs.bvh, packet, false);
+
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			active[i] = packet.hitTriangle[i] >= 0;
+			if (active[i])
+			{
+				const BakeTriangle& tri = inputs.bvh->triangles[packet.hitTriangle[i]];
+				normals[i] = glm::dot(tri.normal, packet.directions[i]) < 0.0f ? tri.normal : -tri.normal;
+				positions[i] = packet.origins[i] + packet.directions[i] * packet.tMax[i];
+			}
+			else
+			{
+				normals[i] = glm::vec3(0.0f, 0.0f, 1.0f);
+				positions[i] = position;
+			}
+		}
+		ComputeDirectLighting(*inputs.bvh, inputs.pointLights, positions, normals, active, irradiance);
+
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			glm::vec3 radiance = active[i] ? inputs.bounceAlbedo * (irradiance[i] + inputs.skyAmbient) : inputs.skyAmbient;
+
+			float basis[SH_COEFFICIENT_COUNT];
+			EvaluateSHBasis(packet.directions[i], basis);
+			for (int c = 0; c < SH_COEFFICIENT_COUNT; ++c)
+			{
+				probe.coefficients[c] += radiance * basis[c];
+			}
+		}
+	}
+
+	// Monte Carlo weight of each uniform sphere sample, times the cosine lobe convolution
+	// (pi, 2pi/3, pi/4 per band) divided by pi
+	const float bandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+	float sampleWeight = 4.0f * glm::pi<float>() / sampleCount;
+	for (int c = 0; c < SH_COEFFICIENT_COUNT; ++c)
+	{
+		int band = c == 0 ? 0 : (c < 4 ? 1 : 2);
+		probe.coefficients[c] *= sampleWeight * bandScale[band];
+	}
+
+	// The lights' ambient terms don't depend on direction, so they only add to the constant band.
+	// A constant ambient a projects to a * sqrt(4pi) = a / 0.282095.
+	glm::vec3 ambient(0.0f);
+	for (const PointLight& light : inputs.pointLights)
+	{
+		float dist = glm::distance(position, light.position);
+		ambient += light.ambient / (light.kConstant + light.kLinear * dist + light.kQuadratic * dist * dist);
+	}
+	for (const SpotLight& light : inputs.spotLights)
+	{
+		float dist = glm::distance(position, light.position);
+		ambient += light.ambient / (light.kConstant + light.kLinear * dist + light.kQuadratic * dist * dist);
+	}
+	probe.coefficients[0] += ambient / 0.282095f;
+
+	return probe;
+}
+
+// Sets up a probe grid and creates its textures. The probes start out black until they are computed.
+// @param	volume		Probe volume to set up
+// @param	boundsMin	Minimum corner of the volume
+// @param	boundsMax	Maximum corner of the volume
+// @param	resolution	Number of probes along each axis
+void CreateProbeVolume(ProbeVolume& volume, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::ivec3& resolution)
+{
+	volume.boundsMin = boundsMin;
+	volume.boundsMax = boundsMax;
+	volume.resolution = resolution;
+	volume.probes.assign(resolution.x * resolution.y * resolution.z, SHProbe());
+
+	glGenTextures(SH_TEXTURE_COUNT, volume.textures);
+	for (int t = 0; t < SH_TEXTURE_COUNT; ++t)
+	{
+		glBindTexture(GL_TEXTURE_3D, volume.textures[t]);
+
+		// Probes are blended trilinearly by the texture unit
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, resolution.x, resolution.y, resolution.z, 0, GL_RGBA, GL_FLOAT, nullptr);
+	}
+}
+
+// Copies the probe coefficients into the volume's textures.
+// The 27 floats of each probe are laid out in order across the 7 RGBA textures,
+// so texture 0 holds (c0.rgb, c1.r), texture 1 holds (c1.gb, c2.rg), and so on.
+void UploadProbeVolume(const ProbeVolume& volume)
+{
+	int probeCount = (int)volume.probes.size();
+	std::vector<float> texels(probeCount * 4);
+	for (int t = 0; t < SH_TEXTURE_COUNT; ++t)
+	{
+		for (int p = 0; p < probeCount; ++p)
+		{
+			const float* flat = &volume.probes[p].coefficients[0].x;
+			for (int j = 0; j < 4; ++j)
+			{
+				int index = t * 4 + j;
+				texels[p * 4 + j] = index < SH_COEFFICIENT_COUNT * 3 ? flat[index] : 0.0f;
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_3D, volume.textures[t]);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, volume.resolution.x, volume.resolution.y, volume.resolution.z,
+			GL_RGBA, GL_FLOAT, texels.data());
+	}
+}
+
+// Computes a range of probes into an output array
+void ComputeProbeRange(const ProbeVolume& volume, const ProbeLightingInputs& inputs, int first, int count, SHProbe* output)
+{
+	int probeCount = (int)volume.probes.size();
+	for (int i = 0; i < count; ++i)
+	{
+		output[i] = ComputeProbe(inputs, GetProbePosition(volume, (first + i) % probeCount));
+	}
+}
+
+// Computes every probe in the volume using all hardware threads, and uploads the result
+// @param	volume	Probe volume to compute
+// @param	inputs	Lighting to compute the probes from
+void BakeProbeVolume(ProbeVolume& volume, const ProbeLightingInputs& inputs)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	int probeCount = (int)volume.probes.size();
+	int threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	int probesPerThread = (probeCount + threadCount - 1) / threadCount;
+
+	std::vector<std::thread> threads;
+	for (int first = 0; first < probeCount; first += probesPerThread)
+	{
+		int count = std::min(probesPerThread, probeCount - first);
+		threads.emplace_back(ComputeProbeRange, std::cref(volume), std::cref(inputs), first, count, &volume.probes[first]);
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	UploadProbeVolume(volume);
+
+	double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	std::cout << "Baked " << probeCount << " light probes in " << elapsedMs << " ms" << std::endl;
+}
+
+// Recomputes a few probes per frame on a worker thread, so that the probes follow moving lights
+// without stalling the frame. Call once per frame from the GL thread.
+// When the previous batch has finished, its probes are uploaded and a new batch is started with
+// the given inputs, otherwise this returns immediately.
+// @param	volume			Probe volume to update
+// @param	inputs			Current lighting (copied for the worker)
+// @param	probesPerBatch	Number of probes to recompute per batch
+void UpdateProbeVolume(ProbeVolume& volume, const ProbeLightingInputs& inputs, int probesPerBatch)
+{
+	if (volume.pendingUpdate.valid())
+	{
+		if (volume.pendingUpdate.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			return;
+		}
+		volume.pendingUpdate.get();
+
+		int probeCount = (int)volume.probes.size();
+		for (int i = 0; i < (int)volume.pendingProbes.size(); ++i)
+		{
+			volume.probes[(volume.pendingFirst + i) % probeCount] = volume.pendingProbes[i];
+		}
+
+		// The whole grid is only a few hundred texels, so it's simpler to reupload all of it
+		UploadProbeVolume(volume);
+	}
+
+	int count = std::min(probesPerBatch, (int)volume.probes.size());
+	volume.pendingFirst = volume.nextProbe;
+	volume.pendingProbes.resize(count);
+	volume.nextProbe = (volume.nextProbe + count) % (int)volume.probes.size();
+
+	ProbeVolume* target = &volume;
+	volume.pendingUpdate = std::async(std::launch::async, [target, inputs, count]()
+	{
+		ComputeProbeRange(*target, inputs, target->pendingFirst, count, target->pendingProbes.data());
+	});
+}
+
+// Binds the probe textures to consecutive texture units starting at firstUnit,
+// and passes the volume parameters to the given shader program
+// @param	volume		Probe volume to bind
+// @param	program		Shader program that samples the probes
+// @param	firstUnit	First texture unit to use
+void BindProbeVolume(const ProbeVolume& volume, GLuint program, int firstUnit)
+{
+	int units[SH_TEXTURE_COUNT];
+	for (int t = 0; t < SH_TEXTURE_COUNT; ++t)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + t);
+		glBindTexture(GL_TEXTURE_3D, volume.textures[t]);
+		units[t] = firstUnit + t;
+	}
+
+	glUniform1iv(glGetUniformLocation(program, "probeTex"), SH_TEXTURE_COUNT, units);
+	glUniform3fv(glGetUniformLocation(program, "probeVolumeMin"), 1, &volume.boundsMin.x);
+	glUniform3fv(glGetUniformLocation(program, "probeVolumeMax"), 1, &volume.boundsMax.x);
+	glUniform3f(glGetUniformLocation(program, "probeVolumeResolution"),
+		(float)volume.resolution.x, (float)volume.resolution.y, (float)volume.resolution.z);
+}
+
+// Waits for any pending update and deletes the volume's textures
+void DeleteProbeVolume(ProbeVolume& volume)
+{
+	if (volume.pendingUpdate.valid())
+	{
+		volume.pendingUpdate.wait();
+	}
+	glDeleteTextures(SH_TEXTURE_COUNT, volume.textures);
+}
@@ -0,0 +1,834 @@
+#pragma once
+
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/intersect.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LightCulling.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIGHTMAP_BAKER_SSE2
+#endif
+
+// Number of rays traced together through the BVH
+#define RAY_PACKET_SIZE 4
+
+// Triangle mesh to bake, in object space.
+// Every vertex needs a lightmap UV in [0, 1] that doesn't overlap any other triangle.
+struct LightmapMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> lightmapUVs;
+	std::vector<unsigned int> indices;
+};
+
+// A static object placed in the scene
+struct LightmapInstance
+{
+	const LightmapMesh* mesh;
+	glm::mat4 modelMatrix;
+
+	// Whether the object blocks light (and bounce rays) for the rest of the scene
+	bool castsShadows;
+
+	// Scale (xy) and offset (zw) from the mesh's lightmap UVs to this instance's tile in the atlas.
+	// Filled in by PackLightmapAtlas.
+	glm::vec4 scaleOffset;
+};
+
+struct LightmapBakeSettings
+{
+	// Size of each instance's tile in the atlas, in texels
+	int tileWidth = 64;
+	int tileHeight = 64;
+
+	// Constant light arriving from every unoccluded direction
+	glm::vec3 skyAmbient = glm::vec3(0.0f);
+
+	// Rays further than this are treated as escaping to the sky
+	float maxRayDistance = 20.0f;
+
+	// Hemisphere rays per texel for sky occlusion and the first bounce (rounded up to a multiple of the packet size)
+	int hemisphereSamples = 64;
+
+	// Average albedo of the scene, used for the bounced light
+	glm::vec3 bounceAlbedo = glm::vec3(0.5f);
+
+	// Number of worker threads, 0 uses one per hardware thread
+	int threadCount = 0;
+};
+
+// Baked lighting for all instances, as linear RGB irradiance per texel
+struct Lightmap
+{
+	int width = 0;
+	int height = 0;
+	std::vector<glm::vec3> texels;
+};
+
+// Generates non-overlapping lightmap UVs for a mesh made of separate charts by packing the charts in a grid.
+// @param	chartUVs		Per-vertex UV coordinates within the vertex's chart, in [0, 1]
+// @param	chartIds		Per-vertex chart index
+// @param	chartCount		Number of charts in the mesh
+// @param	chartResolution	Size of each chart in the lightmap, in texels
+// @param	padding			Empty texels around each chart so that bilinear filtering doesn't bleed between charts
+// @param	lightmapUVs		Receives the per-vertex lightmap UVs
+// @param	tileWidth		Receives the width in texels of the area all charts are packed in
+// @param	tileHeight		Receives the height in texels of the area all charts are packed in
+void GenerateLightmapUVs(const std::vector<glm::vec2>& chartUVs, const std::vector<int>& chartIds, int chartCount,
+	int chartResolution, int padding, std::vector<glm::vec2>& lightmapUVs, int& tileWidth, int& tileHeight)
+{
+	int columns = (int)std::ceil(std::sqrt((float)chartCount));
+	int rows = (chartCount + columns - 1) / columns;
+	int cellSize = chartResolution + 2 * padding;
+
+	tileWidth = columns * cellSize;
+	tileHeight = rows * cellSize;
+
+	lightmapUVs.resize(chartUVs.size());
+	for (size_t i = 0; i < chartUVs.size(); ++i)
+	{
+		int column = chartIds[i] % columns;
+		int row = chartIds[i] / columns;
+
+		glm::vec2 texel = glm::vec2(column * cellSize + padding, row * cellSize + padding) + chartUVs[i] * (float)chartResolution;
+		lightmapUVs[i] = texel / glm::vec2((float)tileWidth, (float)tileHeight);
+	}
+}
+
+// Lays out one tile per instance in an atlas, and stores each instance's UV scale and offset.
+// @param	instances	Instances to place in the atlas
+// @param	settings	Bake settings, for the tile size
+// @param	lightmap	Receives the atlas dimensions
+void PackLightmapAtlas(std::vector<LightmapInstance>& instances, const LightmapBakeSettings& settings, Lightmap& lightmap)
+{
+	int count = (int)instances.size();
+	int columns = std::max(1, (int)std::ceil(std::sqrt((float)count)));
+	int rows = std::max(1, (count + columns - 1) / columns);
+
+	lightmap.width = columns * settings.tileWidth;
+	lightmap.height = rows * settings.tileHeight;
+	lightmap.texels.assign(lightmap.width * lightmap.height, glm::vec3(0.0f));
+
+	for (int i = 0; i < count; ++i)
+	{
+		glm::vec2 scale = glm::vec2((float)settings.tileWidth / lightmap.width, (float)settings.tileHeight / lightmap.height);
+		glm::vec2 offset = glm::vec2((float)(i % columns), (float)(i / columns)) * scale;
+		instances[i].scaleOffset = glm::vec4(scale, offset);
+	}
+}
+
+// --- Ray tracing ---
+
+struct BakeTriangle
+{
+	glm::vec3 v0, v1, v2;
+	glm::vec3 normal;
+};
+
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
+	// Children of an inner node
+	int left;
+	int right;
+
+	// Triangles of a leaf node, inner nodes have no triangles
+	int firstTriangle;
+	int triangleCount;
+};
+
+struct BVH
+{
+	std::vector<BVHNode> nodes;
+	std::vector<BakeTriangle> triangles;
+};
+
+// Recursively splits the triangles in [first, first + count) at the median of the longest axis of their centroids
+int BuildBVHNode(BVH& bvh, int first, int count)
+{
+	int nodeIndex = (int)bvh.nodes.size();
+	bvh.nodes.push_back(BVHNode());
+
+	glm::vec3 boundsMin(std::numeric_limits<float>::max());
+	glm::vec3 boundsMax(-std::numeric_limits<float>::max());
+	glm::vec3 centroidMin = boundsMin;
+	glm::vec3 centroidMax = boundsMax;
+	for (int i = first; i < first + count; ++i)
+	{
+		const BakeTriangle& tri = bvh.triangles[i];
+		boundsMin = glm::min(boundsMin, glm::min(tri.v0, glm::min(tri.v1, tri.v2)));
+		boundsMax = glm::max(boundsMax, glm::max(tri.v0, glm::max(tri.v1, tri.v2)));
+
+		glm::vec3 centroid = (tri.v0 + tri.v1 + tri.v2) / 3.0f;
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+
+	bvh.nodes[nodeIndex].boundsMin = boundsMin;
+	bvh.nodes[nodeIndex].boundsMax = boundsMax;
+
+	if (count <= 4)
+	{
+		bvh.nodes[nodeIndex].left = -1;
+		bvh.nodes[nodeIndex].right = -1;
+		bvh.nodes[nodeIndex].firstTriangle = first;
+		bvh.nodes[nodeIndex].triangleCount = count;
+		return nodeIndex;
+	}
+
+	glm::vec3 extent = centroidMax - centroidMin;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+
+	int mid = first + count / 2;
+	std::nth_element(bvh.triangles.begin() + first, bvh.triangles.begin() + mid, bvh.triangles.begin() + first + count,
+		[axis](const BakeTriangle& a, const BakeTriangle& b)
+		{
+			return (a.v0[axis] + a.v1[axis] + a.v2[axis]) < (b.v0[axis] + b.v1[axis] + b.v2[axis]);
+		});
+
+	// Build the children first, since adding nodes may reallocate the node array
+	int left = BuildBVHNode(bvh, first, mid - first);
+	int right = BuildBVHNode(bvh, mid, first + count - mid);
+	bvh.nodes[nodeIndex].left = left;
+	bvh.nodes[nodeIndex].right = right;
+	bvh.nodes[nodeIndex].firstTriangle = 0;
+	bvh.nodes[nodeIndex].triangleCount = 0;
+	return nodeIndex;
+}
+
+// Builds a BVH over the world-space triangles of every shadow casting instance
+// @param	instances	Instances in the scene
+// @return	Returns the BVH
+BVH BuildBVH(const std::vector<LightmapInstance>& instances)
+{
+	BVH bvh;
+	for (const LightmapInstance& instance : instances)
+	{
+		if (!instance.castsShadows)
+		{
+			continue;
+		}
+
+		const LightmapMesh& mesh = *instance.mesh;
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			BakeTriangle tri;
+			tri.v0 = glm::vec3(instance.modelMatrix * glm::vec4(mesh.positions[mesh.indices[i]], 1.0f));
+			tri.v1 = glm::vec3(instance.modelMatrix * glm::vec4(mesh.positions[mesh.indices[i + 1]], 1.0f));
+			tri.v2 = glm::vec3(instance.modelMatrix * glm::vec4(mesh.positions[mesh.indices[i + 2]], 1.0f));
+			tri.normal = glm::normalize(glm::cross(tri.v1 - tri.v0, tri.v2 - tri.v0));
+			bvh.triangles.push_back(tri);
+		}
+	}
+
+	if (!bvh.triangles.empty())
+	{
+		BuildBVHNode(bvh, 0, (int)bvh.triangles.size());
+	}
+	return bvh;
+}
+
+// A group of rays traced through the BVH together.
+// The rays should start close to each other and point in similar directions, so that they visit the same nodes.
+struct RayPacket
+{
+	glm::vec3 origins[RAY_PACKET_SIZE];
+	glm::vec3 directions[RAY_PACKET_SIZE];
+
+	// Reciprocals of the directions, filled in by TracePacket
+	glm::vec3 invDirections[RAY_PACKET_SIZE];
+
+	// Maximum hit distance of each ray, shortened as hits are found
+	float tMax[RAY_PACKET_SIZE];
+
+	// Rays with a zero entry are ignored
+	int active[RAY_PACKET_SIZE];
+
+	// Index of the closest triangle hit by each ray, or -1
+	int hitTriangle[RAY_PACKET_SIZE];
+};
+
+// Tests the packet's rays against a node's bounding box.
+// @return	Returns a bitmask of the rays that hit the box
+int IntersectPacketBounds(const RayPacket& packet, const BVHNode& node)
+{
+#ifdef LIGHTMAP_BAKER_SSE2
+	// Slab test for all four rays at once, with the ray data transposed to one register per axis
+	__m128 tMin = _mm_setzero_ps();
+	__m128 tMax = _mm_loadu_ps(packet.tMax);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		__m128 origin = _mm_setr_ps(packet.origins[0][axis], packet.origins[1][axis], packet.origins[2][axis], packet.origins[3][axis]);
+		__m128 invDir = _mm_setr_ps(packet.invDirections[0][axis], packet.invDirections[1][axis],
+			packet.invDirections[2][axis], packet.invDirections[3][axis]);
+
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin[axis]), origin), invDir);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax[axis]), origin), invDir);
+		tMin = _mm_max_ps(tMin, _mm_min_ps(t0, t1));
+		tMax = _mm_min_ps(tMax, _mm_max_ps(t0, t1));
+	}
+
+	int activeMask = (packet.active[0] ? 1 : 0) | (packet.active[1] ? 2 : 0) | (packet.active[2] ? 4 : 0) | (packet.active[3] ? 8 : 0);
+	return _mm_movemask_ps(_mm_cmple_ps(tMin, tMax)) & activeMask;
+#else
+	int mask = 0;
+	for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+	{
+		if (!packet.active[i])
+		{
+			continue;
+		}
+
+		glm::vec3 t0 = (node.boundsMin - packet.origins[i]) * packet.invDirections[i];
+		glm::vec3 t1 = (node.boundsMax - packet.origins[i]) * packet.invDirections[i];
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float tMin = std::max(0.0f, std::max(tNear.x, std::max(tNear.y, tNear.z)));
+		float tMax = std::min(packet.tMax[i], std::min(tFar.x, std::min(tFar.y, tFar.z)));
+		if (tMin <= tMax)
+		{
+			mask |= 1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+// Finds the closest triangle hit by each active ray of the packet.
+// Hits are written to packet.hitTriangle and packet.tMax.
+// @param	bvh		BVH to trace against
+// @param	packet	Rays to trace
+// @param	anyHit	If true, a ray stops at the first hit found (enough for shadow rays)
+void TracePacket(const BVH& bvh, RayPacket& packet, bool anyHit)
+{
+	for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+	{
+		packet.hitTriangle[i] = -1;
+
+		// Keep zero direction components away from 0 so the slab test never computes 0 * inf
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float d = packet.directions[i][axis];
+			packet.invDirections[i][axis] = 1.0f / (std::abs(d) > 1e-8f ? d : (d < 0.0f ? -1e-8f : 1e-8f));
+		}
+	}
+
+	if (bvh.nodes.empty())
+	{
+		return;
+	}
+
+	int stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = bvh.nodes[stack[--stackSize]];
+		int mask = IntersectPacketBounds(packet, node);
+		if (mask == 0)
+		{
+			continue;
+		}
+
+		if (node.triangleCount == 0)
+		{
+			stack[stackSize++] = node.right;
+			stack[stackSize++] = node.left;
+			continue;
+		}
+
+		for (int t = node.firstTriangle; t < node.firstTriangle + node.triangleCount; ++t)
+		{
+			const BakeTriangle& tri = bvh.triangles[t];
+			for (int r = 0; r < RAY_PACKET_SIZE; ++r)
+			{
+				if (!(mask & (1 << r)))
+				{
+					continue;
+				}
+
+				glm::vec2 bary;
+				float distance;
+				if (glm::intersectRayTriangle(packet.origins[r], packet.directions[r], tri.v0, tri.v1, tri.v2, bary, distance)
+					&& distance > 0.0f && distance < packet.tMax[r])
+				{
+					packet.tMax[r] = distance;
+					packet.hitTriangle[r] = t;
+					if (anyHit)
+					{
+						packet.active[r] = 0;
+						mask &= ~(1 << r);
+					}
+				}
+			}
+		}
+	}
+}
+
+// --- Baking ---
+
+// A lightmap texel covered by the scene geometry
+struct BakeTexel
+{
+	int atlasIndex;
+	glm::vec3 position;
+	glm::vec3 normal;
+};
+
+// Finds the texels covered by each instance's triangles, and their world-space positions and normals
+void RasterizeLightmapTexels(const std::vector<LightmapInstance>& instances, const Lightmap& lightmap, std::vector<BakeTexel>& texels)
+{
+	std::vector<char> covered(lightmap.width * lightmap.height, 0);
+
+	for (const LightmapInstance& instance : instances)
+	{
+		const LightmapMesh& mesh = *instance.mesh;
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(instance.modelMatrix)));
+
+		for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			unsigned int idx[3] = { mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2] };
+
+			// Triangle corners in atlas texel coordinates
+			glm::vec2 uv[3];
+			for (int j = 0; j < 3; ++j)
+			{
+				glm::vec2 atlasUV = mesh.lightmapUVs[idx[j]] * glm::vec2(instance.scaleOffset) + glm::vec2(instance.scaleOffset.z, instance.scaleOffset.w);
+				uv[j] = atlasUV * glm::vec2((float)lightmap.width, (float)lightmap.height);
+			}
+
+			float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+			if (std::abs(area) < 1e-8f)
+			{
+				continue;
+			}
+
+			glm::vec2 uvMin = glm::min(uv[0], glm::min(uv[1], uv[2]));
+			glm::vec2 uvMax = glm::max(uv[0], glm::max(uv[1], uv[2]));
+			int x0 = std::max(0, (int)std::floor(uvMin.x));
+			int y0 = std::max(0, (int)std::floor(uvMin.y));
+			int x1 = std::min(lightmap.width - 1, (int)std::ceil(uvMax.x));
+			int y1 = std::min(lightmap.height - 1, (int)std::ceil(uvMax.y));
+
+			for (int y = y0; y <= y1; ++y)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					// Barycentric coordinates of the texel center
+					glm::vec2 p((float)x + 0.5f, (float)y + 0.5f);
+					float w1 = ((p.x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (p.y - uv[0].y)) / area;
+					float w2 = ((uv[1].x - uv[0].x) * (p.y - uv[0].y) - (p.x - uv[0].x) * (uv[1].y - uv[0].y)) / area;
+					float w0 = 1.0f - w1 - w2;
+					if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+					{
+						continue;
+					}
+
+					int atlasIndex = y * lightmap.width + x;
+					if (covered[atlasIndex])
+					{
+						continue;
+					}
+					covered[atlasIndex] = 1;
+
+					glm::vec3 localPos = mesh.positions[idx[0]] * w0 + mesh.positions[idx[1]] * w1 + mesh.positions[idx[2]] * w2;
+					glm::vec3 localNormal = mesh.normals[idx[0]] * w0 + mesh.normals[idx[1]] * w1 + mesh.normals[idx[2]] * w2;
+
+					BakeTexel texel;
+					texel.atlasIndex = atlasIndex;
+					texel.position = glm::vec3(instance.modelMatrix * glm::vec4(localPos, 1.0f));
+					texel.normal = glm::normalize(normalMatrix * localNormal);
+					texels.push_back(texel);
+				}
+			}
+		}
+	}
+}
+
+// Returns the i-th point of a base-2 radical inverse sequence
+float RadicalInverse(unsigned int i)
+{
+	i = (i << 16u) | (i >> 16u);
+	i = ((i & 0x55555555u) << 1u) | ((i & 0xAAAAAAAAu) >> 1u);
+	i = ((i & 0x33333333u) << 2u) | ((i & 0xCCCCCCCCu) >> 2u);
+	i = ((i & 0x0F0F0F0Fu) << 4u) | ((i & 0xF0F0F0F0u) >> 4u);
+	i = ((i & 0x00FF00FFu) << 8u) | ((i & 0xFF00FF00u) >> 8u);
+	return (float)i * 2.3283064365386963e-10f;
+}
+
+// Returns a cosine-weighted direction on the hemisphere around the normal.
+// The sample pattern is rotated per texel so that neighbouring texels don't band.
+glm::vec3 CosineSampleHemisphere(const glm::vec3& normal, int sampleIndex, int sampleCount, float rotation)
+{
+	float u = ((float)sampleIndex + 0.5f) / sampleCount;
+	float v = RadicalInverse((unsigned int)sampleIndex) + rotation;
+	v -= std::floor(v);
+
+	float r = std::sqrt(u);
+	float phi = 2.0f * glm::pi<float>() * v;
+	glm::vec3 local(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.0f, 1.0f - u)));
+
+	glm::vec3 up = std::abs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+	glm::vec3 bitangent = glm::cross(normal, tangent);
+	return tangent * local.x + bitangent * local.y + normal * local.z;
+}
+
+// Computes the light arriving directly from the point lights at up to RAY_PACKET_SIZE surface points.
+// This matches the ambient and diffuse terms of CalcPointLight in BasicLighting.fsh, with shadows.
+// @param	bvh			Scene BVH for shadow rays
+// @param	lights		Point lights to evaluate
+// @param	positions	Surface positions
+// @param	normals		Surface normals
+// @param	active		Points with a zero entry are skipped
+// @param	irradiance	Receives the light arriving at each point
+void ComputeDirectLighting(const BVH& bvh, const std::vector<PointLight>& lights,
+	const glm::vec3* positions, const glm::vec3* normals, const int* active, glm::vec3* irradiance)
+{
+	const float bias = 1e-3f;
+
+	for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+	{
+		irradiance[i] = glm::vec3(0.0f);
+	}
+
+	for (const PointLight& light : lights)
+	{
+		RayPacket shadow;
+		float attenuation[RAY_PACKET_SIZE];
+		float nDotL[RAY_PACKET_SIZE];
+
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			shadow.active[i] = 0;
+			shadow.origins[i] = positions[i];
+			shadow.directions[i] = glm::vec3(0.0f, 0.0f, 1.0f);
+			shadow.tMax[i] = 0.0f;
+			attenuation[i] = 0.0f;
+			nDotL[i] = 0.0f;
+			if (!active[i])
+			{
+				continue;
+			}
+
+			glm::vec3 toLight = light.position - positions[i];
+			float dist = glm::length(toLight);
+			attenuation[i] = 1.0f / (light.kConstant + light.kLinear * dist + light.kQuadratic * dist * dist);
+			irradiance[i] += light.ambient * attenuation[i];
+
+			if (dist > 0.0f)
+			{
+				nDotL[i] = std::max(glm::dot(normals[i], toLight / dist), 0.0f);
+			}
+			if (nDotL[i] > 0.0f)
+			{
+				shadow.active[i] = 1;
+				shadow.origins[i] = positions[i] + normals[i] * bias;
+				shadow.directions[i] = toLight / dist;
+				shadow.tMax[i] = dist - bias;
+			}
+		}
+
+		TracePacket(bvh, shadow, true);
+
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			if (nDotL[i] > 0.0f && shadow.hitTriangle[i] < 0)
+			{
+				irradiance[i] += light.diffuse * (nDotL[i] * attenuation[i]);
+			}
+		}
+	}
+}
+
+// Computes the baked lighting of a single texel: direct point lights, occluded sky ambient and one bounce
+glm::vec3 BakeTexelLighting(const BVH& bvh, const std::vector<PointLight>& lights, const LightmapBakeSettings& settings, const BakeTexel& texel)
+{
+	const float bias = 1e-3f;
+
+	glm::vec3 positions[RAY_PACKET_SIZE];
+	glm::vec3 normals[RAY_PACKET_SIZE];
+	int active[RAY_PACKET_SIZE];
+	glm::vec3 irradiance[RAY_PACKET_SIZE];
+
+	// Direct light at the texel itself
+	positions[0] = texel.position;
+	normals[0] = texel.normal;
+	active[0] = 1;
+	for (int i = 1; i < RAY_PACKET_SIZE; ++i)
+	{
+		positions[i] = texel.position;
+		normals[i] = texel.normal;
+		active[i] = 0;
+	}
+	ComputeDirectLighting(bvh, lights, positions, normals, active, irradiance);
+	glm::vec3 result = irradiance[0];
+
+	// Sky ambient and first bounce, from cosine-weighted hemisphere rays
+	int packetCount = (settings.hemisphereSamples + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+	int sampleCount = packetCount * RAY_PACKET_SIZE;
+	float rotation = RadicalInverse((unsigned int)texel.atlasIndex * 2654435761u);
+
+	glm::vec3 gathered(0.0f);
+	for (int p = 0; p < packetCount; ++p)
+	{
+		RayPacket packet;
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			packet.origins[i] = texel.position + texel.normal * bias;
+			packet.directions[i] = CosineSampleHemisphere(texel.normal, p * RAY_PACKET_SIZE + i, sampleCount, rotation);
+			packet.tMax[i] = settings.maxRayDistance;
+			packet.active[i] = 1;
+		}
+		TracePacket(bvh, packet, false);
+
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			active[i] = packet.hitTriangle[i] >= 0;
+			if (!active[i])
+			{
+				gathered += settings.skyAmbient;
+				continue;
+			}
+
+			// Light the hit point from the side the ray arrived on
+			const BakeTriangle& tri = bvh.triangles[packet.hitTriangle[i]];
+			normals[i] = glm::dot(tri.normal, packet.directions[i]) < 0.0f ? tri.normal : -tri.normal;
+			positions[i] = packet.origins[i] + packet.directions[i] * packet.tMax[i];
+		}
+
+		ComputeDirectLighting(bvh, lights, positions, normals, active, irradiance);
+		for (int i = 0; i < RAY_PACKET_SIZE; ++i)
+		{
+			if (active[i])
+			{
+				gathered += settings.bounceAlbedo * (irradiance[i] + settings.skyAmbient);
+			}
+		}
+	}
+
+	return result + gathered / (float)sampleCount;
+}
+
+// Fills uncovered texels next to covered ones with the average of their covered neighbours,
+// so that bilinear filtering at chart edges doesn't pull in black texels.
+void DilateLightmap(Lightmap& lightmap, std::vector<char>& covered, int iterations)
+{
+	for (int it = 0; it < iterations; ++it)
+	{
+		std::vector<char> nextCovered = covered;
+		for (int y = 0; y < lightmap.height; ++y)
+		{
+			for (int x = 0; x < lightmap.width; ++x)
+			{
+				int index = y * lightmap.width + x;
+				if (covered[index])
+				{
+					continue;
+				}
+
+				glm::vec3 sum(0.0f);
+				int count = 0;
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						int nx = x + dx;
+						int ny = y + dy;
+						if (nx < 0 || ny < 0 || nx >= lightmap.width || ny >= lightmap.height)
+						{
+							continue;
+						}
+
+						int neighbour = ny * lightmap.width + nx;
+						if (covered[neighbour])
+						{
+							sum += lightmap.texels[neighbour];
+							++count;
+						}
+					}
+				}
+
+				if (count > 0)
+				{
+					lightmap.texels[index] = sum / (float)count;
+					nextCovered[index] = 1;
+				}
+			}
+		}
+		covered.swap(nextCovered);
+	}
+}
+
+// Bakes the static lighting of the given instances into a lightmap atlas, using all hardware threads.
+// The instances must already have been placed in the atlas with PackLightmapAtlas.
+// @param	instances	Static instances to bake
+// @param	lights		Static point lights
+// @param	settings	Bake settings
+// @param	lightmap	Atlas to bake into
+void BakeLightmap(const std::vector<LightmapInstance>& instances, const std::vector<PointLight>& lights,
+	const LightmapBakeSettings& settings, Lightmap& lightmap)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	BVH bvh = BuildBVH(instances);
+
+	std::vector<BakeTexel> texels;
+	RasterizeLightmapTexels(instances, lightmap, texels);
+
+	int threadCount = settings.threadCount > 0 ? settings.threadCount : (int)std::thread::hardware_concurrency();
+	threadCount = std::max(1, threadCount);
+
+	// Threads take texels in small batches, so that threads that land on cheap
+	// texels (e.g. facing away from every light) help with the rest.
+	const int batchSize = 64;
+	std::atomic<int> nextTexel(0);
+	auto worker = [&]()
+	{
+		for (;;)
+		{
+			int first = nextTexel.fetch_add(batchSize);
+			if (first >= (int)texels.size())
+			{
+				break;
+			}
+
+			int last = std::min(first + batchSize, (int)texels.size());
+			for (int i = first; i < last; ++i)
+			{
+				lightmap.texels[texels[i].atlasIndex] = BakeTexelLighting(bvh, lights, settings, texels[i]);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < threadCount; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	std::vector<char> covered(lightmap.width * lightmap.height, 0);
+	for (const BakeTexel& texel : texels)
+	{
+		covered[texel.atlasIndex] = 1;
+	}
+	DilateLightmap(lightmap, covered, 2);
+
+	double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	std::cout << "Baked " << lightmap.width << "x" << lightmap.height << " lightmap (" << texels.size() << " texels, "
+		<< bvh.triangles.size() << " triangles) on " << threadCount << " threads in " << elapsedMs << " ms" << std::endl;
+}
+
+// --- Caching ---
+
+// Computes a hash of everything that affects the baked result, so that stale lightmaps are rebaked
+uint64_t HashLightmapInputs(const std::vector<LightmapInstance>& instances, const std::vector<PointLight>& lights, const LightmapBakeSettings& settings)
+{
+	// 64-bit FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	auto hashBytes = [&hash](const void* data, size_t size)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	};
+
+	for (const LightmapInstance& instance : instances)
+	{
+		const LightmapMesh& mesh = *instance.mesh;
+		hashBytes(mesh.positions.data(), mesh.positions.size() * sizeof(glm::vec3));
+		hashBytes(mesh.normals.data(), mesh.normals.size() * sizeof(glm::vec3));
+		hashBytes(mesh.lightmapUVs.data(), mesh.lightmapUVs.size() * sizeof(glm::vec2));
+		hashBytes(mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+		hashBytes(&instance.modelMatrix, sizeof(instance.modelMatrix));
+		hashBytes(&instance.castsShadows, sizeof(instance.castsShadows));
+	}
+	for (const PointLight& light : lights)
+	{
+		hashBytes(&light, sizeof(light));
+	}
+	hashBytes(&settings.tileWidth, sizeof(settings.tileWidth));
+	hashBytes(&settings.tileHeight, sizeof(settings.tileHeight));
+	hashBytes(&settings.skyAmbient, sizeof(settings.skyAmbient));
+	hashBytes(&settings.maxRayDistance, sizeof(settings.maxRayDistance));
+	hashBytes(&settings.hemisphereSamples, sizeof(settings.hemisphereSamples));
+	hashBytes(&settings.bounceAlbedo, sizeof(settings.bounceAlbedo));
+	return hash;
+}
+
+// Saves a baked lightmap to disk
+// @param	filePath	Path of the file to write
+// @param	inputHash	Hash of the bake inputs, from HashLightmapInputs
+// @param	lightmap	Lightmap to save
+// @return	Returns true if the file was successfully written
+bool SaveLightmap(const std::string& filePath, uint64_t inputHash, const Lightmap& lightmap)
+{
+	std::ofstream file(filePath, std::ios::binary);
+	if (file.fail())
+	{
+		return false;
+	}
+
+	file.write("LMAP", 4);
+	file.write((const char*)&inputHash, sizeof(inputHash));
+	file.write((const char*)&lightmap.width, sizeof(lightmap.width));
+	file.write((const char*)&lightmap.height, sizeof(lightmap.height));
+	file.write((const char*)lightmap.texels.data(), lightmap.texels.size() * sizeof(glm::vec3));
+	return !file.fail();
+}
+
+// Loads a lightmap previously saved with SaveLightmap
+// @param	filePath	Path of the file to read
+// @param	inputHash	Hash of the current bake inputs. The file is rejected if it was baked from different inputs.
+// @param	lightmap	Lightmap to load into
+// @return	Returns true if an up to date lightmap was loaded
+bool LoadLightmap(const std::string& filePath, uint64_t inputHash, Lightmap& lightmap)
+{
+	std::ifstream file(filePath, std::ios::binary);
+	if (file.fail())
+	{
+		return false;
+	}
+
+	char magic[4];
+	uint64_t fileHash;
+	int width, height;
+	file.read(magic, 4);
+	file.read((char*)&fileHash, sizeof(fileHash));
+	file.read((char*)&width, sizeof(width));
+	file.read((char*)&height, sizeof(height));
+	if (file.fail() || std::string(magic, 4) != "LMAP" || fileHash != inputHash || width != lightmap.width || height != lightmap.height)
+	{
+		return false;
+	}
+
+	file.read((char*)lightmap.texels.data(), lightmap.texels.size() * sizeof(glm::vec3));
+	return !file.fail();
+}
@@ -0,0 +1,50 @@
+// Light types shared by the lit shaders
+
+struct DirectionalLight
+{
+	vec3 direction;
+
+	vec3 diffuse;
+	vec3 specular;	
+};
+
+struct PointLight
+{
+	vec3 position;
+
+	vec3 diffuse;
+	vec3 specular;
+
+	float kConstant;
+	float kLinear;
+	float kQuadratic;
+};
+
+struct SpotLight
+{
+	vec3 position;
+	vec3 direction;
+
+	// Only read for lightmapped objects, the others get it from the light probes
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	float kConstant;
+	float kLinear;
+	float kQuadratic;
+
+	float cutOffAngle;
+};
+
+// The light counts are normally injected by the application from LightCulling.h,
+// these defaults only apply when the shader is compiled on its own.
+#ifndef MAX_POINT_LIGHTS
+#define MAX_POINT_LIGHTS 4
+#endif
+#ifndef MAX_SPOT_LIGHTS
+#define MAX_SPOT_LIGHTS 4
+#endif
+#ifndef MAX_LIGHTS_PER_OBJECT
+#define MAX_LIGHTS_PER_OBJECT 4
+#endif
@@ -5,18 +5,34 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <cstdio>
 #include <iostream>
 #include <string>
 #include <stdexcept>
 #include <vector>
 
+#include "CookedTexture.h"
+#include "DynamicResolution.h"
+#include "GLResources.h"
 #include "GLUtils.h"
+#include "LightCulling.h"
+#include "LightmapBaker.h"
+#include "LightProbes.h"
+#include "MaterialArrays.h"
+#include "MipGenerator.h"
+#include "ShaderHotReload.h"
+#include "TextureCompression.h"
+#include "TextureResidency.h"
+#include "TextureStreaming.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void SetPointLightUniforms(GLuint program, int index, const PointLight& light);
+void SetSpotLightUniforms(GLuint program, int index, const SpotLight& light);
+void SetCubeInstanceAttributes(GLuint instanceBuffer, size_t firstInstance);
 
 const unsigned int windowWidth = 640;
 const unsigned int windowHeight = 480;
@@ -28,6 +44,13 @@ float lastX = (float)windowWidth / 2.0;
 float lastY = (float)windowHeight / 2.0;
 float fov = 45.0f;
 bool normalMappingEnable = true;
+bool lightmapEnable = true;
+bool dynamicResolutionEnable = true;
+bool printTextureResidency = false;
+
+// Feature bits of the cube shader permutations
+const unsigned int CUBE_FEATURE_NORMAL_MAPPING = 1 << 0;
+const unsigned int CUBE_FEATURE_LIGHTMAP = 1 << 1;
 
 // Struct containing vertex info
 struct Vertex
@@ -46,6 +69,29 @@ struct Vertex
 
 	// Bitangent
 	float btx, bty, btz;
+
+	// Lightmap UV coordinates
+	float lu = 0.0f, lv = 0.0f;
+};
+
+static_assert(MAX_LIGHTS_PER_OBJECT == 4, "The cube instance attributes carry four light indices of each kind");
+
+// Per-instance data of a cube, read by the instance attributes of BasicLighting.vsh
+struct CubeInstance
+{
+	glm::mat4 modelMatrix;
+
+	// Scale (xy) and offset (zw) of the cube's tile in the lightmap atlas
+	glm::vec4 lightmapScaleOffset;
+
+	// Layer of the cube's material in the material texture arrays
+	int materialLayer;
+
+	// Lights that can reach the cube
+	int numPointLights;
+	int numSpotLights;
+	int pointLightIndices[MAX_LIGHTS_PER_OBJECT];
+	int spotLightIndices[MAX_LIGHTS_PER_OBJECT];
 };
 
 glm::vec3 operator-(const Vertex& lhs, const Vertex& rhs) {
@@ -88,6 +134,19 @@ int main()
 
 	// Load OpenGL extensions via GLAD
 	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+	LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
+
+	// Owns the buffers, textures and vertex arrays created below
+	GLResourceManager resources;
+	CreateGLResourceManager(resources);
+
+	// Loads textures on worker threads, so the first frame doesn't wait for them
+	TextureStreamer textureStreamer;
+	CreateTextureStreamer(textureStreamer, resources);
+
+	// Keeps the streamed textures within a GPU memory budget, dropping the mip levels that aren't needed at the size they are drawn
+	TextureResidency textureResidency;
+	CreateTextureResidency(textureResidency, (size_t)256 * 1024 * 1024);
 
 	// Vertices of the cube.
 	// Convention for each face: lower-left, lower-right, upper-right, upper-left
@@ -179,24 +238,43 @@ int main()
 		}
 	}
 
+	// Make the lightmap UVs. Each face of the cube is its own chart,
+	// and the face's UV coordinates already cover the chart.
+	std::vector<glm::vec2> cubeChartUVs;
+	std::vector<int> cubeChartIds;
+	for (int i = 0; i < 24; ++i) {
+		cubeChartUVs.push_back(glm::vec2(cubeVertices[i].u, cubeVertices[i].v));
+		cubeChartIds.push_back(i / 4);
+	}
+
+	std::vector<glm::vec2> cubeLightmapUVs;
+	int lightmapTileWidth, lightmapTileHeight;
+	GenerateLightmapUVs(cubeChartUVs, cubeChartIds, 6, 16, 2, cubeLightmapUVs, lightmapTileWidth, lightmapTileHeight);
+	for (int i = 0; i < 24; ++i) {
+		cubeVertices[i].lu = cubeLightmapUVs[i].x;
+		cubeVertices[i].lv = cubeLightmapUVs[i].y;
+	}
+
 	// Enable depth testing to handle occlusion
 	glEnable(GL_DEPTH_TEST);
 
 	// Construct VBO for the cube
-	GLuint cubeVbo;
-	glGenBuffers(1, &cubeVbo);
+	GLResourceHandle cubeVboHandle = CreateGLResource(resources, GLResourceType::Buffer);
+	GLuint cubeVbo = GetGLResourceName(resources, cubeVboHandle);
 	glBindBuffer(GL_ARRAY_BUFFER, cubeVbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+	SetGLResourceMemory(resources, cubeVboHandle, sizeof(cubeVertices));
 
 	// Construct EBO (Element Buffer Object) for the cube
-	GLuint cubeEbo;
-	glGenBuffers(1, &cubeEbo);
+	GLResourceHandle cubeEboHandle = CreateGLResource(resources, GLResourceType::Buffer);
+	GLuint cubeEbo = GetGLResourceName(resources, cubeEboHandle);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
+	SetGLResourceMemory(resources, cubeEboHandle, sizeof(cubeIndices));
 
 	// Construct VAO for the cube
-	GLuint cubeVao;
-	glGenVertexArrays(1, &cubeVao);
+	GLResourceHandle cubeVaoHandle = CreateGLResource(resources, GLResourceType::VertexArray);
+	GLuint cubeVao = GetGLResourceName(resources, cubeVaoHandle);
 	glBindVertexArray(cubeVao);
 
 	glBindBuffer(GL_ARRAY_BUFFER, cubeVbo);
@@ -222,79 +300,38 @@ int main()
 	glEnableVertexAttribArray(4);
 	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, btx));
 
-	// Create texture handle for the cube's diffuse map
-	GLuint cubeDiffuseTex;
-	glGenTextures(1, &cubeDiffuseTex);
-	
-	// Bind our diffuse texture
-	glBindTexture(GL_TEXTURE_2D, cubeDiffuseTex);
-
-	// Set up the parameters for our diffuse texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	// Read the data for our diffuse map
-	int diffuseWidth, diffuseHeight, diffuseNumChannels;
-	unsigned char* diffuseData = stbi_load("container-diffuse.png", &diffuseWidth, &diffuseHeight, &diffuseNumChannels, 0);
-
-	// Upload the diffuse map data
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, diffuseWidth, diffuseHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, diffuseData);
-
-	// Since we already uploaded the diffuse map data to opengl, we don't need it anymore.
-	stbi_image_free(diffuseData);
-	diffuseData = nullptr;
-
-	// Create texture handle for the cube's specular map
-	GLuint cubeSpecularTex;
-	glGenTextures(1, &cubeSpecularTex);
-
-	// Bind our specular texture
-	glBindTexture(GL_TEXTURE_2D, cubeSpecularTex);
-
-	// Set up the parameters for our specular texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	// Read the data for our specular map
-	int specularWidth, specularHeight, specularNumChannels;
-	unsigned char* specularData = stbi_load("container-specular.png", &specularWidth, &specularHeight, &specularNumChannels, 0);
-
-	// Upload the specular map data
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, specularWidth, specularHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, specularData);
-
-	// Since we already uploaded the specular map data to opengl, we don't need it anymore.
-	stbi_image_free(specularData);
-	specularData = nullptr;
-
-	GLuint cubeNormalTex;
-	glGenTextures(1, &cubeNormalTex);
-
-	// Bind our diffuse texture
-	glBindTexture(GL_TEXTURE_2D, cubeNormalTex);
-
-	// Set up the parameters for our diffuse texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	int normalWidth, normalHeight, normalNumChannels;
-	unsigned char* normalData = stbi_load("container-normal2.png", &normalWidth, &normalHeight, &normalNumChannels, 0);
-
-	// Upload the normal map data
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, normalWidth, normalHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, normalData);
-
-	// Since we already uploaded the normal map data to opengl, we don't need it anymore.
-	stbi_image_free(normalData);
-	normalData = nullptr;
+	// Lightmap UV coordinates attribute
+	glEnableVertexAttribArray(5);
+	glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, lu));
+
+	// Per-instance data of the cubes, refilled every frame since the light lists change
+	GLResourceHandle cubeInstanceVboHandle = CreateGLResource(resources, GLResourceType::Buffer);
+	GLuint cubeInstanceVbo = GetGLResourceName(resources, cubeInstanceVboHandle);
+	SetCubeInstanceAttributes(cubeInstanceVbo, 0);
+
+	// Materials of the cubes, streamed into texture arrays and cooked first if needed.
+	// Specular maps are grey masks, so the red channel of each is packed into the alpha of its diffuse map.
+	// Diffuse maps are sRGB, so their mips are averaged in linear space (the specular mask in alpha stays linear).
+	// They are block compressed as BC7 where the driver supports it, and otherwise as BC1, which becomes BC3 to keep the alpha.
+	// Normals are renormalized in every mip, and box filtered since ringing on normals shows up as sparkles.
+	// Only X and Y are kept (as BC5), the shader rebuilds Z from them.
+	double textureStartTime = glfwGetTime();
+	CookedTextureFormat diffuseFormat = IsBlockFormatSupported(BlockFormat::BC7) ? CookedTextureFormat::BC7 : CookedTextureFormat::BC1;
+	std::vector<Material> materials;
+	materials.push_back({ {
+		{ "container-diffuse.png", "Cooked/container-diffuse.ctex", { diffuseFormat, MipFilter::Kaiser, MipContent::SRGBColor },
+			{ { "container_specular.png", 0, 3 } } },
+		{ "container-normal2.png", "Cooked/container-normal2.ctex", { CookedTextureFormat::BC5, MipFilter::Box, MipContent::NormalMap } }
+	} });
+
+	// Until they arrive the cubes are a flat grey, have no highlights, and their normals point straight out of the faces
+	const unsigned char materialPlaceholders[MATERIAL_SLOT_COUNT][4] = { { 128, 128, 128, 0 }, { 128, 128, 255, 255 } };
+	MaterialLibrary materialLibrary;
+	CreateMaterialLibrary(materialLibrary, materials, textureStreamer, textureResidency, resources, "Cooked", materialPlaceholders);
 
 	// Construct VAO for the light source
-	GLuint lightVao;
-	glGenVertexArrays(1, &lightVao);
+	GLResourceHandle lightVaoHandle = CreateGLResource(resources, GLResourceType::VertexArray);
+	GLuint lightVao = GetGLResourceName(resources, lightVaoHandle);
 	glBindVertexArray(lightVao);
 
 	// Since the light source is also a cube, we can reuse the VBO and EBO
@@ -305,11 +342,49 @@ int main()
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
 
-	// Create shader program for the light source
-	GLuint lightProgram = CreateShaderProgram("Basic.vsh", "Basic.fsh");
+	// Linked programs are cached on disk, so only the first launch (or one after a shader or driver change) compiles them
+	double shaderStartTime = glfwGetTime();
+	ProgramBinaryCache programCache;
+	CreateProgramBinaryCache(programCache, "ShaderCache");
 
-	// Create shader program for the cube
-	GLuint cubeProgram = CreateShaderProgram("BasicLighting.vsh", "BasicLighting.fsh");
+	// Create shader program for the light source
+	GLuint lightProgram = CreateShaderProgram("Basic.vsh", "Basic.fsh", &programCache);
+
+	// Create the shader permutations for the cube.
+	// Normal mapping and lightmaps are compiled in or out instead of being branched on per fragment.
+	ShaderPermutationSet cubePermutations = CreateShaderPermutationSet("BasicLighting.vsh", "BasicLighting.fsh",
+		{ "NORMAL_MAPPING", "LIGHTMAP" }, GetLightCountDefines(), &programCache);
+
+	// Compile the plain permutation right away, since it is drawn with until the others are ready.
+	// The others are compiled in the background while the scene is already rendering.
+	PrewarmShaderPermutations(cubePermutations, { 0 });
+	ShaderCompileBatch shaderBatch;
+	CreateShaderCompileBatch(shaderBatch);
+	QueueShaderPermutations(cubePermutations, shaderBatch, { CUBE_FEATURE_NORMAL_MAPPING, CUBE_FEATURE_LIGHTMAP,
+		CUBE_FEATURE_NORMAL_MAPPING | CUBE_FEATURE_LIGHTMAP });
+
+	std::cout << "Shader programs ready in " << (glfwGetTime() - shaderStartTime) * 1000.0 << " ms ("
+		<< programCache.hits << " loaded from cache, " << programCache.misses + programCache.rejected << " compiled";
+	if (programCache.rejected > 0)
+		std::cout << ", " << programCache.rejected << " cached binaries rejected by the driver";
+	if (!programCache.enabled)
+		std::cout << ", driver cannot save program binaries";
+	std::cout << ")" << std::endl;
+	PrintGLResourceStats(resources);
+	bool shadersPending = shaderBatch.pendingCount > 0;
+	bool texturesPending = true;
+
+	// Rebuild the cube shaders when they or their includes are edited.
+	// Builds with embedded shaders never read the files, so there is nothing to watch.
+	ShaderPermutationReload cubeShaderReload;
+	ShaderFileWatcher shaderWatcher;
+	CreateShaderFileWatcher(shaderWatcher);
+#ifndef EMBED_SHADERS
+	for (const std::string& path : cubePermutations.dependencies)
+	{
+		WatchShaderFile(shaderWatcher, path);
+	}
+#endif
 
 	// Construct the projection matrix
 	glm::mat4 projMatrix = glm::perspective(glm::radians(45.0f), windowWidth * 1.0f / windowHeight, 0.1f, 100.0f);
@@ -323,6 +398,26 @@ int main()
 
 	// Light-related parameters
 	glm::vec3 spotLightPosition(0.0f, 0.0f, 0.0f);
+	glm::vec3 dirLightAmbient(0.05f, 0.05f, 0.05f);
+
+	// Point lights in the scene
+	std::vector<PointLight> pointLights;
+	pointLights.push_back({
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(0.01f, 0.01f, 0.01f), glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f),
+		1.0f, 0.09f, 0.032f
+	});
+
+	// Spot lights in the scene.
+	// The first spot light follows the camera to emulate a flash light, its position
+	// and direction are updated every frame.
+	std::vector<SpotLight> spotLights;
+	spotLights.push_back({
+		glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+		glm::vec3(0.1f, 0.1f, 0.1f), glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, 1.0f, 1.0f),
+		1.0f, 0.09f, 0.032f,
+		glm::radians(12.5f)
+	});
 
 	// Cube positions
 	std::vector<glm::vec3> cubePositions;
@@ -336,13 +431,169 @@ int main()
 	cubePositions.push_back(glm::vec3(1.5f, 2.0f, -2.5f));
 	cubePositions.push_back(glm::vec3(1.5f, 0.2f, -1.5f));
 	cubePositions.push_back(glm::vec3(-1.3f, 1.0f, -1.5f));
+
+	// Bounding spheres of the cubes for light culling.
+	// The cube mesh spans [-1, 1] on each axis and is scaled by 0.5 when drawn.
+	ObjectBounds cubeBounds;
+	for (size_t i = 0; i < cubePositions.size(); ++i)
+	{
+		AddObjectBounds(cubeBounds, cubePositions[i], 0.5f * glm::sqrt(3.0f));
+	}
+	std::vector<LightList> cubeLightLists;
+
+	// Material of each cube
+	std::vector<int> cubeMaterials(cubePositions.size(), 0);
+
+	// Cubes in drawing order, grouped by material batch so each batch is one instanced draw
+	std::vector<int> cubeDrawOrder;
+	std::vector<size_t> batchFirstInstances;
+	for (size_t b = 0; b < materialLibrary.batches.size(); ++b)
+	{
+		batchFirstInstances.push_back(cubeDrawOrder.size());
+		for (size_t i = 0; i < cubePositions.size(); ++i)
+		{
+			if (materialLibrary.materialBatches[cubeMaterials[i]] == (int)b)
+			{
+				cubeDrawOrder.push_back((int)i);
+			}
+		}
+	}
+	batchFirstInstances.push_back(cubeDrawOrder.size());
+	std::vector<CubeInstance> cubeInstances(cubeDrawOrder.size());
+
+	// The cubes never move, so their model matrices are computed once
+	std::vector<glm::mat4> cubeModelMatrices;
+	for (size_t i = 0; i < cubePositions.size(); ++i)
+	{
+		glm::mat4 modelMatrix = glm::mat4(1.0f);
+		modelMatrix = glm::translate(modelMatrix, cubePositions[i]);
+
+		float angle = 20.0f * i;
+		modelMatrix = glm::rotate(modelMatrix, glm::radians(angle), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
+		modelMatrix = glm::scale(modelMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
+		cubeModelMatrices.push_back(modelMatrix);
+	}
+
+	// --- Bake the static lighting of the cubes ---
+
+	LightmapMesh cubeLightmapMesh;
+	for (int i = 0; i < 24; ++i)
+	{
+		cubeLightmapMesh.positions.push_back(glm::vec3(cubeVertices[i].x, cubeVertices[i].y, cubeVertices[i].z));
+		cubeLightmapMesh.normals.push_back(glm::vec3(cubeVertices[i].nx, cubeVertices[i].ny, cubeVertices[i].nz));
+		cubeLightmapMesh.lightmapUVs.push_back(glm::vec2(cubeVertices[i].lu, cubeVertices[i].lv));
+	}
+	cubeLightmapMesh.indices.assign(cubeIndices, cubeIndices + 36);
+
+	std::vector<LightmapInstance> cubeLightmapInstances;
+	for (size_t i = 0; i < cubePositions.size(); ++i)
+	{
+		// The point light sits inside the first cube, so that cube can't be allowed
+		// to block it or the rest of the scene would be left in its shadow.
+		bool castsShadows = glm::distance(cubePositions[i], pointLights[0].position) > 0.5f * glm::sqrt(3.0f);
+		cubeLightmapInstances.push_back({ &cubeLightmapMesh, cubeModelMatrices[i], castsShadows, glm::vec4(0.0f) });
+	}
+
+	LightmapBakeSettings lightmapSettings;
+	lightmapSettings.tileWidth = lightmapTileWidth;
+	lightmapSettings.tileHeight = lightmapTileHeight;
+	lightmapSettings.skyAmbient = dirLightAmbient;
+	lightmapSettings.bounceAlbedo = glm::vec3(0.317f, 0.226f, 0.153f); // average color of container-diffuse.png
+
+	Lightmap cubeLightmap;
+	PackLightmapAtlas(cubeLightmapInstances, lightmapSettings, cubeLightmap);
+
+	// The bake is only redone when the scene or the settings change
+	uint64_t lightmapHash = HashLightmapInputs(cubeLightmapInstances, pointLights, lightmapSettings);
+	if (!LoadLightmap("Lightmap.bin", lightmapHash, cubeLightmap))
+	{
+		BakeLightmap(cubeLightmapInstances, pointLights, lightmapSettings, cubeLightmap);
+		if (!SaveLightmap("Lightmap.bin", lightmapHash, cubeLightmap))
+		{
+			std::cout << "Failed to save lightmap file Lightmap.bin" << std::endl;
+		}
+	}
+
+	// Upload the lightmap. It holds unclamped irradiance, so it needs a floating point format.
+	GLResourceHandle cubeLightmapTexHandle = CreateGLResource(resources, GLResourceType::Texture);
+	GLuint cubeLightmapTex = GetGLResourceName(resources, cubeLightmapTexHandle);
+	glBindTexture(GL_TEXTURE_2D, cubeLightmapTex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, cubeLightmap.width, cubeLightmap.height, 0, GL_RGB, GL_FLOAT, cubeLightmap.texels.data());
+	SetGLResourceMemory(resources, cubeLightmapTexHandle, EstimateTextureMemory(cubeLightmap.width, cubeLightmap.height, 6, false));
+
+	// --- Set up the light probes for objects that aren't lightmapped ---
+
+	// Probes see the same static geometry as the lightmap baker
+	BVH sceneBvh = BuildBVH(cubeLightmapInstances);
+
+	// Cover every cube with a margin of one probe spacing
+	glm::vec3 probeMin = cubePositions[0];
+	glm::vec3 probeMax = cubePositions[0];
+	for (size_t i = 1; i < cubePositions.size(); ++i)
+	{
+		probeMin = glm::min(probeMin, cubePositions[i]);
+		probeMax = glm::max(probeMax, cubePositions[i]);
+	}
+	probeMin -= glm::vec3(1.5f);
+	probeMax += glm::vec3(1.5f);
+
+	ProbeLightingInputs probeInputs;
+	probeInputs.bvh = &sceneBvh;
+	probeInputs.pointLights = pointLights;
+	probeInputs.spotLights = spotLights;
+	probeInputs.skyAmbient = dirLightAmbient;
+	probeInputs.bounceAlbedo = lightmapSettings.bounceAlbedo;
+	probeInputs.maxRayDistance = lightmapSettings.maxRayDistance;
+	probeInputs.sampleCount = 64;
+
+	ProbeVolume probeVolume;
+	CreateProbeVolume(probeVolume, probeMin, probeMax, glm::ivec3(6, 6, 12));
+	BakeProbeVolume(probeVolume, probeInputs);
 	// */
+
+	// Render the scene offscreen at a scale that keeps the GPU frame time near 60 fps,
+	// and upscale it to the window afterwards
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	DynamicResolution dynamicResolution;
+	CreateDynamicResolution(dynamicResolution, framebufferWidth, framebufferHeight, 1000.0f / 60.0f, 0.5f, 1.0f);
+
+	// Frame statistics, shown in the window title
+	double statsTime = glfwGetTime();
+	int statsFrames = 0;
+	int statsEvictions = 0;
+	int statsMisses = 0;
+
 	double prevTime = glfwGetTime();
 	while (!glfwWindowShouldClose(window)) {
 		// Calculate amount of time passed since the last frame
 		float deltaTime = glfwGetTime() - prevTime;
 		prevTime = glfwGetTime();
 
+		// Update the stats in the window title twice per second
+		++statsFrames;
+		if (prevTime - statsTime >= 0.5)
+		{
+			char title[192];
+			std::snprintf(title, sizeof(title), "Basic Lighting | %.1f fps | GPU %.2f ms | scale %.2f (%dx%d) | textures %.1f MiB, %d evictions, %d misses",
+				statsFrames / (prevTime - statsTime), dynamicResolution.smoothedMs, dynamicResolution.scale,
+				GetRenderWidth(dynamicResolution), GetRenderHeight(dynamicResolution),
+				textureResidency.residentBytes / (1024.0 * 1024.0), statsEvictions, statsMisses);
+			glfwSetWindowTitle(window, title);
+			statsTime = prevTime;
+			statsFrames = 0;
+			statsEvictions = 0;
+			statsMisses = 0;
+		}
+
+		// Raising the minimum scale to full resolution turns the controller off
+		dynamicResolution.minScale = dynamicResolutionEnable ? 0.5f : 1.0f;
+		BeginDynamicResolutionFrame(dynamicResolution);
+
 		if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(window, true);
 
@@ -355,8 +606,60 @@ int main()
 		// Bind the vao of the cube
 		glBindVertexArray(cubeVao);
 
-		// Use the shader for the cube
+		// Advance the shader programs that are still building
+		PollShaderCompileBatch(shaderBatch);
+		if (shadersPending && shaderBatch.pendingCount == 0)
+		{
+			std::cout << "Background shader compiles finished " << (glfwGetTime() - shaderStartTime) * 1000.0 << " ms after startup" << std::endl;
+			shadersPending = false;
+		}
+
+		// Upload the textures that finished loading, a few mip levels per frame
+		if (UpdateTextureStreamer(textureStreamer, resources) == 0 && texturesPending)
+		{
+			std::cout << "Textures streamed in " << (glfwGetTime() - textureStartTime) * 1000.0 << " ms after startup" << std::endl;
+			texturesPending = false;
+		}
+
+		// Fit the textures drawn last frame in the budget, and stream back the levels they were missing
+		TextureResidencyStats residencyStats = UpdateTextureResidency(textureResidency, textureStreamer, resources);
+		statsEvictions += residencyStats.evictions;
+		statsMisses += residencyStats.misses;
+		if (printTextureResidency)
+		{
+			PrintTextureResidencyStats(textureResidency);
+			printTextureResidency = false;
+		}
+
+		// Start rebuilding the cube shaders if any of their files changed, and swap in the rebuilt programs that are ready
+		std::vector<std::string> changedShaderFiles = PollShaderFileWatcher(shaderWatcher);
+		for (const std::string& path : changedShaderFiles)
+		{
+			InvalidateShaderFile(shaderSourceCache, path);
+		}
+		if (!changedShaderFiles.empty() && ReloadShaderPermutations(cubePermutations, cubeShaderReload, shaderBatch))
+		{
+			// Edits can add new includes
+			for (const std::string& path : cubePermutations.dependencies)
+			{
+				WatchShaderFile(shaderWatcher, path);
+			}
+		}
+		UpdateShaderPermutationReload(cubePermutations, cubeShaderReload, shaderBatch);
+
+		// Use the shader permutation for the currently enabled cube features,
+		// or the plain one while that permutation is still compiling
+		unsigned int cubeFeatures = (normalMappingEnable ? CUBE_FEATURE_NORMAL_MAPPING : 0)
+			| (lightmapEnable ? CUBE_FEATURE_LIGHTMAP : 0);
+		GLuint cubeProgram = GetReadyShaderPermutation(cubePermutations, shaderBatch, cubeFeatures, 0, cubeFeatures);
 		glUseProgram(cubeProgram);
+		bool cubeUsesLightmap = (cubeFeatures & CUBE_FEATURE_LIGHTMAP) != 0;
+
+		// Objects without a lightmap get their ambient lighting from the light probes
+		if (!cubeUsesLightmap)
+		{
+			BindProbeVolume(probeVolume, cubeProgram, 4);
+		}
 
 		/*
 		// Handle camera look input (up/down)
@@ -415,35 +718,32 @@ int main()
 		// Pass directional light parameters to the shader
 		// glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.direction"), 1, glm::value_ptr(glm::vec3(0.0f, -1.0f, 0.0f)));
 		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.direction"), 1, glm::value_ptr(lookDir));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.ambient"), 1, glm::value_ptr(glm::vec3(0.05f, 0.05f, 0.05f)));
 		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.diffuse"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
 		glUniform3fv(glGetUniformLocation(cubeProgram, "dirLight.specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
 
 		// Pass point light parameters to the shader
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.position"), 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, 0.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.ambient"), 1, glm::value_ptr(glm::vec3(0.01f, 0.01f, 0.01f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.diffuse"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "pointLight.specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform1f(glGetUniformLocation(cubeProgram, "pointLight.kConstant"), 1.0f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "pointLight.kLinear"), 0.09f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "pointLight.kQuadratic"), 0.032f);
+		for (int i = 0; i < (int)pointLights.size(); ++i)
+		{
+			SetPointLightUniforms(cubeProgram, i, pointLights[i]);
+		}
 
 		// Pass spot light parameters to the shader
 		// We pass the camera position and direction as the spot light position and direction respectively
 		// to emulate a flash light
-		glm::vec3 temp(0.0f, 0.0f, 0.0f);
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.position"), 1, glm::value_ptr(eyePosition));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.direction"), 1, glm::value_ptr(lookDir));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.ambient"), 1, glm::value_ptr(glm::vec3(0.1f, 0.1f, 0.1f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.diffuse"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.specular"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 1.0f)));
-		// glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.ambient"), 1, glm::value_ptr(temp));
-		// glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.diffuse"), 1, glm::value_ptr(temp));
-		// glUniform3fv(glGetUniformLocation(cubeProgram, "spotLight.specular"), 1, glm::value_ptr(temp));
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.kConstant"), 1.0f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.kLinear"), 0.09f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.kQuadratic"), 0.032f);
-		glUniform1f(glGetUniformLocation(cubeProgram, "spotLight.cutOffAngle"), glm::radians(12.5f));
+		spotLights[0].position = eyePosition;
+		spotLights[0].direction = lookDir;
+		for (int i = 0; i < (int)spotLights.size(); ++i)
+		{
+			SetSpotLightUniforms(cubeProgram, i, spotLights[i]);
+		}
+		glUniform1i(glGetUniformLocation(cubeProgram, "numSpotLights"), (int)spotLights.size());
+
+		// Find the lights that can reach each cube
+		CullLights(pointLights, spotLights, cubeBounds, kLightCutoffThreshold, cubeLightLists);
+
+		// Keep the light probes following the flash light, a few probes per frame
+		probeInputs.spotLights = spotLights;
+		UpdateProbeVolume(probeVolume, probeInputs, 64);
 
 		// Pass the projection matrix to the shader
 		glUniformMatrix4fv(glGetUniformLocation(cubeProgram, "projMatrix"), 1, GL_FALSE, glm::value_ptr(projMatrix));
@@ -452,43 +752,59 @@ int main()
 		glm::mat4 viewMatrix = glm::lookAt(eyePosition, eyePosition + lookDir, glm::vec3(0.0f, 1.0f, 0.0f));
 		glUniformMatrix4fv(glGetUniformLocation(cubeProgram, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
 
-		// Render the cubes
-		for (int i = 0; i < cubePositions.size(); ++i)
+		// Fill in the per-instance data of the cubes
+		for (size_t i = 0; i < cubeDrawOrder.size(); ++i)
 		{
-			glm::mat4 modelMatrix = glm::mat4(1.0f);
-			modelMatrix = glm::translate(modelMatrix, cubePositions[i]);
-
-			float angle = 20.0f * i;
-			modelMatrix = glm::rotate(modelMatrix, glm::radians(angle), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)));
-			modelMatrix = glm::scale(modelMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
-
-			// Set the active texture unit to 0, and
-			// bind the diffuse map texture to it
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, cubeDiffuseTex);
+			int cube = cubeDrawOrder[i];
+			const LightList& lightList = cubeLightLists[cube];
+			CubeInstance& instance = cubeInstances[i];
+			instance.modelMatrix = cubeModelMatrices[cube];
+			instance.lightmapScaleOffset = cubeLightmapInstances[cube].scaleOffset;
+			instance.materialLayer = materialLibrary.materialLayers[cubeMaterials[cube]];
+			instance.numPointLights = lightList.numPointLights;
+			instance.numSpotLights = lightList.numSpotLights;
+			std::copy(lightList.pointLightIndices, lightList.pointLightIndices + MAX_LIGHTS_PER_OBJECT, instance.pointLightIndices);
+			std::copy(lightList.spotLightIndices, lightList.spotLightIndices + MAX_LIGHTS_PER_OBJECT, instance.spotLightIndices);
+		}
 
-			// Set the active texture unit to 1, and
-			// bind the specular map texture to it
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, cubeSpecularTex);
+		// Orphan the instance buffer, so the upload doesn't wait for last frame's draws
+		glBindBuffer(GL_ARRAY_BUFFER, cubeInstanceVbo);
+		glBufferData(GL_ARRAY_BUFFER, cubeInstances.size() * sizeof(CubeInstance), cubeInstances.data(), GL_STREAM_DRAW);
+		SetGLResourceMemory(resources, cubeInstanceVboHandle, cubeInstances.size() * sizeof(CubeInstance));
 
-			// Set the active texture unit to 2, and
-			// bind the specular map texture to it
+		// The material arrays are on texture units 0 and 1, and the lightmap on unit 2
+		glUniform1i(glGetUniformLocation(cubeProgram, "diffuseTex"), 0);
+		glUniform1i(glGetUniformLocation(cubeProgram, "normalTex"), 1);
+		if (cubeUsesLightmap)
+		{
 			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, cubeNormalTex);
-
-			// Tell the shader that the diffuse map texture is texture unit 0
-			glUniform1i(glGetUniformLocation(cubeProgram, "diffuseTex"), 0);
-
-			// Tell the shader that the specular map texture is texture unit 1
-			glUniform1i(glGetUniformLocation(cubeProgram, "specularTex"), 1);
-
-			glUniform1i(glGetUniformLocation(cubeProgram, "normalTex"), 2);
+			glBindTexture(GL_TEXTURE_2D, cubeLightmapTex);
+			glUniform1i(glGetUniformLocation(cubeProgram, "lightmapTex"), 2);
+		}
 
-			glUniform1i(glGetUniformLocation(cubeProgram, "normalMappingEnable"), (normalMappingEnable ? 1 : 0));
-			
-			glUniformMatrix4fv(glGetUniformLocation(cubeProgram, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
-			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		// Render the cubes, one instanced draw per material batch
+		for (size_t b = 0; b < materialLibrary.batches.size(); ++b)
+		{
+			GLsizei instanceCount = (GLsizei)(batchFirstInstances[b + 1] - batchFirstInstances[b]);
+			if (instanceCount == 0)
+			{
+				continue;
+			}
+
+			BindMaterialBatch(materialLibrary, resources, (int)b, GL_TEXTURE0);
+
+			// Each face of a cube is one unit across and shows a whole texture, so the nearest cube decides the mip level needed
+			float projectedPixels = 0.0f;
+			for (size_t i = batchFirstInstances[b]; i < batchFirstInstances[b + 1]; ++i)
+			{
+				float distance = glm::length(cubePositions[cubeDrawOrder[i]] - eyePosition) - 0.5f * glm::sqrt(3.0f);
+				projectedPixels = glm::max(projectedPixels, EstimateProjectedPixels(1.0f, distance, glm::radians(45.0f), GetRenderHeight(dynamicResolution)));
+			}
+			UseMaterialBatch(materialLibrary, textureResidency, (int)b, projectedPixels);
+
+			// GL 3.3 has no base instance, so the instance attributes are pointed at the batch's range instead
+			SetCubeInstanceAttributes(cubeInstanceVbo, batchFirstInstances[b]);
+			glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, instanceCount);
 		}
 
 		/*
@@ -521,6 +837,12 @@ int main()
 		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
 		*/
 
+		// Upscale the scene to the window
+		EndDynamicResolutionFrame(dynamicResolution);
+
+		// Delete the objects the GPU is done with, and top up the pools of object names
+		EndGLResourceFrame(resources);
+
 		// Swap the front and back buffers
 		glfwSwapBuffers(window);
 
@@ -528,6 +850,15 @@ int main()
 		glfwPollEvents();
 	}
 
+	// Let the light probe worker finish before its GL context goes away
+	DeleteProbeVolume(probeVolume);
+	DeleteDynamicResolution(dynamicResolution);
+	DeleteShaderFileWatcher(shaderWatcher);
+	DeleteTextureResidency(textureResidency);
+	DeleteTextureStreamer(textureStreamer, resources);
+	DeleteMaterialLibrary(materialLibrary, resources);
+	DeleteGLResourceManager(resources);
+
 	// Terminate GLFW
 	glfwTerminate();
 
@@ -571,6 +902,80 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 // https://www.glfw.org/docs/3.3.2/input_guide.html
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
+	// Toggling normal mapping switches the cube to a different shader permutation on the next frame
 	if (key == GLFW_KEY_SPACE && action == GLFW_PRESS)
 		normalMappingEnable = !normalMappingEnable;
+	if (key == GLFW_KEY_L && action == GLFW_PRESS)
+		lightmapEnable = !lightmapEnable;
+	if (key == GLFW_KEY_R && action == GLFW_PRESS)
+		dynamicResolutionEnable = !dynamicResolutionEnable;
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		printTextureResidency = true;
+}
+
+// Passes the parameters of a point light to the pointLights array of the given shader program
+void SetPointLightUniforms(GLuint program, int index, const PointLight& light)
+{
+	std::string prefix = "pointLights[" + std::to_string(index) + "].";
+	glUniform3fv(glGetUniformLocation(program, (prefix + "position").c_str()), 1, glm::value_ptr(light.position));
+	glUniform3fv(glGetUniformLocation(program, (prefix + "diffuse").c_str()), 1, glm::value_ptr(light.diffuse));
+	glUniform3fv(glGetUniformLocation(program, (prefix + "specular").c_str()), 1, glm::value_ptr(light.specular));
+	glUniform1f(glGetUniformLocation(program, (prefix + "kConstant").c_str()), light.kConstant);
+	glUniform1f(glGetUniformLocation(program, (prefix + "kLinear").c_str()), light.kLinear);
+	glUniform1f(glGetUniformLocation(program, (prefix + "kQuadratic").c_str()), light.kQuadratic);
+}
+
+// Passes the parameters of a spot light to the spotLights array of the given shader program
+void SetSpotLightUniforms(GLuint program, int index, const SpotLight& light)
+{
+	std::string prefix = "spotLights[" + std::to_string(index) + "].";
+	glUniform3fv(glGetUniformLocation(program, (prefix + "position").c_str()), 1, glm::value_ptr(light.position));
+	glUniform3fv(glGetUniformLocation(program, (prefix + "direction").c_str()), 1, glm::value_ptr(light.direction));
+	glUniform3fv(glGetUniformLocation(program, (prefix + "ambient").c_str()), 1, glm::value_ptr(light.ambient));
+	glUniform3fv(glGetUniformLocation(program, (prefix + "diffuse").c_str()), 1, glm::value_ptr(light.diffuse));
+	glUniform3fv(glGetUniformLocation(program, (prefix + "specular").c_str()), 1, glm::value_ptr(light.specular));
+	glUniform1f(glGetUniformLocation(program, (prefix + "kConstant").c_str()), light.kConstant);
+	glUniform1f(glGetUniformLocation(program, (prefix + "kLinear").c_str()), light.kLinear);
+	glUniform1f(glGetUniformLocation(program, (prefix + "kQuadratic").c_str()), light.kQuadratic);
+	glUniform1f(glGetUniformLocation(program, (prefix + "cutOffAngle").c_str()), light.cutOffAngle);
+}
+
+// Points the cube instance attributes (locations 6 to 14) at a range of the instance buffer.
+// The cube VAO must be bound.
+// @param	instanceBuffer	Buffer of CubeInstance structs
+// @param	firstInstance	Instance to start from
+void SetCubeInstanceAttributes(GLuint instanceBuffer, size_t firstInstance)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	size_t base = firstInstance * sizeof(CubeInstance);
+
+	// A mat4 attribute takes four locations, one per column
+	for (int column = 0; column < 4; ++column)
+	{
+		glEnableVertexAttribArray(6 + column);
+		glVertexAttribPointer(6 + column, 4, GL_FLOAT, GL_FALSE, sizeof(CubeInstance),
+			(void*)(base + offsetof(CubeInstance, modelMatrix) + column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(6 + column, 1);
+	}
+
+	glEnableVertexAttribArray(10);
+	glVertexAttribPointer(10, 4, GL_FLOAT, GL_FALSE, sizeof(CubeInstance), (void*)(base + offsetof(CubeInstance, lightmapScaleOffset)));
+	glVertexAttribDivisor(10, 1);
+
+	// Integer attributes go through glVertexAttribIPointer, so they aren't converted to float
+	glEnableVertexAttribArray(11);
+	glVertexAttribIPointer(11, 1, GL_INT, sizeof(CubeInstance), (void*)(base + offsetof(CubeInstance, materialLayer)));
+	glVertexAttribDivisor(11, 1);
+
+	glEnableVertexAttribArray(12);
+	glVertexAttribIPointer(12, 2, GL_INT, sizeof(CubeInstance), (void*)(base + offsetof(CubeInstance, numPointLights)));
+	glVertexAttribDivisor(12, 1);
+
+	glEnableVertexAttribArray(13);
+	glVertexAttribIPointer(13, 4, GL_INT, sizeof(CubeInstance), (void*)(base + offsetof(CubeInstance, pointLightIndices)));
+	glVertexAttribDivisor(13, 1);
+
+	glEnableVertexAttribArray(14);
+	glVertexAttribIPointer(14, 4, GL_INT, sizeof(CubeInstance), (void*)(base + offsetof(CubeInstance, spotLightIndices)));
+	glVertexAttribDivisor(14, 1);
 }
\ No newline at end of file
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+
+#include "CookedTexture.h"
+#include "GLResources.h"
+#include "TextureResidency.h"
+#include "TextureStreaming.h"
+#include "stb_image.h"
+
+// Materials are drawn from texture arrays, so that objects with different materials can share one instanced draw.
+// Materials whose textures match in format and size are grouped into a batch. Each slot (diffuse, normal)
+// of a batch is one GL_TEXTURE_2D_ARRAY with a layer per material, so a material is just a layer index.
+
+// The specular mask is packed into the alpha of the diffuse map, so a material is sampled with two fetches
+const int MATERIAL_SLOT_COUNT = 2;
+
+const char* materialSlotNames[MATERIAL_SLOT_COUNT] = { "diffuse", "normal" };
+
+// Textures of a material, in the order of materialSlotNames
+struct Material
+{
+	CookedTextureSource textures[MATERIAL_SLOT_COUNT];
+};
+
+// Format and size a texture has once cooked. Textures with the same key can be layers of one array.
+struct TextureArrayKey
+{
+	CookedTextureFormat format;
+	int width;
+	int height;
+};
+
+// Materials whose textures share texture arrays
+struct MaterialBatch
+{
+	// One array per slot
+	GLResourceHandle arrays[MATERIAL_SLOT_COUNT];
+
+	// Materials in the batch. The layer of materials[i] is i in every array.
+	std::vector<int> materials;
+};
+
+struct MaterialLibrary
+{
+	std::vector<MaterialBatch> batches;
+
+	// Batch and layer of each material
+	std::vector<int> materialBatches;
+	std::vector<int> materialLayers;
+};
+
+// Finds the format and size a texture has once cooked, without decoding or cooking it
+// @param	source	Texture to look at
+// @param	key		Receives the format and size
+// @return	Returns false if neither the source image nor the cooked texture can be read
+bool GetTextureArrayKey(const CookedTextureSource& source, TextureArrayKey& key)
+{
+	// Only the header of the image is read
+	int channelCount;
+	if (stbi_info(source.sourcePath.c_str(), &key.width, &key.height, &channelCount))
+	{
+		key.format = InferCookedTextureFormat(source.settings.format, GetCookedChannelCount(channelCount, source));
+		return true;
+	}
+
+	CookedTexture cooked;
+	if (OpenCookedTexture(source.cookedPath, cooked))
+	{
+		key.format = cooked.header->format;
+		key.width = (int)cooked.header->width;
+		key.height = (int)cooked.header->height;
+		CloseCookedTexture(cooked);
+		return true;
+	}
+	return false;
+}
+
+bool IsSameTextureArrayKey(const TextureArrayKey& a, const TextureArrayKey& b)
+{
+	return a.format == b.format && a.width == b.width && a.height == b.height;
+}
+
+// Groups materials into batches whose textures can share arrays, slot by slot.
+// This only reads image headers, so it is cheap enough to run at startup.
+// @param	materials	Materials to group
+// @param	library		Receives the batches and the batch and layer of each material. The arrays are not created.
+void GroupMaterials(const std::vector<Material>& materials, MaterialLibrary& library)
+{
+	library.batches.clear();
+	library.materialBatches.assign(materials.size(), -1);
+	library.materialLayers.assign(materials.size(), 0);
+
+	// Keys of the first material of each batch
+	std::vector<std::vector<TextureArrayKey>> batchKeys;
+	for (size_t i = 0; i < materials.size(); ++i)
+	{
+		std::vector<TextureArrayKey> keys(MATERIAL_SLOT_COUNT);
+		bool known = true;
+		for (int slot = 0; slot < MATERIAL_SLOT_COUNT; ++slot)
+		{
+			known = GetTextureArrayKey(materials[i].textures[slot], keys[slot]) && known;
+		}
+
+		// A material whose size can't be found gets a batch of its own, where loading it will report the problem
+		int batch = -1;
+		for (size_t b = 0; known && b < batchKeys.size() && batch < 0; ++b)
+		{
+			bool same = !batchKeys[b].empty();
+			for (int slot = 0; same && slot < MATERIAL_SLOT_COUNT; ++slot)
+			{
+				same = IsSameTextureArrayKey(keys[slot], batchKeys[b][slot]);
+			}
+			batch = same ? (int)b : -1;
+		}
+		if (batch < 0)
+		{
+			batch = (int)library.batches.size();
+			library.batches.push_back({});
+			batchKeys.push_back(known ? keys : std::vector<TextureArrayKey>());
+		}
+
+		library.materialBatches[i] = batch;
+		library.materialLayers[i] = (int)library.batches[batch].materials.size();
+		library.batches[batch].materials.push_back((int)i);
+	}
+}
+
+// Groups materials into batches and starts streaming their texture arrays in
+// @param	library			Library to create
+// @param	materials		Materials to load
+// @param	streamer		Streamer to load the arrays with
+// @param	residency		Residency manager to keep the arrays within its budget
+// @param	resources		Manager to create the arrays with
+// @param	arrayDirectory	Directory to pack the cooked texture arrays into
+// @param	placeholders	RGBA8 colour of each slot until its array is loaded
+void CreateMaterialLibrary(MaterialLibrary& library, const std::vector<Material>& materials, TextureStreamer& streamer,
+	TextureResidency& residency, GLResourceManager& resources, const std::string& arrayDirectory,
+	const unsigned char placeholders[MATERIAL_SLOT_COUNT][4])
+{
+	GroupMaterials(materials, library);
+
+	for (size_t b = 0; b < library.batches.size(); ++b)
+	{
+		MaterialBatch& batch = library.batches[b];
+		for (int slot = 0; slot < MATERIAL_SLOT_COUNT; ++slot)
+		{
+			std::vector<CookedTextureSource> layers;
+			for (int material : batch.materials)
+			{
+				layers.push_back(materials[material].textures[slot]);
+			}
+
+			batch.arrays[slot] = CreateGLResource(resources, GLResourceType::Texture);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, GetGLResourceName(resources, batch.arrays[slot]));
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+			std::string arrayPath = arrayDirectory + "/MaterialBatch" + std::to_string(b) + "-" + materialSlotNames[slot] + ".ctex";
+			StreamTextureArray(streamer, resources, batch.arrays[slot], layers, arrayPath, placeholders[slot]);
+			TrackTextureResidency(residency, batch.arrays[slot], GL_TEXTURE_2D_ARRAY, layers, arrayPath);
+		}
+	}
+}
+
+// Binds the texture arrays of a batch to consecutive texture units, one per slot
+// @param	library		Library the batch belongs to
+// @param	resources	Manager that owns the arrays
+// @param	batch		Index of the batch
+// @param	firstUnit	Texture unit of the first slot, e.g. GL_TEXTURE0
+void BindMaterialBatch(const MaterialLibrary& library, GLResourceManager& resources, int batch, GLenum firstUnit)
+{
+	for (int slot = 0; slot < MATERIAL_SLOT_COUNT; ++slot)
+	{
+		glActiveTexture(firstUnit + slot);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, GetGLResourceName(resources, library.batches[batch].arrays[slot]));
+	}
+}
+
+// Records that a batch is drawn with this frame, so its arrays keep the mip levels they need
+// @param	library			Library the batch belongs to
+// @param	residency		Residency manager tracking the arrays
+// @param	batch			Index of the batch
+// @param	projectedPixels	Largest size a material of the batch appears at on screen, in pixels along the longer side of its textures
+void UseMaterialBatch(const MaterialLibrary& library, TextureResidency& residency, int batch, float projectedPixels)
+{
+	for (int slot = 0; slot < MATERIAL_SLOT_COUNT; ++slot)
+	{
+		UseResidentTexture(residency, library.batches[batch].arrays[slot], projectedPixels);
+	}
+}
+
+void DeleteMaterialLibrary(MaterialLibrary& library, GLResourceManager& resources)
+{
+	for (MaterialBatch& batch : library.batches)
+	{
+		for (int slot = 0; slot < MATERIAL_SLOT_COUNT; ++slot)
+		{
+			DestroyGLResource(resources, batch.arrays[slot]);
+		}
+	}
+	library = {};
+}
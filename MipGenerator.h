@@ -0,0 +1,394 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIP_GENERATOR_AVX2
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE2
+#endif
+
+// Downsampling filters for mip generation
+enum class MipFilter
+{
+	// Averages 2x2 texels. Cheapest, but slightly blurry and prone to aliasing.
+	Box,
+
+	// Kaiser-windowed sinc, radius 3. Sharp with little ringing.
+	Kaiser,
+
+	// Lanczos-3 windowed sinc. Sharpest, with some ringing on hard edges.
+	Lanczos
+};
+
+// What the texels of a texture hold, which decides how they are filtered
+enum class MipContent
+{
+	// Values are filtered as they are (e.g. specular masks)
+	Linear,
+
+	// RGB is sRGB-encoded, so it is filtered in linear space and re-encoded. Alpha is linear.
+	SRGBColor,
+
+	// RGB holds a unit vector mapped to [0, 1], which is renormalized after filtering
+	NormalMap
+};
+
+// One level of a mip chain, as RGBA8 texels
+struct MipLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> pixels;
+};
+
+// Zeroth-order modified Bessel function of the first kind, used by the Kaiser window
+float BesselI0(float x)
+{
+	float sum = 1.0f;
+	float term = 1.0f;
+	float halfX = x * 0.5f;
+	for (int k = 1; k < 16; ++k)
+	{
+		term *= (halfX / k) * (halfX / k);
+		sum += term;
+	}
+	return sum;
+}
+
+float Sinc(float x)
+{
+	if (std::fabs(x) < 1e-5f)
+	{
+		return 1.0f;
+	}
+	float px = glm::pi<float>() * x;
+	return std::sin(px) / px;
+}
+
+// Gets the support radius of a filter, in destination texels
+float GetMipFilterRadius(MipFilter filter)
+{
+	return filter == MipFilter::Box ? 0.5f : 3.0f;
+}
+
+// Evaluates a filter kernel at a distance given in destination texels
+float EvaluateMipFilter(MipFilter filter, float x)
+{
+	x = std::fabs(x);
+	switch (filter)
+	{
+	case MipFilter::Box:
+		return x < 0.5f ? 1.0f : 0.0f;
+	case MipFilter::Kaiser:
+	{
+		if (x >= 3.0f)
+		{
+			return 0.0f;
+		}
+		const float alpha = 4.0f;
+		float t = x / 3.0f;
+		return Sinc(x) * BesselI0(alpha * std::sqrt(1.0f - t * t)) / BesselI0(alpha);
+	}
+	case MipFilter::Lanczos:
+		return x < 3.0f ? Sinc(x) * Sinc(x / 3.0f) : 0.0f;
+	default:
+		return 0.0f;
+	}
+}
+
+// Source texels and weights contributing to each destination texel along one axis
+struct MipFilterWeights
+{
+	// Destination texel i uses taps [offsets[i], offsets[i + 1])
+	std::vector<int> offsets;
+	std::vector<int> sourceIndices;
+	std::vector<float> weights;
+};
+
+// Computes the filter taps for resampling one axis from sourceSize to destinationSize texels.
+// Textures tile, so taps past the edges wrap around.
+MipFilterWeights ComputeMipFilterWeights(MipFilter filter, int sourceSize, int destinationSize)
+{
+	MipFilterWeights result;
+	float scale = (float)sourceSize / destinationSize;
+	float support = GetMipFilterRadius(filter) * scale;
+
+	result.offsets.push_back(0);
+	for (int i = 0; i < destinationSize; ++i)
+	{
+		float center = (i + 0.5f) * scale;
+		int first = (int)std::floor(center - support);
+		int last = (int)std::ceil(center + support);
+
+		size_t tapStart = result.weights.size();
+		float totalWeight = 0.0f;
+		for (int s = first; s <= last; ++s)
+		{
+			float weight = EvaluateMipFilter(filter, (s + 0.5f - center) / scale);
+			if (weight == 0.0f)
+			{
+				continue;
+			}
+			result.sourceIndices.push_back(((s % sourceSize) + sourceSize) % sourceSize);
+			result.weights.push_back(weight);
+			totalWeight += weight;
+		}
+
+		// Normalize, so that flat areas keep their value
+		for (size_t t = tapStart; t < result.weights.size(); ++t)
+		{
+			result.weights[t] /= totalWeight;
+		}
+		result.offsets.push_back((int)result.weights.size());
+	}
+	return result;
+}
+
+// Converts an sRGB-encoded value in [0, 1] to linear
+float SRGBToLinear(float c)
+{
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Converts a linear value in [0, 1] to sRGB encoding
+float LinearToSRGB(float c)
+{
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Adds weight * source to accumulator, for count floats
+void AccumulateWeightedRow(float* accumulator, const float* source, float weight, int count)
+{
+	int i = 0;
+#if defined(MIP_GENERATOR_AVX2)
+	__m256 w8 = _mm256_set1_ps(weight);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 acc = _mm256_loadu_ps(accumulator + i);
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(w8, _mm256_loadu_ps(source + i)));
+		_mm256_storeu_ps(accumulator + i, acc);
+	}
+#endif
+#if defined(MIP_GENERATOR_SSE2)
+	__m128 w4 = _mm_set1_ps(weight);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 acc = _mm_loadu_ps(accumulator + i);
+		acc = _mm_add_ps(acc, _mm_mul_ps(w4, _mm_loadu_ps(source + i)));
+		_mm_storeu_ps(accumulator + i, acc);
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		accumulator[i] += weight * source[i];
+	}
+}
+
+// Filters one destination row horizontally. Each texel is 4 floats, which fit one SSE register.
+void FilterRowHorizontal(const float* source, float* destination, const MipFilterWeights& weights, int destinationWidth)
+{
+	for (int x = 0; x < destinationWidth; ++x)
+	{
+#if defined(MIP_GENERATOR_SSE2)
+		__m128 acc = _mm_setzero_ps();
+		for (int t = weights.offsets[x]; t < weights.offsets[x + 1]; ++t)
+		{
+			__m128 texel = _mm_loadu_ps(source + weights.sourceIndices[t] * 4);
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights.weights[t]), texel));
+		}
+		_mm_storeu_ps(destination + x * 4, acc);
+#else
+		float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int t = weights.offsets[x]; t < weights.offsets[x + 1]; ++t)
+		{
+			const float* texel = source + weights.sourceIndices[t] * 4;
+			float weight = weights.weights[t];
+			for (int c = 0; c < 4; ++c)
+			{
+				acc[c] += weight * texel[c];
+			}
+		}
+		for (int c = 0; c < 4; ++c)
+		{
+			destination[x * 4 + c] = acc[c];
+		}
+#endif
+	}
+}
+
+// Resamples an RGBA float image with a separable filter, splitting the destination rows across threads
+void ResampleImage(const std::vector<float>& source, int sourceWidth, int sourceHeight,
+	std::vector<float>& destination, int destinationWidth, int destinationHeight, MipFilter filter, int threadCount)
+{
+	MipFilterWeights horizontal = ComputeMipFilterWeights(filter, sourceWidth, destinationWidth);
+	MipFilterWeights vertical = ComputeMipFilterWeights(filter, sourceHeight, destinationHeight);
+	destination.assign((size_t)destinationWidth * destinationHeight * 4, 0.0f);
+
+	std::atomic<int> nextRow(0);
+	auto worker = [&]()
+	{
+		// Vertical pass into a full-width row, then horizontal pass into the destination
+		std::vector<float> column((size_t)sourceWidth * 4);
+		for (int y = nextRow++; y < destinationHeight; y = nextRow++)
+		{
+			std::fill(column.begin(), column.end(), 0.0f);
+			for (int t = vertical.offsets[y]; t < vertical.offsets[y + 1]; ++t)
+			{
+				const float* sourceRow = &source[(size_t)vertical.sourceIndices[t] * sourceWidth * 4];
+				AccumulateWeightedRow(column.data(), sourceRow, vertical.weights[t], sourceWidth * 4);
+			}
+			FilterRowHorizontal(column.data(), &destination[(size_t)y * destinationWidth * 4], horizontal, destinationWidth);
+		}
+	};
+
+	// Small levels aren't worth starting threads for
+	if (destinationHeight < 32)
+	{
+		threadCount = 1;
+	}
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < threadCount; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+// Generates a full mip chain for an RGBA8 image
+// @param	pixels		RGBA8 texels of the base level
+// @param	width		Width of the base level
+// @param	height		Height of the base level
+// @param	filter		Downsampling filter
+// @param	content		What the texels hold, which decides how they are filtered
+// @param	threadCount	Number of threads to use, or 0 for one per core
+// @return	Returns every level, from the base level down to 1x1
+std::vector<MipLevel> GenerateMipChain(const unsigned char* pixels, int width, int height, MipFilter filter, MipContent content, int threadCount = 0)
+{
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	std::vector<MipLevel> levels;
+	levels.push_back({ width, height, std::vector<unsigned char>(pixels, pixels + (size_t)width * height * 4) });
+
+	// Decode the base level into linear floats
+	float decode[256];
+	for (int i = 0; i < 256; ++i)
+	{
+		float c = i / 255.0f;
+		decode[i] = content == MipContent::SRGBColor ? SRGBToLinear(c) : (content == MipContent::NormalMap ? c * 2.0f - 1.0f : c);
+	}
+	std::vector<float> current((size_t)width * height * 4);
+	for (size_t i = 0; i < current.size(); i += 4)
+	{
+		current[i + 0] = decode[pixels[i + 0]];
+		current[i + 1] = decode[pixels[i + 1]];
+		current[i + 2] = decode[pixels[i + 2]];
+		current[i + 3] = pixels[i + 3] / 255.0f;
+	}
+
+	// Each level is filtered from the one above it
+	std::vector<float> next;
+	int levelWidth = width;
+	int levelHeight = height;
+	while (levelWidth > 1 || levelHeight > 1)
+	{
+		int nextWidth = std::max(1, levelWidth / 2);
+		int nextHeight = std::max(1, levelHeight / 2);
+		ResampleImage(current, levelWidth, levelHeight, next, nextWidth, nextHeight, filter, threadCount);
+
+		MipLevel level;
+		level.width = nextWidth;
+		level.height = nextHeight;
+		level.pixels.resize((size_t)nextWidth * nextHeight * 4);
+		for (size_t i = 0; i < next.size(); i += 4)
+		{
+			float* texel = &next[i];
+			if (content == MipContent::NormalMap)
+			{
+				// Averaged unit vectors get shorter, so bring them back to unit length
+				float length = std::sqrt(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+				if (length > 1e-6f)
+				{
+					texel[0] /= length;
+					texel[1] /= length;
+					texel[2] /= length;
+				}
+				else
+				{
+					texel[0] = 0.0f;
+					texel[1] = 0.0f;
+					texel[2] = 1.0f;
+				}
+			}
+
+			for (int c = 0; c < 4; ++c)
+			{
+				float value = texel[c];
+				if (c < 3 && content == MipContent::SRGBColor)
+				{
+					value = LinearToSRGB(glm::clamp(value, 0.0f, 1.0f));
+				}
+				else if (c < 3 && content == MipContent::NormalMap)
+				{
+					value = value * 0.5f + 0.5f;
+				}
+				level.pixels[i + c] = (unsigned char)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+			}
+		}
+		levels.push_back(std::move(level));
+
+		current.swap(next);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+
+	return levels;
+}
+
+// Uploads a mip chain to the currently bound GL_TEXTURE_2D, and turns on trilinear filtering
+// @param	levels			Mip chain, base level first
+// @param	internalFormat	Internal format of the texture, e.g. GL_RGBA8
+void UploadMipChain(const std::vector<MipLevel>& levels, GLint internalFormat)
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		glTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, levels[i].width, levels[i].height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, levels[i].pixels.data());
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Sums the size of every level of a mip chain, in bytes
+size_t GetMipChainSize(const std::vector<MipLevel>& levels)
+{
+	size_t size = 0;
+	for (const MipLevel& level : levels)
+	{
+		size += level.pixels.size();
+	}
+	return size;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "GLExtensions.h"
+#include "Hashing.h"
+
+// Caches linked shader programs on disk with glGetProgramBinary, so that later launches
+// can skip compiling and linking. Entries are keyed by a hash of the final shader sources
+// and of the driver, since binaries are only valid for the driver that produced them.
+struct ProgramBinaryCache
+{
+	// Directory the binaries are stored in
+	std::string directory;
+
+	// Hash of the GL vendor, renderer and version strings
+	uint64_t driverHash;
+
+	// False if the driver cannot save program binaries, in which case every program is compiled
+	bool enabled;
+
+	// Statistics for reporting. Both misses and rejected binaries end up being compiled.
+	int hits;
+	int misses;
+	int rejected;
+};
+
+// Sets up a program binary cache. LoadGLExtensions must have been called first.
+// @param	cache		Cache to set up
+// @param	directory	Directory to store the binaries in, created if it does not exist
+void CreateProgramBinaryCache(ProgramBinaryCache& cache, const std::string& directory)
+{
+	cache.directory = directory;
+	cache.enabled = glExtensions.programBinary;
+	cache.hits = 0;
+	cache.misses = 0;
+	cache.rejected = 0;
+
+	uint64_t hash = 14695981039346656037ull;
+	const char* driverStrings[] = {
+		(const char*)glGetString(GL_VENDOR),
+		(const char*)glGetString(GL_RENDERER),
+		(const char*)glGetString(GL_VERSION)
+	};
+	for (const char* driverString : driverStrings)
+	{
+		hash = HashStringFNV1a(hash, driverString ? driverString : "");
+	}
+	cache.driverHash = hash;
+
+	if (cache.enabled)
+	{
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+}
+
+// Computes the cache key of a program
+// @param	cache					Cache the key is for
+// @param	vertexShaderSource		Final vertex shader source, after all defines are injected
+// @param	fragmentShaderSource	Final fragment shader source, after all defines are injected
+// @return	Returns the cache key
+uint64_t HashProgramSources(const ProgramBinaryCache& cache, const std::string& vertexShaderSource, const std::string& fragmentShaderSource)
+{
+	uint64_t hash = HashStringFNV1a(cache.driverHash, vertexShaderSource);
+	return HashStringFNV1a(hash, fragmentShaderSource);
+}
+
+std::string GetProgramBinaryPath(const ProgramBinaryCache& cache, uint64_t key)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	return cache.directory + "/" + name;
+}
+
+// Creates a program from a cached binary
+// @param	cache	Cache to load from
+// @param	key		Cache key of the program
+// @return	Returns the handle to the linked program, or 0 if the binary is missing or was rejected by the driver
+GLuint LoadProgramBinary(ProgramBinaryCache& cache, uint64_t key)
+{
+	if (!cache.enabled)
+	{
+		++cache.misses;
+		return 0;
+	}
+
+	std::string path = GetProgramBinaryPath(cache, key);
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (file.fail())
+	{
+		++cache.misses;
+		return 0;
+	}
+	size_t fileSize = (size_t)file.tellg();
+	file.seekg(0);
+
+	// File layout: magic, binary format, binary length, binary
+	char magic[4] = {};
+	GLenum format = 0;
+	uint32_t length = 0;
+	file.read(magic, 4);
+	file.read((char*)&format, sizeof(format));
+	file.read((char*)&length, sizeof(length));
+	bool valid = file && std::string(magic, 4) == "PBIN" && length == fileSize - 12;
+	std::vector<char> binary(valid ? length : 0);
+	file.read(binary.data(), binary.size());
+	if (!valid || !file)
+	{
+		std::cout << "Ignoring corrupt program binary " << path << std::endl;
+		++cache.misses;
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, binary.data(), (GLsizei)length);
+
+	// Drivers reject binaries from other driver builds even when the version string matches
+	GLint linkStatus;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus != GL_TRUE)
+	{
+		glDeleteProgram(program);
+		std::remove(path.c_str());
+		++cache.rejected;
+		return 0;
+	}
+
+	++cache.hits;
+	return program;
+}
+
+// Stores a linked program in the cache
+// @param	cache	Cache to store into
+// @param	key		Cache key of the program
+// @param	program	Linked program, created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+void SaveProgramBinary(const ProgramBinaryCache& cache, uint64_t key, GLuint program)
+{
+	if (!cache.enabled)
+	{
+		return;
+	}
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+	{
+		return;
+	}
+
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &length, &format, binary.data());
+
+	std::string path = GetProgramBinaryPath(cache, key);
+	std::ofstream file(path, std::ios::binary);
+	if (file.fail())
+	{
+		std::cout << "Failed to write program binary " << path << std::endl;
+		return;
+	}
+
+	uint32_t length32 = (uint32_t)length;
+	file.write("PBIN", 4);
+	file.write((const char*)&format, sizeof(format));
+	file.write((const char*)&length32, sizeof(length32));
+	file.write(binary.data(), length);
+}
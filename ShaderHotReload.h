@@ -0,0 +1,362 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "GLUtils.h"
+
+// Watches shader files for changes, so that the programs built from them can be rebuilt while the app runs.
+// On Linux this uses inotify on the directories of the watched files, since editors often save by replacing the file.
+// Elsewhere the modification times are polled a few times per second.
+struct ShaderFileWatcher
+{
+	// Watched files, with their last seen modification time when polling
+	std::unordered_map<std::string, long long> files;
+
+#ifdef __linux__
+	int inotifyFd;
+
+	// Watched directories, keyed by inotify watch descriptor
+	std::unordered_map<int, std::string> directories;
+#else
+	std::chrono::steady_clock::time_point lastPollTime;
+#endif
+};
+
+void CreateShaderFileWatcher(ShaderFileWatcher& watcher)
+{
+	watcher.files.clear();
+#ifdef __linux__
+	watcher.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watcher.inotifyFd < 0)
+	{
+		std::cout << "Failed to initialize inotify, shader hot reload is disabled" << std::endl;
+	}
+#else
+	watcher.lastPollTime = std::chrono::steady_clock::now();
+#endif
+}
+
+// Starts watching a file. Watching the same file again does nothing.
+void WatchShaderFile(ShaderFileWatcher& watcher, const std::string& path)
+{
+	if (watcher.files.count(path))
+	{
+		return;
+	}
+	watcher.files[path] = GetFileModificationTime(path);
+
+#ifdef __linux__
+	if (watcher.inotifyFd < 0)
+	{
+		return;
+	}
+
+	std::string directory = GetDirectory(path);
+	if (directory.empty())
+	{
+		directory = "./";
+	}
+	for (const auto& watched : watcher.directories)
+	{
+		if (watched.second == directory)
+		{
+			return;
+		}
+	}
+
+	int wd = inotify_add_watch(watcher.inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd >= 0)
+	{
+		watcher.directories[wd] = directory;
+	}
+#endif
+}
+
+// Collects the watched files that changed since the last call, without blocking
+// @param	watcher		Watcher to poll
+// @return	Returns the paths of the changed files, each at most once
+std::vector<std::string> PollShaderFileWatcher(ShaderFileWatcher& watcher)
+{
+	std::vector<std::string> changed;
+	auto addChanged = [&changed](const std::string& path)
+	{
+		for (const std::string& existing : changed)
+		{
+			if (existing == path)
+			{
+				return;
+			}
+		}
+		changed.push_back(path);
+	};
+
+#ifdef __linux__
+	if (watcher.inotifyFd < 0)
+	{
+		return changed;
+	}
+
+	alignas(inotify_event) char buffer[4096];
+	for (;;)
+	{
+		ssize_t length = read(watcher.inotifyFd, buffer, sizeof(buffer));
+		if (length <= 0)
+		{
+			break;
+		}
+
+		for (char* ptr = buffer; ptr < buffer + length; )
+		{
+			const inotify_event* event = (const inotify_event*)ptr;
+			ptr += sizeof(inotify_event) + event->len;
+
+			auto directory = watcher.directories.find(event->wd);
+			if (directory == watcher.directories.end() || event->len == 0)
+			{
+				continue;
+			}
+
+			// Files are watched by the path they were given with, which has no "./" prefix for the working directory
+			std::string path = (directory->second == "./" ? std::string() : directory->second) + event->name;
+			if (watcher.files.count(path))
+			{
+				addChanged(path);
+			}
+		}
+	}
+#else
+	auto now = std::chrono::steady_clock::now();
+	if (now - watcher.lastPollTime < std::chrono::milliseconds(250))
+	{
+		return changed;
+	}
+	watcher.lastPollTime = now;
+
+	for (auto& file : watcher.files)
+	{
+		long long modificationTime = GetFileModificationTime(file.first);
+		if (modificationTime != file.second && modificationTime != -1)
+		{
+			file.second = modificationTime;
+			addChanged(file.first);
+		}
+	}
+#endif
+
+	return changed;
+}
+
+void DeleteShaderFileWatcher(ShaderFileWatcher& watcher)
+{
+#ifdef __linux__
+	if (watcher.inotifyFd >= 0)
+	{
+		close(watcher.inotifyFd);
+		watcher.inotifyFd = -1;
+	}
+	watcher.directories.clear();
+#endif
+	watcher.files.clear();
+}
+
+// Copies the values of the default-block uniforms and the uniform block bindings from one program to another,
+// matching them by name. Uniforms that only exist in one of the programs are skipped.
+// @param	source		Program to copy the state from
+// @param	destination	Program to copy the state to
+void CopyProgramUniforms(GLuint source, GLuint destination)
+{
+	// glUniform* only affects the current program in GL 3.3, so switch to the destination and back
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	glUseProgram(destination);
+
+	GLint uniformCount = 0;
+	glGetProgramiv(source, GL_ACTIVE_UNIFORMS, &uniformCount);
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		char name[256];
+		GLsizei nameLength = 0;
+		GLint arraySize = 0;
+		GLenum type = 0;
+		glGetActiveUniform(source, (GLuint)i, sizeof(name), &nameLength, &arraySize, &type, name);
+
+		// Uniforms inside uniform blocks live in buffers, which are shared already
+		GLuint index = (GLuint)i;
+		GLint blockIndex = -1;
+		glGetActiveUniformsiv(source, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+		if (blockIndex != -1)
+		{
+			continue;
+		}
+
+		// Arrays are reported as "name[0]", and each element has its own location
+		std::string baseName(name, nameLength);
+		bool isArray = baseName.size() > 3 && baseName.compare(baseName.size() - 3, 3, "[0]") == 0;
+		if (isArray)
+		{
+			baseName.resize(baseName.size() - 3);
+		}
+
+		for (GLint element = 0; element < arraySize; ++element)
+		{
+			std::string elementName = isArray ? baseName + "[" + std::to_string(element) + "]" : baseName;
+			GLint sourceLocation = glGetUniformLocation(source, elementName.c_str());
+			GLint destinationLocation = glGetUniformLocation(destination, elementName.c_str());
+			if (sourceLocation < 0 || destinationLocation < 0)
+			{
+				continue;
+			}
+
+			GLfloat f[16];
+			GLint n[4];
+			switch (type)
+			{
+			case GL_FLOAT:		glGetUniformfv(source, sourceLocation, f); glUniform1fv(destinationLocation, 1, f); break;
+			case GL_FLOAT_VEC2:	glGetUniformfv(source, sourceLocation, f); glUniform2fv(destinationLocation, 1, f); break;
+			case GL_FLOAT_VEC3:	glGetUniformfv(source, sourceLocation, f); glUniform3fv(destinationLocation, 1, f); break;
+			case GL_FLOAT_VEC4:	glGetUniformfv(source, sourceLocation, f); glUniform4fv(destinationLocation, 1, f); break;
+			case GL_FLOAT_MAT2:	glGetUniformfv(source, sourceLocation, f); glUniformMatrix2fv(destinationLocation, 1, GL_FALSE, f); break;
+			case GL_FLOAT_MAT3:	glGetUniformfv(source, sourceLocation, f); glUniformMatrix3fv(destinationLocation, 1, GL_FALSE, f); break;
+			case GL_FLOAT_MAT4:	glGetUniformfv(source, sourceLocation, f); glUniformMatrix4fv(destinationLocation, 1, GL_FALSE, f); break;
+			case GL_INT_VEC2:
+			case GL_BOOL_VEC2:	glGetUniformiv(source, sourceLocation, n); glUniform2iv(destinationLocation, 1, n); break;
+			case GL_INT_VEC3:
+			case GL_BOOL_VEC3:	glGetUniformiv(source, sourceLocation, n); glUniform3iv(destinationLocation, 1, n); break;
+			case GL_INT_VEC4:
+			case GL_BOOL_VEC4:	glGetUniformiv(source, sourceLocation, n); glUniform4iv(destinationLocation, 1, n); break;
+			case GL_UNSIGNED_INT:	glGetUniformuiv(source, sourceLocation, (GLuint*)n); glUniform1uiv(destinationLocation, 1, (GLuint*)n); break;
+
+			// Ints, bools and all sampler types are set with glUniform1i
+			default:			glGetUniformiv(source, sourceLocation, n); glUniform1iv(destinationLocation, 1, n); break;
+			}
+		}
+	}
+
+	GLint blockCount = 0;
+	glGetProgramiv(source, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+	for (GLint i = 0; i < blockCount; ++i)
+	{
+		char name[256];
+		glGetActiveUniformBlockName(source, (GLuint)i, sizeof(name), nullptr, name);
+		GLuint destinationIndex = glGetUniformBlockIndex(destination, name);
+		if (destinationIndex == GL_INVALID_INDEX)
+		{
+			continue;
+		}
+
+		GLint binding = 0;
+		glGetActiveUniformBlockiv(source, (GLuint)i, GL_UNIFORM_BLOCK_BINDING, &binding);
+		glUniformBlockBinding(destination, destinationIndex, (GLuint)binding);
+	}
+
+	glUseProgram((GLuint)previousProgram);
+}
+
+// State of a permutation set that is being rebuilt from changed shader files
+struct ShaderPermutationReload
+{
+	// New programs being built, keyed by feature bitmask
+	std::unordered_map<unsigned int, ShaderProgramHandle> programs;
+
+	// Builds that were superseded by a newer change, deleted once they finish
+	std::vector<ShaderProgramHandle> stale;
+};
+
+// Rereads the shader files of a permutation set and starts rebuilding all of its programs in the background.
+// The current programs stay in use until their replacements have linked.
+// @param	permutations	Permutation set to rebuild
+// @param	reload			Reload state of the permutation set
+// @param	batch			Batch to build the new programs in
+// @return	Returns false if the shader files could not be read, in which case nothing changes
+bool ReloadShaderPermutations(ShaderPermutationSet& permutations, ShaderPermutationReload& reload, ShaderCompileBatch& batch)
+{
+	ShaderSource vshSource;
+	ShaderSource fshSource;
+	if (!LoadShaderSource(permutations.vertexShaderPath, vshSource) || !LoadShaderSource(permutations.fragmentShaderPath, fshSource))
+	{
+		return false;
+	}
+
+	permutations.vertexShaderSource = vshSource.text;
+	permutations.fragmentShaderSource = fshSource.text;
+	permutations.dependencies = vshSource.dependencies;
+	permutations.dependencies.insert(permutations.dependencies.end(), fshSource.dependencies.begin(), fshSource.dependencies.end());
+
+	// Builds from the old sources are no longer wanted
+	for (const auto& pending : reload.programs)
+	{
+		reload.stale.push_back(pending.second);
+	}
+	reload.programs.clear();
+	for (const auto& pending : permutations.pendingPrograms)
+	{
+		reload.stale.push_back(pending.second);
+	}
+	permutations.pendingPrograms.clear();
+
+	for (const auto& program : permutations.programs)
+	{
+		std::string defines = GetShaderPermutationDefines(permutations, program.first);
+		reload.programs[program.first] = QueueShaderProgram(batch,
+			InjectShaderDefines(permutations.vertexShaderSource, defines),
+			InjectShaderDefines(permutations.fragmentShaderSource, defines),
+			permutations.binaryCache);
+	}
+	return true;
+}
+
+// Swaps in the rebuilt programs that have linked. Call once per frame, after PollShaderCompileBatch.
+// A program that fails to build is dropped, and the old one stays in use.
+// @param	permutations	Permutation set being rebuilt
+// @param	reload			Reload state of the permutation set
+// @param	batch			Batch the new programs are built in
+void UpdateShaderPermutationReload(ShaderPermutationSet& permutations, ShaderPermutationReload& reload, ShaderCompileBatch& batch)
+{
+	for (auto it = reload.programs.begin(); it != reload.programs.end(); )
+	{
+		ShaderProgramState state = GetShaderProgramState(batch, it->second);
+		if (state == ShaderProgramState::Ready)
+		{
+			GLuint oldProgram = permutations.programs[it->first];
+			GLuint newProgram = GetShaderProgram(batch, it->second, 0);
+			CopyProgramUniforms(oldProgram, newProgram);
+			permutations.programs[it->first] = newProgram;
+			glDeleteProgram(oldProgram);
+			std::cout << "Reloaded shader permutation " << it->first << " of " << permutations.fragmentShaderPath << std::endl;
+			it = reload.programs.erase(it);
+		}
+		else if (state == ShaderProgramState::Failed)
+		{
+			std::cout << "Keeping the previous program for shader permutation " << it->first << " of " << permutations.fragmentShaderPath << std::endl;
+			it = reload.programs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	for (auto it = reload.stale.begin(); it != reload.stale.end(); )
+	{
+		ShaderProgramState state = GetShaderProgramState(batch, *it);
+		if (state == ShaderProgramState::Ready || state == ShaderProgramState::Failed)
+		{
+			glDeleteProgram(GetShaderProgram(batch, *it, 0));
+			it = reload.stale.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/stat.h>
+
+#ifdef EMBED_SHADERS
+// Generated by Tools/EmbedShaders.cpp, rerun it after editing any shader
+#include "EmbeddedShaders.h"
+#endif
+
+// Reads the contents of the file specified by the file path,
+// and places the file contents into a string.
+// @param	filePath		Path of the file to read
+// @param	outputString	String where the file contents will be copied to
+// @return	Returns true if the file was successfully read or not.
+bool ReadFile(const std::string& filePath, std::string& outputString) {
+	std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+	if (file.fail()) {
+		return false;
+	}
+
+	// Read the whole file with a single allocation and a single read
+	std::streamoff size = file.tellg();
+	file.seekg(0);
+	size_t offset = outputString.size();
+	outputString.resize(offset + (size_t)size);
+	file.read(&outputString[offset], size);
+
+	return !file.fail();
+}
+
+// Gets the modification time of a file, or -1 if it doesn't exist
+long long GetFileModificationTime(const std::string& path)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+	{
+		return -1;
+	}
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		return -1;
+	}
+#endif
+	return (long long)info.st_mtime;
+}
+
+// A shader source with all of its #includes resolved
+struct ShaderSource
+{
+	std::string text;
+
+	// Every file the source was built from, the main file first.
+	// The index of a file is also its source string number in #line directives, so compile errors can be traced back to it.
+	std::vector<std::string> dependencies;
+};
+
+// Contents of shader files, so that a file included by many shaders is only read once
+struct ShaderSourceCache
+{
+	std::unordered_map<std::string, std::string> files;
+};
+
+ShaderSourceCache shaderSourceCache;
+
+// Gets the contents of a shader file, from the embedded sources or the cache when possible
+// @param	cache		Cache of file contents
+// @param	path		Path of the shader file
+// @param	contents	Receives a pointer to the contents of the file
+// @return	Returns true if the file was found
+bool GetShaderFile(ShaderSourceCache& cache, const std::string& path, const std::string*& contents)
+{
+	auto it = cache.files.find(path);
+	if (it == cache.files.end())
+	{
+		std::string text;
+		bool found = false;
+
+#ifdef EMBED_SHADERS
+		for (const EmbeddedShaderFile& file : embeddedShaderFiles)
+		{
+			if (path == file.path)
+			{
+				text = file.source;
+				found = true;
+				break;
+			}
+		}
+#endif
+
+		if (!found && !ReadFile(path, text))
+		{
+			return false;
+		}
+		it = cache.files.emplace(path, std::move(text)).first;
+	}
+
+	contents = &it->second;
+	return true;
+}
+
+// Forgets the cached contents of a shader file, so that the next load reads it again
+void InvalidateShaderFile(ShaderSourceCache& cache, const std::string& path)
+{
+	cache.files.erase(path);
+}
+
+// Checks whether a shader source was built from the given file
+bool ShaderSourceDependsOn(const ShaderSource& source, const std::string& path)
+{
+	for (const std::string& dependency : source.dependencies)
+	{
+		if (dependency == path)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Gets the directory part of a path, including the trailing separator
+std::string GetDirectory(const std::string& path)
+{
+	size_t separator = path.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+}
+
+// Appends a file to a shader source, replacing each #include "file" line with the contents of that file.
+// Every file is included at most once, like with #pragma once.
+// @param	cache		Cache of file contents
+// @param	path		Path of the file to append
+// @param	source		Shader source to append to
+// @param	included	Files that were already included
+// @return	Returns false if the file or one of its includes could not be read
+bool AppendShaderFile(ShaderSourceCache& cache, const std::string& path, ShaderSource& source, std::unordered_set<std::string>& included)
+{
+	const std::string* contents;
+	if (!GetShaderFile(cache, path, contents))
+	{
+		std::cout << "Failed to read shader file " << path << std::endl;
+		return false;
+	}
+
+	int fileIndex = (int)source.dependencies.size();
+	source.dependencies.push_back(path);
+	included.insert(path);
+
+	// The main file keeps its own numbering, since #line may not come before its #version
+	if (fileIndex > 0)
+	{
+		source.text += "#line 1 " + std::to_string(fileIndex) + "\n";
+	}
+
+	const std::string& text = *contents;
+	size_t lineStart = 0;
+	int lineNumber = 1;
+	while (lineStart < text.size())
+	{
+		size_t lineEnd = text.find('\n', lineStart);
+		if (lineEnd == std::string::npos)
+		{
+			lineEnd = text.size();
+		}
+
+		size_t first = text.find_first_not_of(" \t", lineStart);
+		bool isInclude = first < lineEnd && text.compare(first, 8, "#include") == 0;
+		if (!isInclude)
+		{
+			source.text.append(text, lineStart, lineEnd - lineStart);
+			source.text += "\n";
+		}
+		else
+		{
+			size_t open = text.find('"', first + 8);
+			size_t close = open < lineEnd ? text.find('"', open + 1) : std::string::npos;
+			if (close >= lineEnd)
+			{
+				std::cout << path << "(" << lineNumber << "): malformed #include" << std::endl;
+				return false;
+			}
+
+			// Included paths are relative to the including file
+			std::string includePath = GetDirectory(path) + text.substr(open + 1, close - open - 1);
+			if (included.count(includePath) == 0)
+			{
+				if (!AppendShaderFile(cache, includePath, source, included))
+				{
+					return false;
+				}
+
+				// Resume the numbering of this file after the included one
+				source.text += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(fileIndex) + "\n";
+			}
+			else
+			{
+				// Keep the line count of this file intact
+				source.text += "\n";
+			}
+		}
+
+		lineStart = lineEnd + 1;
+		++lineNumber;
+	}
+
+	return true;
+}
+
+// Loads a shader file and resolves its #includes
+// @param	path	Path of the shader file
+// @param	source	Receives the shader source and the files it was built from
+// @param	cache	Cache of file contents
+// @return	Returns true if the shader and all of its includes were read
+bool LoadShaderSource(const std::string& path, ShaderSource& source, ShaderSourceCache& cache = shaderSourceCache)
+{
+	source.text.clear();
+	source.dependencies.clear();
+	std::unordered_set<std::string> included;
+	return AppendShaderFile(cache, path, source, included);
+}
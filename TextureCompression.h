@@ -0,0 +1,958 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "GLExtensions.h"
+#include "MipGenerator.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_COMPRESSION_SSE2
+#endif
+
+// Block-compressed texture formats. Every format stores 4x4 texel blocks.
+enum class BlockFormat
+{
+	// RGB at 4 bits per texel, for opaque colour
+	BC1,
+
+	// BC1 colour plus a BC4 alpha block, 8 bits per texel
+	BC3,
+
+	// One channel at 4 bits per texel, for masks
+	BC4,
+
+	// Two channels at 8 bits per texel, for normal maps (Z is reconstructed in the shader)
+	BC5,
+
+	// RGBA at 8 bits per texel with much better quality than BC1/BC3.
+	// Only mode 6 (one subset, 7-bit endpoints with a shared bit, 4-bit indices) is encoded.
+	BC7
+};
+
+// One level of a block-compressed mip chain
+struct CompressedLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> data;
+};
+
+// Gets the size of one 4x4 block, in bytes
+size_t GetBlockSize(BlockFormat format)
+{
+	return (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+}
+
+// Gets the size of an image in a block format, in bytes
+size_t GetCompressedImageSize(BlockFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * GetBlockSize(format);
+}
+
+// Copies a 4x4 block of RGBA8 texels, repeating the edge texels for blocks that hang over the image
+void FetchBlock(const unsigned char* pixels, int width, int height, int blockX, int blockY, unsigned char block[64])
+{
+	for (int y = 0; y < 4; ++y)
+	{
+		int sy = std::min(blockY * 4 + y, height - 1);
+		for (int x = 0; x < 4; ++x)
+		{
+			int sx = std::min(blockX * 4 + x, width - 1);
+			std::memcpy(&block[(y * 4 + x) * 4], &pixels[((size_t)sy * width + sx) * 4], 4);
+		}
+	}
+}
+
+// Finds the nearest palette entry for each of the 16 texels of a block
+// @param	texels			Texel values, channel-major (texels[c * 16 + i] is channel c of texel i)
+// @param	palette			Palette values, channel-major (palette[c * 16 + p] is channel c of entry p)
+// @param	channelCount	Number of channels to compare, up to 4
+// @param	paletteSize		Number of palette entries, up to 16
+// @param	indices			Receives the index of the nearest entry for each texel
+// @return	Returns the total squared error
+float SelectPaletteIndices(const float* texels, const float* palette, int channelCount, int paletteSize, int indices[16])
+{
+	float totalError = 0.0f;
+
+#ifdef TEXTURE_COMPRESSION_SSE2
+	// Four texels at a time, keeping the best distance and index per lane
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 bestError = _mm_set1_ps(1e30f);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (int p = 0; p < paletteSize; ++p)
+		{
+			__m128 error = _mm_setzero_ps();
+			for (int c = 0; c < channelCount; ++c)
+			{
+				__m128 d = _mm_sub_ps(_mm_loadu_ps(&texels[c * 16 + i]), _mm_set1_ps(palette[c * 16 + p]));
+				error = _mm_add_ps(error, _mm_mul_ps(d, d));
+			}
+			__m128i better = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+			bestError = _mm_min_ps(error, bestError);
+			bestIndex = _mm_or_si128(_mm_and_si128(better, _mm_set1_epi32(p)), _mm_andnot_si128(better, bestIndex));
+		}
+
+		alignas(16) float errors[4];
+		alignas(16) int32_t lanes[4];
+		_mm_store_ps(errors, bestError);
+		_mm_store_si128((__m128i*)lanes, bestIndex);
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			indices[i + lane] = lanes[lane];
+			totalError += errors[lane];
+		}
+	}
+#else
+	for (int i = 0; i < 16; ++i)
+	{
+		float bestError = 1e30f;
+		for (int p = 0; p < paletteSize; ++p)
+		{
+			float error = 0.0f;
+			for (int c = 0; c < channelCount; ++c)
+			{
+				float d = texels[c * 16 + i] - palette[c * 16 + p];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				indices[i] = p;
+			}
+		}
+		totalError += bestError;
+	}
+#endif
+
+	return totalError;
+}
+
+// Finds the line through a block's texels that best fits them, and the extent of the texels along it
+// @param	texels			Texel values, channel-major
+// @param	channelCount	Number of channels
+// @param	endpoint0		Receives the low end of the line
+// @param	endpoint1		Receives the high end of the line
+void FitBlockEndpoints(const float* texels, int channelCount, float endpoint0[4], float endpoint1[4])
+{
+	float mean[4] = {};
+	for (int c = 0; c < channelCount; ++c)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			mean[c] += texels[c * 16 + i];
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int a = 0; a < channelCount; ++a)
+		{
+			for (int b = 0; b < channelCount; ++b)
+			{
+				covariance[a][b] += (texels[a * 16 + i] - mean[a]) * (texels[b * 16 + i] - mean[b]);
+			}
+		}
+	}
+
+	// Principal axis by power iteration, starting from the axis with the largest spread
+	float axis[4] = {};
+	int widest = 0;
+	for (int c = 1; c < channelCount; ++c)
+	{
+		if (covariance[c][c] > covariance[widest][widest])
+		{
+			widest = c;
+		}
+	}
+	axis[widest] = 1.0f;
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = {};
+		float length = 0.0f;
+		for (int a = 0; a < channelCount; ++a)
+		{
+			for (int b = 0; b < channelCount; ++b)
+			{
+				next[a] += covariance[a][b] * axis[b];
+			}
+			length += next[a] * next[a];
+		}
+		if (length < 1e-12f)
+		{
+			break;
+		}
+		length = std::sqrt(length);
+		for (int c = 0; c < channelCount; ++c)
+		{
+			axis[c] = next[c] / length;
+		}
+	}
+
+	float minT = 1e30f;
+	float maxT = -1e30f;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channelCount; ++c)
+		{
+			t += (texels[c * 16 + i] - mean[c]) * axis[c];
+		}
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+
+	for (int c = 0; c < channelCount; ++c)
+	{
+		endpoint0[c] = glm::clamp(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+		endpoint1[c] = glm::clamp(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+	}
+}
+
+// Refits the endpoints to the chosen indices by least squares
+// @param	texels			Texel values, channel-major
+// @param	channelCount	Number of channels
+// @param	indices			Palette index of each texel
+// @param	weights			Interpolation weight (0 = endpoint0, 1 = endpoint1) of each palette index
+// @return	Returns false if the indices don't determine the endpoints (e.g. all texels use the same index)
+bool RefitBlockEndpoints(const float* texels, int channelCount, const int indices[16], const float* weights,
+	float endpoint0[4], float endpoint1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; ++i)
+	{
+		float b = weights[indices[i]];
+		float a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channelCount; ++c)
+		{
+			ax[c] += a * texels[c * 16 + i];
+			bx[c] += b * texels[c * 16 + i];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) < 1e-6f)
+	{
+		return false;
+	}
+	for (int c = 0; c < channelCount; ++c)
+	{
+		endpoint0[c] = glm::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+		endpoint1[c] = glm::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+// --- BC1 ---
+
+uint16_t PackRGB565(const float color[3])
+{
+	int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void UnpackRGB565(uint16_t packed, float color[3])
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Builds the 4-colour BC1 palette in channel-major order
+void BuildBC1Palette(uint16_t color0, uint16_t color1, float palette[64])
+{
+	float c0[3], c1[3];
+	UnpackRGB565(color0, c0);
+	UnpackRGB565(color1, c1);
+	for (int c = 0; c < 3; ++c)
+	{
+		palette[c * 16 + 0] = c0[c];
+		palette[c * 16 + 1] = c1[c];
+		palette[c * 16 + 2] = (2.0f * c0[c] + c1[c]) / 3.0f;
+		palette[c * 16 + 3] = (c0[c] + 2.0f * c1[c]) / 3.0f;
+	}
+}
+
+// Encodes the colour of a block as BC1, always in 4-colour mode so it can be reused by BC3
+// @param	block	RGBA8 texels of the block
+// @param	output	Receives the 8-byte block
+void EncodeBC1Block(const unsigned char block[64], unsigned char output[8])
+{
+	float texels[64];
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			texels[c * 16 + i] = block[i * 4 + c];
+		}
+	}
+
+	float endpoint0[4], endpoint1[4];
+	FitBlockEndpoints(texels, 3, endpoint0, endpoint1);
+
+	// Palette position of each index, for the least-squares refit
+	static const float kWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	uint16_t bestColor0 = 0, bestColor1 = 0;
+	int bestIndices[16] = {};
+	float bestError = 1e30f;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		uint16_t color0 = PackRGB565(endpoint0);
+		uint16_t color1 = PackRGB565(endpoint1);
+
+		float palette[64];
+		int indices[16];
+		BuildBC1Palette(color0, color1, palette);
+		float error = SelectPaletteIndices(texels, palette, 3, 4, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			bestColor0 = color0;
+			bestColor1 = color1;
+			std::memcpy(bestIndices, indices, sizeof(indices));
+		}
+
+		if (!RefitBlockEndpoints(texels, 3, indices, kWeights, endpoint0, endpoint1))
+		{
+			break;
+		}
+	}
+
+	// 4-colour mode needs color0 > color1. Swapping the endpoints swaps the palette entries 0<->1 and 2<->3.
+	if (bestColor0 < bestColor1)
+	{
+		std::swap(bestColor0, bestColor1);
+		for (int i = 0; i < 16; ++i)
+		{
+			bestIndices[i] ^= 1;
+		}
+	}
+	else if (bestColor0 == bestColor1)
+	{
+		// Flat block: every texel uses color0
+		for (int i = 0; i < 16; ++i)
+		{
+			bestIndices[i] = 0;
+		}
+	}
+
+	uint32_t indexBits = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		indexBits |= (uint32_t)bestIndices[i] << (i * 2);
+	}
+	output[0] = bestColor0 & 0xff;
+	output[1] = bestColor0 >> 8;
+	output[2] = bestColor1 & 0xff;
+	output[3] = bestColor1 >> 8;
+	std::memcpy(&output[4], &indexBits, 4);
+}
+
+// Decodes a BC1 block
+// @param	input	8-byte block
+// @param	block	Receives the RGBA8 texels of the block
+void DecodeBC1Block(const unsigned char input[8], unsigned char block[64])
+{
+	uint16_t color0 = input[0] | (input[1] << 8);
+	uint16_t color1 = input[2] | (input[3] << 8);
+	float c0[3], c1[3];
+	UnpackRGB565(color0, c0);
+	UnpackRGB565(color1, c1);
+
+	unsigned char palette[4][4];
+	for (int c = 0; c < 3; ++c)
+	{
+		palette[0][c] = (unsigned char)c0[c];
+		palette[1][c] = (unsigned char)c1[c];
+		if (color0 > color1)
+		{
+			palette[2][c] = (unsigned char)((2 * (int)c0[c] + (int)c1[c]) / 3);
+			palette[3][c] = (unsigned char)(((int)c0[c] + 2 * (int)c1[c]) / 3);
+		}
+		else
+		{
+			palette[2][c] = (unsigned char)(((int)c0[c] + (int)c1[c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = color0 > color1 ? 255 : 0;
+
+	uint32_t indexBits;
+	std::memcpy(&indexBits, &input[4], 4);
+	for (int i = 0; i < 16; ++i)
+	{
+		std::memcpy(&block[i * 4], palette[(indexBits >> (i * 2)) & 3], 4);
+	}
+}
+
+// --- BC4 ---
+
+// Encodes one channel of a block as BC4, in the 8-value mode
+// @param	block	RGBA8 texels of the block
+// @param	channel	Channel to encode
+// @param	output	Receives the 8-byte block
+void EncodeBC4Block(const unsigned char block[64], int channel, unsigned char output[8])
+{
+	float texels[16];
+	int minValue = 255, maxValue = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int value = block[i * 4 + channel];
+		texels[i] = (float)value;
+		minValue = std::min(minValue, value);
+		maxValue = std::max(maxValue, value);
+	}
+
+	int indices[16] = {};
+	if (maxValue != minValue)
+	{
+		// Palette: endpoint0 (max), endpoint1 (min), then six steps from max to min
+		float palette[16];
+		palette[0] = (float)maxValue;
+		palette[1] = (float)minValue;
+		for (int i = 1; i <= 6; ++i)
+		{
+			palette[i + 1] = (float)(((7 - i) * maxValue + i * minValue) / 7);
+		}
+		SelectPaletteIndices(texels, palette, 1, 8, indices);
+	}
+
+	output[0] = (unsigned char)maxValue;
+	output[1] = (unsigned char)minValue;
+	uint64_t indexBits = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		indexBits |= (uint64_t)indices[i] << (i * 3);
+	}
+	for (int i = 0; i < 6; ++i)
+	{
+		output[2 + i] = (unsigned char)(indexBits >> (i * 8));
+	}
+}
+
+// Decodes a BC4 block into one channel
+// @param	input	8-byte block
+// @param	block	RGBA8 texels to write into
+// @param	channel	Channel to write
+void DecodeBC4Block(const unsigned char input[8], unsigned char block[64], int channel)
+{
+	int endpoint0 = input[0];
+	int endpoint1 = input[1];
+	unsigned char palette[8];
+	palette[0] = (unsigned char)endpoint0;
+	palette[1] = (unsigned char)endpoint1;
+	if (endpoint0 > endpoint1)
+	{
+		for (int i = 1; i <= 6; ++i)
+		{
+			palette[i + 1] = (unsigned char)(((7 - i) * endpoint0 + i * endpoint1) / 7);
+		}
+	}
+	else
+	{
+		for (int i = 1; i <= 4; ++i)
+		{
+			palette[i + 1] = (unsigned char)(((5 - i) * endpoint0 + i * endpoint1) / 5);
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	uint64_t indexBits = 0;
+	for (int i = 0; i < 6; ++i)
+	{
+		indexBits |= (uint64_t)input[2 + i] << (i * 8);
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		block[i * 4 + channel] = palette[(indexBits >> (i * 3)) & 7];
+	}
+}
+
+// --- BC7 ---
+
+// Interpolation weights of 4-bit BC7 indices, out of 64
+const int kBC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Writes bits into a 128-bit BC7 block, least significant bit first
+struct BC7BitWriter
+{
+	unsigned char* output;
+	int position;
+
+	void Write(uint32_t value, int bitCount)
+	{
+		for (int i = 0; i < bitCount; ++i, ++position)
+		{
+			if (value & (1u << i))
+			{
+				output[position >> 3] |= (unsigned char)(1u << (position & 7));
+			}
+		}
+	}
+};
+
+// Reads bits from a 128-bit BC7 block, least significant bit first
+struct BC7BitReader
+{
+	const unsigned char* input;
+	int position;
+
+	uint32_t Read(int bitCount)
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < bitCount; ++i, ++position)
+		{
+			value |= (uint32_t)((input[position >> 3] >> (position & 7)) & 1) << i;
+		}
+		return value;
+	}
+};
+
+// Quantizes an RGBA endpoint to mode 6's 7 bits per channel plus a shared low bit, trying both values of that bit
+// @param	endpoint	Endpoint to quantize, in [0, 255]
+// @param	quantized	Receives the 7-bit channel values
+// @param	pBit		Receives the shared low bit
+void QuantizeBC7Mode6Endpoint(const float endpoint[4], int quantized[4], int& pBit)
+{
+	float bestError = 1e30f;
+	for (int p = 0; p < 2; ++p)
+	{
+		int candidate[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; ++c)
+		{
+			// The decoded value is (q << 1) | p
+			candidate[c] = glm::clamp((int)std::floor((endpoint[c] - p) / 2.0f + 0.5f), 0, 127);
+			float d = (float)((candidate[c] << 1) | p) - endpoint[c];
+			error += d * d;
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			pBit = p;
+			std::memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+}
+
+// Encodes a block as BC7 mode 6
+// @param	block	RGBA8 texels of the block
+// @param	output	Receives the 16-byte block
+void EncodeBC7Block(const unsigned char block[64], unsigned char output[16])
+{
+	float texels[64];
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			texels[c * 16 + i] = block[i * 4 + c];
+		}
+	}
+
+	float endpoint0[4], endpoint1[4];
+	FitBlockEndpoints(texels, 4, endpoint0, endpoint1);
+
+	float kWeights[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		kWeights[i] = kBC7Weights4[i] / 64.0f;
+	}
+
+	int bestQuantized[2][4] = {};
+	int bestPBits[2] = {};
+	int bestIndices[16] = {};
+	float bestError = 1e30f;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		int quantized[2][4];
+		int pBits[2];
+		QuantizeBC7Mode6Endpoint(endpoint0, quantized[0], pBits[0]);
+		QuantizeBC7Mode6Endpoint(endpoint1, quantized[1], pBits[1]);
+
+		float palette[64];
+		for (int c = 0; c < 4; ++c)
+		{
+			int e0 = (quantized[0][c] << 1) | pBits[0];
+			int e1 = (quantized[1][c] << 1) | pBits[1];
+			for (int i = 0; i < 16; ++i)
+			{
+				palette[c * 16 + i] = (float)(((64 - kBC7Weights4[i]) * e0 + kBC7Weights4[i] * e1 + 32) >> 6);
+			}
+		}
+
+		int indices[16];
+		float error = SelectPaletteIndices(texels, palette, 4, 16, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			std::memcpy(bestQuantized, quantized, sizeof(quantized));
+			std::memcpy(bestPBits, pBits, sizeof(pBits));
+			std::memcpy(bestIndices, indices, sizeof(indices));
+		}
+
+		if (!RefitBlockEndpoints(texels, 4, indices, kWeights, endpoint0, endpoint1))
+		{
+			break;
+		}
+	}
+
+	// The first index is stored with its top bit implied to be 0, so swap the endpoints if it is set
+	if (bestIndices[0] & 8)
+	{
+		std::swap(bestQuantized[0], bestQuantized[1]);
+		std::swap(bestPBits[0], bestPBits[1]);
+		for (int i = 0; i < 16; ++i)
+		{
+			bestIndices[i] = 15 - bestIndices[i];
+		}
+	}
+
+	std::memset(output, 0, 16);
+	BC7BitWriter writer = { output, 0 };
+
+	// Mode 6 is a 1 in bit 6
+	writer.Write(1 << 6, 7);
+	for (int c = 0; c < 4; ++c)
+	{
+		writer.Write(bestQuantized[0][c], 7);
+		writer.Write(bestQuantized[1][c], 7);
+	}
+	writer.Write(bestPBits[0], 1);
+	writer.Write(bestPBits[1], 1);
+	writer.Write(bestIndices[0], 3);
+	for (int i = 1; i < 16; ++i)
+	{
+		writer.Write(bestIndices[i], 4);
+	}
+}
+
+// Decodes a BC7 block. Only mode 6, which is all EncodeBC7Block produces, is supported.
+// Blocks in other modes decode to magenta so they stand out.
+// @param	input	16-byte block
+// @param	block	Receives the RGBA8 texels of the block
+void DecodeBC7Block(const unsigned char input[16], unsigned char block[64])
+{
+	if ((input[0] & 0x7f) != (1 << 6))
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			block[i * 4 + 0] = 255;
+			block[i * 4 + 1] = 0;
+			block[i * 4 + 2] = 255;
+			block[i * 4 + 3] = 255;
+		}
+		return;
+	}
+
+	BC7BitReader reader = { input, 7 };
+	int endpoints[2][4];
+	for (int c = 0; c < 4; ++c)
+	{
+		endpoints[0][c] = reader.Read(7);
+		endpoints[1][c] = reader.Read(7);
+	}
+	int pBit0 = reader.Read(1);
+	int pBit1 = reader.Read(1);
+	for (int c = 0; c < 4; ++c)
+	{
+		endpoints[0][c] = (endpoints[0][c] << 1) | pBit0;
+		endpoints[1][c] = (endpoints[1][c] << 1) | pBit1;
+	}
+
+	for (int i = 0; i < 16; ++i)
+	{
+		int index = reader.Read(i == 0 ? 3 : 4);
+		int weight = kBC7Weights4[index];
+		for (int c = 0; c < 4; ++c)
+		{
+			block[i * 4 + c] = (unsigned char)(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+		}
+	}
+}
+
+// --- Images ---
+
+// Encodes one block in the given format
+void EncodeBlock(BlockFormat format, const unsigned char block[64], unsigned char* output)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+		EncodeBC1Block(block, output);
+		break;
+	case BlockFormat::BC3:
+		EncodeBC4Block(block, 3, output);
+		EncodeBC1Block(block, output + 8);
+		break;
+	case BlockFormat::BC4:
+		EncodeBC4Block(block, 0, output);
+		break;
+	case BlockFormat::BC5:
+		EncodeBC4Block(block, 0, output);
+		EncodeBC4Block(block, 1, output + 8);
+		break;
+	case BlockFormat::BC7:
+		EncodeBC7Block(block, output);
+		break;
+	}
+}
+
+// Decodes one block in the given format. Channels the format doesn't store are 0, except alpha which is 255.
+void DecodeBlock(BlockFormat format, const unsigned char* input, unsigned char block[64])
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+		DecodeBC1Block(input, block);
+		break;
+	case BlockFormat::BC3:
+		DecodeBC1Block(input + 8, block);
+		DecodeBC4Block(input, block, 3);
+		break;
+	case BlockFormat::BC4:
+	case BlockFormat::BC5:
+		for (int i = 0; i < 16; ++i)
+		{
+			block[i * 4 + 0] = 0;
+			block[i * 4 + 1] = 0;
+			block[i * 4 + 2] = 0;
+			block[i * 4 + 3] = 255;
+		}
+		DecodeBC4Block(input, block, 0);
+		if (format == BlockFormat::BC5)
+		{
+			DecodeBC4Block(input + 8, block, 1);
+		}
+		break;
+	case BlockFormat::BC7:
+		DecodeBC7Block(input, block);
+		break;
+	}
+}
+
+// Compresses an RGBA8 image, splitting the rows of blocks across threads
+// @param	pixels		RGBA8 texels
+// @param	width		Width of the image
+// @param	height		Height of the image
+// @param	format		Block format to compress to. BC4 takes the red channel, BC5 red and green.
+// @param	threadCount	Number of threads to use, or 0 for one per core
+// @return	Returns the compressed blocks, row by row
+std::vector<unsigned char> CompressImage(const unsigned char* pixels, int width, int height, BlockFormat format, int threadCount = 0)
+{
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	size_t blockSize = GetBlockSize(format);
+	std::vector<unsigned char> output((size_t)blocksX * blocksY * blockSize);
+
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	threadCount = std::min(threadCount, blocksY);
+
+	std::atomic<int> nextRow(0);
+	auto worker = [&]()
+	{
+		unsigned char block[64];
+		for (int by = nextRow++; by < blocksY; by = nextRow++)
+		{
+			for (int bx = 0; bx < blocksX; ++bx)
+			{
+				FetchBlock(pixels, width, height, bx, by, block);
+				EncodeBlock(format, block, &output[((size_t)by * blocksX + bx) * blockSize]);
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < threadCount; ++i)
+	{
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	return output;
+}
+
+// Decodes a compressed image back to RGBA8
+std::vector<unsigned char> DecompressImage(const unsigned char* data, int width, int height, BlockFormat format)
+{
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	size_t blockSize = GetBlockSize(format);
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+
+	unsigned char block[64];
+	for (int by = 0; by < blocksY; ++by)
+	{
+		for (int bx = 0; bx < blocksX; ++bx)
+		{
+			DecodeBlock(format, &data[((size_t)by * blocksX + bx) * blockSize], block);
+
+			// Blocks that hang over the edge only write the texels inside the image
+			for (int y = 0; y < 4 && by * 4 + y < height; ++y)
+			{
+				int columns = std::min(4, width - bx * 4);
+				std::memcpy(&pixels[(((size_t)by * 4 + y) * width + bx * 4) * 4], &block[y * 16], columns * 4);
+			}
+		}
+	}
+	return pixels;
+}
+
+// Compresses every level of a mip chain
+std::vector<CompressedLevel> CompressMipChain(const std::vector<MipLevel>& levels, BlockFormat format, int threadCount = 0)
+{
+	std::vector<CompressedLevel> compressed;
+	for (const MipLevel& level : levels)
+	{
+		compressed.push_back({ level.width, level.height, CompressImage(level.pixels.data(), level.width, level.height, format, threadCount) });
+	}
+	return compressed;
+}
+
+// Sums the size of every level of a compressed mip chain, in bytes
+size_t GetCompressedMipChainSize(const std::vector<CompressedLevel>& levels)
+{
+	size_t size = 0;
+	for (const CompressedLevel& level : levels)
+	{
+		size += level.data.size();
+	}
+	return size;
+}
+
+// Checks whether the driver can sample a block format directly
+bool IsBlockFormatSupported(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+	case BlockFormat::BC3:
+		return glExtensions.textureCompressionS3TC;
+	case BlockFormat::BC4:
+	case BlockFormat::BC5:
+		// RGTC is core since GL 3.0
+		return true;
+	case BlockFormat::BC7:
+		return glExtensions.textureCompressionBPTC;
+	default:
+		return false;
+	}
+}
+
+// Gets the GL internal format of a block format
+GLenum GetBlockFormatGLFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:	return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BlockFormat::BC3:	return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BlockFormat::BC4:	return GL_COMPRESSED_RED_RGTC1;
+	case BlockFormat::BC5:	return GL_COMPRESSED_RG_RGTC2;
+	case BlockFormat::BC7:	return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default:				return 0;
+	}
+}
+
+// Gets the uncompressed internal format used when the driver can't sample a block format
+GLenum GetBlockFormatFallbackFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC4:	return GL_R8;
+	case BlockFormat::BC5:	return GL_RG8;
+	default:				return GL_RGBA8;
+	}
+}
+
+// Decodes a compressed mip level in software and uploads it uncompressed to the currently bound texture,
+// for block formats the driver can't sample
+// @param	target		GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY to upload every layer
+// @param	level		Mip level to upload
+// @param	data		Compressed blocks of the level, layer after layer
+// @param	width		Width of the level
+// @param	height		Height of the level
+// @param	layerCount	Number of layers in data, 1 for GL_TEXTURE_2D
+// @param	format		Block format of the data
+// @return	Returns the size of the level in GPU memory, in bytes
+size_t UploadDecompressedLevel(GLenum target, GLint level, const unsigned char* data, int width, int height, int layerCount, BlockFormat format)
+{
+	GLenum fallbackFormat = GetBlockFormatFallbackFormat(format);
+	size_t layerSize = GetCompressedImageSize(format, width, height);
+	std::vector<unsigned char> pixels;
+	for (int layer = 0; layer < layerCount; ++layer)
+	{
+		std::vector<unsigned char> layerPixels = DecompressImage(data + layer * layerSize, width, height, format);
+		pixels.insert(pixels.end(), layerPixels.begin(), layerPixels.end());
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (target == GL_TEXTURE_2D_ARRAY)
+	{
+		glTexImage3D(target, level, fallbackFormat, width, height, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	}
+	else
+	{
+		glTexImage2D(target, level, fallbackFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	}
+	return (size_t)width * height * layerCount * (fallbackFormat == GL_R8 ? 1 : fallbackFormat == GL_RG8 ? 2 : 4);
+}
+
+// Uploads a compressed mip chain to the currently bound GL_TEXTURE_2D, and turns on trilinear filtering.
+// Formats the driver can't sample are decoded in software and uploaded uncompressed.
+// @param	levels	Mip chain, base level first
+// @param	format	Block format of the levels
+// @return	Returns the size of the texture in GPU memory, in bytes
+size_t UploadCompressedMipChain(const std::vector<CompressedLevel>& levels, BlockFormat format)
+{
+	size_t size = 0;
+	bool supported = IsBlockFormatSupported(format);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		const CompressedLevel& level = levels[i];
+		if (supported)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, GetBlockFormatGLFormat(format), level.width, level.height, 0,
+				(GLsizei)level.data.size(), level.data.data());
+			size += level.data.size();
+		}
+		else
+		{
+			size += UploadDecompressedLevel(GL_TEXTURE_2D, (GLint)i, level.data.data(), level.width, level.height, 1, format);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	return size;
+}
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CookedTexture.h"
+#include "GLResources.h"
+#include "TextureStreaming.h"
+
+// Keeps streamed textures within a GPU memory budget. The renderer reports every texture it draws with and how large
+// it appears on screen, which decides the most detailed mip level the texture needs. When the textures take more than
+// the budget, the least recently used ones lose their most detailed levels first, down to their smallest level, which
+// always stays. Textures drawn with more detail than they have are missed, and get their levels streamed back in.
+
+// What happened to the textures during one frame
+struct TextureResidencyStats
+{
+	// GPU memory of the tracked textures at the end of the frame
+	size_t residentBytes;
+
+	// Levels dropped to stay within the budget
+	int evictions;
+
+	// Textures drawn with less detail than they needed
+	int misses;
+
+	// Textures whose missing levels started streaming in
+	int reloads;
+};
+
+// A texture whose mip levels are kept within the budget
+struct ResidentTexture
+{
+	GLResourceHandle texture;
+
+	// How the texture was streamed, to stream its levels back in the same way
+	GLenum target;
+	std::vector<CookedTextureSource> layers;
+	std::string arrayPath;
+
+	// Size of the base level, known once the first level is uploaded
+	int width;
+	int height;
+
+	// GPU memory of each level, 0 for levels that aren't in the texture
+	std::vector<size_t> levelBytes;
+
+	// Most detailed level in the texture, or the level count if it has none yet
+	int residentLevel;
+	size_t residentBytes;
+
+	// Whether levels are streaming into the texture. Levels aren't dropped until they have all landed.
+	bool streaming;
+
+	// Whether the texture failed to load, so it isn't tried again every frame
+	bool failed;
+
+	// Estimated GPU memory of the levels streaming back in
+	size_t pendingBytes;
+
+	// Frame the texture was last drawn with, or -1
+	int64_t lastUsedFrame;
+
+	// Largest size the texture appeared at on screen in that frame, in pixels along its longer side
+	float projectedPixels;
+};
+
+struct TextureResidency
+{
+	// GPU memory the tracked textures may take
+	size_t budgetBytes;
+
+	std::vector<ResidentTexture> textures;
+
+	// Index in textures of the texture in each GL resource slot, or -1
+	std::vector<int> slotTextures;
+
+	// Frame counter, advanced by UpdateTextureResidency
+	int64_t frame;
+
+	size_t residentBytes;
+
+	// Stats of the last frame
+	TextureResidencyStats frameStats;
+};
+
+// @param	residency	Residency manager to set up
+// @param	budgetBytes	GPU memory the tracked textures may take
+void CreateTextureResidency(TextureResidency& residency, size_t budgetBytes)
+{
+	residency.budgetBytes = budgetBytes;
+	residency.frame = 0;
+	residency.residentBytes = 0;
+	residency.frameStats = {};
+}
+
+// Finds the tracked texture of a handle
+// @return	Returns its index in residency.textures, or -1 if it isn't tracked
+int FindResidentTexture(const TextureResidency& residency, GLResourceHandle texture)
+{
+	if (texture.index >= residency.slotTextures.size())
+	{
+		return -1;
+	}
+	int index = residency.slotTextures[texture.index];
+	return (index >= 0 && residency.textures[index].texture.generation == texture.generation) ? index : -1;
+}
+
+// Starts keeping a texture within the budget. Call right after starting to stream it in with StreamTexture or StreamTextureArray,
+// with the same layers and array path.
+// @param	residency	Residency manager to track the texture with
+// @param	texture		Texture being streamed in
+// @param	target		GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+// @param	layers		Textures it is streamed from, one per layer
+// @param	arrayPath	Path of the cooked texture array, for GL_TEXTURE_2D_ARRAY
+void TrackTextureResidency(TextureResidency& residency, GLResourceHandle texture, GLenum target,
+	const std::vector<CookedTextureSource>& layers, const std::string& arrayPath)
+{
+	if (FindResidentTexture(residency, texture) >= 0)
+	{
+		return;
+	}
+
+	ResidentTexture resident = {};
+	resident.texture = texture;
+	resident.target = target;
+	resident.layers = layers;
+	resident.arrayPath = arrayPath;
+	resident.streaming = true;
+	resident.lastUsedFrame = -1;
+
+	if (texture.index >= residency.slotTextures.size())
+	{
+		residency.slotTextures.resize(texture.index + 1, -1);
+	}
+	residency.slotTextures[texture.index] = (int)residency.textures.size();
+	residency.textures.push_back(resident);
+}
+
+// Records that a texture is drawn with this frame. Call for every draw, or at least with the largest size the texture appears at.
+// @param	residency		Residency manager tracking the texture
+// @param	texture			Texture drawn with. Untracked textures are ignored.
+// @param	projectedPixels	Size of the texture's full extent on screen, in pixels along its longer side
+void UseResidentTexture(TextureResidency& residency, GLResourceHandle texture, float projectedPixels)
+{
+	int index = FindResidentTexture(residency, texture);
+	if (index < 0)
+	{
+		return;
+	}
+
+	ResidentTexture& resident = residency.textures[index];
+	if (resident.lastUsedFrame != residency.frame)
+	{
+		resident.lastUsedFrame = residency.frame;
+		resident.projectedPixels = projectedPixels;
+	}
+	else
+	{
+		resident.projectedPixels = std::max(resident.projectedPixels, projectedPixels);
+	}
+}
+
+// Estimates how large something appears on screen with a perspective projection
+// @param	worldSize		Size of the thing in world units
+// @param	distance		Distance from the camera to it
+// @param	fovY			Vertical field of view, in radians
+// @param	viewportHeight	Height of the viewport in pixels
+// @return	Returns its size in pixels
+float EstimateProjectedPixels(float worldSize, float distance, float fovY, int viewportHeight)
+{
+	// Up close the thing covers the screen, and the base level is needed anyway
+	distance = std::max(distance, 1e-3f);
+	return worldSize / (2.0f * distance * std::tan(fovY * 0.5f)) * viewportHeight;
+}
+
+// Finds the most detailed level a texture needs to be drawn at the size it appeared at this frame.
+// Levels that have more texels than the texture covers pixels would only be minified away.
+int GetRequiredTextureLevel(const ResidentTexture& resident)
+{
+	int levelCount = (int)resident.levelBytes.size();
+	float texels = (float)std::max(resident.width, resident.height);
+	if (levelCount == 0 || resident.projectedPixels >= texels)
+	{
+		return 0;
+	}
+	int level = (int)std::floor(std::log2(texels / std::max(resident.projectedPixels, 1.0f)));
+	return std::min(std::max(level, 0), levelCount - 1);
+}
+
+// Estimates the GPU memory of a level, from the bytes per texel of the levels the texture has
+size_t EstimateTextureLevelBytes(const ResidentTexture& resident, int level)
+{
+	int known = std::min(resident.residentLevel, (int)resident.levelBytes.size() - 1);
+	if (known < 0 || resident.levelBytes[known] == 0)
+	{
+		return 0;
+	}
+	double knownTexels = (double)std::max(resident.width >> known, 1) * std::max(resident.height >> known, 1);
+	double texels = (double)std::max(resident.width >> level, 1) * std::max(resident.height >> level, 1);
+	return (size_t)(resident.levelBytes[known] * texels / knownTexels);
+}
+
+// Records the levels the streamer uploaded and the requests it finished
+void ApplyTextureStreamEvents(TextureResidency& residency, const TextureStreamer& streamer)
+{
+	for (const TextureStreamEvent& event : streamer.events)
+	{
+		int index = FindResidentTexture(residency, event.texture);
+		if (index < 0)
+		{
+			continue;
+		}
+
+		ResidentTexture& resident = residency.textures[index];
+		if (!event.failed)
+		{
+			// Shifting a level's size back up would round non-power-of-two sizes, so the header's is used
+			resident.width = event.baseWidth;
+			resident.height = event.baseHeight;
+		}
+		if (event.level < 0)
+		{
+			resident.streaming = false;
+			resident.failed = event.failed;
+			resident.pendingBytes = 0;
+			continue;
+		}
+
+		if ((int)resident.levelBytes.size() != event.levelCount)
+		{
+			// First level of the texture, or it was cooked again with a different number of levels
+			residency.residentBytes -= resident.residentBytes;
+			resident.levelBytes.assign(event.levelCount, 0);
+			resident.residentLevel = event.levelCount;
+			resident.residentBytes = 0;
+		}
+		resident.residentBytes += event.bytes - resident.levelBytes[event.level];
+		residency.residentBytes += event.bytes - resident.levelBytes[event.level];
+		resident.levelBytes[event.level] = event.bytes;
+		resident.residentLevel = std::min(resident.residentLevel, event.level);
+		resident.pendingBytes -= std::min(resident.pendingBytes, event.bytes);
+	}
+}
+
+// Drops the most detailed level of a texture, keeping the texture complete with the levels below it.
+// Textures are created with glTexImage, so a level can be released by redefining it as empty.
+// Changes the texture binding of the active texture unit.
+void EvictTextureLevel(TextureResidency& residency, GLResourceManager& resources, ResidentTexture& resident)
+{
+	int level = resident.residentLevel;
+	GLenum target = resident.target;
+	glBindTexture(target, GetGLResourceName(resources, resident.texture));
+
+	// Sampling moves off the level before it goes
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, level + 1);
+
+	GLint internalFormat = 0, compressed = GL_FALSE;
+	glGetTexLevelParameteriv(target, level, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	glGetTexLevelParameteriv(target, level, GL_TEXTURE_COMPRESSED, &compressed);
+	if (target == GL_TEXTURE_2D_ARRAY && compressed)
+	{
+		glCompressedTexImage3D(target, level, (GLenum)internalFormat, 0, 0, 0, 0, 0, nullptr);
+	}
+	else if (target == GL_TEXTURE_2D_ARRAY)
+	{
+		glTexImage3D(target, level, internalFormat, 0, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+	else if (compressed)
+	{
+		glCompressedTexImage2D(target, level, (GLenum)internalFormat, 0, 0, 0, 0, nullptr);
+	}
+	else
+	{
+		glTexImage2D(target, level, internalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+
+	resident.residentBytes -= resident.levelBytes[level];
+	residency.residentBytes -= resident.levelBytes[level];
+	resident.levelBytes[level] = 0;
+	++resident.residentLevel;
+	SetGLResourceMemory(resources, resident.texture, resident.residentBytes);
+	++residency.frameStats.evictions;
+}
+
+// Forgets the textures that were destroyed
+void RemoveDestroyedResidentTextures(TextureResidency& residency, GLResourceManager& resources)
+{
+	for (size_t i = 0; i < residency.textures.size();)
+	{
+		ResidentTexture& resident = residency.textures[i];
+		if (IsGLResourceValid(resources, resident.texture))
+		{
+			++i;
+			continue;
+		}
+
+		residency.residentBytes -= resident.residentBytes;
+		residency.slotTextures[resident.texture.index] = -1;
+		if (i + 1 < residency.textures.size())
+		{
+			resident = std::move(residency.textures.back());
+			residency.slotTextures[resident.texture.index] = (int)i;
+		}
+		residency.textures.pop_back();
+	}
+}
+
+// Drops levels of the least recently used textures and streams in the levels that drawn textures were missing.
+// Call once per frame on the GL thread, after UpdateTextureStreamer, with the textures drawn since the last call reported by UseResidentTexture.
+// Changes the GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings of the active texture unit.
+// @param	residency	Residency manager to update
+// @param	streamer	Streamer the textures are streamed with
+// @param	resources	Manager that owns the textures
+// @return	Returns what happened to the textures this frame
+TextureResidencyStats UpdateTextureResidency(TextureResidency& residency, TextureStreamer& streamer, GLResourceManager& resources)
+{
+	residency.frameStats = {};
+	ApplyTextureStreamEvents(residency, streamer);
+	RemoveDestroyedResidentTextures(residency, resources);
+
+	// Find the textures drawn this frame with less detail than they needed, and what their missing levels would take
+	std::vector<int> missed;
+	size_t pendingBytes = 0, missingBytes = 0;
+	for (size_t i = 0; i < residency.textures.size(); ++i)
+	{
+		ResidentTexture& resident = residency.textures[i];
+		pendingBytes += resident.pendingBytes;
+		if (resident.lastUsedFrame != residency.frame || resident.failed || resident.levelBytes.empty())
+		{
+			continue;
+		}
+
+		int requiredLevel = GetRequiredTextureLevel(resident);
+		if (requiredLevel < resident.residentLevel)
+		{
+			++residency.frameStats.misses;
+			if (!resident.streaming)
+			{
+				missed.push_back((int)i);
+				for (int level = requiredLevel; level < resident.residentLevel; ++level)
+				{
+					missingBytes += EstimateTextureLevelBytes(resident, level);
+				}
+			}
+		}
+	}
+
+	// Make room, least recently used textures first. Textures drawn this frame keep the levels they need,
+	// and every texture keeps its smallest level, so there is always something to sample.
+	if (residency.residentBytes + pendingBytes + missingBytes > residency.budgetBytes)
+	{
+		std::vector<int> order;
+		for (size_t i = 0; i < residency.textures.size(); ++i)
+		{
+			if (!residency.textures[i].streaming)
+			{
+				order.push_back((int)i);
+			}
+		}
+		std::sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			return residency.textures[a].lastUsedFrame < residency.textures[b].lastUsedFrame;
+		});
+
+		for (int index : order)
+		{
+			ResidentTexture& resident = residency.textures[index];
+			int keepLevel = resident.lastUsedFrame == residency.frame ? GetRequiredTextureLevel(resident) : (int)resident.levelBytes.size() - 1;
+			while (resident.residentLevel < keepLevel && residency.residentBytes + pendingBytes + missingBytes > residency.budgetBytes)
+			{
+				EvictTextureLevel(residency, resources, resident);
+			}
+			if (residency.residentBytes + pendingBytes + missingBytes <= residency.budgetBytes)
+			{
+				break;
+			}
+		}
+	}
+
+	// Stream the missing levels back in, as many as fit in the budget. The rest are tried again next frame.
+	for (int index : missed)
+	{
+		ResidentTexture& resident = residency.textures[index];
+		int finestLevel = GetRequiredTextureLevel(resident);
+		size_t bytes = 0;
+		for (int level = finestLevel; level < resident.residentLevel; ++level)
+		{
+			bytes += EstimateTextureLevelBytes(resident, level);
+		}
+		while (finestLevel < resident.residentLevel && residency.residentBytes + pendingBytes + bytes > residency.budgetBytes)
+		{
+			bytes -= EstimateTextureLevelBytes(resident, finestLevel);
+			++finestLevel;
+		}
+		if (finestLevel >= resident.residentLevel)
+		{
+			continue;
+		}
+
+		StreamTextureLevels(streamer, resources, resident.texture, resident.target, resident.layers, resident.arrayPath,
+			resident.residentLevel - 1, finestLevel, resident.residentBytes);
+		resident.streaming = true;
+		resident.pendingBytes = bytes;
+		pendingBytes += bytes;
+		++residency.frameStats.reloads;
+	}
+
+	residency.frameStats.residentBytes = residency.residentBytes;
+	++residency.frame;
+	return residency.frameStats;
+}
+
+// Prints the stats of the last frame
+void PrintTextureResidencyStats(const TextureResidency& residency)
+{
+	const TextureResidencyStats& stats = residency.frameStats;
+	std::cout << "Texture residency: " << stats.residentBytes / 1024 << " of " << residency.budgetBytes / 1024 << " KiB, "
+		<< stats.evictions << " levels evicted, " << stats.misses << " misses, " << stats.reloads << " reloads" << std::endl;
+}
+
+void DeleteTextureResidency(TextureResidency& residency)
+{
+	residency = {};
+}
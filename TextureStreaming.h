@@ -0,0 +1,544 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CookedTexture.h"
+#include "GLResources.h"
+
+// Streams textures in without blocking the GL thread. Worker threads map (and if needed cook) the textures,
+// and the GL thread uploads them a mip level at a time, smallest first, within a time budget per frame.
+// Until its first level arrives a texture shows a 1x1 placeholder colour, and it then sharpens as levels land.
+// Levels that were dropped to save memory can be streamed back in the same way, on top of the levels still there.
+
+// Link in the queue of loaded textures
+struct TextureStreamNode
+{
+	std::atomic<TextureStreamNode*> next;
+};
+
+// Lock-free queue with many producers (the workers) and one consumer (the GL thread).
+// Producers swap themselves in at the head, the consumer follows the links from the tail.
+struct TextureStreamQueue
+{
+	std::atomic<TextureStreamNode*> head;
+	TextureStreamNode* tail;
+
+	// Always-present node, so the queue is never really empty and pushes never need the consumer's cooperation
+	TextureStreamNode stub;
+};
+
+// A texture being streamed in
+struct StreamedTexture : TextureStreamNode
+{
+	// Texture to fill. If it is destroyed while streaming, the rest of the stream is dropped.
+	GLResourceHandle texture;
+
+	// GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY with every layer packed into arrayPath
+	GLenum target;
+	std::vector<CookedTextureSource> layers;
+	std::string arrayPath;
+
+	// Filled in by the worker
+	CookedTexture cooked;
+	bool loaded;
+
+	// Next mip level to upload. Levels go from the smallest to the base level.
+	int nextLevel;
+
+	// Range of levels to upload. coarsestLevel is -1 for the smallest level of the cooked texture,
+	// and is only set when the levels below it are already in the texture.
+	int coarsestLevel;
+	int finestLevel;
+
+	// GPU memory of the levels already in the texture, and of the levels uploaded so far
+	size_t residentBytes;
+	size_t uploadedBytes;
+};
+
+// A mip level the streamer uploaded, or the end of a request, for whoever keeps track of what is in GPU memory
+struct TextureStreamEvent
+{
+	GLResourceHandle texture;
+
+	// Level uploaded, or -1 when the request finished
+	int level;
+
+	// Size of the level, or of the base level when the request finished
+	int width;
+	int height;
+	size_t bytes;
+
+	// Size of the base level from the cooked header, in every event
+	int baseWidth;
+	int baseHeight;
+
+	int levelCount;
+
+	// Whether the request finished without loading the texture
+	bool failed;
+};
+
+struct TextureStreamer
+{
+	std::vector<std::thread> workers;
+
+	// Requests waiting for a worker
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<StreamedTexture*> pending;
+	bool stopping;
+
+	// Requests the workers are done with, waiting to be uploaded
+	TextureStreamQueue loaded;
+
+	// Requests with levels left to upload. Only touched by the GL thread.
+	std::vector<StreamedTexture*> uploading;
+
+	// Staging buffer for uploads, orphaned for every level so the driver never stalls on an upload in flight
+	GLResourceHandle pixelBuffer;
+
+	// Time the GL thread may spend uploading per frame. At least one level is uploaded per frame regardless.
+	double uploadBudgetMs;
+
+	// Requests that haven't finished uploading yet
+	int inFlight;
+
+	// Levels uploaded and requests finished during the last UpdateTextureStreamer
+	std::vector<TextureStreamEvent> events;
+};
+
+void CreateTextureStreamQueue(TextureStreamQueue& queue)
+{
+	queue.stub.next.store(nullptr, std::memory_order_relaxed);
+	queue.head.store(&queue.stub, std::memory_order_relaxed);
+	queue.tail = &queue.stub;
+}
+
+// Adds a node to the queue. Safe to call from any number of threads at once.
+void PushTextureStreamQueue(TextureStreamQueue& queue, TextureStreamNode* node)
+{
+	node->next.store(nullptr, std::memory_order_relaxed);
+	TextureStreamNode* previous = queue.head.exchange(node, std::memory_order_acq_rel);
+	previous->next.store(node, std::memory_order_release);
+}
+
+// Takes the oldest node from the queue. Must only be called from one thread.
+// @return	Returns the node, or nullptr if the queue is empty or the next push hasn't been linked in yet
+TextureStreamNode* PopTextureStreamQueue(TextureStreamQueue& queue)
+{
+	TextureStreamNode* tail = queue.tail;
+	TextureStreamNode* next = tail->next.load(std::memory_order_acquire);
+	if (tail == &queue.stub)
+	{
+		if (!next)
+		{
+			return nullptr;
+		}
+		queue.tail = next;
+		tail = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if (next)
+	{
+		queue.tail = next;
+		return tail;
+	}
+
+	// The tail is the last node. It can only be handed out once the stub is behind it,
+	// and if a producer is halfway through a push it has to be waited for next time.
+	if (tail != queue.head.load(std::memory_order_acquire))
+	{
+		return nullptr;
+	}
+	PushTextureStreamQueue(queue, &queue.stub);
+	next = tail->next.load(std::memory_order_acquire);
+	if (next)
+	{
+		queue.tail = next;
+		return tail;
+	}
+	return nullptr;
+}
+
+// Loads queued textures until the streamer stops
+void RunTextureStreamWorker(TextureStreamer& streamer)
+{
+	// Decode textures as stored, whatever another thread sets stb_image's global flags to in the meantime
+	stbi_set_flip_vertically_on_load_thread(0);
+	stbi_set_unpremultiply_on_load_thread(0);
+	stbi_convert_iphone_png_to_rgb_thread(0);
+
+	// The workers already decode several textures at once, so each decode stays on its worker
+	stbi_set_parallel_for_thread(nullptr, nullptr, 0);
+
+	while (true)
+	{
+		StreamedTexture* request;
+		{
+			std::unique_lock<std::mutex> lock(streamer.mutex);
+			streamer.wake.wait(lock, [&]() { return streamer.stopping || !streamer.pending.empty(); });
+			if (streamer.stopping)
+			{
+				return;
+			}
+			request = streamer.pending.front();
+			streamer.pending.pop_front();
+		}
+
+		if (request->target == GL_TEXTURE_2D_ARRAY)
+		{
+			request->loaded = LoadCookedTextureArray(request->layers, request->arrayPath, request->cooked);
+		}
+		else
+		{
+			request->loaded = LoadCookedTexture(request->layers[0], request->cooked);
+		}
+		PushTextureStreamQueue(streamer.loaded, request);
+	}
+}
+
+// Starts the texture streaming workers
+// @param	streamer		Streamer to start
+// @param	resources		Manager to create the staging buffer with
+// @param	threadCount		Number of worker threads, or 0 for one per core (leaving one for the GL thread)
+// @param	uploadBudgetMs	Time the GL thread may spend uploading per frame, in milliseconds
+void CreateTextureStreamer(TextureStreamer& streamer, GLResourceManager& resources, int threadCount = 0, double uploadBudgetMs = 2.0)
+{
+	streamer.stopping = false;
+	streamer.uploadBudgetMs = uploadBudgetMs;
+	streamer.inFlight = 0;
+	streamer.pixelBuffer = CreateGLResource(resources, GLResourceType::Buffer);
+	CreateTextureStreamQueue(streamer.loaded);
+
+	if (threadCount <= 0)
+	{
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	}
+	for (int i = 0; i < threadCount; ++i)
+	{
+		streamer.workers.emplace_back(RunTextureStreamWorker, std::ref(streamer));
+	}
+}
+
+// Fills a texture with a single texel, to sample until its real contents are streamed in.
+// Texture arrays get a single layer, which every layer index clamps to.
+// @param	target	GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+// @param	texture	Texture to fill
+// @param	color	RGBA8 colour of the texel
+void SetPlaceholderTexture(GLenum target, GLuint texture, const unsigned char color[4])
+{
+	glBindTexture(target, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (target == GL_TEXTURE_2D_ARRAY)
+	{
+		glTexImage3D(target, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, color);
+	}
+	else
+	{
+		glTexImage2D(target, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, color);
+	}
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	GLint swizzle[] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+	glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+// Shows a placeholder in a texture, unless placeholder is nullptr, and hands the request to the workers
+void QueueStreamedTexture(TextureStreamer& streamer, GLResourceManager& resources, StreamedTexture* request, const unsigned char placeholder[4])
+{
+	if (placeholder)
+	{
+		SetPlaceholderTexture(request->target, GetGLResourceName(resources, request->texture), placeholder);
+		SetGLResourceMemory(resources, request->texture, 4);
+	}
+
+	request->loaded = false;
+	request->uploadedBytes = 0;
+	++streamer.inFlight;
+
+	{
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		streamer.pending.push_back(request);
+	}
+	streamer.wake.notify_one();
+}
+
+// Starts streaming a cooked texture into a texture, which shows a placeholder colour in the meantime
+// @param	streamer	Streamer to load the texture with
+// @param	resources	Manager that owns the texture
+// @param	texture		GL_TEXTURE_2D texture to fill
+// @param	sourcePath	Path of the source image, cooked if the cooked texture is missing or stale
+// @param	cookedPath	Path of the cooked texture
+// @param	settings	How to cook the texture
+// @param	placeholder	RGBA8 colour to show until the texture is loaded
+void StreamTexture(TextureStreamer& streamer, GLResourceManager& resources, GLResourceHandle texture, const std::string& sourcePath,
+	const std::string& cookedPath, const CookedTextureSettings& settings, const unsigned char placeholder[4])
+{
+	StreamedTexture* request = new StreamedTexture();
+	request->texture = texture;
+	request->target = GL_TEXTURE_2D;
+	request->layers.push_back({ sourcePath, cookedPath, settings });
+	request->coarsestLevel = -1;
+	request->finestLevel = 0;
+	request->residentBytes = 0;
+	QueueStreamedTexture(streamer, resources, request, placeholder);
+}
+
+// Starts streaming cooked textures into the layers of a texture array, which shows a placeholder colour in the meantime
+// @param	streamer	Streamer to load the texture with
+// @param	resources	Manager that owns the texture
+// @param	texture		GL_TEXTURE_2D_ARRAY texture to fill
+// @param	layers		Textures to load, one per layer. They must share their format and size.
+// @param	arrayPath	Path of the cooked texture array, packed from the layers if it is missing or stale
+// @param	placeholder	RGBA8 colour to show until the texture is loaded
+void StreamTextureArray(TextureStreamer& streamer, GLResourceManager& resources, GLResourceHandle texture,
+	const std::vector<CookedTextureSource>& layers, const std::string& arrayPath, const unsigned char placeholder[4])
+{
+	StreamedTexture* request = new StreamedTexture();
+	request->texture = texture;
+	request->target = GL_TEXTURE_2D_ARRAY;
+	request->layers = layers;
+	request->arrayPath = arrayPath;
+	request->coarsestLevel = -1;
+	request->finestLevel = 0;
+	request->residentBytes = 0;
+	QueueStreamedTexture(streamer, resources, request, placeholder);
+}
+
+// Starts streaming levels back into a texture that still has the levels below them, e.g. after they were dropped to save memory.
+// The texture keeps sampling the levels it has until the finer ones land.
+// @param	streamer		Streamer to load the levels with
+// @param	resources		Manager that owns the texture
+// @param	texture			GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY texture to fill, as first streamed in
+// @param	target			Target of the texture
+// @param	layers			Textures the texture was streamed from, one per layer
+// @param	arrayPath		Path of the cooked texture array, for GL_TEXTURE_2D_ARRAY
+// @param	coarsestLevel	Level to start at, one finer than the most detailed level the texture has
+// @param	finestLevel		Level to stop at
+// @param	residentBytes	GPU memory of the levels the texture has
+void StreamTextureLevels(TextureStreamer& streamer, GLResourceManager& resources, GLResourceHandle texture, GLenum target,
+	const std::vector<CookedTextureSource>& layers, const std::string& arrayPath, int coarsestLevel, int finestLevel, size_t residentBytes)
+{
+	StreamedTexture* request = new StreamedTexture();
+	request->texture = texture;
+	request->target = target;
+	request->layers = layers;
+	request->arrayPath = arrayPath;
+	request->coarsestLevel = coarsestLevel;
+	request->finestLevel = finestLevel;
+	request->residentBytes = residentBytes;
+	QueueStreamedTexture(streamer, resources, request, nullptr);
+}
+
+// Uploads the next mip level of a streamed texture, and makes it the texture's most detailed level
+void UploadStreamedLevel(TextureStreamer& streamer, GLResourceManager& resources, StreamedTexture& request)
+{
+	const CookedTextureHeader& header = *request.cooked.header;
+	const CookedTextureLevel& level = request.cooked.levels[request.nextLevel];
+	const unsigned char* payload = request.cooked.file.data + level.offset;
+	bool compressed = IsCookedTextureCompressed(header.format);
+	BlockFormat blockFormat = GetCookedBlockFormat(header.format);
+	GLenum internalFormat, pixelFormat;
+	GetCookedTextureGLFormat(header.format, internalFormat, pixelFormat);
+
+	GLenum target = request.target;
+	GLsizei layerCount = (GLsizei)header.layerCount;
+	glBindTexture(target, GetGLResourceName(resources, request.texture));
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	size_t levelBytes;
+	if (compressed && !IsBlockFormatSupported(blockFormat))
+	{
+		levelBytes = UploadDecompressedLevel(target, request.nextLevel, payload, level.width, level.height, layerCount, blockFormat);
+	}
+	else
+	{
+		// Orphan the staging buffer and copy the level straight from the file mapping into it
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, GetGLResourceName(resources, streamer.pixelBuffer));
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)level.size, nullptr, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)level.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped)
+		{
+			std::memcpy(mapped, payload, (size_t)level.size);
+		}
+
+		// With the staging buffer bound, the data pointer is an offset into it
+		const void* data = nullptr;
+		if (!mapped || glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			data = payload;
+		}
+
+		if (target == GL_TEXTURE_2D_ARRAY && compressed)
+		{
+			glCompressedTexImage3D(target, request.nextLevel, GetBlockFormatGLFormat(blockFormat), level.width, level.height, layerCount, 0,
+				(GLsizei)level.size, data);
+		}
+		else if (target == GL_TEXTURE_2D_ARRAY)
+		{
+			glTexImage3D(target, request.nextLevel, internalFormat, level.width, level.height, layerCount, 0, pixelFormat, GL_UNSIGNED_BYTE, data);
+		}
+		else if (compressed)
+		{
+			glCompressedTexImage2D(target, request.nextLevel, GetBlockFormatGLFormat(blockFormat), level.width, level.height, 0,
+				(GLsizei)level.size, data);
+		}
+		else
+		{
+			glTexImage2D(target, request.nextLevel, internalFormat, level.width, level.height, 0, pixelFormat, GL_UNSIGNED_BYTE, data);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		levelBytes = (size_t)level.size;
+	}
+	request.uploadedBytes += levelBytes;
+	streamer.events.push_back({ request.texture, request.nextLevel, (int)level.width, (int)level.height, levelBytes,
+		(int)header.width, (int)header.height, (int)header.levelCount, false });
+
+	// The first level replaces the placeholder, so the sampling state switches to the cooked texture's
+	if (request.nextLevel == (int)header.levelCount - 1)
+	{
+		glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, (GLint)header.levelCount - 1);
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, (const GLint*)header.swizzle);
+	}
+
+	// Levels below the base level (including the placeholder at level 0) are ignored,
+	// so the texture is complete with every level uploaded so far
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, request.nextLevel);
+	--request.nextLevel;
+}
+
+// Finishes a streamed texture, successful or not
+void FinishStreamedTexture(TextureStreamer& streamer, GLResourceManager& resources, StreamedTexture* request)
+{
+	if (request->loaded)
+	{
+		// Does nothing if the texture was destroyed while streaming
+		SetGLResourceMemory(resources, request->texture, request->residentBytes + request->uploadedBytes);
+		const CookedTextureHeader& header = *request->cooked.header;
+		streamer.events.push_back({ request->texture, -1, (int)header.width, (int)header.height, 0,
+			(int)header.width, (int)header.height, (int)header.levelCount, false });
+	}
+	else
+	{
+		std::cout << "Failed to load texture " << (request->arrayPath.empty() ? request->layers[0].sourcePath : request->arrayPath) << std::endl;
+		streamer.events.push_back({ request->texture, -1, 0, 0, 0, 0, 0, 0, true });
+	}
+
+	CloseCookedTexture(request->cooked);
+	delete request;
+	--streamer.inFlight;
+}
+
+// Uploads loaded textures for up to the streamer's time budget, recording what it uploaded in the streamer's events.
+// Call once per frame on the GL thread.
+// Changes the GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings of the active texture unit.
+// @param	streamer	Streamer to update
+// @param	resources	Manager that owns the textures
+// @return	Returns the number of textures that are still streaming
+int UpdateTextureStreamer(TextureStreamer& streamer, GLResourceManager& resources)
+{
+	streamer.events.clear();
+	while (TextureStreamNode* node = PopTextureStreamQueue(streamer.loaded))
+	{
+		StreamedTexture* request = static_cast<StreamedTexture*>(node);
+		if (!request->loaded)
+		{
+			FinishStreamedTexture(streamer, resources, request);
+			continue;
+		}
+		// The cooked texture may have been cooked again with fewer levels since the texture was first streamed
+		int levelCount = (int)request->cooked.header->levelCount;
+		request->nextLevel = request->coarsestLevel < 0 ? levelCount - 1 : std::min(request->coarsestLevel, levelCount - 1);
+		request->finestLevel = std::min(request->finestLevel, request->nextLevel);
+		streamer.uploading.push_back(request);
+	}
+
+	// Upload a level of each texture in turn, so they all sharpen together
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t next = 0;
+	bool uploadedAny = false;
+	while (!streamer.uploading.empty())
+	{
+		double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (uploadedAny && elapsedMs >= streamer.uploadBudgetMs)
+		{
+			break;
+		}
+
+		next %= streamer.uploading.size();
+		StreamedTexture* request = streamer.uploading[next];
+		if (IsGLResourceValid(resources, request->texture))
+		{
+			UploadStreamedLevel(streamer, resources, *request);
+			uploadedAny = true;
+		}
+		else
+		{
+			// The texture was destroyed while it was streaming, so there is nothing left to fill
+			request->nextLevel = -1;
+		}
+
+		if (request->nextLevel < request->finestLevel)
+		{
+			streamer.uploading.erase(streamer.uploading.begin() + next);
+			FinishStreamedTexture(streamer, resources, request);
+		}
+		else
+		{
+			++next;
+		}
+	}
+
+	return streamer.inFlight;
+}
+
+// Stops the workers and drops every texture that hasn't finished streaming
+void DeleteTextureStreamer(TextureStreamer& streamer, GLResourceManager& resources)
+{
+	{
+		std::lock_guard<std::mutex> lock(streamer.mutex);
+		streamer.stopping = true;
+	}
+	streamer.wake.notify_all();
+	for (std::thread& worker : streamer.workers)
+	{
+		worker.join();
+	}
+	streamer.workers.clear();
+
+	for (StreamedTexture* request : streamer.pending)
+	{
+		delete request;
+	}
+	streamer.pending.clear();
+	while (TextureStreamNode* node = PopTextureStreamQueue(streamer.loaded))
+	{
+		streamer.uploading.push_back(static_cast<StreamedTexture*>(node));
+	}
+	for (StreamedTexture* request : streamer.uploading)
+	{
+		CloseCookedTexture(request->cooked);
+		delete request;
+	}
+	streamer.uploading.clear();
+	streamer.inFlight = 0;
+
+	DestroyGLResource(resources, streamer.pixelBuffer);
+}
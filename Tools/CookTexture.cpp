@@ -0,0 +1,100 @@
+// Cooks a texture ahead of time, so that the first launch doesn't have to.
+// The app cooks missing or stale textures into Cooked/ by itself, with the same code;
+// running this before shipping means the source images can be left out.
+//
+// Build it on its own, and run it from the project directory:
+//	cl /EHsc /I Libraries\glad\include /I Libraries\glm Tools\CookTexture.cpp Libraries\glad\src\glad.c
+//	CookTexture.exe container-diffuse.png Cooked\container-diffuse.ctex BC7 kaiser srgb container_specular.png r a
+//	CookTexture.exe container-normal2.png Cooked\container-normal2.ctex BC5 box normal
+//
+// Arguments after the content type come in threes, and pack a channel of another image into the texture:
+// the image, its channel, and the channel of the texture to put it in. Above, the specular mask goes into
+// the alpha of the diffuse map. RGBA8 textures only keep the channels they need, as R8, RG8, RGB8 or RGBA8.
+//
+// Cooked textures of the same format and size can then be packed into the texture array of a material batch:
+//	CookTexture.exe pack Cooked\MaterialBatch0-diffuse.ctex Cooked\container-diffuse.ctex
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../CookedTexture.h"
+
+#include <cstring>
+#include <iostream>
+
+// Packs cooked textures into one cooked texture array
+// @param	arrayPath	Path of the array to write
+// @param	layerPaths	Cooked textures to pack, one per layer
+// @param	layerCount	Number of layers
+// @return	Returns 0 on success, or 1 on failure
+int PackTextureArray(const char* arrayPath, char** layerPaths, int layerCount)
+{
+	std::vector<CookedTexture> layers(layerCount);
+	bool opened = true;
+	for (int i = 0; i < layerCount && opened; ++i)
+	{
+		opened = OpenCookedTexture(layerPaths[i], layers[i]);
+	}
+
+	// The sources aren't known here, so the array is not tied to them, and the app will repack it if it can
+	bool packed = opened && PackCookedTextureArray(layers, 0, arrayPath);
+	for (CookedTexture& layer : layers)
+	{
+		CloseCookedTexture(layer);
+	}
+	return packed ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 4 && std::strcmp(argv[1], "pack") == 0)
+	{
+		return PackTextureArray(argv[2], argv + 3, argc - 3);
+	}
+
+	if (argc < 6 || (argc - 6) % 3 != 0)
+	{
+		std::cout << "Usage: CookTexture <source image> <cooked texture> <RGBA8|BC1|BC3|BC4|BC5|BC7> <box|kaiser|lanczos> <linear|srgb|normal> [<image> <r|g|b|a> <r|g|b|a>]..." << std::endl;
+		std::cout << "       CookTexture pack <cooked texture array> <cooked texture>..." << std::endl;
+		return 1;
+	}
+
+	const char* formatNames[] = { "RGBA8", "BC1", "BC3", "BC4", "BC5", "BC7" };
+	const char* filterNames[] = { "box", "kaiser", "lanczos" };
+	const char* contentNames[] = { "linear", "srgb", "normal" };
+	const char* channelNames[] = { "r", "g", "b", "a" };
+
+	// Finds an argument in a list of names, or returns -1
+	auto find = [](const char* argument, const char* const* names, int count)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			if (std::strcmp(argument, names[i]) == 0)
+			{
+				return i;
+			}
+		}
+		return -1;
+	};
+
+	int format = find(argv[3], formatNames, 6);
+	int filter = find(argv[4], filterNames, 3);
+	int content = find(argv[5], contentNames, 3);
+	if (format < 0 || filter < 0 || content < 0)
+	{
+		std::cout << "Unknown format, filter or content type" << std::endl;
+		return 1;
+	}
+
+	CookedTextureSource source = { argv[1], argv[2], { (CookedTextureFormat)format, (MipFilter)filter, (MipContent)content } };
+	for (int i = 6; i < argc; i += 3)
+	{
+		int sourceChannel = find(argv[i + 1], channelNames, 4);
+		int channel = find(argv[i + 2], channelNames, 4);
+		if (sourceChannel < 0 || channel < 0)
+		{
+			std::cout << "Unknown channel" << std::endl;
+			return 1;
+		}
+		source.packedChannels.push_back({ argv[i], sourceChannel, channel });
+	}
+	return CookTexture(source) ? 0 : 1;
+}
@@ -0,0 +1,591 @@
+// Measures how fast stb_image decodes images, to check the SIMD paths (PNG unfiltering and the JPEG kernels) pay off and
+// to catch regressions. Every image is decoded once for each combination of:
+//	-channels	desired_channels passed to stbi_load, 0 for the channels in the file (default 0,1,2,3,4)
+//	-sources	memory decodes the file from a buffer read up front, so the numbers leave out disk reads; file decodes from
+//				the path, with stb_image reading it through stdio (default memory,file)
+//	-decoders	number of threads decoding the image at the same time, as when streaming textures in (default 1)
+//	-threads	threads each decoder gets through stbi_set_parallel_for_thread, to see how JPEG decoding scales.
+//				0 decodes on the decoder's thread alone (default 0)
+// and the decode rate is printed in ms/image (per decoder) and MB/s of decoded pixels (all decoders together).
+// -json writes the same numbers to a file, so runs can be compared over time.
+//
+// Images are files or directories, which are searched for every file stb_image reads. -seed fills a directory with the
+// project's container-*.png and synthetic PNG, JPEG, TGA and HDR images of the -sizes given (default
+// 512,1024,2048,4096,8192), skipping files already there, and benchmarks it.
+//
+// Build it on its own, and run it from the project directory:
+//	cl /O2 /EHsc /std:c++17 Tools\DecodeBenchmark.cpp
+//	DecodeBenchmark.exe -seed BenchmarkImages -json decode.json
+//	DecodeBenchmark.exe -channels 0 -sources memory -decoders 1,4 -threads 0,2,4 photo.jpg container-diffuse.png
+// Build it again with /DSTBI_NO_SIMD for the scalar numbers to compare against.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+#include "SyntheticImages.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Minimal pool to give stb_image a parallel-for. The calling thread runs tasks too, so a pool of N threads has N - 1 workers.
+struct ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+
+	// Current parallel-for. Tasks are claimed in index order until all taskCount are taken.
+	stbi_parallel_task* task = nullptr;
+	void* taskData = nullptr;
+	int taskCount = 0;
+	int nextTask = 0;
+	int tasksDone = 0;
+
+	// Bumped for every parallel-for, so a worker that wakes late doesn't take tasks of the next one for the last one's
+	int generation = 0;
+	bool stopping = false;
+};
+
+// Runs tasks of a parallel-for until none are left to claim. Tasks are coarse, so claiming them under the lock costs little.
+// @param	pool		Pool whose parallel-for to help with
+// @param	generation	Generation of that parallel-for
+void RunThreadPoolTasks(ThreadPool& pool, int generation)
+{
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	while (pool.generation == generation && pool.nextTask < pool.taskCount)
+	{
+		int index = pool.nextTask++;
+		lock.unlock();
+		pool.task(pool.taskData, index);
+		lock.lock();
+
+		if (++pool.tasksDone == pool.taskCount)
+		{
+			pool.finished.notify_all();
+		}
+	}
+}
+
+void RunThreadPoolWorker(ThreadPool& pool)
+{
+	int seenGeneration = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool.mutex);
+			pool.wake.wait(lock, [&]() { return pool.stopping || pool.generation != seenGeneration; });
+			if (pool.stopping)
+			{
+				return;
+			}
+			seenGeneration = pool.generation;
+		}
+		RunThreadPoolTasks(pool, seenGeneration);
+	}
+}
+
+// Parallel-for handed to stbi_set_parallel_for_thread
+void ThreadPoolParallelFor(void* user, stbi_parallel_task* task, void* data, int count)
+{
+	ThreadPool& pool = *(ThreadPool*)user;
+	int generation;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.task = task;
+		pool.taskData = data;
+		pool.taskCount = count;
+		pool.nextTask = 0;
+		pool.tasksDone = 0;
+		generation = ++pool.generation;
+	}
+	pool.wake.notify_all();
+
+	RunThreadPoolTasks(pool, generation);
+
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.finished.wait(lock, [&]() { return pool.tasksDone == count; });
+}
+
+void CreateThreadPool(ThreadPool& pool, int threadCount)
+{
+	for (int i = 1; i < threadCount; ++i)
+	{
+		pool.workers.emplace_back(RunThreadPoolWorker, std::ref(pool));
+	}
+}
+
+void DestroyThreadPool(ThreadPool& pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		pool.stopping = true;
+	}
+	pool.wake.notify_all();
+	for (std::thread& worker : pool.workers)
+	{
+		worker.join();
+	}
+	pool.workers.clear();
+}
+
+struct BenchmarkOptions
+{
+	std::vector<int> channels = { 0, 1, 2, 3, 4 };
+	std::vector<std::string> sources = { "memory", "file" };
+	std::vector<int> decoderCounts = { 1 };
+	std::vector<int> threadCounts = { 0 };
+	std::vector<int> sizes = { 512, 1024, 2048, 4096, 8192 };
+	double minSeconds = 1.0;
+	std::string jsonPath;
+	std::string seedDirectory;
+};
+
+// Image to benchmark, read into memory once
+struct BenchmarkImage
+{
+	std::string path;
+	std::string format;
+	int width;
+	int height;
+	int channelCount;
+	std::vector<unsigned char> encoded;
+};
+
+// Decode rate of one image for one combination of options
+struct BenchmarkResult
+{
+	const BenchmarkImage* image;
+	int desiredChannels;
+	std::string source;
+	int decoderCount;
+	int threadCount;
+	long long decodes;
+	double msPerImage;
+	double mbPerSecond;
+};
+
+std::vector<int> ParseIntList(const std::string& text)
+{
+	std::vector<int> values;
+	std::stringstream list(text);
+	std::string value;
+	while (std::getline(list, value, ','))
+	{
+		values.push_back(std::atoi(value.c_str()));
+	}
+	return values;
+}
+
+std::vector<std::string> ParseStringList(const std::string& text)
+{
+	std::vector<std::string> values;
+	std::stringstream list(text);
+	std::string value;
+	while (std::getline(list, value, ','))
+	{
+		values.push_back(value);
+	}
+	return values;
+}
+
+bool WriteFile(const std::filesystem::path& path, const std::vector<unsigned char>& data)
+{
+	std::ofstream file(path, std::ios::binary);
+	file.write((const char*)data.data(), data.size());
+	return (bool)file;
+}
+
+// Copies the project's container textures into a directory and writes synthetic images of each size and format next to them.
+// Files already in the directory are kept, as the larger ones take a while to encode.
+// @param	directory	Directory to fill, created if missing
+// @param	sizes		Width and height of the synthetic images
+// @return	Returns false if the directory can't be created
+bool SeedBenchmarkDirectory(const std::filesystem::path& directory, const std::vector<int>& sizes)
+{
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (!std::filesystem::is_directory(directory))
+	{
+		std::cout << "Failed to create " << directory.string() << std::endl;
+		return false;
+	}
+
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(".", error))
+	{
+		std::string name = entry.path().filename().string();
+		if (entry.is_regular_file() && name.rfind("container-", 0) == 0 && entry.path().extension() == ".png")
+		{
+			std::filesystem::copy_file(entry.path(), directory / name, std::filesystem::copy_options::skip_existing, error);
+		}
+	}
+
+	for (int size : sizes)
+	{
+		if (size <= 0 || size > 65535)
+		{
+			std::cout << "Skipping synthetic images of size " << size << std::endl;
+			continue;
+		}
+
+		std::vector<unsigned char> pixels;
+		const char* extensions[] = { "png", "jpg", "tga", "hdr" };
+		for (const char* extension : extensions)
+		{
+			std::filesystem::path path = directory / ("synthetic-" + std::to_string(size) + "." + extension);
+			if (std::filesystem::exists(path))
+			{
+				continue;
+			}
+			if (pixels.empty())
+			{
+				pixels = GenerateSyntheticImage(size, size);
+			}
+
+			std::cout << "Writing " << path.string() << std::endl;
+			std::string format = extension;
+			std::vector<unsigned char> encoded = format == "png" ? EncodePng(pixels, size, size, 4)
+				: format == "jpg" ? EncodeJpeg(pixels, size, size, 90)
+				: format == "tga" ? EncodeTga(pixels, size, size)
+				: EncodeHdr(pixels, size, size, 4.0f);
+			if (!WriteFile(path, encoded))
+			{
+				std::cout << "Failed to write " << path.string() << std::endl;
+			}
+		}
+	}
+	return true;
+}
+
+// Reads an image into memory, if stb_image can decode it
+// @param	path	File to read
+// @param	image	Receives the file contents and what the header says
+// @return	Returns false if the file can't be read or isn't an image stb_image decodes
+bool ReadBenchmarkImage(const std::filesystem::path& path, BenchmarkImage& image)
+{
+	std::ifstream file(path, std::ios::binary);
+	image.encoded.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	if (image.encoded.empty()
+		|| !stbi_info_from_memory(image.encoded.data(), (int)image.encoded.size(), &image.width, &image.height, &image.channelCount))
+	{
+		return false;
+	}
+
+	image.path = path.string();
+	image.format = path.extension().string();
+	image.format.erase(0, image.format.empty() ? 0 : 1);
+	std::transform(image.format.begin(), image.format.end(), image.format.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return true;
+}
+
+// Decodes an image on several threads at once, each decoding it over and over until minSeconds have passed
+// @param	image			Image to decode
+// @param	desiredChannels	desired_channels to decode with
+// @param	fromFile		Decode from the file rather than the copy in memory
+// @param	decoderCount	Threads decoding at the same time
+// @param	threadCount		Threads each decoder's parallel-for runs on, or 0 for none
+// @param	minSeconds		Time to keep decoding for
+// @param	result			Receives the decode rate
+// @return	Returns false if the image failed to decode
+bool BenchmarkDecode(const BenchmarkImage& image, int desiredChannels, bool fromFile, int decoderCount, int threadCount,
+	double minSeconds, BenchmarkResult& result)
+{
+	// Pools are started before timing, so their threads' start-up isn't counted
+	std::vector<std::unique_ptr<ThreadPool>> pools(decoderCount);
+	for (std::unique_ptr<ThreadPool>& pool : pools)
+	{
+		if (threadCount > 0)
+		{
+			pool.reset(new ThreadPool());
+			CreateThreadPool(*pool, threadCount);
+		}
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<bool> failed(false);
+	std::atomic<long long> decodes(0);
+	std::mutex failureMutex;
+	std::string failure;
+	auto decode = [&](ThreadPool* pool)
+	{
+		stbi_set_parallel_for_thread(pool ? ThreadPoolParallelFor : nullptr, pool, pool ? threadCount : 0);
+		do
+		{
+			int width, height, channelCount;
+			unsigned char* pixels = fromFile
+				? stbi_load(image.path.c_str(), &width, &height, &channelCount, desiredChannels)
+				: stbi_load_from_memory(image.encoded.data(), (int)image.encoded.size(), &width, &height, &channelCount, desiredChannels);
+			if (!pixels)
+			{
+				std::lock_guard<std::mutex> lock(failureMutex);
+				failure = stbi_failure_reason();
+				failed = true;
+				return;
+			}
+			stbi_image_free(pixels);
+			++decodes;
+		} while (!stop && !failed);
+	};
+
+	// Every decoder finishes the decode it is in when time is up, and that time counts too
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> decoders;
+	for (int i = 0; i < decoderCount; ++i)
+	{
+		decoders.emplace_back(decode, pools[i].get());
+	}
+	std::this_thread::sleep_for(std::chrono::duration<double>(minSeconds));
+	stop = true;
+	for (std::thread& decoder : decoders)
+	{
+		decoder.join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for (std::unique_ptr<ThreadPool>& pool : pools)
+	{
+		if (pool)
+		{
+			DestroyThreadPool(*pool);
+		}
+	}
+
+	if (failed)
+	{
+		std::cout << "Failed to decode " << image.path << ": " << failure << std::endl;
+		return false;
+	}
+
+	// Throughput is measured in decoded bytes, so images of different formats compare fairly
+	int decodedChannels = desiredChannels ? desiredChannels : image.channelCount;
+	result.image = &image;
+	result.desiredChannels = desiredChannels;
+	result.source = fromFile ? "file" : "memory";
+	result.decoderCount = decoderCount;
+	result.threadCount = threadCount;
+	result.decodes = decodes;
+	result.msPerImage = seconds * 1000.0 * decoderCount / decodes;
+	result.mbPerSecond = (double)image.width * image.height * decodedChannels * decodes / (1024.0 * 1024.0) / seconds;
+	return true;
+}
+
+std::string EscapeJsonString(const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char code[8];
+			std::snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+// Writes the results as JSON, one object per measurement
+bool WriteBenchmarkJson(const std::string& path, const std::vector<BenchmarkResult>& results, double minSeconds)
+{
+	std::ofstream file(path);
+	file << "{\n";
+#ifdef STBI_NO_SIMD
+	file << "\t\"simd\": false,\n";
+#else
+	file << "\t\"simd\": true,\n";
+#endif
+	file << "\t\"minSeconds\": " << minSeconds << ",\n";
+	file << "\t\"results\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const BenchmarkResult& result = results[i];
+		file << (i ? ",\n" : "\n") << "\t\t{ \"file\": \"" << EscapeJsonString(result.image->path)
+			<< "\", \"format\": \"" << EscapeJsonString(result.image->format)
+			<< "\", \"width\": " << result.image->width << ", \"height\": " << result.image->height
+			<< ", \"channelsInFile\": " << result.image->channelCount << ", \"desiredChannels\": " << result.desiredChannels
+			<< ", \"source\": \"" << result.source << "\", \"decoders\": " << result.decoderCount << ", \"threads\": " << result.threadCount
+			<< ", \"decodes\": " << result.decodes << ", \"msPerImage\": " << result.msPerImage << ", \"mbPerSecond\": " << result.mbPerSecond << " }";
+	}
+	file << "\n\t]\n}\n";
+	return (bool)file;
+}
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	std::vector<std::string> inputs;
+	bool usage = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (argument == "-channels" && hasValue)
+		{
+			options.channels = ParseIntList(argv[++i]);
+		}
+		else if (argument == "-sources" && hasValue)
+		{
+			options.sources = ParseStringList(argv[++i]);
+		}
+		else if (argument == "-decoders" && hasValue)
+		{
+			options.decoderCounts = ParseIntList(argv[++i]);
+		}
+		else if (argument == "-threads" && hasValue)
+		{
+			options.threadCounts = ParseIntList(argv[++i]);
+		}
+		else if (argument == "-sizes" && hasValue)
+		{
+			options.sizes = ParseIntList(argv[++i]);
+		}
+		else if (argument == "-seconds" && hasValue)
+		{
+			options.minSeconds = std::atof(argv[++i]);
+		}
+		else if (argument == "-json" && hasValue)
+		{
+			options.jsonPath = argv[++i];
+		}
+		else if (argument == "-seed" && hasValue)
+		{
+			options.seedDirectory = argv[++i];
+		}
+		else if (argument[0] == '-')
+		{
+			usage = true;
+		}
+		else
+		{
+			inputs.push_back(argument);
+		}
+	}
+
+	for (int channels : options.channels)
+	{
+		usage = usage || channels < 0 || channels > 4;
+	}
+	for (const std::string& source : options.sources)
+	{
+		usage = usage || (source != "memory" && source != "file");
+	}
+	for (int decoders : options.decoderCounts)
+	{
+		usage = usage || decoders < 1;
+	}
+	for (int threads : options.threadCounts)
+	{
+		usage = usage || threads < 0;
+	}
+	if (!options.seedDirectory.empty())
+	{
+		inputs.push_back(options.seedDirectory);
+	}
+	if (usage || inputs.empty() || options.channels.empty() || options.sources.empty() || options.decoderCounts.empty()
+		|| options.threadCounts.empty())
+	{
+		std::cout << "Usage: DecodeBenchmark [-channels 0,1,2,3,4] [-sources memory,file] [-decoders <count>,...] [-threads <count>,...]"
+			<< " [-seconds <seconds>] [-json <file>] [-seed <directory> [-sizes <size>,...]] <image or directory>..." << std::endl;
+		return 1;
+	}
+
+	if (!options.seedDirectory.empty() && !SeedBenchmarkDirectory(options.seedDirectory, options.sizes))
+	{
+		return 1;
+	}
+
+	// Directories are searched in name order, so runs list images the same way
+	std::vector<std::filesystem::path> paths;
+	for (const std::string& input : inputs)
+	{
+		std::error_code error;
+		if (std::filesystem::is_directory(input))
+		{
+			std::vector<std::filesystem::path> files;
+			for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(input, error))
+			{
+				if (entry.is_regular_file())
+				{
+					files.push_back(entry.path());
+				}
+			}
+			std::sort(files.begin(), files.end());
+			paths.insert(paths.end(), files.begin(), files.end());
+		}
+		else
+		{
+			paths.push_back(input);
+		}
+	}
+
+	// Results point at their image, so every image is read before the first decode
+	std::vector<BenchmarkImage> images;
+	for (const std::filesystem::path& path : paths)
+	{
+		BenchmarkImage image;
+		if (ReadBenchmarkImage(path, image))
+		{
+			images.push_back(std::move(image));
+		}
+		else
+		{
+			std::cout << "Skipping " << path.string() << ": " << (stbi_failure_reason() ? stbi_failure_reason() : "can't read it") << std::endl;
+		}
+	}
+
+	std::vector<BenchmarkResult> results;
+	for (const BenchmarkImage& image : images)
+	{
+		for (int channels : options.channels)
+		{
+			for (const std::string& source : options.sources)
+			{
+				for (int decoders : options.decoderCounts)
+				{
+					for (int threads : options.threadCounts)
+					{
+						BenchmarkResult result;
+						if (!BenchmarkDecode(image, channels, source == "file", decoders, threads, options.minSeconds, result))
+						{
+							continue;
+						}
+						std::cout << image.path << ": " << image.format << " " << image.width << "x" << image.height << "x" << image.channelCount
+							<< " -> " << (channels ? channels : image.channelCount) << ", " << source << ", " << decoders << " decoders, "
+							<< threads << " threads: " << result.msPerImage << " ms/image, " << result.mbPerSecond << " MB/s" << std::endl;
+						results.push_back(result);
+					}
+				}
+			}
+		}
+	}
+
+	if (!options.jsonPath.empty() && !WriteBenchmarkJson(options.jsonPath, results, options.minSeconds))
+	{
+		std::cout << "Failed to write " << options.jsonPath << std::endl;
+		return 1;
+	}
+	return 0;
+}
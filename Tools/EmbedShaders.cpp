@@ -0,0 +1,86 @@
+// Generates EmbeddedShaders.h, which compiles the shader files into the executable
+// so that builds with EMBED_SHADERS defined (Release) do no shader file I/O at startup.
+//
+// Build it on its own, and rerun it from the project directory after editing any shader:
+//	cl /EHsc Tools\EmbedShaders.cpp
+//	EmbedShaders.exe EmbeddedShaders.h Basic.vsh Basic.fsh BasicLighting.vsh BasicLighting.fsh Lights.glsl LightProbes.glsl
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// MSVC rejects string literals longer than about 16KB, so long files are split into adjacent literals
+const size_t kMaxLiteralLength = 8000;
+
+const char* kDelimiter = "shader";
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cout << "Usage: EmbedShaders <output header> <shader files...>" << std::endl;
+		return 1;
+	}
+
+	std::ostringstream header;
+	header << "// Generated by Tools/EmbedShaders.cpp from the shader files, do not edit.\n";
+	header << "// Rerun the tool after editing a shader.\n";
+	header << "#pragma once\n\n";
+	header << "struct EmbeddedShaderFile\n{\n\tconst char* path;\n\tconst char* source;\n};\n\n";
+	header << "constexpr EmbeddedShaderFile embeddedShaderFiles[] =\n{\n";
+
+	for (int i = 2; i < argc; ++i)
+	{
+		std::ifstream file(argv[i], std::ios::binary);
+		if (file.fail())
+		{
+			std::cout << "Failed to read shader file " << argv[i] << std::endl;
+			return 1;
+		}
+		std::ostringstream contents;
+		contents << file.rdbuf();
+
+		// Line endings inside raw string literals depend on the compiler, so store plain newlines
+		std::string source;
+		for (char c : contents.str())
+		{
+			if (c != '\r')
+			{
+				source += c;
+			}
+		}
+
+		if (source.find(std::string(")") + kDelimiter + "\"") != std::string::npos)
+		{
+			std::cout << argv[i] << " contains the raw string delimiter" << std::endl;
+			return 1;
+		}
+
+		header << "\t{ \"" << argv[i] << "\",\n";
+		for (size_t offset = 0; offset < source.size() || offset == 0; offset += kMaxLiteralLength)
+		{
+			header << "\t\tR\"" << kDelimiter << "(" << source.substr(offset, kMaxLiteralLength) << ")" << kDelimiter << "\"\n";
+		}
+		header << "\t},\n";
+	}
+	header << "};\n";
+
+	// Only touch the output when it changes, so that an unchanged header doesn't trigger a rebuild
+	std::ifstream existing(argv[1], std::ios::binary);
+	std::ostringstream existingContents;
+	existingContents << existing.rdbuf();
+	if (existingContents.str() == header.str())
+	{
+		return 0;
+	}
+
+	std::ofstream output(argv[1], std::ios::binary);
+	output << header.str();
+	if (output.fail())
+	{
+		std::cout << "Failed to write " << argv[1] << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,772 @@
+#pragma once
+
+// Generates test images of any size and encodes them as PNG, JPEG, TGA and Radiance HDR, for
+// DecodeBenchmark to seed its corpus with. The encoders are small rather than good: PNG uses
+// fixed-Huffman deflate, JPEG is baseline 4:2:0 with the standard tables, TGA is RLE and HDR
+// uses the run-length scanlines most HDR files have. They only need to write files stb_image
+// decodes the way it decodes real ones.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Hashes a pixel position and a seed to a pseudo-random value in [0, 1)
+float HashNoise(int x, int y, int seed)
+{
+	uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u + (uint32_t)seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+	return (h & 0xffffff) / 16777216.0f;
+}
+
+// Smoothly interpolated noise on a grid with cells of the given size
+float ValueNoise(int x, int y, int cellSize, int seed)
+{
+	int cellX = x / cellSize, cellY = y / cellSize;
+	float fx = (float)(x % cellSize) / cellSize, fy = (float)(y % cellSize) / cellSize;
+	fx = fx * fx * (3.0f - 2.0f * fx);
+	fy = fy * fy * (3.0f - 2.0f * fy);
+	float top = HashNoise(cellX, cellY, seed) + (HashNoise(cellX + 1, cellY, seed) - HashNoise(cellX, cellY, seed)) * fx;
+	float bottom = HashNoise(cellX, cellY + 1, seed) + (HashNoise(cellX + 1, cellY + 1, seed) - HashNoise(cellX, cellY + 1, seed)) * fx;
+	return top + (bottom - top) * fy;
+}
+
+// Generates an RGBA8 image that compresses roughly like a photo or a painted texture:
+// smooth gradients, a few octaves of noise, hard-edged shapes and a little grain
+// @param	width	Width in pixels
+// @param	height	Height in pixels
+// @return	Returns width * height RGBA8 pixels
+std::vector<unsigned char> GenerateSyntheticImage(int width, int height)
+{
+	std::vector<unsigned char> pixels((size_t)width * height * 4);
+	int scale = std::max(width, height);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			// Coordinates relative to the image size, so every size shows the same picture
+			float u = (float)x / scale, v = (float)y / scale;
+			float clouds = 0.5f * ValueNoise(x, y, std::max(scale / 8, 2), 1) + 0.3f * ValueNoise(x, y, std::max(scale / 32, 2), 2)
+				+ 0.2f * ValueNoise(x, y, std::max(scale / 128, 2), 3);
+			bool tile = ((int)(u * 12.0f) + (int)(v * 12.0f)) % 5 == 0;
+			float grain = HashNoise(x, y, 4) - 0.5f;
+
+			float colour[4] = {
+				0.2f + 0.6f * u + 0.3f * clouds,
+				0.3f + 0.4f * std::sin(v * 9.0f) * 0.5f + 0.4f * clouds,
+				0.7f - 0.5f * v + (tile ? 0.2f : 0.0f),
+				0.5f + 0.5f * std::cos((u - 0.5f) * (v - 0.5f) * 40.0f)
+			};
+			for (int c = 0; c < 4; ++c)
+			{
+				float value = colour[c] * 255.0f + (c < 3 ? grain * 12.0f : 0.0f);
+				pixels[((size_t)y * width + x) * 4 + c] = (unsigned char)std::min(255.0f, std::max(0.0f, value + 0.5f));
+			}
+		}
+	}
+	return pixels;
+}
+
+// Appends a value to a byte stream, most significant byte first
+void PutBigEndian(std::vector<unsigned char>& out, uint32_t value, int byteCount)
+{
+	for (int i = byteCount - 1; i >= 0; --i)
+	{
+		out.push_back((unsigned char)(value >> (i * 8)));
+	}
+}
+
+//
+// PNG
+//
+
+uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+	static uint32_t table[256];
+	static bool tableBuilt = false;
+	if (!tableBuilt)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+		tableBuilt = true;
+	}
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+	{
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// Writes deflate's bit stream, least significant bit first
+struct DeflateBitWriter
+{
+	std::vector<unsigned char>& out;
+	uint32_t bits;
+	int bitCount;
+};
+
+void PutDeflateBits(DeflateBitWriter& writer, uint32_t value, int count)
+{
+	writer.bits |= value << writer.bitCount;
+	writer.bitCount += count;
+	while (writer.bitCount >= 8)
+	{
+		writer.out.push_back((unsigned char)writer.bits);
+		writer.bits >>= 8;
+		writer.bitCount -= 8;
+	}
+}
+
+// Writes a Huffman code, which deflate stores most significant bit first
+void PutDeflateCode(DeflateBitWriter& writer, uint32_t code, int length)
+{
+	uint32_t reversed = 0;
+	for (int i = 0; i < length; ++i)
+	{
+		reversed |= ((code >> i) & 1) << (length - 1 - i);
+	}
+	PutDeflateBits(writer, reversed, length);
+}
+
+// Writes a literal/length symbol with the fixed Huffman code
+void PutFixedLiteral(DeflateBitWriter& writer, int symbol)
+{
+	if (symbol < 144)
+	{
+		PutDeflateCode(writer, 0x30 + symbol, 8);
+	}
+	else if (symbol < 256)
+	{
+		PutDeflateCode(writer, 0x190 + symbol - 144, 9);
+	}
+	else if (symbol < 280)
+	{
+		PutDeflateCode(writer, symbol - 256, 7);
+	}
+	else
+	{
+		PutDeflateCode(writer, 0xc0 + symbol - 280, 8);
+	}
+}
+
+// Compresses data as a zlib stream of one fixed-Huffman block, with greedy LZ77 matching
+std::vector<unsigned char> ZlibCompress(const std::vector<unsigned char>& data)
+{
+	static const int lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const int distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+		4097, 6145, 8193, 12289, 16385, 24577 };
+	static const int distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	const int windowSize = 32768;
+	const int hashSize = 1 << 15;
+	const int maxChain = 16;
+
+	std::vector<unsigned char> out = { 0x78, 0x01 };
+	DeflateBitWriter writer = { out, 0, 0 };
+	PutDeflateBits(writer, 1, 1); // last block
+	PutDeflateBits(writer, 1, 2); // fixed Huffman codes
+
+	// Most recent position of each hash of three bytes, and the one before it for every position in the window
+	std::vector<int> head(hashSize, -1);
+	std::vector<int> previous(windowSize, -1);
+	auto hash = [&](size_t i) { return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & (hashSize - 1); };
+	auto insert = [&](size_t i)
+	{
+		int h = hash(i);
+		previous[i % windowSize] = head[h];
+		head[h] = (int)i;
+	};
+
+	size_t i = 0;
+	while (i < data.size())
+	{
+		int bestLength = 0, bestDistance = 0;
+		if (i + 3 <= data.size())
+		{
+			int candidate = head[hash(i)];
+			for (int chain = 0; chain < maxChain && candidate >= 0 && (int)i - candidate <= windowSize - 1; ++chain)
+			{
+				int length = 0;
+				int maxLength = (int)std::min<size_t>(258, data.size() - i);
+				while (length < maxLength && data[candidate + length] == data[i + length])
+				{
+					++length;
+				}
+				if (length > bestLength)
+				{
+					bestLength = length;
+					bestDistance = (int)i - candidate;
+				}
+				int next = previous[candidate % windowSize];
+				candidate = next < candidate ? next : -1;
+			}
+		}
+
+		if (bestLength >= 3)
+		{
+			int code = 28;
+			while (lengthBase[code] > bestLength)
+			{
+				--code;
+			}
+			PutFixedLiteral(writer, 257 + code);
+			PutDeflateBits(writer, bestLength - lengthBase[code], lengthExtra[code]);
+
+			code = 29;
+			while (distanceBase[code] > bestDistance)
+			{
+				--code;
+			}
+			PutDeflateCode(writer, code, 5);
+			PutDeflateBits(writer, bestDistance - distanceBase[code], distanceExtra[code]);
+
+			for (int k = 0; k < bestLength; ++k, ++i)
+			{
+				if (i + 3 <= data.size())
+				{
+					insert(i);
+				}
+			}
+		}
+		else
+		{
+			PutFixedLiteral(writer, data[i]);
+			if (i + 3 <= data.size())
+			{
+				insert(i);
+			}
+			++i;
+		}
+	}
+	PutFixedLiteral(writer, 256);
+	PutDeflateBits(writer, 0, 7); // flush the last byte
+
+	uint32_t a = 1, b = 0;
+	for (unsigned char byte : data)
+	{
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	PutBigEndian(out, (b << 16) | a, 4);
+	return out;
+}
+
+void PutPngChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+	PutBigEndian(out, (uint32_t)data.size(), 4);
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	PutBigEndian(out, Crc32(&out[start], out.size() - start), 4);
+}
+
+// Encodes RGBA8 pixels as an 8-bit PNG, choosing each row's filter by the smallest sum of filtered bytes, as libpng does
+// @param	pixels			RGBA8 pixels
+// @param	width			Width in pixels
+// @param	height			Height in pixels
+// @param	channelCount	3 to drop the alpha channel, or 4
+std::vector<unsigned char> EncodePng(const std::vector<unsigned char>& pixels, int width, int height, int channelCount)
+{
+	size_t rowSize = (size_t)width * channelCount;
+	std::vector<unsigned char> rows((size_t)height * rowSize);
+	for (size_t i = 0; i < (size_t)width * height; ++i)
+	{
+		std::memcpy(&rows[i * channelCount], &pixels[i * 4], channelCount);
+	}
+
+	std::vector<unsigned char> filtered;
+	filtered.reserve((rowSize + 1) * height);
+	std::vector<unsigned char> candidate(rowSize);
+	std::vector<unsigned char> best(rowSize);
+	std::vector<unsigned char> zeroRow(rowSize, 0);
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char* row = &rows[y * rowSize];
+		const unsigned char* above = y > 0 ? &rows[(y - 1) * rowSize] : zeroRow.data();
+		int bestFilter = 0;
+		uint64_t bestSum = UINT64_MAX;
+		for (int filter = 0; filter < 5; ++filter)
+		{
+			uint64_t sum = 0;
+			for (size_t i = 0; i < rowSize; ++i)
+			{
+				int a = i >= (size_t)channelCount ? row[i - channelCount] : 0;
+				int b = above[i];
+				int c = i >= (size_t)channelCount ? above[i - channelCount] : 0;
+				int predicted = 0;
+				if (filter == 1)
+				{
+					predicted = a;
+				}
+				else if (filter == 2)
+				{
+					predicted = b;
+				}
+				else if (filter == 3)
+				{
+					predicted = (a + b) / 2;
+				}
+				else if (filter == 4)
+				{
+					int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+					predicted = (pa <= pb && pa <= pc) ? a : pb <= pc ? b : c;
+				}
+				candidate[i] = (unsigned char)(row[i] - predicted);
+				sum += (uint64_t)std::abs((int)(signed char)candidate[i]);
+			}
+			if (sum < bestSum)
+			{
+				bestSum = sum;
+				bestFilter = filter;
+				best.swap(candidate);
+			}
+		}
+		filtered.push_back((unsigned char)bestFilter);
+		filtered.insert(filtered.end(), best.begin(), best.end());
+	}
+
+	std::vector<unsigned char> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	std::vector<unsigned char> header;
+	PutBigEndian(header, width, 4);
+	PutBigEndian(header, height, 4);
+	header.insert(header.end(), { 8, (unsigned char)(channelCount == 4 ? 6 : 2), 0, 0, 0 });
+	PutPngChunk(out, "IHDR", header);
+	PutPngChunk(out, "IDAT", ZlibCompress(filtered));
+	PutPngChunk(out, "IEND", {});
+	return out;
+}
+
+//
+// JPEG
+//
+
+// Zigzag position of each coefficient of an 8x8 block, in row order
+const int jpegZigzag[64] = {
+	0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42, 3, 8, 12, 17, 25, 30, 41, 43, 9, 11, 18, 24, 31, 40, 44, 53,
+	10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63
+};
+
+// The example Huffman tables of the JPEG standard (Annex K): code counts per length, then the symbols
+const unsigned char jpegDcLuminanceCounts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+const unsigned char jpegDcChrominanceCounts[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+const unsigned char jpegDcSymbols[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+const unsigned char jpegAcLuminanceCounts[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+const unsigned char jpegAcLuminanceSymbols[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+const unsigned char jpegAcChrominanceCounts[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+const unsigned char jpegAcChrominanceSymbols[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+
+// The example quantization tables of the JPEG standard, in row order, for quality 50
+const unsigned char jpegLuminanceQuantization[64] = {
+	16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+};
+const unsigned char jpegChrominanceQuantization[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Code and length of each symbol of a Huffman table
+struct JpegHuffmanCodes
+{
+	uint16_t codes[256];
+	uint8_t lengths[256];
+};
+
+JpegHuffmanCodes BuildJpegHuffmanCodes(const unsigned char counts[16], const unsigned char* symbols)
+{
+	JpegHuffmanCodes table = {};
+	int code = 0, k = 0;
+	for (int length = 1; length <= 16; ++length)
+	{
+		for (int i = 0; i < counts[length - 1]; ++i, ++k, ++code)
+		{
+			table.codes[symbols[k]] = (uint16_t)code;
+			table.lengths[symbols[k]] = (uint8_t)length;
+		}
+		code <<= 1;
+	}
+	return table;
+}
+
+// Writes JPEG entropy-coded data, most significant bit first, stuffing a zero byte after every 0xff
+struct JpegBitWriter
+{
+	std::vector<unsigned char>& out;
+	uint32_t bits;
+	int bitCount;
+};
+
+void PutJpegBits(JpegBitWriter& writer, uint32_t value, int count)
+{
+	writer.bits = (writer.bits << count) | (value & ((1u << count) - 1));
+	writer.bitCount += count;
+	while (writer.bitCount >= 8)
+	{
+		unsigned char byte = (unsigned char)(writer.bits >> (writer.bitCount - 8));
+		writer.out.push_back(byte);
+		if (byte == 0xff)
+		{
+			writer.out.push_back(0);
+		}
+		writer.bitCount -= 8;
+	}
+}
+
+// Writes a coefficient as its Huffman-coded size category and then its bits, folding in a run of zeros before it
+void PutJpegCoefficient(JpegBitWriter& writer, const JpegHuffmanCodes& table, int zeroRun, int value)
+{
+	int magnitude = std::abs(value), size = 0;
+	while (magnitude >> size)
+	{
+		++size;
+	}
+	int symbol = (zeroRun << 4) | size;
+	PutJpegBits(writer, table.codes[symbol], table.lengths[symbol]);
+	PutJpegBits(writer, value < 0 ? value + (1 << size) - 1 : value, size);
+}
+
+// Transforms, quantizes and writes one 8x8 block
+// @param	block			Samples, centred on zero
+// @param	quantization	Quantization table, in row order
+// @param	previousDc		DC coefficient of the previous block of the component, updated to this block's
+void EncodeJpegBlock(JpegBitWriter& writer, const float block[64], const unsigned char quantization[64], const JpegHuffmanCodes& dc,
+	const JpegHuffmanCodes& ac, int& previousDc)
+{
+	static float cosines[8][8];
+	static bool cosinesBuilt = false;
+	if (!cosinesBuilt)
+	{
+		for (int u = 0; u < 8; ++u)
+		{
+			for (int x = 0; x < 8; ++x)
+			{
+				cosines[u][x] = std::cos((2 * x + 1) * u * 3.14159265f / 16.0f) * (u == 0 ? std::sqrt(0.125f) : 0.5f);
+			}
+		}
+		cosinesBuilt = true;
+	}
+
+	// Separable DCT: rows, then columns
+	float rows[64];
+	for (int y = 0; y < 8; ++y)
+	{
+		for (int u = 0; u < 8; ++u)
+		{
+			float sum = 0.0f;
+			for (int x = 0; x < 8; ++x)
+			{
+				sum += block[y * 8 + x] * cosines[u][x];
+			}
+			rows[y * 8 + u] = sum;
+		}
+	}
+	int zigzag[64];
+	for (int v = 0; v < 8; ++v)
+	{
+		for (int u = 0; u < 8; ++u)
+		{
+			float sum = 0.0f;
+			for (int y = 0; y < 8; ++y)
+			{
+				sum += rows[y * 8 + u] * cosines[v][y];
+			}
+			zigzag[jpegZigzag[v * 8 + u]] = (int)std::lround(sum / quantization[v * 8 + u]);
+		}
+	}
+
+	PutJpegCoefficient(writer, dc, 0, zigzag[0] - previousDc);
+	previousDc = zigzag[0];
+
+	int zeroRun = 0;
+	for (int i = 1; i < 64; ++i)
+	{
+		if (zigzag[i] == 0)
+		{
+			++zeroRun;
+			continue;
+		}
+		while (zeroRun >= 16)
+		{
+			PutJpegBits(writer, ac.codes[0xf0], ac.lengths[0xf0]);
+			zeroRun -= 16;
+		}
+		PutJpegCoefficient(writer, ac, zeroRun, zigzag[i]);
+		zeroRun = 0;
+	}
+	if (zeroRun > 0)
+	{
+		PutJpegBits(writer, ac.codes[0x00], ac.lengths[0x00]);
+	}
+}
+
+void PutJpegHuffmanTable(std::vector<unsigned char>& out, int tableClass, int id, const unsigned char counts[16], const unsigned char* symbols)
+{
+	int symbolCount = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		symbolCount += counts[i];
+	}
+	PutBigEndian(out, 0xffc4, 2);
+	PutBigEndian(out, 2 + 1 + 16 + symbolCount, 2);
+	out.push_back((unsigned char)((tableClass << 4) | id));
+	out.insert(out.end(), counts, counts + 16);
+	out.insert(out.end(), symbols, symbols + symbolCount);
+}
+
+// Encodes RGBA8 pixels as a baseline JPEG with 4:2:0 chroma subsampling, ignoring alpha
+// @param	pixels	RGBA8 pixels
+// @param	width	Width in pixels, at most 65535
+// @param	height	Height in pixels, at most 65535
+// @param	quality	Quality from 1 to 100, scaling the standard tables as libjpeg does
+std::vector<unsigned char> EncodeJpeg(const std::vector<unsigned char>& pixels, int width, int height, int quality)
+{
+	quality = std::min(100, std::max(1, quality));
+	int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+	unsigned char quantization[2][64];
+	for (int i = 0; i < 64; ++i)
+	{
+		quantization[0][i] = (unsigned char)std::min(255, std::max(1, (jpegLuminanceQuantization[i] * scale + 50) / 100));
+		quantization[1][i] = (unsigned char)std::min(255, std::max(1, (jpegChrominanceQuantization[i] * scale + 50) / 100));
+	}
+
+	std::vector<unsigned char> out = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+	for (int table = 0; table < 2; ++table)
+	{
+		PutBigEndian(out, 0xffdb, 2);
+		PutBigEndian(out, 2 + 1 + 64, 2);
+		out.push_back((unsigned char)table);
+		unsigned char zigzag[64];
+		for (int i = 0; i < 64; ++i)
+		{
+			zigzag[jpegZigzag[i]] = quantization[table][i];
+		}
+		out.insert(out.end(), zigzag, zigzag + 64);
+	}
+
+	// Frame: Y sampled 2x2, Cb and Cr 1x1
+	PutBigEndian(out, 0xffc0, 2);
+	PutBigEndian(out, 8 + 3 * 3, 2);
+	out.push_back(8);
+	PutBigEndian(out, height, 2);
+	PutBigEndian(out, width, 2);
+	out.insert(out.end(), { 3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 });
+
+	PutJpegHuffmanTable(out, 0, 0, jpegDcLuminanceCounts, jpegDcSymbols);
+	PutJpegHuffmanTable(out, 1, 0, jpegAcLuminanceCounts, jpegAcLuminanceSymbols);
+	PutJpegHuffmanTable(out, 0, 1, jpegDcChrominanceCounts, jpegDcSymbols);
+	PutJpegHuffmanTable(out, 1, 1, jpegAcChrominanceCounts, jpegAcChrominanceSymbols);
+
+	PutBigEndian(out, 0xffda, 2);
+	PutBigEndian(out, 6 + 2 * 3, 2);
+	out.insert(out.end(), { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 });
+
+	JpegHuffmanCodes dcCodes[2] = {
+		BuildJpegHuffmanCodes(jpegDcLuminanceCounts, jpegDcSymbols), BuildJpegHuffmanCodes(jpegDcChrominanceCounts, jpegDcSymbols) };
+	JpegHuffmanCodes acCodes[2] = {
+		BuildJpegHuffmanCodes(jpegAcLuminanceCounts, jpegAcLuminanceSymbols), BuildJpegHuffmanCodes(jpegAcChrominanceCounts, jpegAcChrominanceSymbols) };
+
+	JpegBitWriter writer = { out, 0, 0 };
+	int previousDc[3] = { 0, 0, 0 };
+	for (int mcuY = 0; mcuY < height; mcuY += 16)
+	{
+		for (int mcuX = 0; mcuX < width; mcuX += 16)
+		{
+			// Convert the 16x16 pixels of the MCU to YCbCr, repeating the edge pixels past the image
+			float ycc[3][16][16];
+			for (int y = 0; y < 16; ++y)
+			{
+				for (int x = 0; x < 16; ++x)
+				{
+					const unsigned char* pixel = &pixels[((size_t)std::min(mcuY + y, height - 1) * width + std::min(mcuX + x, width - 1)) * 4];
+					float r = pixel[0], g = pixel[1], b = pixel[2];
+					ycc[0][y][x] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+					ycc[1][y][x] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+					ycc[2][y][x] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+				}
+			}
+
+			float block[64];
+			for (int blockIndex = 0; blockIndex < 4; ++blockIndex)
+			{
+				int blockX = (blockIndex & 1) * 8, blockY = (blockIndex >> 1) * 8;
+				for (int i = 0; i < 64; ++i)
+				{
+					block[i] = ycc[0][blockY + i / 8][blockX + i % 8];
+				}
+				EncodeJpegBlock(writer, block, quantization[0], dcCodes[0], acCodes[0], previousDc[0]);
+			}
+			for (int component = 1; component < 3; ++component)
+			{
+				for (int i = 0; i < 64; ++i)
+				{
+					int y = (i / 8) * 2, x = (i % 8) * 2;
+					block[i] = 0.25f * (ycc[component][y][x] + ycc[component][y][x + 1] + ycc[component][y + 1][x] + ycc[component][y + 1][x + 1]);
+				}
+				EncodeJpegBlock(writer, block, quantization[1], dcCodes[1], acCodes[1], previousDc[component]);
+			}
+		}
+	}
+	PutJpegBits(writer, 0x7f, 7); // pad the last byte with ones
+	PutBigEndian(out, 0xffd9, 2);
+	return out;
+}
+
+//
+// TGA
+//
+
+// Encodes RGBA8 pixels as a run-length encoded, top-down 32-bit TGA
+std::vector<unsigned char> EncodeTga(const std::vector<unsigned char>& pixels, int width, int height)
+{
+	std::vector<unsigned char> out = { 0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		(unsigned char)width, (unsigned char)(width >> 8), (unsigned char)height, (unsigned char)(height >> 8), 32, 0x28 };
+
+	// Packets don't cross rows
+	for (int y = 0; y < height; ++y)
+	{
+		const uint32_t* row = (const uint32_t*)&pixels[(size_t)y * width * 4];
+		int x = 0;
+		while (x < width)
+		{
+			int run = 1;
+			while (x + run < width && run < 128 && row[x + run] == row[x])
+			{
+				++run;
+			}
+			int literal = 0;
+			if (run == 1)
+			{
+				// Raw packet up to the next run of at least two pixels
+				while (x + literal < width && literal < 128 && (x + literal + 1 >= width || row[x + literal + 1] != row[x + literal]))
+				{
+					++literal;
+				}
+				literal = std::max(literal, 1);
+			}
+
+			int count = literal ? literal : run;
+			out.push_back((unsigned char)((literal ? 0x00 : 0x80) | (count - 1)));
+			for (int i = 0; i < (literal ? count : 1); ++i)
+			{
+				const unsigned char* pixel = (const unsigned char*)&row[x + i];
+				out.insert(out.end(), { pixel[2], pixel[1], pixel[0], pixel[3] });
+			}
+			x += count;
+		}
+	}
+	return out;
+}
+
+//
+// Radiance HDR
+//
+
+// Encodes the RGB of RGBA8 pixels, decoded from sRGB and brightened by brightness, as a Radiance HDR with run-length encoded scanlines
+std::vector<unsigned char> EncodeHdr(const std::vector<unsigned char>& pixels, int width, int height, float brightness)
+{
+	std::vector<unsigned char> out;
+	const char* header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n";
+	out.insert(out.end(), header, header + std::strlen(header));
+	std::string size = "-Y " + std::to_string(height) + " +X " + std::to_string(width) + "\n";
+	out.insert(out.end(), size.begin(), size.end());
+
+	float linear[256];
+	for (int i = 0; i < 256; ++i)
+	{
+		float c = i / 255.0f;
+		linear[i] = (c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f)) * brightness;
+	}
+
+	std::vector<unsigned char> rgbe((size_t)width * 4);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			const unsigned char* pixel = &pixels[((size_t)y * width + x) * 4];
+			float r = linear[pixel[0]], g = linear[pixel[1]], b = linear[pixel[2]];
+			float largest = std::max(r, std::max(g, b));
+			unsigned char* out4 = &rgbe[x * 4];
+			if (largest < 1e-32f)
+			{
+				out4[0] = out4[1] = out4[2] = out4[3] = 0;
+				continue;
+			}
+			int exponent;
+			float mantissa = std::frexp(largest, &exponent) * 256.0f / largest;
+			out4[0] = (unsigned char)(r * mantissa);
+			out4[1] = (unsigned char)(g * mantissa);
+			out4[2] = (unsigned char)(b * mantissa);
+			out4[3] = (unsigned char)(exponent + 128);
+		}
+
+		// Each channel of the scanline is run-length encoded on its own
+		out.insert(out.end(), { 2, 2, (unsigned char)(width >> 8), (unsigned char)width });
+		for (int channel = 0; channel < 4; ++channel)
+		{
+			int x = 0;
+			while (x < width)
+			{
+				int run = 1;
+				while (x + run < width && run < 127 && rgbe[(x + run) * 4 + channel] == rgbe[x * 4 + channel])
+				{
+					++run;
+				}
+				if (run >= 3)
+				{
+					out.insert(out.end(), { (unsigned char)(128 + run), rgbe[x * 4 + channel] });
+					x += run;
+					continue;
+				}
+
+				// Literal bytes up to the next run of three
+				int literal = 0;
+				while (x + literal < width && literal < 128)
+				{
+					int ahead = x + literal;
+					if (ahead + 2 < width && rgbe[ahead * 4 + channel] == rgbe[(ahead + 1) * 4 + channel]
+						&& rgbe[ahead * 4 + channel] == rgbe[(ahead + 2) * 4 + channel])
+					{
+						break;
+					}
+					++literal;
+				}
+				out.push_back((unsigned char)literal);
+				for (int i = 0; i < literal; ++i)
+				{
+					out.push_back(rgbe[(x + i) * 4 + channel]);
+				}
+				x += literal;
+			}
+		}
+	}
+	return out;
+}
@@ -224,7 +224,9 @@ RECENT REVISION HISTORY:
 // code.)
 //
 // On x86, SSE2 will automatically be used when available based on a run-time
-// test; if not, the generic C versions are used as a fall-back. On ARM targets,
+// test; if not, the generic C versions are used as a fall-back. Wider paths
+// (SSSE3, AVX2) are compiled in regardless of the build's target flags and
+// picked by a run-time CPUID test as well. On ARM targets,
 // the typical path is to have separate builds for NEON and non-NEON devices
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
@@ -390,6 +392,27 @@ extern "C" {
 	STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
 
+	////////////////////////////////////
+	//
+	// 8-bits-per-channel decoding into caller memory
+	//
+	// these decode into memory the caller owns, such as a mapped pixel buffer, rather
+	// than a buffer stb_image mallocs. get the size with stbi_info* first; the image
+	// must be exactly width x height. row y goes to output + y*stride as
+	// width*desired_channels bytes (row height-1-y when flipping vertically on load),
+	// so stride must be at least that. desired_channels is required, 1..4.
+	// conversion to desired_channels and the vertical flip are done as the rows are
+	// written out, and jpeg rows are written straight from color conversion.
+	// returns 1 on success, 0 on failure.
+
+	STBIDEF int      stbi_load_into_from_memory(stbi_uc const *buffer, int len, stbi_uc *output, int width, int height, int stride, int desired_channels);
+	STBIDEF int      stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_uc *output, int width, int height, int stride, int desired_channels);
+
+#ifndef STBI_NO_STDIO
+	STBIDEF int      stbi_load_into(char const *filename, stbi_uc *output, int width, int height, int stride, int desired_channels);
+	STBIDEF int      stbi_load_into_from_file(FILE *f, stbi_uc *output, int width, int height, int stride, int desired_channels);
+#endif
+
 	////////////////////////////////////
 	//
 	// 16-bits-per-channel interface
@@ -475,6 +498,25 @@ extern "C" {
 	// calling it will fail to link if your compiler doesn't
 	STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+	// as stbi_set_unpremultiply_on_load and stbi_convert_iphone_png_to_rgb, but only for the calling thread,
+	// with the same thread-local requirement as above. Threads that never call them follow the global flags.
+	STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
+	STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
+
+	// multithreaded decoding. stb_image never starts threads itself; give it a function that
+	// calls task(task_data, i) once for every i in [0, count), on as many threads as it likes,
+	// and returns once all of them have finished (e.g. a thread pool's parallel-for).
+	// thread_count is how many tasks it can run at once, which decides how finely work is split.
+	// Currently used by the JPEG decoder; the output is identical to a single-threaded decode.
+	// Pass NULL to decode on the calling thread only, which is the default.
+	typedef void stbi_parallel_task(void *task_data, int index);
+	typedef void stbi_parallel_for_func(void *user, stbi_parallel_task *task, void *task_data, int count);
+	STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *parallel_for, void *user, int thread_count);
+
+	// as above, but only for the calling thread, with the same thread-local requirement as
+	// stbi_set_flip_vertically_on_load_thread
+	STBIDEF void stbi_set_parallel_for_thread(stbi_parallel_for_func *parallel_for, void *user, int thread_count);
+
 	// ZLIB client - used by PNG, available for other purposes
 
 	STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -588,12 +630,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -669,6 +713,16 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32) == 4 ? 1 : -1];
 #if !defined(STBI_NO_SIMD) && (defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET))
 #define STBI_SSE2
 #include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+
+// functions using instructions past SSE2 are marked for GCC/Clang, so they
+// compile without -mssse3/-mavx2; they only run after a run-time check
+#if defined(__GNUC__) || defined(__clang__)
+#define STBI__SIMD_TARGET(x) __attribute__((target(x)))
+#else
+#define STBI__SIMD_TARGET(x)
+#endif
 
 #ifdef _MSC_VER
 
@@ -695,18 +749,44 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#ifdef STBI_SSE2
 static int stbi__sse2_available(void)
 {
 	int info3 = stbi__cpuid3();
 	return ((info3 >> 26) & 1) != 0;
 }
+
+static int stbi__ssse3_available(void)
+{
+#if _MSC_VER >= 1400
+	int info[4];
+	__cpuid(info, 1);
+	return ((info[2] >> 9) & 1) != 0;
+#else
+	return 0;
+#endif
+}
+
+static int stbi__avx2_available(void)
+{
+#if _MSC_VER >= 1600 // __cpuidex and _xgetbv
+	int info[4];
+	__cpuid(info, 1);
+	// the OS has to save the YMM registers too (OSXSAVE, then XCR0 bits 1 and 2)
+	if (((info[2] >> 27) & 1) == 0 || ((info[2] >> 28) & 1) == 0 || (_xgetbv(0) & 6) != 6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return ((info[1] >> 5) & 1) != 0;
+#else
+	return 0;
+#endif
+}
 #endif
 
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#ifdef STBI_SSE2
 static int stbi__sse2_available(void)
 {
 	// If we're even attempting to compile this on GCC/Clang, that means
@@ -714,6 +794,17 @@ static int stbi__sse2_available(void)
 	// instructions at will, and so are we.
 	return 1;
 }
+
+// these check that the OS saves the wider registers as well
+static int stbi__ssse3_available(void)
+{
+	return __builtin_cpu_supports("ssse3");
+}
+
+static int stbi__avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
 #endif
 
 #endif
@@ -835,9 +926,19 @@ typedef struct
 	int channel_order;
 } stbi__result_info;
 
+// where stbi_load_into* writes an image: row y starts at first + y*step, and
+// step is negative when flipping
+typedef struct
+{
+	stbi_uc *first;
+	ptrdiff_t step;
+	int w, h, comp;
+} stbi__into;
+
 #ifndef STBI_NO_JPEG
 static int      stbi__jpeg_test(stbi__context *s);
 static void    *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
+static int      stbi__jpeg_load_into(stbi__context *s, stbi__into *into);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
@@ -1046,6 +1147,71 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+typedef struct
+{
+	stbi_parallel_for_func *func;
+	void *user;
+	int thread_count;
+} stbi__parallel_for_hook;
+
+static stbi__parallel_for_hook stbi__parallel_for_global;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for_func *parallel_for, void *user, int thread_count)
+{
+	stbi__parallel_for_global.func = parallel_for;
+	stbi__parallel_for_global.user = user;
+	stbi__parallel_for_global.thread_count = thread_count;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__parallel_for  stbi__parallel_for_global
+#else
+static STBI_THREAD_LOCAL stbi__parallel_for_hook stbi__parallel_for_local;
+static STBI_THREAD_LOCAL int stbi__parallel_for_set;
+
+STBIDEF void stbi_set_parallel_for_thread(stbi_parallel_for_func *parallel_for, void *user, int thread_count)
+{
+	stbi__parallel_for_local.func = parallel_for;
+	stbi__parallel_for_local.user = user;
+	stbi__parallel_for_local.thread_count = thread_count;
+	stbi__parallel_for_set = 1;
+}
+
+#define stbi__parallel_for  (stbi__parallel_for_set       \
+                             ? stbi__parallel_for_local  \
+                             : stbi__parallel_for_global)
+#endif // STBI_THREAD_LOCAL
+
+// number of tasks worth splitting work into; 1 when there is no hook to run them on
+static int stbi__parallel_thread_count(void)
+{
+	stbi__parallel_for_hook hook = stbi__parallel_for;
+	return hook.func && hook.thread_count > 1 ? hook.thread_count : 1;
+}
+
+// number of tasks to split up to max_tasks units of work into: a few per thread, so they
+// even out, or just 1 without a hook
+static int stbi__parallel_task_count(int max_tasks)
+{
+	int tasks = stbi__parallel_thread_count();
+	if (tasks > 1) tasks *= 4;
+	if (tasks > max_tasks) tasks = max_tasks;
+	return tasks > 1 ? tasks : 1;
+}
+
+// runs task for 0..count-1 through the hook if there is one, otherwise in order on this thread
+static void stbi__parallel_run(stbi_parallel_task *task, void *task_data, int count)
+{
+	stbi__parallel_for_hook hook = stbi__parallel_for;
+	if (hook.func && count > 1)
+		hook.func(hook.user, task, task_data, count);
+	else {
+		int i;
+		for (i = 0; i < count; ++i)
+			task(task_data, i);
+	}
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
 	memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1093,17 +1259,84 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
 	return stbi__errpuc("unknown image type", "Image not of any known type, or corrupt");
 }
 
+// bulk conversions are split into tasks of at least this many elements, so small
+// images aren't handed to other threads for less work than the hand-off costs
+#define STBI__CONVERT_TASK_SIZE  (1 << 16)
+
+typedef struct
+{
+	void *input;
+	void *output;
+	int count, tasks, simd;
+} stbi__convert_depth;
+
+static void stbi__convert_16_to_8_task(void *task_data, int task)
+{
+	stbi__convert_depth *c = (stbi__convert_depth *)task_data;
+	stbi__uint16 *orig = (stbi__uint16 *)c->input;
+	stbi_uc *reduced = (stbi_uc *)c->output;
+	int i = (int)((stbi__uint64)c->count * task / c->tasks);
+	int end = (int)((stbi__uint64)c->count * (task + 1) / c->tasks);
+
+#ifdef STBI_SSE2
+	if (c->simd) {
+		for (; i + 16 <= end; i += 16) {
+			__m128i lo = _mm_srli_epi16(_mm_loadu_si128((__m128i const *)(orig + i)), 8);
+			__m128i hi = _mm_srli_epi16(_mm_loadu_si128((__m128i const *)(orig + i + 8)), 8);
+			_mm_storeu_si128((__m128i *)(reduced + i), _mm_packus_epi16(lo, hi));
+		}
+	}
+#endif
+	for (; i < end; ++i)
+		reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+}
+
+static void stbi__convert_8_to_16_task(void *task_data, int task)
+{
+	stbi__convert_depth *c = (stbi__convert_depth *)task_data;
+	stbi_uc *orig = (stbi_uc *)c->input;
+	stbi__uint16 *enlarged = (stbi__uint16 *)c->output;
+	int i = (int)((stbi__uint64)c->count * task / c->tasks);
+	int end = (int)((stbi__uint64)c->count * (task + 1) / c->tasks);
+
+#ifdef STBI_SSE2
+	if (c->simd) {
+		for (; i + 16 <= end; i += 16) {
+			// a byte paired with itself is that byte times 257
+			__m128i v = _mm_loadu_si128((__m128i const *)(orig + i));
+			_mm_storeu_si128((__m128i *)(enlarged + i), _mm_unpacklo_epi8(v, v));
+			_mm_storeu_si128((__m128i *)(enlarged + i + 8), _mm_unpackhi_epi8(v, v));
+		}
+	}
+#endif
+	for (; i < end; ++i)
+		enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+}
+
+static void stbi__convert_depth_run(stbi_parallel_task *task, void *input, void *output, int count)
+{
+	stbi__convert_depth c;
+	c.input = input;
+	c.output = output;
+	c.count = count;
+	c.tasks = stbi__parallel_task_count(count / STBI__CONVERT_TASK_SIZE);
+#ifdef STBI_SSE2
+	c.simd = stbi__sse2_available();
+#else
+	c.simd = 0;
+#endif
+	stbi__parallel_run(task, &c, c.tasks);
+}
+
 static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
 {
-	int i;
 	int img_len = w * h * channels;
 	stbi_uc *reduced;
 
 	reduced = (stbi_uc *)stbi__malloc(img_len);
 	if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
 
-	for (i = 0; i < img_len; ++i)
-		reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
+	stbi__convert_depth_run(stbi__convert_16_to_8_task, orig, reduced, img_len);
 
 	STBI_FREE(orig);
 	return reduced;
@@ -1111,15 +1344,13 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
 
 static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
 {
-	int i;
 	int img_len = w * h * channels;
 	stbi__uint16 *enlarged;
 
 	enlarged = (stbi__uint16 *)stbi__malloc(img_len * 2);
 	if (enlarged == NULL) return (stbi__uint16 *)stbi__errpuc("outofmem", "Out of memory");
 
-	for (i = 0; i < img_len; ++i)
-		enlarged[i] = (stbi__uint16)((orig[i] << 8) + orig[i]); // replicate to high and low byte, maps 0->0, 255->0xffff
+	stbi__convert_depth_run(stbi__convert_8_to_16_task, orig, enlarged, img_len);
 
 	STBI_FREE(orig);
 	return enlarged;
@@ -1630,9 +1861,6 @@ static stbi__uint32 stbi__get32le(stbi__context *s)
 
 #define STBI__BYTECAST(x)  ((stbi_uc) ((x) & 255))  // truncate int to byte without warnings
 
-#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
-// nothing
-#else
 //////////////////////////////////////////////////////////////////////////////
 //
 //  generic converter from built-in img_n to req_comp
@@ -1648,14 +1876,229 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 {
 	return (stbi_uc)(((r * 77) + (g * 150) + (29 * b)) >> 8);
 }
+
+#ifdef STBI_SSE2
+// channel conversion with byte shuffles. A step converts a fixed number of pixels into 16-byte
+// vectors: byte k of vector v is byte mask[l][v][k] of the 16 bytes at offset[v] + 16*l from
+// the step's first input byte, or zero where the mask byte has its top bit set, ored with
+// fill[v][k]. Grey from colour shuffles r, g, b and a out into 16-bit lanes instead, and then
+// does the sum of stbi__compute_y in those lanes.
+typedef struct
+{
+	int luma, req_comp;
+	int step;      // pixels per step
+	int in_pixel, out_pixel;
+	int count;     // vectors per step
+	int loads;     // 16-byte loads per vector, 1 or 2
+	int reach;     // bytes a step reads from its first input byte, which can be past its pixels
+	int offset[8];
+	stbi_uc mask[2][8][16];
+	stbi_uc fill[8][16];
+} stbi__swizzle;
+
+// the source channel of output channel c, or -1 for an opaque alpha
+static int stbi__swizzle_channel(int img_n, int req_comp, int c)
+{
+	if (img_n <= 2 && req_comp >= 3)
+		return c < 3 ? 0 : (img_n == 2 ? 1 : -1);
+	if ((req_comp & 1) == 0 && c == req_comp - 1)
+		return (img_n & 1) == 0 ? img_n - 1 : -1;
+	return c;
+}
+
+// sets up the shuffles converting img_n channels of bytes each to req_comp; 0 if there are none
+static int stbi__swizzle_setup(stbi__swizzle *z, int img_n, int req_comp, int bytes)
+{
+	// for each output byte, the input byte it is, or -1 for 0 and -2 for 255
+	int index[8][16];
+	int v, k;
+
+	z->luma = img_n >= 3 && req_comp <= 2;
+	z->req_comp = req_comp;
+	z->in_pixel = img_n * bytes;
+	z->out_pixel = req_comp * bytes;
+	if (z->luma) {
+		// 16-bit grey needs up to four loads a vector and a 24-bit sum, and measured no faster
+		// than the scalar loop
+		if (bytes == 2) return 0;
+		// r, g, b and a, each for pixels 0-7 and then 8-15
+		z->step = 16;
+		z->count = req_comp == 2 ? 8 : 6;
+		for (v = 0; v < z->count; ++v) {
+			int c = v >> 1;
+			for (k = 0; k < 16; ++k) {
+				int p = (v & 1) * 8 + (k >> 1);
+				if (k & 1)
+					index[v][k] = -1;
+				else
+					index[v][k] = c == 3 && img_n == 3 ? -2 : p * img_n + c;
+			}
+		}
+	} else {
+		z->step = 32 / bytes;
+		z->count = 2 * req_comp;
+		for (v = 0; v < z->count; ++v) {
+			for (k = 0; k < 16; ++k) {
+				int e = (v * 16 + k) / bytes, p = e / req_comp;
+				int c = stbi__swizzle_channel(img_n, req_comp, e % req_comp);
+				index[v][k] = c < 0 ? -2 : (p * img_n + c) * bytes + k % bytes;
+			}
+		}
+	}
+
+	z->loads = 1;
+	z->reach = 0;
+	for (v = 0; v < z->count; ++v) {
+		int first = -1, last = 0;
+		for (k = 0; k < 16; ++k) {
+			if (index[v][k] < 0) continue;
+			if (first < 0 || index[v][k] < first) first = index[v][k];
+			if (index[v][k] > last) last = index[v][k];
+		}
+		z->offset[v] = first < 0 ? 0 : first;
+		if (last - z->offset[v] >= 32) return 0;
+		if (last - z->offset[v] >= 16) z->loads = 2;
+	}
+	for (v = 0; v < z->count; ++v) {
+		if (z->offset[v] + 16 * z->loads > z->reach) z->reach = z->offset[v] + 16 * z->loads;
+		for (k = 0; k < 16; ++k) {
+			int d = index[v][k] - z->offset[v];
+			z->mask[0][v][k] = index[v][k] >= 0 && d < 16 ? (stbi_uc) d : 0x80;
+			z->mask[1][v][k] = index[v][k] >= 0 && d >= 16 ? (stbi_uc) (d - 16) : 0x80;
+			z->fill[v][k] = index[v][k] == -2 ? 255 : 0;
+		}
+	}
+	return 1;
+}
+
+// stbi__compute_y of 8 pixels in 16-bit lanes; the sum fits in 16 bits
+stbi_inline static __m128i stbi__swizzle_y_sse2(__m128i r, __m128i g, __m128i b)
+{
+	__m128i s = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+	return _mm_srli_epi16(_mm_add_epi16(s, _mm_mullo_epi16(b, _mm_set1_epi16(29))), 8);
+}
+
+// runs whole steps over the start of a row of x pixels and returns how many pixels it did.
+// It is made once for each number of loads per vector, so that loop unrolls.
+#define STBI__SWIZZLE_SSSE3(name, loads) \
+	STBI__SIMD_TARGET("ssse3") static int name(const stbi__swizzle *z, stbi_uc *dest, const stbi_uc *src, int x) \
+	{ \
+		int i, v, l; \
+		for (i = 0; i + z->step <= x && (size_t)(x - i) * z->in_pixel >= (size_t)z->reach; i += z->step) { \
+			const stbi_uc *in = src + (size_t)i * z->in_pixel; \
+			stbi_uc *out = dest + (size_t)i * z->out_pixel; \
+			__m128i t[8]; \
+			for (v = 0; v < z->count; ++v) { \
+				__m128i a = _mm_loadu_si128((const __m128i *) z->fill[v]); \
+				for (l = 0; l < loads; ++l) { \
+					__m128i b = _mm_loadu_si128((const __m128i *) (in + z->offset[v] + 16 * l)); \
+					a = _mm_or_si128(a, _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *) z->mask[l][v]))); \
+				} \
+				t[v] = a; \
+			} \
+			if (!z->luma) { \
+				for (v = 0; v < z->count; ++v) \
+					_mm_storeu_si128((__m128i *) (out + 16 * v), t[v]); \
+			} else { \
+				/* t[2c] and t[2c+1] hold channel c of pixels 0-7 and 8-15 */ \
+				__m128i y0 = stbi__swizzle_y_sse2(t[0], t[2], t[4]); \
+				__m128i y1 = stbi__swizzle_y_sse2(t[1], t[3], t[5]); \
+				if (z->req_comp == 1) \
+					_mm_storeu_si128((__m128i *) out, _mm_packus_epi16(y0, y1)); \
+				else { \
+					_mm_storeu_si128((__m128i *) out, _mm_or_si128(y0, _mm_slli_epi16(t[6], 8))); \
+					_mm_storeu_si128((__m128i *) (out + 16), _mm_or_si128(y1, _mm_slli_epi16(t[7], 8))); \
+				} \
+			} \
+		} \
+		return i; \
+	}
+
+STBI__SWIZZLE_SSSE3(stbi__swizzle_ssse3_1, 1)
+STBI__SWIZZLE_SSSE3(stbi__swizzle_ssse3_2, 2)
+#undef STBI__SWIZZLE_SSSE3
+
+// grey from colour as stbi__swizzle_ssse3_2, with both halves of a channel in one register. It
+// only pays off here: the plain shuffles would need a lane insert for every shuffle they save.
+STBI__SIMD_TARGET("avx2")
+static int stbi__swizzle_luma_avx2(const stbi__swizzle *z, stbi_uc *dest, const stbi_uc *src, int x)
+{
+	int i, v, l;
+	for (i = 0; i + z->step <= x && (size_t)(x - i) * z->in_pixel >= (size_t)z->reach; i += z->step) {
+		const stbi_uc *in = src + (size_t)i * z->in_pixel;
+		stbi_uc *out = dest + (size_t)i * z->out_pixel;
+		__m256i t[4], y;
+		for (v = 0; v < z->count; v += 2) {
+			__m256i a = _mm256_loadu_si256((const __m256i *) z->fill[v]);
+			for (l = 0; l < 2; ++l) {
+				__m128i first = _mm_loadu_si128((const __m128i *) (in + z->offset[v] + 16 * l));
+				__m128i second = _mm_loadu_si128((const __m128i *) (in + z->offset[v + 1] + 16 * l));
+				__m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+				a = _mm256_or_si256(a, _mm256_shuffle_epi8(b, _mm256_loadu_si256((const __m256i *) z->mask[l][v])));
+			}
+			t[v >> 1] = a;
+		}
+		y = _mm256_add_epi16(_mm256_mullo_epi16(t[0], _mm256_set1_epi16(77)), _mm256_mullo_epi16(t[1], _mm256_set1_epi16(150)));
+		y = _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_mullo_epi16(t[2], _mm256_set1_epi16(29))), 8);
+		if (z->req_comp == 1)
+			_mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(y, y), 0x08)));
+		else
+			_mm256_storeu_si256((__m256i *) out, _mm256_or_si256(y, _mm256_slli_epi16(t[3], 8)));
+	}
+	return i;
+}
+
+// converts as much of the start of a row as the shuffles can and returns how many pixels that was
+static int stbi__convert_row_simd(void *dest, const void *src, int img_n, int req_comp, int x, int bytes)
+{
+	stbi__swizzle z;
+	if (x < 64 || !stbi__ssse3_available() || !stbi__swizzle_setup(&z, img_n, req_comp, bytes)) return 0;
+	if (z.luma && z.loads == 2 && stbi__avx2_available())
+		return stbi__swizzle_luma_avx2(&z, (stbi_uc *) dest, (const stbi_uc *) src, x);
+	if (z.loads == 1)
+		return stbi__swizzle_ssse3_1(&z, (stbi_uc *) dest, (const stbi_uc *) src, x);
+	return stbi__swizzle_ssse3_2(&z, (stbi_uc *) dest, (const stbi_uc *) src, x);
+}
+#endif
+
+// convert a row of x pixels with img_n components to one with req_comp components
+static void stbi__convert_row(stbi_uc *dest, stbi_uc const *src, int img_n, int req_comp, unsigned int x)
+{
+	int i;
+#ifdef STBI_SSE2
+	i = stbi__convert_row_simd(dest, src, img_n, req_comp, (int) x, 1);
+	dest += i * req_comp;
+	src += i * img_n;
+	x -= i;
 #endif
 
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+	// avoid switch per pixel, so use switch per scanline and massive macros
+	switch (STBI__COMBO(img_n, req_comp)) {
+		STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 255; } break;
+		STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+		STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 255; } break;
+		STBI__CASE(2, 1) { dest[0] = src[0]; } break;
+		STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+		STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
+		STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 255; } break;
+		STBI__CASE(3, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
+		STBI__CASE(3, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = 255; } break;
+		STBI__CASE(4, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
+		STBI__CASE(4, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = src[3]; } break;
+		STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
+	default: STBI_ASSERT(0);
+	}
+#undef STBI__CASE
+#undef STBI__COMBO
+}
+
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-	int i, j;
 	unsigned char *good;
 
 	if (req_comp == img_n) return data;
@@ -1667,31 +2110,9 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 		return stbi__errpuc("outofmem", "Out of memory");
 	}
 
-	for (j = 0; j < (int)y; ++j) {
-		unsigned char *src = data + j * x * img_n;
-		unsigned char *dest = good + j * x * req_comp;
-
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-		// convert source image with img_n components to one with req_comp components;
-		// avoid switch per pixel, so use switch per scanline and massive macros
-		switch (STBI__COMBO(img_n, req_comp)) {
-			STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 255; } break;
-			STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-			STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 255; } break;
-			STBI__CASE(2, 1) { dest[0] = src[0]; } break;
-			STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-			STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
-			STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 255; } break;
-			STBI__CASE(3, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
-			STBI__CASE(3, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = 255; } break;
-			STBI__CASE(4, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
-			STBI__CASE(4, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = src[3]; } break;
-			STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
-		default: STBI_ASSERT(0);
-		}
-#undef STBI__CASE
-	}
+	// convert source image with img_n components to one with req_comp components; rows are
+	// packed in both, so the image goes through as one long row
+	stbi__convert_row(good, data, img_n, req_comp, x * y);
 
 	STBI_FREE(data);
 	return good;
@@ -1710,9 +2131,41 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
+// convert a row of x pixels with img_n components to one with req_comp components
+static void stbi__convert_row16(stbi__uint16 *dest, stbi__uint16 const *src, int img_n, int req_comp, unsigned int x)
+{
+	int i;
+#ifdef STBI_SSE2
+	i = stbi__convert_row_simd(dest, src, img_n, req_comp, (int) x, 2);
+	dest += i * req_comp;
+	src += i * img_n;
+	x -= i;
+#endif
+
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+	// avoid switch per pixel, so use switch per scanline and massive macros
+	switch (STBI__COMBO(img_n, req_comp)) {
+		STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 0xffff; } break;
+		STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+		STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 0xffff; } break;
+		STBI__CASE(2, 1) { dest[0] = src[0]; } break;
+		STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+		STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
+		STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 0xffff; } break;
+		STBI__CASE(3, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
+		STBI__CASE(3, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = 0xffff; } break;
+		STBI__CASE(4, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
+		STBI__CASE(4, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = src[3]; } break;
+		STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
+	default: STBI_ASSERT(0);
+	}
+#undef STBI__CASE
+#undef STBI__COMBO
+}
+
 static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-	int i, j;
 	stbi__uint16 *good;
 
 	if (req_comp == img_n) return data;
@@ -1724,57 +2177,198 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 		return (stbi__uint16 *)stbi__errpuc("outofmem", "Out of memory");
 	}
 
-	for (j = 0; j < (int)y; ++j) {
-		stbi__uint16 *src = data + j * x * img_n;
-		stbi__uint16 *dest = good + j * x * req_comp;
+	// convert source image with img_n components to one with req_comp components; rows are
+	// packed in both, so the image goes through as one long row
+	stbi__convert_row16(good, data, img_n, req_comp, x * y);
 
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-		// convert source image with img_n components to one with req_comp components;
-		// avoid switch per pixel, so use switch per scanline and massive macros
-		switch (STBI__COMBO(img_n, req_comp)) {
-			STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 0xffff; } break;
-			STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-			STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 0xffff; } break;
-			STBI__CASE(2, 1) { dest[0] = src[0]; } break;
-			STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-			STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
-			STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 0xffff; } break;
-			STBI__CASE(3, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
-			STBI__CASE(3, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = 0xffff; } break;
-			STBI__CASE(4, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
-			STBI__CASE(4, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = src[3]; } break;
-			STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
-		default: STBI_ASSERT(0);
+	STBI_FREE(data);
+	return good;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  decoding into caller memory
+//
+
+// copy a decoded image with img_n components of bpc bits out to where
+// stbi_load_into* wants it, converting and flipping on the way
+static int stbi__write_into(stbi__into *into, void *data, int x, int y, int img_n, int bpc)
+{
+	size_t row_len = (size_t)x * img_n;
+	int j;
+
+	if (x != into->w || y != into->h) return stbi__err("wrong size", "Image is not the size given to stbi_load_into");
+
+#if !defined(STBI_NO_PNG) || !defined(STBI_NO_PSD)
+	if (bpc == 16) {
+		// 16-bit rows are converted at 16 bits, as stbi_load does, then reduced
+		size_t out_len = (size_t)x * into->comp;
+		stbi__uint16 *converted = NULL;
+		if (img_n != into->comp) {
+			converted = (stbi__uint16 *)stbi__malloc_mad2(x, into->comp * 2, 0);
+			if (!converted) return stbi__err("outofmem", "Out of memory");
 		}
-#undef STBI__CASE
+		for (j = 0; j < y; ++j) {
+			stbi_uc *dest = into->first + j * into->step;
+			stbi__uint16 *src = (stbi__uint16 *)data + j * row_len;
+			size_t i;
+			if (converted) {
+				stbi__convert_row16(converted, src, img_n, into->comp, x);
+				src = converted;
+			}
+			for (i = 0; i < out_len; ++i)
+				dest[i] = (stbi_uc)(src[i] >> 8); // as in stbi__convert_16_to_8
+		}
+		STBI_FREE(converted);
+		return 1;
 	}
+#endif
 
-	STBI_FREE(data);
-	return good;
+	STBI_ASSERT(bpc == 8);
+	for (j = 0; j < y; ++j) {
+		stbi_uc *dest = into->first + j * into->step;
+		stbi_uc *src = (stbi_uc *)data + j * row_len;
+		if (img_n != into->comp)
+			stbi__convert_row(dest, src, img_n, into->comp, x);
+		else
+			memcpy(dest, src, row_len);
+	}
+	return 1;
 }
+
+static int stbi__load_into_main(stbi__context *s, stbi_uc *output, int width, int height, int stride, int req_comp)
+{
+	stbi__into into;
+	stbi__result_info ri;
+	void *result;
+	int x, y, comp, decode_comp, ok;
+
+	if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+	if (width <= 0 || height <= 0 || stride / req_comp < width) return stbi__err("bad stride", "Output rows are too short for the image");
+
+	into.first = output;
+	into.step = stride;
+	into.w = width;
+	into.h = height;
+	into.comp = req_comp;
+	if (stbi__vertically_flip_on_load) {
+		into.first = output + (ptrdiff_t)(height - 1) * stride;
+		into.step = -(ptrdiff_t)stride;
+	}
+
+#ifndef STBI_NO_JPEG
+	// jpeg color-converts rows straight into the output
+	if (stbi__jpeg_test(s)) return stbi__jpeg_load_into(s, &into);
+#endif
+
+	// everything else decodes into its own buffer as usual, but without converting,
+	// so that conversion and flipping happen in the one pass that copies it out.
+	// hdr converts as it maps floats to bytes, to get the same bytes as stbi_load
+	decode_comp = 0;
+#ifndef STBI_NO_HDR
+	if (stbi__hdr_test(s)) decode_comp = req_comp;
 #endif
+	result = stbi__load_main(s, &x, &y, &comp, decode_comp, &ri, 8);
+	if (result == NULL)
+		return 0;
+	ok = stbi__write_into(&into, result, x, y, decode_comp ? decode_comp : comp, ri.bits_per_channel);
+	STBI_FREE(result);
+	return ok;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, stbi_uc *output, int width, int height, int stride, int desired_channels)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_into_main(&s, output, width, height, stride, desired_channels);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_uc *output, int width, int height, int stride, int desired_channels)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_into_main(&s, output, width, height, stride, desired_channels);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into(char const *filename, stbi_uc *output, int width, int height, int stride, int desired_channels)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	int result;
+	if (!f) return stbi__err("can't fopen", "Unable to open file");
+	result = stbi_load_into_from_file(f, output, width, height, stride, desired_channels);
+	fclose(f);
+	return result;
+}
+
+STBIDEF int stbi_load_into_from_file(FILE *f, stbi_uc *output, int width, int height, int stride, int desired_channels)
+{
+	int result;
+	stbi__context s;
+	stbi__start_file(&s, f);
+	result = stbi__load_into_main(&s, output, width, height, stride, desired_channels);
+	if (result) {
+		// need to 'unget' all the characters in the IO buffer
+		fseek(f, -(int)(s.img_buffer_end - s.img_buffer), SEEK_CUR);
+	}
+	return result;
+}
+#endif //!STBI_NO_STDIO
 
 #ifndef STBI_NO_LINEAR
+typedef struct
+{
+	stbi_uc *data;
+	float *output;
+	int pixels, comp, tasks;
+	// value of every 8-bit input: colour channels go through the gamma curve, alpha doesn't
+	float colour[256], alpha[256];
+} stbi__ldr_to_hdr_work;
+
+static void stbi__ldr_to_hdr_task(void *task_data, int task)
+{
+	stbi__ldr_to_hdr_work *w = (stbi__ldr_to_hdr_work *)task_data;
+	stbi_uc *data = w->data;
+	float *output = w->output;
+	const float *colour = w->colour;
+	int k, comp = w->comp;
+	size_t i = (size_t)((stbi__uint64)w->pixels * task / w->tasks) * comp;
+	size_t end = (size_t)((stbi__uint64)w->pixels * (task + 1) / w->tasks) * comp;
+
+	if (comp & 1) {
+		for (; i < end; ++i)
+			output[i] = colour[data[i]];
+	} else {
+		// the last channel is alpha
+		for (; i < end; i += comp) {
+			for (k = 0; k < comp - 1; ++k)
+				output[i + k] = colour[data[i + k]];
+			output[i + k] = w->alpha[data[i + k]];
+		}
+	}
+}
+
 static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
-	int i, k, n;
+	int i;
 	float *output;
+	stbi__ldr_to_hdr_work w;
 	if (!data) return NULL;
 	output = (float *)stbi__malloc_mad4(x, y, comp, sizeof(float), 0);
 	if (output == NULL) { STBI_FREE(data); return stbi__errpf("outofmem", "Out of memory"); }
-	// compute number of non-alpha components
-	if (comp & 1) n = comp; else n = comp - 1;
-	for (i = 0; i < x*y; ++i) {
-		for (k = 0; k < n; ++k) {
-			output[i*comp + k] = (float)(pow(data[i*comp + k] / 255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
-		}
-	}
-	if (n < comp) {
-		for (i = 0; i < x*y; ++i) {
-			output[i*comp + n] = data[i*comp + n] / 255.0f;
-		}
-	}
+	// an 8-bit input only has 256 values, so pow() runs once per value rather than per component;
+	// the table holds exactly what it returns, so the output is the same
+	for (i = 0; i < 256; ++i) {
+		w.colour[i] = (float)(pow(i / 255.0f, stbi__l2h_gamma) * stbi__l2h_scale);
+		w.alpha[i] = i / 255.0f;
+	}
+	w.data = data;
+	w.output = output;
+	w.pixels = x * y;
+	w.comp = comp;
+	w.tasks = stbi__parallel_task_count(w.pixels * comp / STBI__CONVERT_TASK_SIZE);
+	stbi__parallel_run(stbi__ldr_to_hdr_task, &w, w.tasks);
 	STBI_FREE(data);
 	return output;
 }
@@ -1897,6 +2491,7 @@ typedef struct
 
 	// kernels
 	void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+	void(*idct_block2_kernel)(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64]); // two at once, or NULL
 	void(*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
 	stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
@@ -2600,6 +3195,187 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+// avx2 version of the above doing two blocks at once, one per 128-bit lane. every
+// unpack, pack and madd works within a lane, so each lane runs exactly the sse2
+// steps, and the results are still bit-identical to the generic C version.
+STBI__SIMD_TARGET("avx2")
+static void stbi__idct_simd2_avx2(stbi_uc *out0, int out_stride0, short data0[64], stbi_uc *out1, int out_stride1, short data1[64])
+{
+	__m256i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m256i tmp;
+	int i;
+
+	// dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_set1_epi32((int) ((unsigned short) (x) | ((unsigned int) (unsigned short) (y) << 16)))
+
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+#define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+#define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+#define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+	// block 0 in the low lane, block 1 in the high lane
+#define dct_load(k) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i *) (data0 + (k) * 8))), \
+         _mm_load_si128((const __m128i *) (data1 + (k) * 8)), 1)
+
+	__m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+	__m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+	__m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+	__m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+	__m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+	__m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+	__m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+	__m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+	__m256i bias_0 = _mm256_set1_epi32(512);
+	__m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+	row0 = dct_load(0);
+	row1 = dct_load(1);
+	row2 = dct_load(2);
+	row3 = dct_load(3);
+	row4 = dct_load(4);
+	row5 = dct_load(5);
+	row6 = dct_load(6);
+	row7 = dct_load(7);
+
+	// column pass
+	dct_pass(bias_0, 10);
+
+	{
+		// 16bit 8x8 transpose, three passes
+		dct_interleave16(row0, row4);
+		dct_interleave16(row1, row5);
+		dct_interleave16(row2, row6);
+		dct_interleave16(row3, row7);
+
+		dct_interleave16(row0, row2);
+		dct_interleave16(row1, row3);
+		dct_interleave16(row4, row6);
+		dct_interleave16(row5, row7);
+
+		dct_interleave16(row0, row1);
+		dct_interleave16(row2, row3);
+		dct_interleave16(row4, row5);
+		dct_interleave16(row6, row7);
+	}
+
+	// row pass
+	dct_pass(bias_1, 17);
+
+	{
+		__m256i p0 = _mm256_packus_epi16(row0, row1);
+		__m256i p1 = _mm256_packus_epi16(row2, row3);
+		__m256i p2 = _mm256_packus_epi16(row4, row5);
+		__m256i p3 = _mm256_packus_epi16(row6, row7);
+		__m128i q[8];
+
+		// 8bit 8x8 transpose, three passes
+		dct_interleave8(p0, p2);
+		dct_interleave8(p1, p3);
+
+		dct_interleave8(p0, p1);
+		dct_interleave8(p2, p3);
+
+		dct_interleave8(p0, p2);
+		dct_interleave8(p1, p3);
+
+		// rows 0-7 of block 0, then of block 1, two rows per register
+		q[0] = _mm256_castsi256_si128(p0);
+		q[1] = _mm256_castsi256_si128(p2);
+		q[2] = _mm256_castsi256_si128(p1);
+		q[3] = _mm256_castsi256_si128(p3);
+		q[4] = _mm256_extracti128_si256(p0, 1);
+		q[5] = _mm256_extracti128_si256(p2, 1);
+		q[6] = _mm256_extracti128_si256(p1, 1);
+		q[7] = _mm256_extracti128_si256(p3, 1);
+
+		// store
+		for (i = 0; i < 4; ++i) {
+			_mm_storel_epi64((__m128i *) out0, q[i]); out0 += out_stride0;
+			_mm_storel_epi64((__m128i *) out0, _mm_shuffle_epi32(q[i], 0x4e)); out0 += out_stride0;
+		}
+		for (i = 4; i < 8; ++i) {
+			_mm_storel_epi64((__m128i *) out1, q[i]); out1 += out_stride1;
+			_mm_storel_epi64((__m128i *) out1, _mm_shuffle_epi32(q[i], 0x4e)); out1 += out_stride1;
+		}
+	}
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+}
+
 #endif // STBI_SSE2
 
 #ifdef STBI_NEON
@@ -2844,69 +3620,332 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
 	// since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+// blocks waiting for their idct. with a two-block kernel, a block is held back until a
+// second one comes along, so its coefficients must stay put until the queue is flushed
+typedef struct
 {
-	stbi__jpeg_reset(z);
-	if (!z->progressive) {
-		if (z->scan_n == 1) {
-			int i, j;
-			STBI_SIMD_ALIGN(short, data[64]);
-			int n = z->order[0];
-			// non-interleaved data, we just need to process one block at a time,
-			// in trivial scanline order
-			// number of blocks to do just depends on how many actual "pixels" this
-			// component has, independent of interleaved MCU blocking and such
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j) {
-				for (i = 0; i < w; ++i) {
+	STBI_SIMD_ALIGN(short, blocks[2][64]); // for blocks decoded straight into the queue
+	short *data;
+	stbi_uc *out;
+	int out_stride;
+} stbi__jpeg_idct_queue;
+
+static void stbi__jpeg_idct(stbi__jpeg *z, stbi__jpeg_idct_queue *q, stbi_uc *out, int out_stride, short *data)
+{
+	if (!z->idct_block2_kernel)
+		z->idct_block_kernel(out, out_stride, data);
+	else if (!q->data) {
+		q->data = data;
+		q->out = out;
+		q->out_stride = out_stride;
+	}
+	else {
+		z->idct_block2_kernel(q->out, q->out_stride, q->data, out, out_stride, data);
+		q->data = NULL;
+	}
+}
+
+static void stbi__jpeg_idct_flush(stbi__jpeg *z, stbi__jpeg_idct_queue *q)
+{
+	if (q->data) z->idct_block_kernel(q->out, q->out_stride, q->data);
+	q->data = NULL;
+}
+
+// a block of the queue that is free to decode into
+static short *stbi__jpeg_idct_free_block(stbi__jpeg_idct_queue *q)
+{
+	return q->data == q->blocks[0] ? q->blocks[1] : q->blocks[0];
+}
+
+// a baseline scan is decoded as a sequence of mcus: interleaved ones, or single blocks
+// in raster order when the scan has one component
+static int stbi__jpeg_mcu_row_length(stbi__jpeg *z)
+{
+	if (z->scan_n == 1) return (z->img_comp[z->order[0]].x + 7) >> 3;
+	return z->img_mcu_x;
+}
+
+static int stbi__jpeg_mcu_count(stbi__jpeg *z)
+{
+	if (z->scan_n == 1) return stbi__jpeg_mcu_row_length(z) * ((z->img_comp[z->order[0]].y + 7) >> 3);
+	return z->img_mcu_x * z->img_mcu_y;
+}
+
+static int stbi__jpeg_mcu_block_count(stbi__jpeg *z)
+{
+	int k, count = 0;
+	if (z->scan_n == 1) return 1;
+	for (k = 0; k < z->scan_n; ++k)
+		count += z->img_comp[z->order[k]].h * z->img_comp[z->order[k]].v;
+	return count;
+}
+
+// decode one mcu of a baseline scan. without coeff, each block is queued for its idct
+// right away; otherwise the dequantized coefficients of its blocks are stored in
+// coeff, 64 per block, for stbi__jpeg_idct_mcu to finish later
+static int stbi__jpeg_decode_mcu(stbi__jpeg *z, int mcu, short *coeff, stbi__jpeg_idct_queue *q)
+{
+	short *block = coeff ? coeff : stbi__jpeg_idct_free_block(q);
+	if (z->scan_n == 1) {
+		int n = z->order[0];
+		int w = (z->img_comp[n].x + 7) >> 3;
+		int i = mcu % w, j = mcu / w;
+		int ha = z->img_comp[n].ha;
+		if (!stbi__jpeg_decode_block(z, block, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+		if (!coeff)
+			stbi__jpeg_idct(z, q, z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, block);
+	}
+	else {
+		int i = mcu % z->img_mcu_x, j = mcu / z->img_mcu_x;
+		int k, x, y;
+		// scan an interleaved mcu... process scan_n components in order
+		for (k = 0; k < z->scan_n; ++k) {
+			int n = z->order[k];
+			// scan out an mcu's worth of this component; that's just determined
+			// by the basic H and V specified for the component
+			for (y = 0; y < z->img_comp[n].v; ++y) {
+				for (x = 0; x < z->img_comp[n].h; ++x) {
+					int x2 = (i*z->img_comp[n].h + x) * 8;
+					int y2 = (j*z->img_comp[n].v + y) * 8;
 					int ha = z->img_comp[n].ha;
-					if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
-					// every data block is an MCU, so countdown the restart interval
-					if (--z->todo <= 0) {
-						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-						// if it's NOT a restart, then just bail, so we get corrupt data
-						// rather than no data
-						if (!STBI__RESTART(z->marker)) return 1;
-						stbi__jpeg_reset(z);
+					if (!stbi__jpeg_decode_block(z, block, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+					if (coeff)
+						block += 64;
+					else {
+						stbi__jpeg_idct(z, q, z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, block);
+						block = stbi__jpeg_idct_free_block(q);
 					}
 				}
 			}
-			return 1;
 		}
-		else { // interleaved
-			int i, j, k, x, y;
-			STBI_SIMD_ALIGN(short, data[64]);
-			for (j = 0; j < z->img_mcu_y; ++j) {
-				for (i = 0; i < z->img_mcu_x; ++i) {
-					// scan an interleaved mcu... process scan_n components in order
-					for (k = 0; k < z->scan_n; ++k) {
-						int n = z->order[k];
-						// scan out an mcu's worth of this component; that's just determined
-						// by the basic H and V specified for the component
-						for (y = 0; y < z->img_comp[n].v; ++y) {
-							for (x = 0; x < z->img_comp[n].h; ++x) {
-								int x2 = (i*z->img_comp[n].h + x) * 8;
-								int y2 = (j*z->img_comp[n].v + y) * 8;
-								int ha = z->img_comp[n].ha;
-								if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-								z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
-							}
-						}
-					}
-					// after all interleaved components, that's an interleaved MCU,
-					// so now count down the restart interval
-					if (--z->todo <= 0) {
-						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-						if (!STBI__RESTART(z->marker)) return 1;
-						stbi__jpeg_reset(z);
-					}
+	}
+	return 1;
+}
+
+// queue the blocks stbi__jpeg_decode_mcu stored for an mcu for their idct
+static void stbi__jpeg_idct_mcu(stbi__jpeg *z, int mcu, short *coeff, stbi__jpeg_idct_queue *q)
+{
+	if (z->scan_n == 1) {
+		int n = z->order[0];
+		int w = (z->img_comp[n].x + 7) >> 3;
+		int i = mcu % w, j = mcu / w;
+		stbi__jpeg_idct(z, q, z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, coeff);
+	}
+	else {
+		int i = mcu % z->img_mcu_x, j = mcu / z->img_mcu_x;
+		int k, x, y;
+		for (k = 0; k < z->scan_n; ++k) {
+			int n = z->order[k];
+			for (y = 0; y < z->img_comp[n].v; ++y) {
+				for (x = 0; x < z->img_comp[n].h; ++x) {
+					int x2 = (i*z->img_comp[n].h + x) * 8;
+					int y2 = (j*z->img_comp[n].v + y) * 8;
+					stbi__jpeg_idct(z, q, z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, coeff);
+					coeff += 64;
 				}
 			}
-			return 1;
 		}
 	}
+}
+
+// decode mcus *mcu..end-1 of a baseline scan, counting down the restart interval, and
+// advance *mcu past the ones decoded. with coeff, mcus are stored there one after another
+// (see stbi__jpeg_decode_mcu). returns 0 on error, 1 when all were decoded, and 2 when it
+// stopped early because a restart marker was missing
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int *mcu, int end, short *coeff)
+{
+	stbi__jpeg_idct_queue q;
+	int coeff_step = coeff ? 64 * stbi__jpeg_mcu_block_count(z) : 0;
+	int result = 1;
+	q.data = NULL;
+	while (*mcu < end) {
+		if (!stbi__jpeg_decode_mcu(z, *mcu, coeff, &q)) return 0;
+		++*mcu;
+		coeff += coeff_step;
+		// after each mcu, count down the restart interval
+		if (--z->todo <= 0) {
+			if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+			// if it's NOT a restart, then just bail, so we get corrupt data
+			// rather than no data
+			if (!STBI__RESTART(z->marker)) { result = 2; break; }
+			stbi__jpeg_reset(z);
+		}
+	}
+	stbi__jpeg_idct_flush(z, &q);
+	return result;
+}
+
+// restart intervals are entropy coded independently, so when the whole scan is in
+// memory, they can be located up front and decoded in parallel, a run of them per task
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi__jpeg *decoders;     // one copy of z per task...
+	stbi__context *contexts;  // ...reading from its own slice of the scan
+	stbi_uc **interval_start;
+	int *results;
+	int intervals, tasks, mcus;
+} stbi__jpeg_intervals;
+
+static void stbi__jpeg_decode_intervals_task(void *task_data, int task)
+{
+	stbi__jpeg_intervals *w = (stbi__jpeg_intervals *)task_data;
+	stbi__jpeg *z = &w->decoders[task];
+	stbi__context *s = &w->contexts[task];
+	int first = (int)((stbi__uint64)task * w->intervals / w->tasks);
+	int last = (int)((stbi__uint64)(task + 1) * w->intervals / w->tasks);
+	int mcu = first * w->z->restart_interval;
+	int end = last == w->intervals ? w->mcus : last * w->z->restart_interval;
+
+	*z = *w->z;
+	*s = *w->z->s;
+	z->s = s;
+	s->img_buffer = w->interval_start[first];
+	if (last < w->intervals)
+		s->img_buffer_end = w->interval_start[last];
+	stbi__jpeg_reset(z);
+	w->results[task] = stbi__jpeg_decode_mcus(z, &mcu, end, NULL);
+}
+
+// returns -1 when the scan can't be split, leaving z untouched, otherwise as stbi__jpeg_decode_mcus
+static int stbi__jpeg_decode_intervals(stbi__jpeg *z)
+{
+	stbi__jpeg_intervals w;
+	stbi__context *s = z->s;
+	stbi_uc *p = s->img_buffer;
+	int i, found = 0, result = 1;
+	void *mem;
+
+	if (!z->restart_interval || s->read_from_callbacks) return -1;
+	w.z = z;
+	w.mcus = stbi__jpeg_mcu_count(z);
+	w.intervals = (w.mcus + z->restart_interval - 1) / z->restart_interval;
+	if (w.intervals < 2) return -1;
+	w.tasks = stbi__parallel_task_count(w.intervals);
+
+	mem = stbi__malloc(w.tasks * (sizeof(stbi__jpeg) + sizeof(stbi__context) + sizeof(int)) + w.intervals * sizeof(stbi_uc *));
+	if (!mem) return -1;
+	w.decoders = (stbi__jpeg *)mem;
+	w.contexts = (stbi__context *)(w.decoders + w.tasks);
+	w.interval_start = (stbi_uc **)(w.contexts + w.tasks);
+	w.results = (int *)(w.interval_start + w.intervals);
+
+	// find the restart markers, which can't appear inside entropy coded data
+	// (0xff bytes there are followed by a stuffed 0), up to the marker that ends the scan
+	w.interval_start[0] = p;
+	while (p + 1 < s->img_buffer_end && found < w.intervals) {
+		if (p[0] != 0xff) ++p;
+		else if (p[1] == 0x00) p += 2;
+		else if (p[1] == 0xff) ++p; // fill byte
+		else if (STBI__RESTART(p[1])) {
+			p += 2;
+			if (++found < w.intervals) w.interval_start[found] = p;
+		}
+		else break;
+	}
+	// the decoder gets no further than the first interval that doesn't end in a restart
+	// marker, so if they don't all line up, decode in order, where that is handled
+	if (found != w.intervals - 1) { STBI_FREE(mem); return -1; }
+
+	stbi__parallel_run(stbi__jpeg_decode_intervals_task, &w, w.tasks);
+
+	// as if decoded in order: the first task that failed or stopped is where the decoder
+	// would have ended up, otherwise the last task is
+	for (i = 0; i < w.tasks; ++i)
+		if (w.results[i] != 1 || i == w.tasks - 1) break;
+	result = w.results[i];
+	if (result) {
+		s->img_buffer = w.contexts[i].img_buffer;
+		*z = w.decoders[i];
+		z->s = s;
+	}
+	STBI_FREE(mem);
+	return result ? result : stbi__err("bad huffman code", "Corrupt JPEG");
+}
+
+// without usable restart markers, entropy decoding is sequential, but the idct of one
+// band of mcus can run while the next band is decoded
+typedef struct
+{
+	stbi__jpeg *z;
+	short *coeff[2];            // [0] is being decoded into, [1] idct'd from
+	int decode_first, decode_end, decoded_end, decode_result;
+	int idct_first, idct_end, idct_tasks;
+	int block_count;
+} stbi__jpeg_pipeline;
+
+static void stbi__jpeg_pipeline_task(void *task_data, int task)
+{
+	stbi__jpeg_pipeline *p = (stbi__jpeg_pipeline *)task_data;
+	if (task == 0) {
+		p->decoded_end = p->decode_first;
+		p->decode_result = stbi__jpeg_decode_mcus(p->z, &p->decoded_end, p->decode_end, p->coeff[0]);
+	}
+	else {
+		int count = p->idct_end - p->idct_first;
+		int mcu = p->idct_first + count * (task - 1) / p->idct_tasks;
+		int end = p->idct_first + count * task / p->idct_tasks;
+		stbi__jpeg_idct_queue q;
+		q.data = NULL;
+		for (; mcu < end; ++mcu)
+			stbi__jpeg_idct_mcu(p->z, mcu, p->coeff[1] + (mcu - p->idct_first) * p->block_count * 64, &q);
+		stbi__jpeg_idct_flush(p->z, &q);
+	}
+}
+
+// returns -1 when there isn't enough to overlap, otherwise as stbi__jpeg_decode_mcus
+static int stbi__jpeg_decode_pipelined(stbi__jpeg *z)
+{
+	stbi__jpeg_pipeline p;
+	int mcus = stbi__jpeg_mcu_count(z);
+	int row = stbi__jpeg_mcu_row_length(z);
+	int band, result = 1;
+	void *mem;
+
+	p.block_count = stbi__jpeg_mcu_block_count(z);
+	// whole rows of mcus, and enough blocks per band that handing work over costs little next to it
+	band = row * ((4096 + row * p.block_count - 1) / (row * p.block_count));
+	if (band >= mcus) return -1;
+	mem = stbi__malloc_mad3(2 * band, p.block_count * 64, sizeof(short), 15);
+	if (!mem) return -1;
+	p.coeff[0] = (short *)(((size_t)mem + 15) & ~15);
+	p.coeff[1] = p.coeff[0] + band * p.block_count * 64;
+	p.z = z;
+	p.idct_tasks = stbi__parallel_thread_count() - 1;
+	p.idct_first = p.idct_end = 0;
+	p.decode_first = 0;
+	p.decode_end = band;
+
+	while (p.decode_first < p.decode_end || p.idct_first < p.idct_end) {
+		short *t;
+		stbi__parallel_run(stbi__jpeg_pipeline_task, &p, p.idct_first < p.idct_end ? 1 + p.idct_tasks : 1);
+		result = p.decode_result;
+		if (!result) break;
+		// the band just decoded is idct'd next, while the one after it is decoded
+		t = p.coeff[0]; p.coeff[0] = p.coeff[1]; p.coeff[1] = t;
+		p.idct_first = p.decode_first;
+		p.idct_end = p.decoded_end;
+		p.decode_first = result == 2 ? mcus : p.decode_end;
+		p.decode_end = p.decode_first + band < mcus ? p.decode_first + band : mcus;
+	}
+	STBI_FREE(mem);
+	return result;
+}
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+	stbi__jpeg_reset(z);
+	if (!z->progressive) {
+		int mcu = 0, result = -1;
+		if (stbi__parallel_thread_count() > 1) {
+			result = stbi__jpeg_decode_intervals(z);
+			if (result < 0)
+				result = stbi__jpeg_decode_pipelined(z);
+		}
+		if (result < 0)
+			result = stbi__jpeg_decode_mcus(z, &mcu, stbi__jpeg_mcu_count(z), NULL);
+		return result != 0;
+	}
 	else {
 		if (z->scan_n == 1) {
 			int i, j;
@@ -2979,21 +4018,42 @@ static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
 		data[i] *= dequant[i];
 }
 
+typedef struct
+{
+	stbi__jpeg *z;
+	int n, rows, tasks;
+} stbi__jpeg_finish_rows;
+
+// dequantize and idct one task's share of the block rows of a component
+static void stbi__jpeg_finish_task(void *task_data, int task)
+{
+	stbi__jpeg_finish_rows *f = (stbi__jpeg_finish_rows *)task_data;
+	stbi__jpeg *z = f->z;
+	int n = f->n;
+	int w = (z->img_comp[n].x + 7) >> 3;
+	int i, j = f->rows * task / f->tasks, end = f->rows * (task + 1) / f->tasks;
+	stbi__jpeg_idct_queue q;
+	q.data = NULL;
+	for (; j < end; ++j) {
+		for (i = 0; i < w; ++i) {
+			short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+			stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
+			stbi__jpeg_idct(z, &q, z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
+		}
+	}
+	stbi__jpeg_idct_flush(z, &q);
+}
+
 static void stbi__jpeg_finish(stbi__jpeg *z)
 {
 	if (z->progressive) {
-		// dequantize and idct the data
-		int i, j, n;
-		for (n = 0; n < z->s->img_n; ++n) {
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j) {
-				for (i = 0; i < w; ++i) {
-					short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-					stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
-				}
-			}
+		// dequantize and idct the data; every block is independent by now
+		stbi__jpeg_finish_rows f;
+		f.z = z;
+		for (f.n = 0; f.n < z->s->img_n; ++f.n) {
+			f.rows = (z->img_comp[f.n].y + 7) >> 3;
+			f.tasks = stbi__parallel_task_count(f.rows);
+			stbi__parallel_run(stbi__jpeg_finish_task, &f, f.tasks);
 		}
 	}
 }
@@ -3521,6 +4581,72 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_SSE2
+// avx2 version of the above, 16 pixels at a time. the same steps as the sse2 loop, with
+// the one-pixel shifts for "prev" and "next" crossing between the two 128-bit lanes.
+STBI__SIMD_TARGET("avx2")
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	int i = 0, t0, t1;
+
+	if (w == 1) {
+		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+		return out;
+	}
+
+	t1 = 3 * in_near[0] + in_far[0];
+	for (; i < ((w - 1) & ~15); i += 16) {
+		// vertical pass: 3*x + y = 4*x + (y - x)
+		__m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+		__m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+		__m256i diff = _mm256_sub_epi16(farw, nearw);
+		__m256i nears = _mm256_slli_epi16(nearw, 2);
+		__m256i curr = _mm256_add_epi16(nears, diff);
+
+		// shift by one pixel: alignr works within lanes, so pair each lane with its
+		// neighbour lane (or zero) first
+		__m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+		__m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+		__m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+		__m256i next = _mm256_insert_epi16(nxt0, 3 * in_near[i + 16] + in_far[i + 16], 15);
+
+		// horizontal pass, polyphase
+		__m256i bias = _mm256_set1_epi16(8);
+		__m256i curs = _mm256_slli_epi16(curr, 2);
+		__m256i prvd = _mm256_sub_epi16(prev, curr);
+		__m256i nxtd = _mm256_sub_epi16(next, curr);
+		__m256i curb = _mm256_add_epi16(curs, bias);
+		__m256i even = _mm256_add_epi16(prvd, curb);
+		__m256i odd = _mm256_add_epi16(nxtd, curb);
+
+		// interleave and undo scaling. each lane packs to its own 16 output bytes in order
+		__m256i int0 = _mm256_unpacklo_epi16(even, odd);
+		__m256i int1 = _mm256_unpackhi_epi16(even, odd);
+		__m256i de0 = _mm256_srli_epi16(int0, 4);
+		__m256i de1 = _mm256_srli_epi16(int1, 4);
+		_mm256_storeu_si256((__m256i *) (out + i * 2), _mm256_packus_epi16(de0, de1));
+
+		t1 = 3 * in_near[i + 15] + in_far[i + 15];
+	}
+
+	t0 = t1;
+	t1 = 3 * in_near[i] + in_far[i];
+	out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+	for (++i; i < w; ++i) {
+		t0 = t1;
+		t1 = 3 * in_near[i] + in_far[i];
+		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+	}
+	out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
 	// resample with nearest-neighbor
@@ -3695,12 +4821,80 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_SSE2
+// avx2 version of the sse2 loop above, 16 pixels at a time, leaving the rest to it
+STBI__SIMD_TARGET("avx2")
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+	int i = 0;
+
+	if (step == 4) {
+		__m256i signflip = _mm256_set1_epi8(-0x80);
+		__m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f*4096.0f + 0.5f));
+		__m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f*4096.0f + 0.5f));
+		__m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f*4096.0f + 0.5f));
+		__m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f*4096.0f + 0.5f));
+		__m256i y_bias = _mm256_set1_epi8((char)(unsigned char)128);
+		__m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+		for (; i + 15 < count; i += 16) {
+			// load, with pixels 0-7 at the bottom of the low lane and 8-15 at the bottom of
+			// the high lane, so the in-lane unpacks below work as in the sse2 version
+			__m256i y_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) (y + i))), 0x50);
+			__m256i cr_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) (pcr + i))), 0x50);
+			__m256i cb_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) (pcb + i))), 0x50);
+			__m256i cr_biased = _mm256_xor_si256(cr_bytes, signflip); // -128
+			__m256i cb_biased = _mm256_xor_si256(cb_bytes, signflip); // -128
+
+			// unpack to short (and left-shift cr, cb by 8)
+			__m256i yw = _mm256_unpacklo_epi8(y_bias, y_bytes);
+			__m256i crw = _mm256_unpacklo_epi8(_mm256_setzero_si256(), cr_biased);
+			__m256i cbw = _mm256_unpacklo_epi8(_mm256_setzero_si256(), cb_biased);
+
+			// color transform
+			__m256i yws = _mm256_srli_epi16(yw, 4);
+			__m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+			__m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+			__m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+			__m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+			__m256i rws = _mm256_add_epi16(cr0, yws);
+			__m256i gwt = _mm256_add_epi16(cb0, yws);
+			__m256i bws = _mm256_add_epi16(yws, cb1);
+			__m256i gws = _mm256_add_epi16(gwt, cr1);
+
+			// descale
+			__m256i rw = _mm256_srai_epi16(rws, 4);
+			__m256i bw = _mm256_srai_epi16(bws, 4);
+			__m256i gw = _mm256_srai_epi16(gws, 4);
+
+			// back to byte, set up for transpose
+			__m256i brb = _mm256_packus_epi16(rw, bw);
+			__m256i gxb = _mm256_packus_epi16(gw, xw);
+
+			// transpose to interleave channels. o0 holds pixels 0-3 and 8-11, o1 4-7 and 12-15
+			__m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+			__m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+			__m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+			__m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+			// store
+			_mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+			_mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+			out += 64;
+		}
+	}
+
+	stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
 	j->idct_block_kernel = stbi__idct_block;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+	j->idct_block2_kernel = NULL;
 
 #ifdef STBI_SSE2
 	if (stbi__sse2_available()) {
@@ -3708,6 +4902,11 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
 		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
 		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 	}
+	if (stbi__avx2_available()) {
+		j->idct_block2_kernel = stbi__idct_simd2_avx2;
+		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+	}
 #endif
 
 #ifdef STBI_NEON
@@ -3740,7 +4939,160 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 	return (stbi_uc)((t + (t >> 8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// moves a resampler on to its next output row
+static void stbi__resample_next_row(stbi__resample *r, int comp_y, int w2)
+{
+	if (++r->ystep >= r->vs) {
+		r->ystep = 0;
+		r->line0 = r->line1;
+		if (++r->ypos < comp_y)
+			r->line1 += w2;
+	}
+}
+
+// output rows are independent once the components are decoded, so they are
+// resampled and color-converted in bands, one per task
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi__resample res_comp[4]; // as at the first row
+	stbi_uc *output; // row j starts at output + j*output_step
+	ptrdiff_t output_step;
+	stbi_uc *last_rows; // see stbi__jpeg_convert_task
+	int all_rows_on_side;
+	int n, decode_n, is_rgb, tasks;
+} stbi__jpeg_convert;
+
+static void stbi__jpeg_convert_task(void *task_data, int task)
+{
+	stbi__jpeg_convert *c = (stbi__jpeg_convert *)task_data;
+	stbi__jpeg *z = c->z;
+	stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+	stbi__resample res_comp[4];
+	int k, n = c->n, decode_n = c->decode_n, is_rgb = c->is_rgb;
+	unsigned int i, j = (unsigned int)((stbi__uint64)z->s->img_y * task / c->tasks);
+	unsigned int end = (unsigned int)((stbi__uint64)z->s->img_y * (task + 1) / c->tasks);
+
+	for (k = 0; k < decode_n; ++k) {
+		unsigned int row;
+		res_comp[k] = c->res_comp[k];
+		for (row = 0; row < j; ++row)
+			stbi__resample_next_row(&res_comp[k], z->img_comp[k].y, z->img_comp[k].w2);
+	}
+
+	for (; j < end; ++j) {
+		stbi_uc *dest = c->output + (ptrdiff_t)j * c->output_step;
+		stbi_uc *out = dest;
+		// some conversions write a byte of slop past the end of a row (out[3] for RGB,
+		// out[1] for grey from CMYK), which would land in the next task's first row,
+		// so the last row of a band is built on the side. in memory the caller owns,
+		// the slop could land anywhere, so there every row is
+		int on_side = c->last_rows && (c->all_rows_on_side || (j == end - 1 && end < z->s->img_y));
+		if (on_side)
+			out = c->last_rows + task * (n * z->s->img_x + 1);
+		for (k = 0; k < decode_n; ++k) {
+			stbi__resample *r = &res_comp[k];
+			int y_bot = r->ystep >= (r->vs >> 1);
+			coutput[k] = r->resample(z->img_comp[k].linebuf + task * (z->s->img_x + 3),
+				y_bot ? r->line1 : r->line0,
+				y_bot ? r->line0 : r->line1,
+				r->w_lores, r->hs);
+			stbi__resample_next_row(r, z->img_comp[k].y, z->img_comp[k].w2);
+		}
+		if (n >= 3) {
+			stbi_uc *y = coutput[0];
+			if (z->s->img_n == 3) {
+				if (is_rgb) {
+					for (i = 0; i < z->s->img_x; ++i) {
+						out[0] = y[i];
+						out[1] = coutput[1][i];
+						out[2] = coutput[2][i];
+						out[3] = 255;
+						out += n;
+					}
+				}
+				else {
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else if (z->s->img_n == 4) {
+				if (z->app14_color_transform == 0) { // CMYK
+					for (i = 0; i < z->s->img_x; ++i) {
+						stbi_uc m = coutput[3][i];
+						out[0] = stbi__blinn_8x8(coutput[0][i], m);
+						out[1] = stbi__blinn_8x8(coutput[1][i], m);
+						out[2] = stbi__blinn_8x8(coutput[2][i], m);
+						out[3] = 255;
+						out += n;
+					}
+				}
+				else if (z->app14_color_transform == 2) { // YCCK
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+					for (i = 0; i < z->s->img_x; ++i) {
+						stbi_uc m = coutput[3][i];
+						out[0] = stbi__blinn_8x8(255 - out[0], m);
+						out[1] = stbi__blinn_8x8(255 - out[1], m);
+						out[2] = stbi__blinn_8x8(255 - out[2], m);
+						out += n;
+					}
+				}
+				else { // YCbCr + alpha?  Ignore the fourth channel for now
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = out[1] = out[2] = y[i];
+					out[3] = 255; // not used if n==3
+					out += n;
+				}
+		}
+		else {
+			if (is_rgb) {
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i)
+						*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+				else {
+					for (i = 0; i < z->s->img_x; ++i, out += 2) {
+						out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+						out[1] = 255;
+					}
+				}
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					stbi_uc m = coutput[3][i];
+					stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+					stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+					stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+					out[0] = stbi__compute_y(r, g, b);
+					out[1] = 255;
+					out += n;
+				}
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+					out[1] = 255;
+					out += n;
+				}
+			}
+			else {
+				stbi_uc *y = coutput[0];
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+				else
+					for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+			}
+		}
+		if (on_side)
+			memcpy(dest, c->last_rows + task * (n * z->s->img_x + 1), n * z->s->img_x);
+	}
+}
+
+// with into, the image is written there rather than to a new buffer, and the
+// return value only tells success from failure
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, stbi__into *into)
 {
 	int n, decode_n, is_rgb;
 	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
@@ -3751,6 +5103,11 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 	// load a jpeg image from whichever source, but leave in YCbCr format
 	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+	if (into && (z->s->img_x != (stbi__uint32)into->w || z->s->img_y != (stbi__uint32)into->h)) {
+		stbi__cleanup_jpeg(z);
+		return stbi__errpuc("wrong size", "Image is not the size given to stbi_load_into");
+	}
+
 	// determine actual number of components to generate
 	n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3764,18 +5121,18 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 	// resample and color-convert
 	{
 		int k;
-		unsigned int i, j;
 		stbi_uc *output;
-		stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+		stbi__jpeg_convert c;
 
-		stbi__resample res_comp[4];
+		// bands of at least 16 rows
+		c.tasks = stbi__parallel_task_count(z->s->img_y / 16);
 
 		for (k = 0; k < decode_n; ++k) {
-			stbi__resample *r = &res_comp[k];
+			stbi__resample *r = &c.res_comp[k];
 
 			// allocate line buffer big enough for upsampling off the edges
-			// with upsample factor of 4
-			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
+			// with upsample factor of 4, one per task
+			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc_mad2(c.tasks, z->s->img_x + 3, 0);
 			if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
 			r->hs = z->img_h_max / z->img_comp[k].h;
@@ -3792,114 +5149,32 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 			else                               r->resample = stbi__resample_row_generic;
 		}
 
-		// can't error after this so, this is safe
-		output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-		if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+		if (into) {
+			output = into->first;
+			c.output_step = into->step;
+		}
+		else {
+			output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+			if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+			c.output_step = n * z->s->img_x;
+		}
 
-		// now go ahead and resample
-		for (j = 0; j < z->s->img_y; ++j) {
-			stbi_uc *out = output + n * z->s->img_x * j;
-			for (k = 0; k < decode_n; ++k) {
-				stbi__resample *r = &res_comp[k];
-				int y_bot = r->ystep >= (r->vs >> 1);
-				coutput[k] = r->resample(z->img_comp[k].linebuf,
-					y_bot ? r->line1 : r->line0,
-					y_bot ? r->line0 : r->line1,
-					r->w_lores, r->hs);
-				if (++r->ystep >= r->vs) {
-					r->ystep = 0;
-					r->line0 = r->line1;
-					if (++r->ypos < z->img_comp[k].y)
-						r->line1 += z->img_comp[k].w2;
-				}
-			}
-			if (n >= 3) {
-				stbi_uc *y = coutput[0];
-				if (z->s->img_n == 3) {
-					if (is_rgb) {
-						for (i = 0; i < z->s->img_x; ++i) {
-							out[0] = y[i];
-							out[1] = coutput[1][i];
-							out[2] = coutput[2][i];
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else {
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else if (z->s->img_n == 4) {
-					if (z->app14_color_transform == 0) { // CMYK
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(coutput[0][i], m);
-							out[1] = stbi__blinn_8x8(coutput[1][i], m);
-							out[2] = stbi__blinn_8x8(coutput[2][i], m);
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else if (z->app14_color_transform == 2) { // YCCK
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(255 - out[0], m);
-							out[1] = stbi__blinn_8x8(255 - out[1], m);
-							out[2] = stbi__blinn_8x8(255 - out[2], m);
-							out += n;
-						}
-					}
-					else { // YCbCr + alpha?  Ignore the fourth channel for now
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = out[1] = out[2] = y[i];
-						out[3] = 255; // not used if n==3
-						out += n;
-					}
-			}
-			else {
-				if (is_rgb) {
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-					else {
-						for (i = 0; i < z->s->img_x; ++i, out += 2) {
-							out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-							out[1] = 255;
-						}
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						stbi_uc m = coutput[3][i];
-						stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-						stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-						stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-						out[0] = stbi__compute_y(r, g, b);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else {
-					stbi_uc *y = coutput[0];
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-					else
-						for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-				}
-			}
+		// only RGB and grey output write slop past a row
+		c.all_rows_on_side = into && (n == 1 || n == 3);
+		c.last_rows = NULL;
+		if (c.tasks > 1 || c.all_rows_on_side) {
+			c.last_rows = (stbi_uc *)stbi__malloc_mad2(c.tasks, n * z->s->img_x + 1, 0);
+			if (!c.last_rows) { if (!into) STBI_FREE(output); stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 		}
+
+		// now go ahead and resample
+		c.z = z;
+		c.output = output;
+		c.n = n;
+		c.decode_n = decode_n;
+		c.is_rgb = is_rgb;
+		stbi__parallel_run(stbi__jpeg_convert_task, &c, c.tasks);
+		STBI_FREE(c.last_rows);
 		stbi__cleanup_jpeg(z);
 		*out_x = z->s->img_x;
 		*out_y = z->s->img_y;
@@ -3915,11 +5190,23 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
 	STBI_NOTUSED(ri);
 	j->s = s;
 	stbi__setup_jpeg(j);
-	result = load_jpeg_image(j, x, y, comp, req_comp);
+	result = load_jpeg_image(j, x, y, comp, req_comp, NULL);
 	STBI_FREE(j);
 	return result;
 }
 
+static int stbi__jpeg_load_into(stbi__context *s, stbi__into *into)
+{
+	stbi_uc *result;
+	int x, y, comp;
+	stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+	j->s = s;
+	stbi__setup_jpeg(j);
+	result = load_jpeg_image(j, &x, &y, &comp, into->comp, into);
+	STBI_FREE(j);
+	return result != NULL;
+}
+
 static int stbi__jpeg_test(stbi__context *s)
 {
 	int r;
@@ -3960,14 +5247,22 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 //      - all input must be provided in an upfront buffer
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
-//      - fast huffman
+//      - fast huffman, with two literals per lookup where both codes fit
+//      - 64-bit bit buffer, refilled a word at a time
+//      - matches copied 8/16 bytes at a time when they don't overlap that closely
 
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and most codes of dynamic ones
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 
+// entries of the literal/length pair table: the first symbol, the second literal,
+// the bits both codes take, and whether there is a second literal
+#define STBI__ZPAIR_SECOND_SHIFT  9
+#define STBI__ZPAIR_BITS_SHIFT    17
+#define STBI__ZPAIR_TWO           (1 << 22)
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
@@ -4054,7 +5349,8 @@ typedef struct
 {
 	stbi_uc *zbuffer, *zbuffer_end;
 	int num_bits;
-	stbi__uint32 code_buffer;
+	int num_overread; // zero bytes put in the bit buffer from past the end of zbuffer
+	stbi__uint64 code_buffer;
 
 	char *zout;
 	char *zout_start;
@@ -4062,6 +5358,7 @@ typedef struct
 	int   z_expandable;
 
 	stbi__zhuffman z_length, z_distance;
+	stbi__uint32 z_length_pairs[1 << STBI__ZFAST_BITS];
 } stbi__zbuf;
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -4070,20 +5367,43 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 	return *z->zbuffer++;
 }
 
+stbi_inline static stbi__uint64 stbi__zload64le(const stbi_uc *p)
+{
+#if defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	stbi__uint64 v;
+	memcpy(&v, p, 8);
+	return v;
+#else
+	return (stbi__uint64)p[0] | ((stbi__uint64)p[1] << 8) | ((stbi__uint64)p[2] << 16) | ((stbi__uint64)p[3] << 24)
+		| ((stbi__uint64)p[4] << 32) | ((stbi__uint64)p[5] << 40) | ((stbi__uint64)p[6] << 48) | ((stbi__uint64)p[7] << 56);
+#endif
+}
+
+// tops the bit buffer up to at least 56 bits
 static void stbi__fill_bits(stbi__zbuf *z)
 {
+	STBI_ASSERT(z->num_bits < 56 && z->code_buffer < ((stbi__uint64)1 << z->num_bits));
+	if (z->zbuffer_end - z->zbuffer >= 8) {
+		// one unaligned load, keeping the whole bytes that fit
+		int n = (63 - z->num_bits) >> 3;
+		stbi__uint64 bits = stbi__zload64le(z->zbuffer) & (~(stbi__uint64)0 >> (64 - 8 * n));
+		z->code_buffer |= bits << z->num_bits;
+		z->zbuffer += n;
+		z->num_bits += 8 * n;
+		return;
+	}
 	do {
-		STBI_ASSERT(z->code_buffer < (1U << z->num_bits));
-		z->code_buffer |= (unsigned int)stbi__zget8(z) << z->num_bits;
+		if (z->zbuffer >= z->zbuffer_end) ++z->num_overread;
+		z->code_buffer |= (stbi__uint64)stbi__zget8(z) << z->num_bits;
 		z->num_bits += 8;
-	} while (z->num_bits <= 24);
+	} while (z->num_bits <= 56);
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
 	unsigned int k;
 	if (z->num_bits < n) stbi__fill_bits(z);
-	k = z->code_buffer & ((1 << n) - 1);
+	k = (unsigned int)(z->code_buffer & ((1 << n) - 1));
 	z->code_buffer >>= n;
 	z->num_bits -= n;
 	return k;
@@ -4094,7 +5414,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
 	int b, s, k;
 	// not resolved by fast table, so compute it the slow way
 	// use jpeg approach, which requires MSbits at top
-	k = stbi__bit_reverse(a->code_buffer, 16);
+	k = stbi__bit_reverse((int)(a->code_buffer & 0xffff), 16);
 	for (s = STBI__ZFAST_BITS + 1; ; ++s)
 		if (k < z->maxcode[s])
 			break;
@@ -4154,11 +5474,71 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
 
+// builds the literal/length table that decodes two literals in one lookup when both codes fit in
+// STBI__ZFAST_BITS, and any single symbol the fast table has otherwise
+static void stbi__zbuild_length_pairs(stbi__zbuf *a)
+{
+	const stbi__uint16 *fast = a->z_length.fast;
+	int i;
+	for (i = 0; i < (1 << STBI__ZFAST_BITS); ++i) {
+		int b = fast[i];
+		stbi__uint32 entry = 0;
+		if (b) {
+			int s = b >> 9;
+			entry = (stbi__uint32)((b & 511) | (s << STBI__ZPAIR_BITS_SHIFT));
+			if ((b & 511) < 256 && s < STBI__ZFAST_BITS) {
+				// only the low STBI__ZFAST_BITS - s bits of the next code are known here
+				int b2 = fast[i >> s];
+				int s2 = b2 >> 9;
+				if (b2 && (b2 & 511) < 256 && s + s2 <= STBI__ZFAST_BITS)
+					entry = (stbi__uint32)((b & 511) | ((b2 & 511) << STBI__ZPAIR_SECOND_SHIFT) | ((s + s2) << STBI__ZPAIR_BITS_SHIFT) | STBI__ZPAIR_TWO);
+			}
+		}
+		a->z_length_pairs[i] = entry;
+	}
+}
+
+stbi_inline static void stbi__zcopy16(char *dest, const char *src)
+{
+#ifdef STBI_SSE2
+	_mm_storeu_si128((__m128i *) dest, _mm_loadu_si128((const __m128i *) src));
+#elif defined(STBI_NEON)
+	vst1q_u8((stbi_uc *) dest, vld1q_u8((const stbi_uc *) src));
+#else
+	memcpy(dest, src, 16);
+#endif
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
 	char *zout = a->zout;
 	for (;;) {
-		int z = stbi__zhuffman_decode(a, &a->z_length);
+		int z;
+		stbi__uint32 e;
+		// one refill covers a whole length/distance pair (15+5+15+13 bits)
+		if (a->num_bits < 48) stbi__fill_bits(a);
+		e = a->z_length_pairs[a->code_buffer & STBI__ZFAST_MASK];
+		if (e & STBI__ZPAIR_TWO) {
+			int s = (e >> STBI__ZPAIR_BITS_SHIFT) & 31;
+			if (a->zout_end - zout < 2) {
+				if (!stbi__zexpand(a, zout, 2)) return 0;
+				zout = a->zout;
+			}
+			zout[0] = (char)(e & 255);
+			zout[1] = (char)((e >> STBI__ZPAIR_SECOND_SHIFT) & 255);
+			zout += 2;
+			a->code_buffer >>= s;
+			a->num_bits -= s;
+			continue;
+		}
+		if (e) {
+			int s = (e >> STBI__ZPAIR_BITS_SHIFT) & 31;
+			z = (int)(e & 511);
+			a->code_buffer >>= s;
+			a->num_bits -= s;
+		}
+		else
+			z = stbi__zhuffman_decode(a, &a->z_length);
 		if (z < 256) {
 			if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG"); // error in huffman codes
 			if (zout >= a->zout_end) {
@@ -4168,17 +5548,18 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
 			*zout++ = (char)z;
 		}
 		else {
-			stbi_uc *p;
+			char *p;
 			int len, dist;
 			if (z == 256) {
 				a->zout = zout;
 				return 1;
 			}
+			if (z >= 286) return stbi__err("bad huffman code", "Corrupt PNG"); // per DEFLATE, length codes 286 and 287 must not appear
 			z -= 257;
 			len = stbi__zlength_base[z];
 			if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
 			z = stbi__zhuffman_decode(a, &a->z_distance);
-			if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG");
+			if (z < 0 || z >= 30) return stbi__err("bad huffman code", "Corrupt PNG"); // per DEFLATE, distance codes 30 and 31 must not appear
 			dist = stbi__zdist_base[z];
 			if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
 			if (zout - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
@@ -4186,10 +5567,22 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
 				if (!stbi__zexpand(a, zout, len)) return 0;
 				zout = a->zout;
 			}
-			p = (stbi_uc *)(zout - dist);
+			p = zout - dist;
 			if (dist == 1) { // run of one byte; common in images.
-				stbi_uc v = *p;
-				if (len) { do *zout++ = v; while (--len); }
+				memset(zout, *p, len);
+				zout += len;
+			}
+			else if (dist >= 16 && a->zout_end - zout >= len + 15) {
+				// each 16 bytes read are written before they are overwritten, and the
+				// up to 15 bytes written past the match are overwritten by what follows
+				char *end = zout + len;
+				do { stbi__zcopy16(zout, p); zout += 16; p += 16; } while (zout < end);
+				zout = end;
+			}
+			else if (dist >= 8 && a->zout_end - zout >= len + 7) {
+				char *end = zout + len;
+				do { memcpy(zout, p, 8); zout += 8; p += 8; } while (zout < end);
+				zout = end;
 			}
 			else {
 				if (len) { do *zout++ = *p++; while (--len); }
@@ -4254,17 +5647,15 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
 	int len, nlen, k;
 	if (a->num_bits & 7)
 		stbi__zreceive(a, a->num_bits & 7); // discard
-	 // drain the bit-packed data into header
-	k = 0;
-	while (a->num_bits > 0) {
-		header[k++] = (stbi_uc)(a->code_buffer & 255); // suppress MSVC run-time check
-		a->code_buffer >>= 8;
-		a->num_bits -= 8;
-	}
-	STBI_ASSERT(a->num_bits == 0);
-	// now fill header the normal way
-	while (k < 4)
-		header[k++] = stbi__zget8(a);
+	// hand the whole bytes left in the bit buffer back to zbuffer (the refills read ahead by up
+	// to 8 bytes), except the zeros from past its end, and read the header from there
+	k = (a->num_bits >> 3) - a->num_overread;
+	if (k > 0) a->zbuffer -= k;
+	a->code_buffer = 0;
+	a->num_bits = 0;
+	a->num_overread = 0;
+	for (k = 0; k < 4; ++k)
+		header[k] = stbi__zget8(a);
 	len = header[1] * 256 + header[0];
 	nlen = header[3] * 256 + header[2];
 	if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt", "Corrupt PNG");
@@ -4325,6 +5716,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 	if (parse_header)
 		if (!stbi__parse_zlib_header(a)) return 0;
 	a->num_bits = 0;
+	a->num_overread = 0;
 	a->code_buffer = 0;
 	do {
 		final = stbi__zreceive(a, 1);
@@ -4344,6 +5736,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 			else {
 				if (!stbi__compute_huffman_codes(a)) return 0;
 			}
+			stbi__zbuild_length_pairs(a);
 			if (!stbi__parse_huffman_block(a)) return 0;
 		}
 	} while (!final);
@@ -4512,6 +5905,184 @@ static int stbi__paeth(int a, int b, int c)
 	return c;
 }
 
+#ifdef STBI_SSE2
+// SIMD unfiltering of 8-bit rows with 3 or 4 bytes per pixel, optionally expanding 3 to 4 with
+// alpha 255. Sub, Avg and Paeth depend on the pixel to the left, so they run a pixel per step and
+// keep that pixel in a register; Up has no such dependency and runs 16 or 32 bytes per step.
+// All of them produce exactly what the scalar loops do.
+
+enum
+{
+	STBI__PNG_SIMD_NONE,
+	STBI__PNG_SIMD_SSE2,
+	STBI__PNG_SIMD_SSSE3,
+	STBI__PNG_SIMD_AVX2
+};
+
+static int stbi__png_simd_level(void)
+{
+	if (!stbi__sse2_available()) return STBI__PNG_SIMD_NONE;
+	if (stbi__avx2_available()) return STBI__PNG_SIMD_AVX2;
+	if (stbi__ssse3_available()) return STBI__PNG_SIMD_SSSE3;
+	return STBI__PNG_SIMD_SSE2;
+}
+
+// 3-byte pixels are moved with 3-byte copies, so nothing is read or written past the row
+stbi_inline static __m128i stbi__png_load_pixel(const stbi_uc *p, int n)
+{
+	int v = 0;
+	if (n == 4) memcpy(&v, p, 4);
+	else memcpy(&v, p, 3);
+	return _mm_cvtsi32_si128(v);
+}
+
+stbi_inline static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n, int out_n)
+{
+	int t = _mm_cvtsi128_si32(v);
+	if (n == 4) memcpy(p, &t, 4);
+	else memcpy(p, &t, 3);
+	if (out_n != n) p[n] = 255;
+}
+
+// n is the pixel size in raw, out_n in cur (which gets alpha 255 if it is bigger)
+static void stbi__png_unfilter_sub_sse2(stbi_uc *cur, stbi_uc *raw, int count, int n, int out_n)
+{
+	__m128i a = stbi__png_load_pixel(cur - out_n, n);
+	int i = 0;
+	if (n == 4 && out_n == 4) {
+		// 4 pixels at a time as a prefix sum, carrying in the last pixel of the previous step
+		__m128i last = _mm_shuffle_epi32(a, 0);
+		for (; i + 4 <= count; i += 4, raw += 16, cur += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i *) raw);
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+			x = _mm_add_epi8(x, last);
+			_mm_storeu_si128((__m128i *) cur, x);
+			last = _mm_shuffle_epi32(x, 0xff);
+		}
+		a = last;
+	}
+	for (; i < count; ++i, raw += n, cur += out_n) {
+		a = _mm_add_epi8(a, stbi__png_load_pixel(raw, n));
+		stbi__png_store_pixel(cur, a, n, out_n);
+	}
+}
+
+static void stbi__png_unfilter_up_sse2(stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int count, int n, int out_n)
+{
+	int i = 0;
+	if (n == out_n) {
+		int k = 0, nk = count * n;
+		for (; k + 16 <= nk; k += 16) {
+			__m128i x = _mm_add_epi8(_mm_loadu_si128((const __m128i *) (raw + k)), _mm_loadu_si128((const __m128i *) (prior + k)));
+			_mm_storeu_si128((__m128i *) (cur + k), x);
+		}
+		for (; k < nk; ++k)
+			cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+		return;
+	}
+	for (; i < count; ++i, raw += n, cur += out_n, prior += out_n)
+		stbi__png_store_pixel(cur, _mm_add_epi8(stbi__png_load_pixel(raw, n), stbi__png_load_pixel(prior, n)), n, out_n);
+}
+
+STBI__SIMD_TARGET("avx2")
+static void stbi__png_unfilter_up_avx2(stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int count, int n)
+{
+	int k = 0, nk = count * n;
+	for (; k + 32 <= nk; k += 32) {
+		__m256i x = _mm256_add_epi8(_mm256_loadu_si256((const __m256i *) (raw + k)), _mm256_loadu_si256((const __m256i *) (prior + k)));
+		_mm256_storeu_si256((__m256i *) (cur + k), x);
+	}
+	for (; k < nk; ++k)
+		cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+
+// prior is NULL for the first row, where it counts as 0
+static void stbi__png_unfilter_avg_sse2(stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int count, int n, int out_n)
+{
+	__m128i a = stbi__png_load_pixel(cur - out_n, n);
+	__m128i one = _mm_set1_epi8(1);
+	int i;
+	for (i = 0; i < count; ++i, raw += n, cur += out_n) {
+		__m128i b = _mm_setzero_si128();
+		__m128i avg;
+		if (prior) {
+			b = stbi__png_load_pixel(prior, n);
+			prior += out_n;
+		}
+		// _mm_avg_epu8 rounds up, (a + b) >> 1 rounds down
+		avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(stbi__png_load_pixel(raw, n), avg);
+		stbi__png_store_pixel(cur, a, n, out_n);
+	}
+}
+
+// The Paeth predictor on 16-bit lanes, with stbi__paeth's tie breaking: a, then b, then c.
+// Only the absolute value differs between the SSE2 and SSSE3 versions.
+#define STBI__PNG_UNFILTER_PAETH(name, target, abs16) \
+	target static void name(stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int count, int n, int out_n) \
+	{ \
+		__m128i zero = _mm_setzero_si128(); \
+		__m128i a = _mm_unpacklo_epi8(stbi__png_load_pixel(cur - out_n, n), zero); \
+		__m128i c = _mm_unpacklo_epi8(stbi__png_load_pixel(prior - out_n, n), zero); \
+		int i; \
+		for (i = 0; i < count; ++i, raw += n, cur += out_n, prior += out_n) { \
+			__m128i b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior, n), zero); \
+			__m128i pa = _mm_sub_epi16(b, c); \
+			__m128i pb = _mm_sub_epi16(a, c); \
+			__m128i pc = _mm_add_epi16(pa, pb); \
+			__m128i smallest, use_a, use_b, predicted, x; \
+			pa = abs16(pa); \
+			pb = abs16(pb); \
+			pc = abs16(pc); \
+			smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb)); \
+			use_a = _mm_cmpeq_epi16(pa, smallest); \
+			use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(pb, smallest)); \
+			predicted = _mm_or_si128(_mm_and_si128(use_a, a), _mm_and_si128(use_b, b)); \
+			predicted = _mm_or_si128(predicted, _mm_andnot_si128(_mm_or_si128(use_a, use_b), c)); \
+			x = _mm_add_epi8(stbi__png_load_pixel(raw, n), _mm_packus_epi16(predicted, predicted)); \
+			stbi__png_store_pixel(cur, x, n, out_n); \
+			a = _mm_unpacklo_epi8(x, zero); \
+			c = b; \
+		} \
+	}
+
+#define STBI__ABS_EPI16_SSE2(x) _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x))
+STBI__PNG_UNFILTER_PAETH(stbi__png_unfilter_paeth_sse2, , STBI__ABS_EPI16_SSE2)
+STBI__PNG_UNFILTER_PAETH(stbi__png_unfilter_paeth_ssse3, STBI__SIMD_TARGET("ssse3"), _mm_abs_epi16)
+#undef STBI__ABS_EPI16_SSE2
+#undef STBI__PNG_UNFILTER_PAETH
+
+// Unfilters every pixel of an 8-bit row after the first, which the caller has done already.
+// n is the pixel size in raw (3 or 4), out_n in cur (n, or 4 to add alpha)
+// returns 0 if the row has to take the scalar path
+static int stbi__png_unfilter_row_simd(int level, int filter, stbi_uc *cur, stbi_uc *raw, stbi_uc *prior, int count, int n, int out_n)
+{
+	switch (filter) {
+	case STBI__F_sub:
+	case STBI__F_paeth_first: // stbi__paeth(a, 0, 0) is a
+		stbi__png_unfilter_sub_sse2(cur, raw, count, n, out_n);
+		return 1;
+	case STBI__F_up:
+		if (level >= STBI__PNG_SIMD_AVX2 && n == out_n) stbi__png_unfilter_up_avx2(cur, raw, prior, count, n);
+		else stbi__png_unfilter_up_sse2(cur, raw, prior, count, n, out_n);
+		return 1;
+	case STBI__F_avg:
+		stbi__png_unfilter_avg_sse2(cur, raw, prior, count, n, out_n);
+		return 1;
+	case STBI__F_avg_first:
+		stbi__png_unfilter_avg_sse2(cur, raw, NULL, count, n, out_n);
+		return 1;
+	case STBI__F_paeth:
+		if (level >= STBI__PNG_SIMD_SSSE3) stbi__png_unfilter_paeth_ssse3(cur, raw, prior, count, n, out_n);
+		else stbi__png_unfilter_paeth_sse2(cur, raw, prior, count, n, out_n);
+		return 1;
+	default:
+		return 0;
+	}
+}
+#endif // STBI_SSE2
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4527,6 +6098,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 	int output_bytes = out_n * bytes;
 	int filter_bytes = img_n * bytes;
 	int width = x;
+#ifdef STBI_SSE2
+	int simd_level = (depth == 8 && (img_n == 3 || img_n == 4)) ? stbi__png_simd_level() : STBI__PNG_SIMD_NONE;
+#endif
 
 	STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
 	a->out = (stbi_uc *)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4596,6 +6170,12 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 		}
 
 		// this is a little gross, so that we don't switch per-pixel or per-component
+#ifdef STBI_SSE2
+		if (simd_level != STBI__PNG_SIMD_NONE && stbi__png_unfilter_row_simd(simd_level, filter, cur, raw, prior, x - 1, img_n, out_n)) {
+			raw += (x - 1) * img_n;
+		}
+		else
+#endif
 		if (depth < 8 || img_n == out_n) {
 			int nk = (width - 1)*filter_bytes;
 #define STBI__CASE(f) \
@@ -4868,19 +6448,46 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
 	return 1;
 }
 
-static int stbi__unpremultiply_on_load = 0;
-static int stbi__de_iphone_flag = 0;
+static int stbi__unpremultiply_on_load_global = 0;
+static int stbi__de_iphone_flag_global = 0;
 
 STBIDEF void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply)
 {
-	stbi__unpremultiply_on_load = flag_true_if_should_unpremultiply;
+	stbi__unpremultiply_on_load_global = flag_true_if_should_unpremultiply;
 }
 
 STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
 {
-	stbi__de_iphone_flag = flag_true_if_should_convert;
+	stbi__de_iphone_flag_global = flag_true_if_should_convert;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__unpremultiply_on_load  stbi__unpremultiply_on_load_global
+#define stbi__de_iphone_flag  stbi__de_iphone_flag_global
+#else
+static STBI_THREAD_LOCAL int stbi__unpremultiply_on_load_local, stbi__unpremultiply_on_load_set;
+static STBI_THREAD_LOCAL int stbi__de_iphone_flag_local, stbi__de_iphone_flag_set;
+
+STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply)
+{
+	stbi__unpremultiply_on_load_local = flag_true_if_should_unpremultiply;
+	stbi__unpremultiply_on_load_set = 1;
+}
+
+STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert)
+{
+	stbi__de_iphone_flag_local = flag_true_if_should_convert;
+	stbi__de_iphone_flag_set = 1;
 }
 
+#define stbi__unpremultiply_on_load  (stbi__unpremultiply_on_load_set       \
+                                      ? stbi__unpremultiply_on_load_local  \
+                                      : stbi__unpremultiply_on_load_global)
+#define stbi__de_iphone_flag  (stbi__de_iphone_flag_set       \
+                               ? stbi__de_iphone_flag_local  \
+                               : stbi__de_iphone_flag_global)
+#endif // STBI_THREAD_LOCAL
+
 static void stbi__de_iphone(stbi__png *z)
 {
 	stbi__context *s = z->s;
@@ -6959,17 +8566,104 @@ static void stbi__hdr_convert(float *output, stbi_uc *input, int req_comp)
 	}
 }
 
+// converts a row of RGBE pixels, 4 at a time with SSE2. the exponent becomes the float scale
+// directly, except for the few exponents whose scale is denormal, where stbi__hdr_convert's
+// ldexp takes over; each output is then computed with the same float operations as there
+static void stbi__hdr_convert_row(float *output, stbi_uc *input, int count, int req_comp, int simd)
+{
+	int i = 0;
+#ifdef STBI_SSE2
+	if (simd) {
+		__m128i zero = _mm_setzero_si128();
+		__m128i bytes = _mm_set1_epi32(0xff);
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 three = _mm_set1_ps(3.0f);
+		// for RGB, each pixel is stored as 4 floats over the start of the next; the last
+		// group of a row has to leave a pixel for the scalar code so nothing lands past the row
+		int end = req_comp == 3 ? count - 4 : count - 3;
+		for (; i < end; i += 4) {
+			__m128i px = _mm_loadu_si128((__m128i const *)(input + i * 4));
+			__m128i e = _mm_srli_epi32(px, 24);
+			__m128i live = _mm_cmpgt_epi32(e, zero);
+			__m128i r = _mm_and_si128(px, bytes);
+			__m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), bytes);
+			__m128i b = _mm_and_si128(_mm_srli_epi32(px, 16), bytes);
+			__m128 scale;
+			if (_mm_movemask_epi8(_mm_and_si128(live, _mm_cmplt_epi32(e, _mm_set1_epi32(10))))) {
+				int k;
+				for (k = 0; k < 4; ++k)
+					stbi__hdr_convert(output + (i + k) * req_comp, input + (i + k) * 4, req_comp);
+				continue;
+			}
+			// 2^(e-136) is a float with exponent field e-9; an exponent of 0 means black
+			scale = _mm_and_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(e, _mm_set1_epi32(9)), 23)), _mm_castsi128_ps(live));
+			if (req_comp <= 2) {
+				__m128i sum = _mm_add_epi32(_mm_add_epi32(r, g), b);
+				__m128 y = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale), three);
+				if (req_comp == 1)
+					_mm_storeu_ps(output + i, y);
+				else {
+					_mm_storeu_ps(output + i * 2, _mm_unpacklo_ps(y, one));
+					_mm_storeu_ps(output + i * 2 + 4, _mm_unpackhi_ps(y, one));
+				}
+			} else {
+				__m128 p0 = _mm_mul_ps(_mm_cvtepi32_ps(r), scale);
+				__m128 p1 = _mm_mul_ps(_mm_cvtepi32_ps(g), scale);
+				__m128 p2 = _mm_mul_ps(_mm_cvtepi32_ps(b), scale);
+				__m128 p3 = one;
+				_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+				_mm_storeu_ps(output + (i + 0) * req_comp, p0);
+				_mm_storeu_ps(output + (i + 1) * req_comp, p1);
+				_mm_storeu_ps(output + (i + 2) * req_comp, p2);
+				_mm_storeu_ps(output + (i + 3) * req_comp, p3);
+			}
+		}
+	}
+#else
+	STBI_NOTUSED(simd);
+#endif
+	for (; i < count; ++i)
+		stbi__hdr_convert(output + i * req_comp, input + i * 4, req_comp);
+}
+
+// rows of run-length decoded RGBE pixels, converted on several threads
+typedef struct
+{
+	float *output;
+	stbi_uc *scanlines;
+	int width, rows, req_comp, tasks, simd;
+} stbi__hdr_convert_rows;
+
+static void stbi__hdr_convert_task(void *task_data, int task)
+{
+	stbi__hdr_convert_rows *c = (stbi__hdr_convert_rows *)task_data;
+	int j = (int)((stbi__uint64)c->rows * task / c->tasks);
+	int end = (int)((stbi__uint64)c->rows * (task + 1) / c->tasks);
+	for (; j < end; ++j)
+		stbi__hdr_convert_row(c->output + (size_t)j * c->width * c->req_comp, c->scanlines + (size_t)j * c->width * 4, c->width, c->req_comp, c->simd);
+}
+
+static void stbi__hdr_convert_batch(stbi__hdr_convert_rows *c, float *output, int rows)
+{
+	c->output = output;
+	c->rows = rows;
+	c->tasks = stbi__parallel_task_count((int)((stbi__uint64)rows * c->width / STBI__CONVERT_TASK_SIZE));
+	stbi__parallel_run(stbi__hdr_convert_task, c, c->tasks);
+}
+
 static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
 	char buffer[STBI__HDR_BUFLEN];
 	char *token;
 	int valid = 0;
 	int width, height;
-	stbi_uc *scanline;
+	stbi_uc *scanline, *row;
 	float *hdr_data;
 	int len;
 	unsigned char count, value;
 	int i, j, k, c1, c2, z;
+	int batch_rows, first_row;
+	stbi__hdr_convert_rows convert;
 	const char *headerToken;
 	STBI_NOTUSED(ri);
 
@@ -7026,8 +8720,19 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 		}
 	}
 	else {
-		// Read RLE-encoded data
+		// Read RLE-encoded data. rows are decoded into a batch of scanlines, which is
+		// converted to float all at once, so the conversion can be split over threads
 		scanline = NULL;
+		batch_rows = (1 << 18) / width;
+		if (batch_rows > height) batch_rows = height;
+		first_row = 0;
+		convert.width = width;
+		convert.req_comp = req_comp;
+#ifdef STBI_SSE2
+		convert.simd = stbi__sse2_available();
+#else
+		convert.simd = 0;
+#endif
 
 		for (j = 0; j < height; ++j) {
 			c1 = stbi__get8(s);
@@ -7051,13 +8756,15 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 			len |= stbi__get8(s);
 			if (len != width) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("invalid decoded scanline length", "corrupt HDR"); }
 			if (scanline == NULL) {
-				scanline = (stbi_uc *)stbi__malloc_mad2(width, 4, 0);
+				scanline = (stbi_uc *)stbi__malloc_mad2(width * batch_rows, 4, 0);
+				convert.scanlines = scanline;
 				if (!scanline) {
 					STBI_FREE(hdr_data);
 					return stbi__errpf("outofmem", "Out of memory");
 				}
 			}
 
+			row = scanline + (size_t)(j - first_row) * width * 4;
 			for (k = 0; k < 4; ++k) {
 				int nleft;
 				i = 0;
@@ -7069,18 +8776,20 @@ static float *stbi__hdr_load(stbi__context *s, int *x, int *y, int *comp, int re
 						count -= 128;
 						if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
 						for (z = 0; z < count; ++z)
-							scanline[i++ * 4 + k] = value;
+							row[i++ * 4 + k] = value;
 					}
 					else {
 						// Dump
 						if (count > nleft) { STBI_FREE(hdr_data); STBI_FREE(scanline); return stbi__errpf("corrupt", "bad RLE data in HDR"); }
 						for (z = 0; z < count; ++z)
-							scanline[i++ * 4 + k] = stbi__get8(s);
+							row[i++ * 4 + k] = stbi__get8(s);
 					}
 				}
 			}
-			for (i = 0; i < width; ++i)
-				stbi__hdr_convert(hdr_data + (j*width + i)*req_comp, scanline + i * 4, req_comp);
+			if (j + 1 - first_row == batch_rows || j + 1 == height) {
+				stbi__hdr_convert_batch(&convert, hdr_data + (size_t)first_row * width * req_comp, j + 1 - first_row);
+				first_row = j + 1;
+			}
 		}
 		if (scanline)
 			STBI_FREE(scanline);